@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#ifndef BUP_ASM_H
+#define BUP_ASM_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Section index of undefined symbols */
+#define ASM_UNDEF ((size_t)-1)
+
+/*
+ * Represents valid relocation types
+ *
+ * @ASM_RELOC_REL32: 32-bit PC-relative (S + A - P)
+ * @ASM_RELOC_ABS32: 32-bit absolute (S + A)
+ * @ASM_RELOC_ABS64: 64-bit absolute (S + A)
+ */
+typedef enum {
+    ASM_RELOC_REL32,
+    ASM_RELOC_ABS32,
+    ASM_RELOC_ABS64
+} asm_reloc_t;
+
+/*
+ * Represents an assembled section
+ *
+ * @name:  Section name
+ * @data:  Section contents (NULL if nobits)
+ * @size:  Section size in bytes
+ * @cap:   Capacity of data buffer
+ * @align: Required alignment
+ * @nobits: If set, section occupies no file space
+ * @exec:  If set, section is executable
+ * @write: If set, section is writable
+ */
+struct asm_section {
+    char *name;
+    uint8_t *data;
+    size_t size;
+    size_t cap;
+    size_t align;
+    uint8_t nobits : 1;
+    uint8_t exec : 1;
+    uint8_t write : 1;
+};
+
+/*
+ * Represents an assembler symbol
+ *
+ * Symbols without a '.' in their name begin a new chunk of
+ * code or data, while dotted symbols (e.g., 'L.0', 'xy.x' or
+ * expanded NASM local labels) belong to the chunk before them.
+ *
+ * @name:    Symbol name
+ * @section: Section index, ASM_UNDEF if not defined
+ * @off:     Offset within section
+ * @global:  If set, symbol is visible to other objects
+ * @fallthrough: If set, control falls off the end of the
+ *               code belonging to this symbol
+ */
+struct asm_symbol {
+    char *name;
+    size_t section;
+    size_t off;
+    uint8_t global : 1;
+    uint8_t fallthrough : 1;
+};
+
+/*
+ * Represents a relocation
+ *
+ * @type:    Relocation type
+ * @section: Section the field lives in
+ * @off:     Offset of the field within the section
+ * @symbol:  Symbol index the field refers to
+ * @addend:  Constant addend
+ */
+struct asm_reloc {
+    asm_reloc_t type;
+    size_t section;
+    size_t off;
+    size_t symbol;
+    int64_t addend;
+};
+
+/*
+ * Represents an assembled object
+ *
+ * @sections:  Sections
+ * @nsections: Number of sections
+ * @symbols:   Symbols
+ * @nsymbols:  Number of symbols
+ * @relocs:    Relocations
+ * @nrelocs:   Number of relocations
+ */
+struct asm_object {
+    struct asm_section *sections;
+    size_t nsections;
+    struct asm_symbol *symbols;
+    size_t nsymbols;
+    struct asm_reloc *relocs;
+    size_t nrelocs;
+};
+
+/*
+ * Assemble NASM-syntax x86-64 source as emitted by the
+ * compiler into an object held in memory.
+ *
+ * @text: Assembly source
+ * @len:  Length of assembly source
+ * @res:  Object result is written here
+ *
+ * Returns zero on success
+ */
+int asm_assemble(const char *text, size_t len, struct asm_object *res);
+
+/*
+ * Look up a symbol within an object
+ *
+ * @obj:  Object to search
+ * @name: Symbol name
+ *
+ * Returns the symbol index, or ASM_UNDEF if not found
+ */
+size_t asm_symbol_lookup(struct asm_object *obj, const char *name);
+
+/*
+ * Destroy an assembled object
+ *
+ * @obj: Object to destroy
+ */
+void asm_object_destroy(struct asm_object *obj);
+
+#endif  /* !BUP_ASM_H */
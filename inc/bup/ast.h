@@ -9,6 +9,9 @@
 #include "bup/state.h"
 #include "bup/symbol.h"
 
+/* Largest unroll factor a loop may ask for */
+#define AST_UNROLL_MAX 64
+
 /*
  * Represents valid AST types
  *
@@ -17,17 +20,19 @@
  * @AST_NUMBER: Is a number
  * @AST_RETURN: Return statement
  * @AST_ASM:    Assembly block
- * @AST_LOOP:   Loop block
+ * @AST_LOOP:   Loop block (unroll factor in 'v', zero if none)
  * @AST_VAR:    Variable declaration
  * @AST_VARDEF: Variable definition
  * @AST_BREAK:  Break statement
  * @AST_CONT:   Continue statement
- * @AST_IF:     If statement
+ * @AST_IF:     If statement (hint in 'v', 1 if likely, -1 if unlikely)
  * @AST_ASSIGN: Assignment of variable
  * @AST_SYMBOL: Is a symbol
  * @AST_CALL:   Procedure call
  * @AST_FIELD_ACCESS: Access of a field
  * @AST_FIELD:  Field
+ * @AST_BINOP:  Binary operation (operator token in 'v')
+ * @AST_INDEX:  Array element (index expression in 'right')
  */
 typedef enum {
     AST_NONE,
@@ -46,7 +51,9 @@ typedef enum {
     AST_CALL,
     AST_STRUCT,
     AST_FIELD_ACCESS,
-    AST_FIELD
+    AST_FIELD,
+    AST_BINOP,
+    AST_INDEX
 } ast_type_t;
 
 /*
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#ifndef BUP_CALLGRAPH_H
+#define BUP_CALLGRAPH_H 1
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include "bup/ir.h"
+
+/*
+ * Represents a procedure of a translation unit
+ *
+ * @item:      Item of procedure
+ * @calls:     Number of call sites in the unit
+ * @moved:     Number of call sites moved elsewhere (inlined or
+ *             pointed at a clone) by the pass using the graph
+ * @mentioned: Set if assembly mentions the procedure
+ */
+struct callgraph_node {
+    struct ir_item *item;
+    size_t calls;
+    size_t moved;
+    bool mentioned;
+};
+
+/*
+ * Represents the procedures of a translation unit and how
+ * often they are called
+ *
+ * @nodes: Procedures, in unit order
+ * @count: Number of procedures
+ */
+struct callgraph {
+    struct callgraph_node *nodes;
+    size_t count;
+};
+
+/*
+ * Represents the size of a procedure body
+ *
+ * @cost:  Number of instructions, jumps and returns are
+ *         not counted
+ * @nrets: Number of returns
+ * @nvals: Number of returns with a value
+ */
+struct callgraph_size {
+    size_t cost;
+    size_t nrets;
+    size_t nvals;
+};
+
+/*
+ * Find the procedures of a translation unit and count
+ * their calls. Procedures added to the unit later are
+ * not part of the graph.
+ *
+ * @unit: Translation unit
+ * @res:  Graph is written here, release with callgraph_release()
+ *
+ * Returns zero on success
+ */
+int callgraph_build(struct ir_unit *unit, struct callgraph *res);
+
+/*
+ * Count the call sites and assembly mentions of each
+ * procedure again after calls have changed
+ *
+ * @unit:  Translation unit
+ * @graph: Procedures
+ */
+void callgraph_count(struct ir_unit *unit, struct callgraph *graph);
+
+/*
+ * Look up a procedure by name
+ *
+ * Returns its index in graph->nodes, or a less than zero
+ * value if it is not defined in the unit
+ */
+ssize_t callgraph_find(const struct callgraph *graph, const char *name);
+
+/*
+ * Measure the body of a procedure
+ *
+ * @proc: Procedure
+ * @res:  Size is written here
+ */
+void callgraph_measure(struct ir_proc *proc, struct callgraph_size *res);
+
+/*
+ * Delete the internal procedures that had calls moved away
+ * and are no longer called or mentioned, the calls are
+ * counted again first.
+ *
+ * @unit:  Translation unit
+ * @graph: Procedures
+ * @pass:  Name of pass for tracing
+ */
+void callgraph_drop(struct ir_unit *unit, struct callgraph *graph, const char *pass);
+
+/*
+ * Release a graph made by callgraph_build()
+ */
+void callgraph_release(struct callgraph *graph);
+
+#endif  /* !BUP_CALLGRAPH_H */
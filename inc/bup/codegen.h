@@ -19,4 +19,14 @@
  */
 int cg_compile_node(struct bup_state *state, struct ast_node *root);
 
+/*
+ * Finish the translation unit, lowering the IR built
+ * by cg_compile_node() to assembly
+ *
+ * @state: Compiler state
+ *
+ * Returns zero on success
+ */
+int cg_finish(struct bup_state *state);
+
 #endif  /* !BUP_CODEGEN_H */
@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#ifndef BUP_INLINE_H
+#define BUP_INLINE_H 1
+
+#include "bup/state.h"
+#include "bup/ir.h"
+
+/* Cost of the call instruction an inlined body replaces */
+#define INLINE_CALL_COST 1
+
+/* Largest body inlined at every call site at -O2 */
+#define INLINE_MAX_COST 24
+
+/*
+ * Replace calls to procedures defined in the translation
+ * unit with a copy of their body.
+ *
+ * A call is inlined if the callee is marked 'inline', if
+ * it is internal and this is its only call site, or if its
+ * body costs no more than INLINE_MAX_COST instructions
+ * (INLINE_CALL_COST at -Os). Procedures marked 'noinline'
+ * and calls of a procedure to itself are left alone.
+ * Internal procedures whose calls have all been inlined
+ * are deleted.
+ *
+ * @state: Compiler state
+ * @unit:  Translation unit
+ *
+ * Returns the number of calls inlined, or a less than zero
+ * value on failure.
+ */
+int inline_unit(struct bup_state *state, struct ir_unit *unit);
+
+#endif  /* !BUP_INLINE_H */
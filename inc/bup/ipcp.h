@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#ifndef BUP_IPCP_H
+#define BUP_IPCP_H 1
+
+#include "bup/state.h"
+#include "bup/ir.h"
+
+/* Most globals a procedure is specialized for */
+#define IPCP_MAX_PARAMS 8
+
+/* Most clones made of a single procedure */
+#define IPCP_MAX_CLONES 4
+
+/* Largest specialized body kept as a clone */
+#define IPCP_CLONE_MAX_COST 48
+
+/* Fewest instructions a clone must save over the original */
+#define IPCP_CLONE_MIN_GAIN 2
+
+/*
+ * Propagate constants across the calls of a translation
+ * unit. Procedures take no arguments, so the globals a
+ * procedure reads stand in for them.
+ *
+ * Where each call of an internal procedure stores the same
+ * constant to a global it reads just before the call, the
+ * reads that see that value become the constant. At -O2,
+ * calls that agree on other constants are pointed at a
+ * clone specialized for them (named '<proc>_constprop_<n>')
+ * if it saves at least IPCP_CLONE_MIN_GAIN instructions
+ * and costs no more than IPCP_CLONE_MAX_COST. Internal
+ * procedures left without calls are deleted.
+ *
+ * Procedures that return the same constant on every path,
+ * directly or by passing on the result of such a call,
+ * are then recorded and calls whose result is kept in a
+ * register get the constant instead.
+ *
+ * @state: Compiler state
+ * @unit:  Translation unit
+ *
+ * Returns the number of changes made, or a less than zero
+ * value on failure.
+ */
+int ipcp_unit(struct bup_state *state, struct ir_unit *unit);
+
+#endif  /* !BUP_IPCP_H */
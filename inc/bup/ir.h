@@ -0,0 +1,438 @@
+/*
+ * Copyright (C) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#ifndef BUP_IR_H
+#define BUP_IR_H 1
+
+#include <sys/queue.h>
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include "bup/state.h"
+#include "bup/symbol.h"
+#include "bup/mu.h"
+
+/* No virtual register */
+#define IR_NOREG ((ir_vreg_t)-1)
+
+/* Most operands an instruction reads, see ir_operands() */
+#define IR_MAX_OPERANDS 5
+
+/* Virtual register */
+typedef size_t ir_vreg_t;
+
+/*
+ * Represents valid IR value types
+ *
+ * @IR_VAL_NONE: No value
+ * @IR_VAL_IMM:  Immediate
+ * @IR_VAL_VREG: Virtual register
+ * @IR_VAL_MEM:  Global variable in memory (operand 'b' of arithmetic)
+ */
+typedef enum {
+    IR_VAL_NONE,
+    IR_VAL_IMM,
+    IR_VAL_VREG,
+    IR_VAL_MEM
+} ir_valtype_t;
+
+/*
+ * Represents an instruction operand
+ *
+ * @type: Value type
+ * @imm:  Immediate (IR_VAL_IMM)
+ * @vreg: Virtual register (IR_VAL_VREG)
+ * @mem:  Variable, its name and size (IR_VAL_MEM)
+ */
+struct ir_value {
+    ir_valtype_t type;
+    union {
+        ssize_t imm;
+        ir_vreg_t vreg;
+        struct {
+            struct symbol *var;
+            const char *sym;
+            msize_t msize;
+        } mem;
+    };
+};
+
+/*
+ * Represents valid IR operations
+ *
+ * @IR_MOV:   dst = a
+ * @IR_ADD:   dst = a + b
+ * @IR_SUB:   dst = a - b
+ * @IR_MUL:   dst = a * b
+ * @IR_LOAD:  dst = [sym] (zero extended from msize)
+ * @IR_STORE: [sym] = a
+ * @IR_LOADX: dst = [sym + a*scale + disp] (zero extended from msize)
+ * @IR_STOREX: [sym + b*scale + disp] = a
+ * @IR_ADDR:  dst = address of sym
+ * @IR_SET:   dst = 1 if the condition holds, otherwise 0
+ * @IR_SEL:   dst = sel[0] if the condition holds, otherwise sel[1]
+ * @IR_CALL:  Call sym
+ * @IR_ASM:   Inline assembly line (text)
+ * @IR_JMP:   Jump to target[0]
+ * @IR_BR:    Jump to target[0] if the condition holds, otherwise target[1]
+ * @IR_RET:   Return a (if any)
+ * @IR_TAILCALL: Jump to sym, which returns to our caller
+ */
+typedef enum {
+    IR_MOV,
+    IR_ADD,
+    IR_SUB,
+    IR_MUL,
+    IR_LOAD,
+    IR_STORE,
+    IR_LOADX,
+    IR_STOREX,
+    IR_ADDR,
+    IR_SET,
+    IR_SEL,
+    IR_CALL,
+    IR_ASM,
+    IR_JMP,
+    IR_BR,
+    IR_RET,
+    IR_TAILCALL
+} ir_op_t;
+
+/*
+ * Represents valid conditions of a branch, set or select,
+ * comparisons are unsigned
+ *
+ * @IR_COND_NZ: a is not zero
+ * @IR_COND_EQ: a == b
+ * @IR_COND_NE: a != b
+ * @IR_COND_LT: a < b
+ * @IR_COND_LE: a <= b
+ * @IR_COND_GT: a > b
+ * @IR_COND_GE: a >= b
+ */
+typedef enum {
+    IR_COND_NZ,
+    IR_COND_EQ,
+    IR_COND_NE,
+    IR_COND_LT,
+    IR_COND_LE,
+    IR_COND_GT,
+    IR_COND_GE
+} ir_cond_t;
+
+/* Returns true if an operation ends a block */
+#define ir_is_term(OP)  \
+    ((OP) == IR_JMP || (OP) == IR_BR || (OP) == IR_RET || \
+     (OP) == IR_TAILCALL)
+
+/*
+ * Represents a single IR instruction
+ *
+ * @op:     Operation
+ * @size:   Operation size
+ * @msize:  Memory access size (loads and stores)
+ * @dst:    Destination, IR_NOREG if none
+ * @a:      First operand
+ * @b:      Second operand
+ * @sym:    Symbol name (loads, stores, IR_ADDR, IR_CALL, IR_TAILCALL)
+ * @var:    Variable accessed (loads and stores)
+ * @scale:  Bytes per index step (IR_LOADX, IR_STOREX)
+ * @disp:   Byte offset from sym (IR_LOADX, IR_STOREX)
+ * @base:   Address of sym if held in a virtual register (IR_LOADX,
+ *          IR_STOREX), IR_VAL_NONE to address sym directly
+ * @text:   Assembly text (IR_ASM)
+ * @target: Jump targets (IR_JMP, IR_BR)
+ * @cond:   Condition on a and b (IR_BR, IR_SET, IR_SEL)
+ * @sel:    Values chosen between (IR_SEL)
+ * @hint:   Greater than zero if target[0] is likely taken and less
+ *          than zero if it is unlikely, zero if unknown (IR_BR)
+ * @link:   Block instruction queue link
+ */
+struct ir_insn {
+    ir_op_t op;
+    msize_t size;
+    msize_t msize;
+    ir_vreg_t dst;
+    struct ir_value a;
+    struct ir_value b;
+    const char *sym;
+    struct symbol *var;
+    size_t scale;
+    ssize_t disp;
+    struct ir_value base;
+    const char *text;
+    struct ir_block *target[2];
+    ir_cond_t cond;
+    struct ir_value sel[2];
+    int hint;
+    TAILQ_ENTRY(ir_insn) link;
+};
+
+/*
+ * Represents a basic block
+ *
+ * @id:     Block number within procedure
+ * @label:  Block label (e.g., 'L.0' or 'IF.0'), NULL if anonymous
+ * @insns:  Instructions, the last one is a terminator
+ * @preds:  Predecessor blocks (see ir_cfg_build())
+ * @npreds: Number of predecessor blocks
+ * @unroll: Unroll factor asked for the loop headed by this block,
+ *          zero if none and one if it must not be unrolled
+ * @cold:   Set if the block was placed at the end of the procedure
+ *          as unlikely to run (see opt_layout())
+ * @link:   Procedure block queue link
+ */
+struct ir_block {
+    size_t id;
+    const char *label;
+    TAILQ_HEAD(ir_insn_q, ir_insn) insns;
+    struct ir_block **preds;
+    size_t npreds;
+    size_t unroll;
+    bool cold;
+    TAILQ_ENTRY(ir_block) link;
+};
+
+/*
+ * Represents a procedure
+ *
+ * @symbol:  Procedure symbol
+ * @section: Section to place procedure in
+ * @nblocks: Number of blocks created
+ * @nvregs:  Number of virtual registers created
+ * @blocks:  Blocks in layout order, the first is the entry
+ */
+struct ir_proc {
+    struct symbol *symbol;
+    const char *section;
+    size_t nblocks;
+    size_t nvregs;
+    TAILQ_HEAD(ir_block_q, ir_block) blocks;
+};
+
+/*
+ * Represents valid top-level item types
+ *
+ * @IR_ITEM_PROC:   Procedure
+ * @IR_ITEM_ASM:    Inline assembly line
+ * @IR_ITEM_VAR:    Global variable or array
+ * @IR_ITEM_STRUCT: Structure instance
+ */
+typedef enum {
+    IR_ITEM_PROC,
+    IR_ITEM_ASM,
+    IR_ITEM_VAR,
+    IR_ITEM_STRUCT
+} ir_item_type_t;
+
+/*
+ * Represents a top-level item, kept in source order
+ *
+ * @type:   Item type
+ * @proc:   Procedure (IR_ITEM_PROC)
+ * @text:   Assembly text (IR_ITEM_ASM)
+ * @symbol: Variable or instance symbol
+ * @init:   If set, variable is initialized to 'imm'
+ * @imm:    Initial value
+ * @link:   Unit item queue link
+ */
+struct ir_item {
+    ir_item_type_t type;
+    struct ir_proc *proc;
+    const char *text;
+    struct symbol *symbol;
+    bool init;
+    ssize_t imm;
+    TAILQ_ENTRY(ir_item) link;
+};
+
+/*
+ * Represents the IR of a translation unit
+ *
+ * @items: Top-level items
+ * @proc:  Procedure being built
+ * @cur:   Block being appended to
+ */
+struct ir_unit {
+    TAILQ_HEAD(ir_item_q, ir_item) items;
+    struct ir_proc *proc;
+    struct ir_block *cur;
+};
+
+/*
+ * Create an empty translation unit
+ *
+ * @state: Compiler state
+ *
+ * Returns NULL on failure
+ */
+struct ir_unit *ir_unit_new(struct bup_state *state);
+
+/*
+ * Append a top-level item to a translation unit
+ *
+ * @state: Compiler state
+ * @type:  Item type
+ *
+ * Returns NULL on failure
+ */
+struct ir_item *ir_item_new(struct bup_state *state, ir_item_type_t type);
+
+/*
+ * Begin a new procedure, its entry block becomes the
+ * current block.
+ *
+ * @state:   Compiler state
+ * @symbol:  Procedure symbol
+ * @section: Section to place procedure in
+ *
+ * Returns NULL on failure
+ */
+struct ir_proc *ir_proc_new(
+    struct bup_state *state, struct symbol *symbol,
+    const char *section
+);
+
+/*
+ * Create a block that is not yet placed in the layout
+ *
+ * @state: Compiler state
+ * @label: Block label, NULL if anonymous
+ *
+ * Returns NULL on failure
+ */
+struct ir_block *ir_block_new(struct bup_state *state, const char *label);
+
+/*
+ * Place a block at the end of the current procedure and make
+ * it the current block. If the previous block falls through,
+ * a jump to the new block is added.
+ *
+ * @state: Compiler state
+ * @blk:   Block to place
+ *
+ * Returns zero on success
+ */
+int ir_block_place(struct bup_state *state, struct ir_block *blk);
+
+/*
+ * Get the terminator of a block
+ *
+ * Returns NULL if the block is still open
+ */
+struct ir_insn *ir_block_term(struct ir_block *blk);
+
+/*
+ * Get the printable name of a block
+ *
+ * @proc: Procedure of block
+ * @blk:  Block
+ * @buf:  Name buffer
+ * @len:  Length of name buffer
+ */
+void ir_block_name(
+    struct ir_proc *proc, struct ir_block *blk,
+    char *buf, size_t len
+);
+
+/*
+ * Create an instruction that is not yet in any block
+ *
+ * @state: Compiler state
+ * @op:    Operation
+ * @size:  Operation size
+ *
+ * Returns NULL on failure
+ */
+struct ir_insn *ir_insn_new(struct bup_state *state, ir_op_t op, msize_t size);
+
+/*
+ * Append an instruction to the current block, if the
+ * current block is terminated a new anonymous (and
+ * unreachable) block is started.
+ *
+ * @state: Compiler state
+ * @op:    Operation
+ * @size:  Operation size
+ *
+ * Returns NULL on failure
+ */
+struct ir_insn *ir_emit(struct bup_state *state, ir_op_t op, msize_t size);
+
+/*
+ * Allocate a virtual register in the current procedure
+ */
+ir_vreg_t ir_vreg_new(struct bup_state *state);
+
+/*
+ * Get the successors of a block
+ *
+ * @blk: Block
+ * @res: Successors are written here
+ *
+ * Returns the number of successors
+ */
+size_t ir_succs(struct ir_block *blk, struct ir_block *res[2]);
+
+/*
+ * Get the operands an instruction may read, unused ones
+ * are of type IR_VAL_NONE
+ *
+ * @insn: Instruction
+ * @res:  Operands are written here
+ *
+ * Returns the number of operands written
+ */
+size_t ir_operands(struct ir_insn *insn, struct ir_value *res[IR_MAX_OPERANDS]);
+
+/*
+ * Get the condition that holds when another does not,
+ * IR_COND_NZ has none
+ */
+ir_cond_t ir_cond_negate(ir_cond_t cond);
+
+/*
+ * Get the condition that holds with the operands swapped
+ */
+ir_cond_t ir_cond_swap(ir_cond_t cond);
+
+/*
+ * Evaluate a comparison of two constants
+ *
+ * @cond: Condition, not IR_COND_NZ
+ * @a:    First operand
+ * @b:    Second operand
+ */
+bool ir_cond_holds(ir_cond_t cond, size_t a, size_t b);
+
+/*
+ * Compute the predecessors of every block in a procedure
+ *
+ * @state: Compiler state
+ * @proc:  Procedure
+ *
+ * Returns zero on success
+ */
+int ir_cfg_build(struct bup_state *state, struct ir_proc *proc);
+
+/*
+ * Print a translation unit in a human readable form
+ *
+ * @unit: Translation unit
+ * @fp:   Output file
+ */
+void ir_dump(struct ir_unit *unit, FILE *fp);
+
+/*
+ * Lower a translation unit to the machine layer
+ *
+ * @state: Compiler state
+ * @unit:  Translation unit
+ *
+ * Returns zero on success
+ */
+int ir_lower(struct bup_state *state, struct ir_unit *unit);
+
+#endif  /* !BUP_IR_H */
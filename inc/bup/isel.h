@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#ifndef BUP_ISEL_H
+#define BUP_ISEL_H 1
+
+#include "bup/state.h"
+#include "bup/ir.h"
+#include "bup/regalloc.h"
+
+/*
+ * Represents valid instruction selection rules, each one
+ * covers a small tree of IR instructions with one machine
+ * instruction
+ *
+ * @ISEL_SELF:    Lowered on its own
+ * @ISEL_COVERED: Folded into a later instruction, nothing is emitted
+ * @ISEL_RMW:     store [x], (add|sub (load [x]), b)  ->  add [x], b
+ * @ISEL_MEMOP:   add|sub|mul a, (load [x])           ->  add r, [x]
+ * @ISEL_LEA:     add|sub a, imm, add a, b or mul a, 2|3|5|9
+ *                                                    ->  lea r, [...]
+ * @ISEL_LEAIDX:  add a, (mul b, 2|4|8)                ->  lea r, [a + b*k]
+ */
+typedef enum {
+    ISEL_SELF,
+    ISEL_COVERED,
+    ISEL_RMW,
+    ISEL_MEMOP,
+    ISEL_LEA,
+    ISEL_LEAIDX
+} isel_rule_t;
+
+/*
+ * Represents the rule chosen for an instruction
+ *
+ * @rule: Rule covering the instruction
+ * @kid:  Instruction folded in, the operation of ISEL_RMW,
+ *        the load of ISEL_MEMOP and the multiply of
+ *        ISEL_LEAIDX, NULL for other rules
+ */
+struct isel_choice {
+    isel_rule_t rule;
+    struct ir_insn *kid;
+};
+
+/*
+ * Choose the instructions of a procedure. Values used once
+ * in the block that computes them form trees with their
+ * user, and each tree is covered with the rules of least
+ * total cost (see 'iseltab' in src/isel.c) by labelling it
+ * bottom up and reducing it top down.
+ *
+ * Rules that move a read past other instructions are only
+ * matched where no store, call or inline assembly in
+ * between could change what is read, and where the register
+ * allocation in 'ra' keeps the operand alive.
+ *
+ * @state: Compiler state
+ * @proc:  Procedure, its registers already allocated
+ * @ra:    Register allocation of the procedure
+ * @res:   Choice for each instruction in layout order,
+ *         release with free()
+ *
+ * Returns zero on success
+ */
+int isel_proc(
+    struct bup_state *state, struct ir_proc *proc,
+    struct ra_result *ra, struct isel_choice **res
+);
+
+#endif  /* !BUP_ISEL_H */
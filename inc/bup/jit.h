@@ -0,0 +1,31 @@
+/*
+ * Copyright (C) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#ifndef BUP_JIT_H
+#define BUP_JIT_H 1
+
+#include <stddef.h>
+#include "bup/asm.h"
+
+/*
+ * Load assembled objects into executable memory and
+ * call an entry procedure in-process.
+ *
+ * A perf map (/tmp/perf-<pid>.map) is written so that
+ * samples can be attributed to bup procedures.
+ *
+ * @objs:   Objects to load
+ * @nobjs:  Number of objects
+ * @entry:  Name of procedure to call
+ * @status: Low byte of the return value is written here
+ *
+ * Returns zero on success
+ */
+int jit_run(
+    struct asm_object *objs, size_t nobjs,
+    const char *entry, int *status
+);
+
+#endif  /* !BUP_JIT_H */
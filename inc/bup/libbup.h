@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#ifndef BUP_LIBBUP_H
+#define BUP_LIBBUP_H 1
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "bup/trace.h"
+
+/*
+ * Represents options for a single compilation
+ *
+ * @no_sections: If set, disable sections in output
+ * @syntax:      Assembler syntax ("nasm" or "gas"), NULL for NASM
+ * @dump_ir:     If set, print the IR to standard output
+ * @peep_stats:  If set, report peephole rule counts to the diag hook
+ * @time_passes: If set, report time and memory per pass to the diag hook
+ * @opt_level:   Optimization level ("0", "1", "2" or "s"), NULL for "0"
+ * @no_passes:   Names of passes to disable, NULL terminated (or NULL)
+ * @no_red_zone: If set, never keep data below the stack pointer (kernel code)
+ * @tune:        Processor to tune for ("generic", "znver", "icelake" or
+ *               "atom"), NULL for "generic"
+ * @diag:        Diagnostic hook, NULL for standard output
+ * @diag_arg:    Argument passed to diagnostic hook
+ */
+struct bup_opts {
+    bool no_sections;
+    const char *syntax;
+    bool dump_ir;
+    bool peep_stats;
+    bool time_passes;
+    const char *opt_level;
+    const char *const *no_passes;
+    bool no_red_zone;
+    const char *tune;
+    trace_hook_t diag;
+    void *diag_arg;
+};
+
+/*
+ * Compile a source buffer into assembly held in memory
+ *
+ * @src:    Source buffer to compile
+ * @len:    Length of source buffer
+ * @opts:   Compile options, NULL for defaults
+ * @out:    Output buffer is written here, free with free()
+ * @outlen: Length of output buffer is written here
+ *
+ * Returns zero on success
+ */
+int bup_compile_buffer(
+    const char *src, size_t len, const struct bup_opts *opts,
+    char **out, size_t *outlen
+);
+
+/*
+ * Release memory kept warm across compilations
+ */
+void bup_release(void);
+
+#endif  /* !BUP_LIBBUP_H */
@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#ifndef BUP_LINK_H
+#define BUP_LINK_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+#include "bup/asm.h"
+
+/* Default base address of ELF64 executables */
+#define LINK_ELF_BASE 0x400000
+
+/*
+ * Represents valid output formats
+ *
+ * @LINK_ELF64: ELF64 executable
+ * @LINK_FLAT:  Flat binary
+ */
+typedef enum {
+    LINK_ELF64,
+    LINK_FLAT
+} link_fmt_t;
+
+/*
+ * Represents a chunk of a section, this is the unit of
+ * garbage collection. A chunk starts at a symbol with no
+ * '.' in its name (see bup/asm.h) and ends where the next
+ * one begins.
+ *
+ * @obj:     Object index
+ * @section: Section index within object
+ * @sym:     Symbol naming the chunk, ASM_UNDEF if none
+ * @start:   Start offset within section
+ * @end:     End offset within section
+ * @off:     Offset within image
+ * @live:    If set, chunk is kept in the image
+ * @fallthrough: If set, control may fall into the next chunk
+ */
+struct link_chunk {
+    size_t obj;
+    size_t section;
+    size_t sym;
+    size_t start;
+    size_t end;
+    size_t off;
+    uint8_t live : 1;
+    uint8_t fallthrough : 1;
+};
+
+/*
+ * Represents a laid out image of one or more objects
+ *
+ * Executable chunks come first, followed (on a new page)
+ * by initialized data and then zero-initialized data.
+ *
+ * @objs:      Objects making up the image
+ * @nobjs:     Number of objects
+ * @chunks:    Chunks, ordered by object, section and offset
+ * @nchunks:   Number of chunks
+ * @sect_chunk: Index of first chunk of each section, per object
+ * @text_size: Page aligned size of the executable part
+ * @file_size: Size of the initialized part
+ * @size:      Total size in memory
+ */
+struct link_image {
+    struct asm_object *objs;
+    size_t nobjs;
+    struct link_chunk *chunks;
+    size_t nchunks;
+    size_t **sect_chunk;
+    size_t text_size;
+    size_t file_size;
+    size_t size;
+};
+
+/*
+ * Lay out objects into an image
+ *
+ * @img:   Image result is written here
+ * @objs:  Objects to lay out
+ * @nobjs: Number of objects
+ * @page:  Page size
+ * @roots: NULL terminated list of symbols to keep, everything
+ *         unreachable from these is dropped. If NULL, nothing
+ *         is dropped.
+ *
+ * Returns zero on success
+ */
+int link_layout(
+    struct link_image *img, struct asm_object *objs,
+    size_t nobjs, size_t page, const char **roots
+);
+
+/*
+ * Resolve the address of a symbol referenced by an object
+ *
+ * @img:  Image to resolve within
+ * @obj:  Index of object referencing the symbol
+ * @sym:  Symbol index within that object
+ * @base: Address the image is loaded at
+ * @res:  Address is written here
+ *
+ * Returns zero on success
+ */
+int link_resolve(
+    struct link_image *img, size_t obj,
+    size_t sym, uint64_t base, uint64_t *res
+);
+
+/*
+ * Look up a defined symbol by name across all objects
+ *
+ * @img:  Image to search
+ * @name: Symbol name
+ * @base: Address the image is loaded at
+ * @res:  Address is written here
+ *
+ * Returns zero on success
+ */
+int link_lookup(
+    struct link_image *img, const char *name,
+    uint64_t base, uint64_t *res
+);
+
+/*
+ * Copy live chunks into memory and apply relocations
+ *
+ * @img:  Image to load
+ * @mem:  Zeroed memory of at least img->size bytes
+ * @base: Address the image will run at
+ *
+ * Returns zero on success
+ */
+int link_load(struct link_image *img, uint8_t *mem, uint64_t base);
+
+/*
+ * Statically link objects into an executable file
+ *
+ * @objs:  Objects to link
+ * @nobjs: Number of objects
+ * @path:  Output path
+ * @fmt:   Output format
+ *
+ * Returns zero on success
+ */
+int link_write(
+    struct asm_object *objs, size_t nobjs,
+    const char *path, link_fmt_t fmt
+);
+
+/*
+ * Destroy an image (objects are left alone)
+ *
+ * @img: Image to destroy
+ */
+void link_destroy(struct link_image *img);
+
+#endif  /* !BUP_LINK_H */
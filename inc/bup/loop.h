@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#ifndef BUP_LOOP_H
+#define BUP_LOOP_H 1
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "bup/state.h"
+#include "bup/ir.h"
+
+/* Most header instructions copied when rotating a loop */
+#define ROTATE_MAX_COST 8
+
+/* Most iterations a loop is fully unrolled for at -O2 */
+#define UNROLL_FULL_MAX 8
+
+/* Most instructions an unrolled loop may grow to at -O2 */
+#define UNROLL_MAX_COST 64
+
+/* Copies of the body made when partially unrolling at -O2 */
+#define UNROLL_FACTOR 4
+
+/*
+ * Represents a natural loop
+ *
+ * @head:  Header, every way into the loop goes through it
+ * @pre:   Preheader, NULL until made by loop_preheader()
+ * @body:  Set for the id of each block in the loop
+ * @nbody: Number of blocks in the loop
+ */
+struct ir_loop {
+    struct ir_block *head;
+    struct ir_block *pre;
+    bool *body;
+    size_t nbody;
+};
+
+/*
+ * Represents the loops of a procedure
+ *
+ * @loops: Loops, innermost first
+ * @count: Number of loops
+ * @cap:   Number of block ids each body can hold
+ */
+struct loop_nest {
+    struct ir_loop *loops;
+    size_t count;
+    size_t cap;
+};
+
+/*
+ * Returns true if a block is part of a loop
+ */
+static inline bool
+loop_contains(struct loop_nest *nest, struct ir_loop *loop, struct ir_block *blk)
+{
+    return blk->id < nest->cap && loop->body[blk->id];
+}
+
+/*
+ * Find the natural loops of a procedure from the back edges
+ * of its CFG, which must be built.
+ *
+ * @state: Compiler state
+ * @proc:  Procedure
+ * @res:   Loops are written here, release with loop_release()
+ *
+ * Returns zero on success
+ */
+int loop_find(struct bup_state *state, struct ir_proc *proc, struct loop_nest *res);
+
+/*
+ * Give a loop a preheader, a block outside of the loop that
+ * is the only way into its header. The block that jumps to
+ * the header is reused if it is the only one, otherwise a
+ * new block is placed before the header and the enclosing
+ * loops are updated.
+ *
+ * @state: Compiler state
+ * @proc:  Procedure
+ * @nest:  Loops of procedure
+ * @loop:  Loop to give a preheader
+ *
+ * Returns one if a block was made, zero if one was reused
+ * and a less than zero value on failure.
+ */
+int loop_preheader(
+    struct bup_state *state, struct ir_proc *proc,
+    struct loop_nest *nest, struct ir_loop *loop
+);
+
+/*
+ * Release the loops found by loop_find()
+ */
+void loop_release(struct loop_nest *nest);
+
+/*
+ * Hoist computations whose operands do not change within a
+ * loop into its preheader. Loads of globals and of array
+ * elements are hoisted if nothing in the loop stores to them,
+ * calls or runs inline assembly. An array element may be out
+ * of bounds, so unless its index is a constant it is only
+ * hoisted from blocks that run on every iteration.
+ *
+ * @state: Compiler state
+ * @proc:  Procedure to optimize
+ *
+ * Returns the number of instructions hoisted, or a less
+ * than zero value on failure.
+ */
+int loop_licm(struct bup_state *state, struct ir_proc *proc);
+
+/*
+ * Rotate loops whose header ends by testing whether to
+ * leave. Every jump back to the header is replaced with a
+ * copy of it, so each iteration ends in one conditional
+ * jump back to the top instead of a jump to a test at the
+ * top. The header stays in front as a guard that decides
+ * whether to enter at all.
+ *
+ * Headers whose values are used elsewhere are left alone
+ * (there is nothing to merge the copies with), as are
+ * headers that would copy more than ROTATE_MAX_COST
+ * instructions in total.
+ *
+ * @state: Compiler state
+ * @proc:  Procedure to optimize
+ *
+ * Returns the number of loops rotated, or a less than
+ * zero value on failure.
+ */
+int loop_rotate(struct bup_state *state, struct ir_proc *proc);
+
+/*
+ * Unroll innermost loops. A loop marked 'unroll(n)' is
+ * unrolled n times at every level, other loops only at
+ * -O2 and only if how often they run is known from their
+ * counter.
+ *
+ * A loop running no more than UNROLL_FULL_MAX times is
+ * unrolled fully. Otherwise UNROLL_FACTOR iterations go
+ * into each trip around the loop and the iterations left
+ * over are peeled off in front of it. A loop may not grow
+ * past UNROLL_MAX_COST instructions unless asked to, and
+ * a loop whose count is not known keeps every counter
+ * test so no remainder is needed.
+ *
+ * @state: Compiler state
+ * @proc:  Procedure to optimize
+ *
+ * Returns the number of loops unrolled, or a less than
+ * zero value on failure.
+ */
+int loop_unroll(struct bup_state *state, struct ir_proc *proc);
+
+#endif  /* !BUP_LOOP_H */
@@ -6,10 +6,13 @@
 #ifndef BUP_MU_H
 #define BUP_MU_H 1
 
+#include <stdio.h>
 #include <stdbool.h>
+#include <sys/types.h>
 #include "bup/state.h"
 #include "bup/types.h"
 #include "bup/symbol.h"
+#include "bup/peep.h"
 
 /*
  * Represents valid machine size types
@@ -23,11 +26,52 @@ typedef enum {
     MSIZE_MAX
 } msize_t;
 
+/* Machine register handle, see mu_regfile() */
+typedef int8_t mu_reg_t;
+
+/*
+ * Represents valid two-operand arithmetic operations
+ */
+typedef enum {
+    MU_ADD,
+    MU_SUB,
+    MU_MUL,
+    MU_CMP      /* Only sets the flags */
+} mu_binop_t;
+
+/*
+ * Represents valid conditions tested after MU_CMP,
+ * comparisons are unsigned
+ */
+typedef enum {
+    MU_EQ,
+    MU_NE,
+    MU_LT,
+    MU_LE,
+    MU_GT,
+    MU_GE
+} mu_cond_t;
+
+/*
+ * Represents valid places code is aligned at
+ *
+ * @MU_ALIGN_PROC: Start of a procedure
+ * @MU_ALIGN_LOOP: Header of a loop, jumped back to each iteration
+ */
+typedef enum {
+    MU_ALIGN_PROC,
+    MU_ALIGN_LOOP
+} mu_align_t;
+
 #define datum_msize(DATUM)              \
     ((DATUM)->ptr_depth > 0)            \
         ? MSIZE_QWORD                   \
         : type_to_msize((DATUM)->type)
 
+/* Number of bytes in a machine size */
+#define msize_bytes(SIZE)               \
+    ((size_t)1 << ((SIZE) - MSIZE_BYTE))
+
 /*
  * Convert a program type into a machine size
  * type
@@ -48,6 +92,133 @@ type_to_msize(bup_type_t type)
     return MSIZE_BAD;
 }
 
+/*
+ * Represents an assembler syntax the backend can emit,
+ * instructions themselves are always Intel ordered.
+ *
+ * @name:     Name used to select the syntax
+ * @prologue: Emit anything needed before the first line, 'codealign'
+ *            is set if code labels may be aligned
+ * @section:  Switch to a named section holding code, data or
+ *            zeroed data as given by 'kind'
+ * @global:   Make a symbol visible to other objects
+ * @data:     Define a datum of a specific size
+ * @zero:     Define a number of zero bytes
+ * @reserve:  Reserve a number of zeroed data in a nobits section
+ * @align:    Align the current location
+ * @codealign: Align the current location in code, padding with long
+ *            nops if 'longnop' is set and single byte ones otherwise
+ * @memref:   Format a sized memory operand referring to a label
+ * @stackref: Format a sized memory operand at an offset (possibly negative)
+ *            from the stack pointer
+ * @idxref:   Format a sized memory operand at 'base + index*scale + disp',
+ *            'index' is NULL if there is none
+ * @secname:  Returns true if a line switches section, with the section
+ *            name (or an empty string if unknown) written to 'buf'
+ */
+struct mu_syntax {
+    const char *name;
+    void(*prologue)(FILE *fp, bool codealign);
+    void(*section)(FILE *fp, const char *name, bin_section_t kind);
+    void(*global)(FILE *fp, const char *name);
+    void(*data)(FILE *fp, msize_t size, ssize_t imm);
+    void(*zero)(FILE *fp, size_t count);
+    void(*reserve)(FILE *fp, msize_t size, size_t count);
+    void(*align)(FILE *fp, size_t bytes, bool nobits);
+    void(*codealign)(FILE *fp, size_t bytes, bool longnop);
+    void(*memref)(char *buf, size_t len, msize_t size, const char *label);
+    void(*stackref)(char *buf, size_t len, msize_t size, ssize_t off);
+    void(*idxref)(char *buf, size_t len, msize_t size, const char *base,
+        const char *index, size_t scale, ssize_t disp);
+    bool(*secname)(const char *line, char *buf, size_t len);
+};
+
+/*
+ * Describes the register file to the register allocator
+ *
+ * @order:   Allocatable registers in order of preference
+ * @count:   Number of allocatable registers
+ * @callee:  Mask of registers preserved across calls
+ * @retval:  Register holding return values
+ * @scratch: Registers never allocated, used to reload spilled values
+ */
+struct mu_regfile {
+    const mu_reg_t *order;
+    size_t count;
+    uint32_t callee;
+    mu_reg_t retval;
+    mu_reg_t scratch[2];
+};
+
+/*
+ * Represents an indexed memory operand, the address is
+ * 'label + index*scale + disp' or, without a label,
+ * 'base + index*scale + disp'
+ *
+ * @label: Label the address is relative to, NULL to use 'base'
+ * @base:  Register holding the address (if no label)
+ * @index: Index register, less than zero if none
+ * @scale: Bytes per index step (1, 2, 4 or 8)
+ * @disp:  Byte displacement
+ */
+struct mu_addr {
+    const char *label;
+    mu_reg_t base;
+    mu_reg_t index;
+    size_t scale;
+    ssize_t disp;
+};
+
+/*
+ * Get the register file of the target
+ */
+const struct mu_regfile *mu_regfile(void);
+
+/*
+ * Get the peephole rules of the target
+ *
+ * @count: Number of rules is written here
+ */
+const struct peep_rule *mu_peep_rules(size_t *count);
+
+/*
+ * Look up an assembler syntax by name
+ *
+ * @name: Syntax name (e.g., "nasm" or "gas"), NULL for default
+ *
+ * Returns NULL if not found
+ */
+const struct mu_syntax *mu_syntax_lookup(const char *name);
+
+/*
+ * Look up a tuning profile by the name of the processor
+ * family it tunes for, profiles are private to the target
+ *
+ * @name: Profile name (e.g., "generic" or "znver"), NULL for default
+ *
+ * Returns NULL if not found
+ */
+const struct mu_tune *mu_tune_lookup(const char *name);
+
+/*
+ * Returns the code width (16, 32 or 64) a line of inline
+ * assembly switches to, or zero if it is not such a
+ * directive.
+ *
+ * @line: Line of inline assembly
+ */
+uint8_t mu_code_bits(const char *line);
+
+/*
+ * Begin the output of a translation unit, code is only
+ * aligned if state->code_bits is 64.
+ *
+ * @state: Compiler state
+ *
+ * Returns zero on success
+ */
+int mu_cg_begin(struct bup_state *state);
+
 /*
  * Generate a label of a specific name
  *
@@ -63,14 +234,26 @@ int mu_cg_label(
     const char *section, bool is_global
 );
 
+/*
+ * Align the next label to what the tuning profile in
+ * state->tune wants at a place, after any section switch
+ * the label makes. Nothing is emitted if it wants none.
+ *
+ * @state: Compiler state
+ * @where: Place being aligned
+ *
+ * Returns zero on success
+ */
+int mu_cg_align(struct bup_state *state, mu_align_t where);
+
 /*
  * Create a global variable of a specific type
  *
  * @state: Compiler state
  * @name:  Label name
  * @size:  Label size
- * @sect:  Label section
- * @imm:   Value to initialize to
+ * @sect:  Label section, SECTION_BSS reserves zeroed space
+ * @imm:   Value to initialize to, ignored for SECTION_BSS
  * @is_global: If true, label should be global
  */
 int mu_cg_globvar(
@@ -79,6 +262,8 @@ int mu_cg_globvar(
 );
 
 /*
+ * Reserve a zero-initialized array
+ *
  * State: Compiler state
  * @label: Label of array
  * @is_global: If true, array is global
@@ -154,6 +339,17 @@ int mu_cg_icmpnz(struct bup_state *state, const char *label, ssize_t imm);
  */
 int mu_cg_call(struct bup_state *state, const char *label);
 
+/*
+ * Leave the procedure and jump to a label, which returns
+ * to our caller in our place
+ *
+ * @state: Compiler state
+ * @label: Label to jump to
+ *
+ * Returns zero on success
+ */
+int mu_cg_tailcall(struct bup_state *state, const char *label);
+
 /*
  * Generate a structure from a struct symbol
  *
@@ -184,4 +380,336 @@ int mu_cg_istorevar(
     const char *label, ssize_t imm
 );
 
+/*
+ * Set up the frame of a procedure, must follow its label.
+ * Every return emitted afterwards tears the frame down.
+ *
+ * A leaf makes no calls and leaves the stack alone, so its
+ * spill slots are kept in the red zone below the stack
+ * pointer unless state->no_red_zone is set.
+ *
+ * @state: Compiler state
+ * @saved: Mask of callee-saved registers to preserve
+ * @slots: Number of 8 byte spill slots
+ * @leaf:  Set if the procedure is a leaf
+ *
+ * Returns zero on success
+ */
+int mu_cg_enter(struct bup_state *state, uint32_t saved, size_t slots, bool leaf);
+
+/*
+ * Store a register into a spill slot
+ *
+ * @state: Compiler state
+ * @slot:  Spill slot
+ * @reg:   Register to store
+ *
+ * Returns zero on success
+ */
+int mu_cg_spill(struct bup_state *state, size_t slot, mu_reg_t reg);
+
+/*
+ * Load a register from a spill slot
+ *
+ * @state: Compiler state
+ * @reg:   Register to load
+ * @slot:  Spill slot
+ *
+ * Returns zero on success
+ */
+int mu_cg_reload(struct bup_state *state, mu_reg_t reg, size_t slot);
+
+/*
+ * Load an immediate into a register
+ *
+ * @state: Compiler state
+ * @size:  Machine size
+ * @reg:   Destination register
+ * @imm:   Value to load
+ *
+ * Returns zero on success
+ */
+int mu_cg_ldimm(struct bup_state *state, msize_t size, mu_reg_t reg, ssize_t imm);
+
+/*
+ * Copy a register into another
+ *
+ * @state: Compiler state
+ * @size:  Machine size
+ * @dst:   Destination register
+ * @src:   Source register
+ *
+ * Returns zero on success
+ */
+int mu_cg_movreg(struct bup_state *state, msize_t size, mu_reg_t dst, mu_reg_t src);
+
+/*
+ * Load a variable into a register, zero extending it
+ *
+ * @state: Compiler state
+ * @size:  Size of variable
+ * @reg:   Destination register
+ * @label: Label of variable
+ *
+ * Returns zero on success
+ */
+int mu_cg_loadvar(
+    struct bup_state *state, msize_t size,
+    mu_reg_t reg, const char *label
+);
+
+/*
+ * Store a register into a variable
+ *
+ * @state: Compiler state
+ * @size:  Size of variable
+ * @label: Label of variable
+ * @reg:   Source register
+ *
+ * Returns zero on success
+ */
+int mu_cg_storevar(
+    struct bup_state *state, msize_t size,
+    const char *label, mu_reg_t reg
+);
+
+/*
+ * Load an indexed memory operand into a register, zero
+ * extending it. A label indexed by a register is addressed
+ * through the first scratch register, so the index must not
+ * be in it.
+ *
+ * @state: Compiler state
+ * @size:  Size of operand
+ * @reg:   Destination register
+ * @addr:  Address of operand
+ *
+ * Returns zero on success
+ */
+int mu_cg_loadidx(
+    struct bup_state *state, msize_t size,
+    mu_reg_t reg, const struct mu_addr *addr
+);
+
+/*
+ * Store a register into an indexed memory operand, see
+ * mu_cg_loadidx() for the registers used
+ *
+ * @state: Compiler state
+ * @size:  Size of operand
+ * @addr:  Address of operand
+ * @reg:   Source register
+ *
+ * Returns zero on success
+ */
+int mu_cg_storeidx(
+    struct bup_state *state, msize_t size,
+    const struct mu_addr *addr, mu_reg_t reg
+);
+
+/*
+ * Store an immediate into an indexed memory operand, see
+ * mu_cg_loadidx() for the registers used
+ *
+ * @state: Compiler state
+ * @size:  Size of operand
+ * @addr:  Address of operand
+ * @imm:   Value to store
+ *
+ * Returns zero on success
+ */
+int mu_cg_istoreidx(
+    struct bup_state *state, msize_t size,
+    const struct mu_addr *addr, ssize_t imm
+);
+
+/*
+ * Load the address of an indexed memory operand into a
+ * register, see mu_cg_loadidx() for the registers used
+ *
+ * @state: Compiler state
+ * @size:  Machine size, the address is truncated to it
+ * @reg:   Destination register
+ * @addr:  Address to load
+ *
+ * Returns zero on success
+ */
+int mu_cg_leaidx(
+    struct bup_state *state, msize_t size,
+    mu_reg_t reg, const struct mu_addr *addr
+);
+
+/*
+ * Perform 'dst = dst <op> src'
+ *
+ * @state: Compiler state
+ * @op:    Operation
+ * @size:  Machine size
+ * @dst:   Destination register
+ * @src:   Source register
+ *
+ * Returns zero on success
+ */
+int mu_cg_binop(
+    struct bup_state *state, mu_binop_t op,
+    msize_t size, mu_reg_t dst, mu_reg_t src
+);
+
+/*
+ * Perform 'dst = dst <op> var' with the variable as a
+ * memory operand
+ *
+ * @state: Compiler state
+ * @op:    Operation
+ * @size:  Machine size, also the size of the variable
+ * @dst:   Destination register
+ * @label: Label of variable
+ *
+ * Returns zero on success, byte and word variables must
+ * be loaded with mu_cg_loadvar() instead.
+ */
+int mu_cg_binopvar(
+    struct bup_state *state, mu_binop_t op,
+    msize_t size, mu_reg_t dst, const char *label
+);
+
+/*
+ * Perform 'var = var <op> src' in place
+ *
+ * @state: Compiler state
+ * @op:    Operation, MU_ADD or MU_SUB
+ * @size:  Size of the variable
+ * @label: Label of variable
+ * @src:   Source register
+ *
+ * Returns zero on success
+ */
+int mu_cg_rmwvar(
+    struct bup_state *state, mu_binop_t op,
+    msize_t size, const char *label, mu_reg_t src
+);
+
+/*
+ * Perform 'var = var <op> imm' in place
+ *
+ * @state: Compiler state
+ * @op:    Operation, MU_ADD or MU_SUB
+ * @size:  Size of the variable
+ * @label: Label of variable
+ * @imm:   Immediate, truncated to the size of the variable
+ *
+ * Returns zero on success
+ */
+int mu_cg_irmwvar(
+    struct bup_state *state, mu_binop_t op,
+    msize_t size, const char *label, ssize_t imm
+);
+
+/*
+ * Perform 'dst = dst <op> slot' with a spill slot as a
+ * memory operand
+ *
+ * @state: Compiler state
+ * @op:    Operation
+ * @size:  Machine size
+ * @dst:   Destination register
+ * @slot:  Spill slot
+ *
+ * Returns zero on success
+ */
+int mu_cg_binopslot(
+    struct bup_state *state, mu_binop_t op,
+    msize_t size, mu_reg_t dst, size_t slot
+);
+
+/*
+ * Perform 'dst = dst <op> imm'
+ *
+ * @state: Compiler state
+ * @op:    Operation
+ * @size:  Machine size
+ * @dst:   Destination register
+ * @imm:   Immediate operand
+ *
+ * Returns zero on success
+ */
+int mu_cg_ibinop(
+    struct bup_state *state, mu_binop_t op,
+    msize_t size, mu_reg_t dst, ssize_t imm
+);
+
+/*
+ * Generate a return with the return value register
+ * copied from a register
+ *
+ * @state: Compiler state
+ * @size:  Machine size
+ * @reg:   Register holding the return value
+ *
+ * Returns zero on success
+ */
+int mu_cg_retreg(struct bup_state *state, msize_t size, mu_reg_t reg);
+
+/*
+ * Jump to a label if a register is zero
+ *
+ * @state: Compiler state
+ * @size:  Machine size
+ * @reg:   Register to test
+ * @label: Label to jump to
+ *
+ * Returns zero on success
+ */
+int mu_cg_jz(struct bup_state *state, msize_t size, mu_reg_t reg, const char *label);
+
+/*
+ * Jump to a label if a register is not zero
+ *
+ * @state: Compiler state
+ * @size:  Machine size
+ * @reg:   Register to test
+ * @label: Label to jump to
+ *
+ * Returns zero on success
+ */
+int mu_cg_jnz(struct bup_state *state, msize_t size, mu_reg_t reg, const char *label);
+
+/*
+ * Jump to a label if the last MU_CMP operation found its
+ * destination to compare to its source as given
+ *
+ * @state: Compiler state
+ * @cond:  Condition
+ * @label: Label to jump to
+ *
+ * Returns zero on success
+ */
+int mu_cg_jcc(struct bup_state *state, mu_cond_t cond, const char *label);
+
+/*
+ * Set a register to one if the last MU_CMP operation found
+ * the condition to hold, otherwise zero
+ *
+ * @state: Compiler state
+ * @cond:  Condition
+ * @reg:   Register to set
+ *
+ * Returns zero on success
+ */
+int mu_cg_setcc(struct bup_state *state, mu_cond_t cond, mu_reg_t reg);
+
+/*
+ * Copy a register into another if the last MU_CMP operation
+ * found the condition to hold, without branching. The whole
+ * register is copied.
+ *
+ * @state: Compiler state
+ * @cond:  Condition
+ * @dst:   Destination register
+ * @src:   Source register
+ *
+ * Returns zero on success
+ */
+int mu_cg_cmov(struct bup_state *state, mu_cond_t cond, mu_reg_t dst, mu_reg_t src);
+
 #endif  /* !BUP_MU_H */
@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#ifndef BUP_OPT_H
+#define BUP_OPT_H 1
+
+#include "bup/state.h"
+#include "bup/ir.h"
+
+/* Most instructions run unconditionally in place of a branch */
+#define SELECT_MAX_COST 6
+
+/*
+ * Propagate constants and copies through a procedure and
+ * fold branches on constant conditions.
+ *
+ * Virtual registers are only ever assigned once so the IR is
+ * in SSA form by construction. Global variables are promoted
+ * by forwarding stored and loaded values to later loads of
+ * the same variable, including into blocks with a single
+ * predecessor, and stores of what a variable is known to
+ * hold already (such as 'x = x' left by a select whose
+ * condition folded) are removed. The CFG of the procedure
+ * must be built.
+ *
+ * @state: Compiler state
+ * @proc:  Procedure to optimize
+ *
+ * Returns the number of changes made, or a less than
+ * zero value on failure.
+ */
+int opt_propagate(struct bup_state *state, struct ir_proc *proc);
+
+/*
+ * Delete blocks that cannot be reached from the entry
+ * block and rebuild the CFG.
+ *
+ * @state: Compiler state
+ * @proc:  Procedure to optimize
+ *
+ * Returns the number of blocks deleted, or a less than
+ * zero value on failure.
+ */
+int opt_prune(struct bup_state *state, struct ir_proc *proc);
+
+/*
+ * Delete instructions whose results are never used
+ *
+ * @state: Compiler state
+ * @proc:  Procedure to optimize
+ *
+ * Returns the number of instructions deleted, or a less
+ * than zero value on failure.
+ */
+int opt_dce(struct bup_state *state, struct ir_proc *proc);
+
+/*
+ * Replace loads of internal globals that are never written
+ * with their initial value
+ *
+ * @state: Compiler state
+ * @unit:  Translation unit
+ *
+ * Returns the number of loads replaced, or a less than
+ * zero value on failure.
+ */
+int opt_const_globals(struct bup_state *state, struct ir_unit *unit);
+
+/*
+ * Delete stores to internal globals that are never read
+ * within the translation unit, including by inline assembly.
+ *
+ * @state: Compiler state
+ * @unit:  Translation unit
+ *
+ * Returns the number of stores deleted, or a less than
+ * zero value on failure.
+ */
+int opt_dead_stores(struct bup_state *state, struct ir_unit *unit);
+
+/*
+ * Turn calls that are directly followed by a return of
+ * their result, or of nothing, into tail calls
+ *
+ * @state: Compiler state
+ * @proc:  Procedure to optimize
+ *
+ * Returns the number of calls turned into tail calls, or
+ * a less than zero value on failure.
+ */
+int opt_tail_calls(struct bup_state *state, struct ir_proc *proc);
+
+/*
+ * Fold the arithmetic computing the index of array accesses
+ * into their addressing mode. Adding or subtracting a constant
+ * moves the displacement and multiplying by a constant is
+ * absorbed by the scale when the product is 1, 2, 4 or 8, so
+ * 'a[i*2 + 1]' of a u32 array becomes '[a + i*8 + 4]'. Array
+ * addresses taken more than once in a block are reused.
+ *
+ * @state: Compiler state
+ * @proc:  Procedure to optimize
+ *
+ * Returns the number of changes made, or a less than zero
+ * value on failure.
+ */
+int opt_fold_addr(struct bup_state *state, struct ir_proc *proc);
+
+/*
+ * Replace branches around short bodies that store to internal
+ * variables with selects. The body runs every time and each
+ * store writes either its value or the one already there,
+ * picked with a conditional move instead of a jump that may
+ * be mispredicted. Branches marked 'likely' or 'unlikely' are
+ * assumed to predict well and are left alone, as are bodies
+ * costing more than SELECT_MAX_COST instructions. The CFG
+ * of the procedure must be built.
+ *
+ * @state: Compiler state
+ * @proc:  Procedure to optimize
+ *
+ * Returns the number of branches removed, or a less than
+ * zero value on failure.
+ */
+int opt_select(struct bup_state *state, struct ir_proc *proc);
+
+/*
+ * Place the unlikely side of each branch marked 'likely' or
+ * 'unlikely' at the end of the procedure, so the likely side
+ * falls through and the cold code stays out of the way. Only
+ * blocks reached from the branch alone are moved, along with
+ * none whose label inline assembly mentions. The CFG of
+ * the procedure must be built.
+ *
+ * @state: Compiler state
+ * @proc:  Procedure to optimize
+ *
+ * Returns the number of blocks moved, or a less than zero
+ * value on failure.
+ */
+int opt_layout(struct bup_state *state, struct ir_proc *proc);
+
+/*
+ * Clean up the control flow of a procedure. Jumps and
+ * branches are threaded through blocks that only jump on,
+ * a branch with both targets the same becomes a jump, a
+ * block is merged into the one jumping to it when nothing
+ * else does and blocks left unreachable are removed. Blocks
+ * whose label inline assembly mentions are kept as they are.
+ * The CFG of the procedure must be built.
+ *
+ * @state: Compiler state
+ * @proc:  Procedure to optimize
+ *
+ * Returns the number of changes made, or a less than
+ * zero value on failure.
+ */
+int opt_cleanup_cfg(struct bup_state *state, struct ir_proc *proc);
+
+/*
+ * Truncate an immediate to the width of a size
+ *
+ * @size: Size the immediate is held in
+ * @imm:  Immediate to truncate
+ */
+ssize_t opt_trunc(msize_t size, ssize_t imm);
+
+/*
+ * Returns true if assembly text mentions a symbol
+ *
+ * @text: Assembly text
+ * @name: Symbol name
+ */
+bool opt_mentions(const char *text, const char *name);
+
+/*
+ * Propagate and prune a procedure until neither makes
+ * any more progress. The CFG of the procedure must be
+ * built and is kept up to date.
+ *
+ * @state: Compiler state
+ * @proc:  Procedure to optimize
+ *
+ * Returns the number of changes made, or a less than
+ * zero value on failure.
+ */
+int opt_simplify(struct bup_state *state, struct ir_proc *proc);
+
+#endif  /* !BUP_OPT_H */
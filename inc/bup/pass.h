@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#ifndef BUP_PASS_H
+#define BUP_PASS_H 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include "bup/state.h"
+#include "bup/ir.h"
+
+/* Maximum number of analyses a pass may name */
+#define PASS_MAX_DEPS 4
+
+/*
+ * Optimization levels
+ *
+ * @PASS_O0: No optimization, fastest compile
+ * @PASS_O1: Cheap scalar cleanups
+ * @PASS_O2: Everything
+ * @PASS_OS: Everything that does not grow code
+ */
+typedef enum {
+    PASS_O0,
+    PASS_O1,
+    PASS_O2,
+    PASS_OS,
+    PASS_OMAX
+} pass_level_t;
+
+/* Mask of a single level */
+#define PASS_AT(level)  (1 << (level))
+
+/* Mask of every level */
+#define PASS_ALWAYS     ((1 << PASS_OMAX) - 1)
+
+/* Levels past -O0 */
+#define PASS_OPT        (PASS_AT(PASS_O1) | PASS_AT(PASS_O2) | PASS_AT(PASS_OS))
+
+/*
+ * Kind of pass
+ *
+ * @PASS_ANALYSIS:  Computes information other passes depend on,
+ *                  run on demand and again once a transform
+ *                  that does not preserve it changes anything.
+ * @PASS_TRANSFORM: Optional rewrite, selected by level
+ * @PASS_CODEGEN:   Produces output, cannot be disabled
+ */
+typedef enum {
+    PASS_ANALYSIS,
+    PASS_TRANSFORM,
+    PASS_CODEGEN
+} pass_kind_t;
+
+/*
+ * What passes operate on
+ *
+ * @unit:    IR of the translation unit
+ * @asm_buf: Assembly emitted so far
+ * @asm_len: Length of assembly
+ */
+struct pass_ctx {
+    struct ir_unit *unit;
+    char *asm_buf;
+    size_t asm_len;
+};
+
+/*
+ * Represents a pass
+ *
+ * @name:   Name used by -fno-<name> and --time-passes
+ * @kind:   Kind of pass
+ * @levels: Mask of levels the pass runs at
+ * @deps:   Analyses that must be current before the pass runs,
+ *          NULL terminated
+ * @keeps:  Analyses still current after the pass changes
+ *          something, NULL terminated
+ * @run:    Run the pass over the unit, returns the number of
+ *          changes made or a less than zero value on failure.
+ * @run_proc: Run the pass over a single procedure instead, it
+ *          is called for each procedure of the unit in turn
+ *          and returns the same as 'run'.
+ */
+struct pass {
+    const char *name;
+    pass_kind_t kind;
+    uint8_t levels;
+    const char *deps[PASS_MAX_DEPS];
+    const char *keeps[PASS_MAX_DEPS];
+    int(*run)(struct bup_state *state, struct pass_ctx *ctx);
+    int(*run_proc)(struct bup_state *state, struct ir_proc *proc);
+};
+
+/*
+ * Parse an optimization level ("0", "1", "2" or "s")
+ *
+ * @str: Level as given after -O
+ *
+ * Returns PASS_OMAX if invalid
+ */
+pass_level_t pass_level(const char *str);
+
+/*
+ * Look up a pass by name
+ *
+ * Returns NULL if there is no such pass
+ */
+const struct pass *pass_lookup(const char *name);
+
+/*
+ * Returns true if a pass is selected by the level and has
+ * not been disabled
+ *
+ * @state: Compiler state
+ * @pass:  Pass to check
+ */
+bool pass_enabled(struct bup_state *state, const struct pass *pass);
+
+/*
+ * Run every selected pass over a translation unit, from
+ * the IR up to writing the final assembly.
+ *
+ * @state: Compiler state
+ * @unit:  Translation unit
+ * @out:   Stream assembly is written to
+ *
+ * Returns zero on success
+ */
+int pass_run(struct bup_state *state, struct ir_unit *unit, FILE *out);
+
+#endif  /* !BUP_PASS_H */
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#ifndef BUP_PEEP_H
+#define BUP_PEEP_H 1
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "bup/state.h"
+
+/* Maximum number of operands of an instruction line */
+#define PEEP_MAX_ARGS 3
+
+/* Maximum length of a mnemonic, operand or name */
+#define PEEP_NAME_LEN 64
+
+/* Largest window a rule may look at */
+#define PEEP_WINDOW_MAX 8
+
+/*
+ * Kind of an emitted line
+ *
+ * @PEEP_INSN:    Instruction (indented)
+ * @PEEP_LABEL:   Label definition on its own line
+ * @PEEP_SECTION: Section directive
+ * @PEEP_OTHER:   Any other directive or data
+ */
+typedef enum {
+    PEEP_INSN,
+    PEEP_LABEL,
+    PEEP_SECTION,
+    PEEP_OTHER
+} peep_kind_t;
+
+/*
+ * Represents a single line of emitted assembly
+ *
+ * @kind:  Kind of line
+ * @text:  Text of line without the newline
+ * @op:    Mnemonic (PEEP_INSN)
+ * @args:  Operands (PEEP_INSN)
+ * @nargs: Number of operands
+ * @name:  Label or section name (PEEP_LABEL, PEEP_SECTION)
+ * @dead:  Set if the line has been deleted
+ */
+struct peep_line {
+    peep_kind_t kind;
+    char *text;
+    char op[PEEP_NAME_LEN];
+    char args[PEEP_MAX_ARGS][PEEP_NAME_LEN];
+    size_t nargs;
+    char name[PEEP_NAME_LEN];
+    bool dead;
+};
+
+/*
+ * State rules may look at besides their window
+ *
+ * @state:   Compiler state
+ * @section: Name of the section being emitted into, empty
+ *           if none has been declared yet
+ */
+struct peep_ctx {
+    struct bup_state *state;
+    char section[PEEP_NAME_LEN];
+};
+
+/*
+ * Represents a rewrite rule
+ *
+ * @name:   Name reported by --peephole-stats
+ * @window: Number of live lines the rule looks at
+ * @apply:  Rewrite the window, returns true if it fired. The
+ *          window is NULL terminated and is shorter near the
+ *          end of the stream.
+ */
+struct peep_rule {
+    const char *name;
+    size_t window;
+    bool(*apply)(struct peep_ctx *ctx, struct peep_line **win);
+};
+
+/*
+ * Replace the text of a line and parse it again
+ *
+ * @ctx:  Peephole context
+ * @line: Line to rewrite
+ * @fmt:  Format of the new text
+ *
+ * Returns zero on success
+ */
+int peep_set(struct peep_ctx *ctx, struct peep_line *line, const char *fmt, ...);
+
+/*
+ * Run the rules of the target over emitted assembly and
+ * write the result out.
+ *
+ * @state: Compiler state
+ * @text:  Emitted assembly
+ * @len:   Length of assembly
+ * @out:   Stream to write the result to
+ *
+ * Returns zero on success
+ */
+int peep_run(struct bup_state *state, const char *text, size_t len, FILE *out);
+
+#endif  /* !BUP_PEEP_H */
@@ -15,10 +15,12 @@
  * to allocated memory
  *
  * @data: Allocated memory
+ * @sclass: Size class of allocation
  * @link: Queue link
  */
 struct ptrbox_entry {
     void *data;
+    uint8_t sclass;
     TAILQ_ENTRY(ptrbox_entry) link;
 };
 
@@ -28,10 +30,12 @@ struct ptrbox_entry {
  *
  * @entries: Pointer box entries
  * @entry_count: Number of entries in pointer box
+ * @bytes: Number of bytes handed out, including size class rounding
  */
 struct ptrbox {
     TAILQ_HEAD(, ptrbox_entry) entries;
     size_t entry_count;
+    size_t bytes;
 };
 
 /*
@@ -62,6 +66,12 @@ void *ptrbox_strdup(struct ptrbox *ptrbox, const char *s);
  */
 void ptrbox_destroy(struct ptrbox *ptrbox);
 
+/*
+ * Release memory cached by destroyed pointer boxes
+ * back to the system.
+ */
+void ptrbox_cache_drain(void);
+
 /*
  * Initialize a pointer box
  *
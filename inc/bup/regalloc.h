@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#ifndef BUP_REGALLOC_H
+#define BUP_REGALLOC_H 1
+
+#include <stdint.h>
+#include "bup/state.h"
+#include "bup/ir.h"
+#include "bup/mu.h"
+
+/* Virtual register is not in a spill slot */
+#define RA_NOSLOT ((size_t)-1)
+
+/*
+ * Represents where a virtual register lives
+ *
+ * @reg:  Machine register, less than zero if spilled
+ * @slot: Spill slot, RA_NOSLOT if in a register
+ */
+struct ra_loc {
+    mu_reg_t reg;
+    size_t slot;
+};
+
+/*
+ * Represents the result of allocating a procedure
+ *
+ * @locs:   Location of each virtual register
+ * @nslots: Number of spill slots used
+ * @used:   Mask of machine registers assigned
+ */
+struct ra_result {
+    struct ra_loc *locs;
+    size_t nslots;
+    uint32_t used;
+};
+
+/*
+ * Assign machine registers to the virtual registers of a
+ * procedure using linear scan over live intervals.
+ *
+ * Values live across a call are kept in callee-saved
+ * registers, values live across inline assembly are always
+ * spilled. The destination of an instruction prefers the
+ * register of its first operand when that operand dies, so
+ * the copy can be dropped.
+ *
+ * @state: Compiler state
+ * @proc:  Procedure to allocate
+ * @res:   Result is written here
+ *
+ * Returns zero on success
+ */
+int ra_alloc(struct bup_state *state, struct ir_proc *proc, struct ra_result *res);
+
+/*
+ * Release the result of an allocation
+ *
+ * @res: Result to release
+ */
+void ra_release(struct ra_result *res);
+
+#endif  /* !BUP_REGALLOC_H */
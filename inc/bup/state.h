@@ -16,53 +16,99 @@
 #define DEFAULT_ASMOUT "bupgen.asm"
 #define SCOPE_STACK_MAX 8
 
+struct mu_syntax;
+struct mu_tune;
+struct ir_unit;
+struct ir_block;
+
 /*
  * Represents the compiler state
  *
- * @in_fd: Input file descriptor
+ * @in_buf: Input source buffer
+ * @in_len: Length of input source buffer
+ * @in_off: Current offset into input source buffer
  * @putback: Putback buffer
  * @tbuf:    Token buffer
  * @ptrbox:  Global pointer box
  * @symtab:  Global symbol table
  * @line_num: Current line number
  * @out_fp:   Output file pointer
+ * @syntax:   Assembler syntax of output
+ * @tune:     Tuning profile of the target processor
  * @scope_stack: Used to keep track of scope
  * @scope_depth: How deep in scope we are
  * @unreachable: If set, we are in unreachable code
+ * @dead_depth:  Scope depth the unreachable code began at
  * @loop_count:  Number of program loops
  * @if_count:    Number of if statements
  * @this_proc:   Symbol of current procedure
  * @cur_section: Current program section
  * @parse_putback: Parser putback buffer
+ * @ir:          IR of the translation unit
+ * @loop_stack:  Head and exit blocks of open loops
+ * @loop_depth:  Number of open loops
+ * @if_stack:    End blocks of open if statements
+ * @if_depth:    Number of open if statements
+ * @dump_ir:     If set, print the IR before lowering it
+ * @peep_stats:  If set, print how often each peephole rule fired
+ * @time_passes: If set, print the time and memory spent in each pass
+ * @opt_level:   Optimization level (pass_level_t)
+ * @no_passes:   Names of disabled passes, NULL terminated
+ * @no_red_zone: If set, never keep data below the stack pointer
+ * @align_next:  Alignment of the next code label, zero for none
+ * @code_bits:   Narrowest code width (16, 32 or 64) the unit selects
  * @cur_section: Symbol section, auto-placed if SECTION_DISABLED
  */
 struct bup_state {
-    int in_fd;
+    const char *in_buf;
+    size_t in_len;
+    size_t in_off;
     char putback;
     struct token_buf tbuf;
     struct ptrbox ptrbox;
     struct symbol_table symtab;
     size_t line_num;
     FILE *out_fp;
+    const struct mu_syntax *syntax;
+    const struct mu_tune *tune;
     tt_t scope_stack[SCOPE_STACK_MAX];
     uint8_t scope_depth;
     uint8_t unreachable : 1;
+    uint8_t dead_depth;
     size_t loop_count;
     size_t if_count;
     struct symbol *this_proc;
     bin_section_t cur_section;
     struct token parse_putback;
+    struct ir_unit *ir;
+    struct ir_block *loop_stack[SCOPE_STACK_MAX][2];
+    uint8_t loop_depth;
+    struct ir_block *if_stack[SCOPE_STACK_MAX];
+    uint8_t if_depth;
+    uint8_t dump_ir : 1;
+    uint8_t peep_stats : 1;
+    uint8_t time_passes : 1;
+    uint8_t opt_level;
+    const char *const *no_passes;
+    uint8_t no_red_zone : 1;
+    size_t align_next;
+    uint8_t code_bits;
 };
 
 /*
  * Initialize the compiler state
  *
- * @input_path: Path of input source file
- * @res: Result is written here
+ * @src:    Input source buffer
+ * @len:    Length of input source buffer
+ * @out_fp: Output file pointer, owned by the state
+ * @res:    Result is written here
  *
  * Returns zero on success
  */
-int bup_state_init(const char *input_path, struct bup_state *res);
+int bup_state_init(
+    const char *src, size_t len,
+    FILE *out_fp, struct bup_state *res
+);
 
 /*
  * Destroy the compiler state
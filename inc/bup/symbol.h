@@ -37,6 +37,8 @@ typedef enum {
  * @type: Symbol type
  * @data_type: Data type
  * @is_global: If set, symbol is global
+ * @is_inline: If set, procedure is always inlined
+ * @no_inline: If set, procedure is never inlined
  * @field_count: Number of fields (if structure)
  * @section: Section override for symbol (unused if NULL)
  * @fields: Fields (if structure)
@@ -49,6 +51,8 @@ struct symbol {
     sym_type_t type;
     struct datum_type data_type;
     uint8_t is_global : 1;
+    uint8_t is_inline : 1;
+    uint8_t no_inline : 1;
     size_t field_count;
     size_t array_size;
     struct symbol *parent;
@@ -25,6 +25,8 @@ typedef enum {
     TT_LT,      /* '<' */
     TT_GTE,     /* '>= */
     TT_LTE,     /* '<=' */
+    TT_EQEQ,    /* '==' */
+    TT_NEQ,     /* '!=' */
     TT_ARROW,   /* '->' */
     TT_SEMI,    /* ';' */
     TT_LBRACE,  /* '{' */
@@ -50,6 +52,8 @@ typedef enum {
     TT_IF,      /* 'if' */
     TT_STRUCT,  /* 'struct' */
     TT_TYPE,    /* 'type' */
+    TT_INLINE,  /* 'inline' */
+    TT_NOINLINE, /* 'noinline' */
     TT_IDENT,   /* <IDENT> */
     TT_NUMBER,  /* <NUMBER> */
     TT_COMMENT, /* <COMMENT: ignored> */
@@ -7,20 +7,69 @@
 #define BUP_TRACE_H 1
 
 #include <stdio.h>
+#include <stddef.h>
 #include "bup/state.h"
 
+/*
+ * Represents valid trace levels
+ *
+ * @TRACE_ERROR: Compilation failed
+ * @TRACE_WARN:  Compilation goes on
+ * @TRACE_DEBUG: Internal progress
+ * @TRACE_INFO:  Report asked for by an option, printed as is
+ */
+typedef enum {
+    TRACE_ERROR,
+    TRACE_WARN,
+    TRACE_DEBUG,
+    TRACE_INFO
+} trace_level_t;
+
+/*
+ * Diagnostic hook, used to route compiler messages somewhere
+ * other than standard output.
+ *
+ * @arg:   Argument given to trace_set_hook()
+ * @level: Message level
+ * @line:  Line number (zero if not applicable)
+ * @msg:   Formatted message
+ */
+typedef void(*trace_hook_t)(
+    void *arg, trace_level_t level,
+    size_t line, const char *msg
+);
+
 #define trace_error(gup_state, fmt, ...)    \
-    printf("[\033[90;91merror\033[0m]: " fmt, ##__VA_ARGS__); \
-    printf("[near line %zu]\n", (gup_state)->line_num);
+    trace_emit(TRACE_ERROR, (gup_state)->line_num, fmt, ##__VA_ARGS__)
 #define trace_warn(fmt, ...)   \
-    printf("[\033[90;95mwarn\033[0m]: " fmt, ##__VA_ARGS__)
+    trace_emit(TRACE_WARN, 0, fmt, ##__VA_ARGS__)
+#define trace_info(fmt, ...)   \
+    trace_emit(TRACE_INFO, 0, fmt, ##__VA_ARGS__)
 
 #define DEBUG 1
 #if DEBUG
 #define trace_debug(fmt, ...)   \
-    printf("[\033[90;94mdebug\033[0m]: " fmt, ##__VA_ARGS__)
+    trace_emit(TRACE_DEBUG, 0, fmt, ##__VA_ARGS__)
 #else
 #define trace_debug(...) (void)0
 #endif  /* DEBUG */
 
+/*
+ * Install a diagnostic hook, if NULL then messages
+ * go to standard output.
+ *
+ * @hook: Hook to install
+ * @arg:  Argument passed to the hook
+ */
+void trace_set_hook(trace_hook_t hook, void *arg);
+
+/*
+ * Emit a diagnostic message
+ *
+ * @level: Message level
+ * @line:  Line number, zero if none
+ * @fmt:   Format string
+ */
+void trace_emit(trace_level_t level, size_t line, const char *fmt, ...);
+
 #endif  /* !BUP_TRACE_H */
@@ -4,22 +4,18 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
 #include "bup/state.h"
 #include "bup/mu.h"
 #include "bup/trace.h"
 
-typedef int8_t reg_id_t;
-
 #define regmask(id)     \
     (1 << (id))
 
-#define out_of_regs(state)      \
-    trace_error(                \
-        (state),                \
-        "out of registers!\n"   \
-    )
-
 /* Return size lookup table */
 static const char *rettab[] = {
     [MSIZE_BYTE] = "al",
@@ -28,14 +24,38 @@ static const char *rettab[] = {
     [MSIZE_QWORD] = "rax"
 };
 
-/* Define size lookup table */
-static const char *dsztab[] = {
+/* NASM define size lookup table */
+static const char *nasm_dsztab[] = {
     [MSIZE_BYTE] = "db",
     [MSIZE_WORD] = "dw",
     [MSIZE_DWORD] = "dd",
     [MSIZE_QWORD] = "dq"
 };
 
+/* GAS define size lookup table */
+static const char *gas_dsztab[] = {
+    [MSIZE_BYTE] = ".byte",
+    [MSIZE_WORD] = ".word",
+    [MSIZE_DWORD] = ".long",
+    [MSIZE_QWORD] = ".quad"
+};
+
+/* NASM reserve size lookup table */
+static const char *nasm_restab[] = {
+    [MSIZE_BYTE] = "resb",
+    [MSIZE_WORD] = "resw",
+    [MSIZE_DWORD] = "resd",
+    [MSIZE_QWORD] = "resq"
+};
+
+/* Size in bytes lookup table */
+static const size_t bytetab[] = {
+    [MSIZE_BYTE] = 1,
+    [MSIZE_WORD] = 2,
+    [MSIZE_DWORD] = 4,
+    [MSIZE_QWORD] = 8
+};
+
 /* Size table */
 static const char *sztab[] = {
     [MSIZE_BYTE] = "byte",
@@ -52,16 +72,423 @@ static const char *sectab[] = {
     [SECTION_BSS]  =    ".bss"
 };
 
-/* General purpose register table */
-static const char *gpregtab[] = {
-    "r8", "r9",
-    "r10", "r11",
-    "r12", "r13",
-    "r14", "r15",
+/*
+ * General purpose registers, numbered by their encoding
+ */
+typedef enum {
+    REG_RAX, REG_RCX, REG_RDX, REG_RBX,
+    REG_RSP, REG_RBP, REG_RSI, REG_RDI,
+    REG_R8,  REG_R9,  REG_R10, REG_R11,
+    REG_R12, REG_R13, REG_R14, REG_R15,
+    REG_MAX
+} reg_id_t;
+
+/* Sized general purpose register table */
+static const char *gpregsztab[][REG_MAX] = {
+    [MSIZE_BYTE] = {
+        "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+        "r8b", "r9b", "r10b", "r11b",
+        "r12b", "r13b", "r14b", "r15b"
+    },
+    [MSIZE_WORD] = {
+        "ax", "cx", "dx", "bx", "sp", "bp", "si", "di",
+        "r8w", "r9w", "r10w", "r11w",
+        "r12w", "r13w", "r14w", "r15w"
+    },
+    [MSIZE_DWORD] = {
+        "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+        "r8d", "r9d", "r10d", "r11d",
+        "r12d", "r13d", "r14d", "r15d"
+    },
+    [MSIZE_QWORD] = {
+        "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+        "r8", "r9", "r10", "r11",
+        "r12", "r13", "r14", "r15"
+    }
+};
+
+/*
+ * Allocatable registers, caller-saved first so that
+ * procedures without calls need not save anything.
+ */
+static const mu_reg_t regorder[] = {
+    REG_R8, REG_R9, REG_RCX, REG_RDX,
+    REG_RSI, REG_RDI, REG_RAX, REG_RBX,
+    REG_R12, REG_R13, REG_R14, REG_R15
+};
+
+/* Register file given to the allocator (SysV) */
+static const struct mu_regfile regfile = {
+    .order = regorder,
+    .count = sizeof(regorder) / sizeof(regorder[0]),
+    .callee = regmask(REG_RBX) | regmask(REG_R12) | regmask(REG_R13) |
+              regmask(REG_R14) | regmask(REG_R15),
+    .retval = REG_RAX,
+    .scratch = { REG_R11, REG_R10 }
+};
+
+/* Bytes below the stack pointer that signal handlers leave alone (SysV) */
+#define RED_ZONE_SIZE 128
+
+/*
+ * Represents the frame of the procedure being emitted
+ *
+ * @saved:   Mask of callee-saved registers pushed on entry
+ * @size:    Bytes reserved below the pushed registers
+ * @redzone: Set if the reserved bytes are in the red zone, the
+ *           stack pointer is then left alone.
+ */
+static struct {
+    uint32_t saved;
+    size_t size;
+    bool redzone;
+} frame;
+
+/* Arithmetic mnemonic lookup table */
+static const char *binoptab[] = {
+    [MU_ADD] = "add",
+    [MU_SUB] = "sub",
+    [MU_MUL] = "imul",
+    [MU_CMP] = "cmp"
+};
+
+/* Unsigned condition code lookup table (jcc, setcc, cmovcc) */
+static const char *cctab[] = {
+    [MU_EQ] = "e",
+    [MU_NE] = "ne",
+    [MU_LT] = "b",
+    [MU_LE] = "be",
+    [MU_GT] = "a",
+    [MU_GE] = "ae"
+};
+
+/*
+ * Format the inside of a 'base + index*scale + disp' memory
+ * operand, shared by both syntaxes. 'base' may also be a
+ * label.
+ */
+static void
+cg_sibfmt(char *buf, size_t len, const char *base, const char *index,
+    size_t scale, ssize_t disp)
+{
+    size_t off;
+
+    off = snprintf(buf, len, "%s", base);
+    if (index != NULL && off < len) {
+        off += snprintf(buf + off, len - off, " + %s*%zu", index, scale);
+    }
+
+    if (disp != 0 && off < len) {
+        snprintf(buf + off, len - off, " %c %zd", (disp < 0) ? '-' : '+',
+            (disp < 0) ? -disp : disp);
+    }
+}
+
+static void
+nasm_prologue(FILE *fp, bool codealign)
+{
+    /* Pad code with long nops unless told otherwise */
+    if (codealign) {
+        fprintf(fp, "%%use smartalign\nalignmode p6\n");
+    }
+}
+
+static void
+nasm_section(FILE *fp, const char *name, bin_section_t kind)
+{
+    (void)kind;
+    fprintf(fp, "[section %s]\n", name);
+}
+
+static void
+nasm_global(FILE *fp, const char *name)
+{
+    fprintf(fp, "[global %s]\n", name);
+}
+
+static void
+nasm_data(FILE *fp, msize_t size, ssize_t imm)
+{
+    fprintf(fp, "%s %zd\n", nasm_dsztab[size], imm);
+}
+
+static void
+nasm_zero(FILE *fp, size_t count)
+{
+    fprintf(fp, "times %zu db 0\n", count);
+}
+
+static void
+nasm_reserve(FILE *fp, msize_t size, size_t count)
+{
+    fprintf(fp, "%s %zu\n", nasm_restab[size], count);
+}
+
+static void
+nasm_align(FILE *fp, size_t bytes, bool nobits)
+{
+    fprintf(fp, "%s %zu\n", nobits ? "alignb" : "align", bytes);
+}
+
+static void
+nasm_codealign(FILE *fp, size_t bytes, bool longnop)
+{
+    fprintf(fp, longnop ? "align %zu\n" : "align %zu, nop\n", bytes);
+}
+
+static void
+nasm_memref(char *buf, size_t len, msize_t size, const char *label)
+{
+    snprintf(buf, len, "%s [rel %s]", sztab[size], label);
+}
+
+static void
+nasm_stackref(char *buf, size_t len, msize_t size, ssize_t off)
+{
+    if (off < 0) {
+        snprintf(buf, len, "%s [rsp - %zd]", sztab[size], -off);
+        return;
+    }
+
+    snprintf(buf, len, "%s [rsp + %zd]", sztab[size], off);
+}
+
+static void
+nasm_idxref(char *buf, size_t len, msize_t size, const char *base,
+    const char *index, size_t scale, ssize_t disp)
+{
+    char sib[64];
+
+    cg_sibfmt(sib, sizeof(sib), base, index, scale, disp);
+    snprintf(buf, len, "%s [%s]", sztab[size], sib);
+}
+
+static bool
+nasm_secname(const char *line, char *buf, size_t len)
+{
+    const char *p = line + strspn(line, " \t");
+    bool bracket = (*p == '[');
+    size_t n;
+
+    p += bracket;
+    if (strncmp(p, "section", 7) != 0 && strncmp(p, "segment", 7) != 0) {
+        return false;
+    }
+
+    if (!isspace(p[7])) {
+        return false;
+    }
+
+    p += 8 + strspn(p + 8, " \t");
+    n = strcspn(p, bracket ? "] \t" : " \t");
+    n = (n < len) ? n : 0;
+    memcpy(buf, p, n);
+    buf[n] = '\0';
+    return true;
+}
+
+static void
+gas_prologue(FILE *fp, bool codealign)
+{
+    (void)codealign;
+    fprintf(fp, ".intel_syntax noprefix\n");
+
+    /* Nothing needs an executable stack */
+    fprintf(fp, ".section .note.GNU-stack,\"\",@progbits\n");
+    fprintf(fp, ".text\n");
+}
+
+static void
+gas_section(FILE *fp, const char *name, bin_section_t kind)
+{
+    /* Sections the assembler does not know about get no flags */
+    switch (kind) {
+    case SECTION_TEXT:
+        fprintf(fp, ".section %s,\"ax\",@progbits\n", name);
+        break;
+    case SECTION_BSS:
+        fprintf(fp, ".section %s,\"aw\",@nobits\n", name);
+        break;
+    default:
+        fprintf(fp, ".section %s,\"aw\",@progbits\n", name);
+        break;
+    }
+}
+
+static void
+gas_global(FILE *fp, const char *name)
+{
+    fprintf(fp, ".globl %s\n", name);
+}
+
+static void
+gas_data(FILE *fp, msize_t size, ssize_t imm)
+{
+    fprintf(fp, "%s %zd\n", gas_dsztab[size], imm);
+}
+
+static void
+gas_zero(FILE *fp, size_t count)
+{
+    fprintf(fp, ".zero %zu\n", count);
+}
+
+static void
+gas_reserve(FILE *fp, msize_t size, size_t count)
+{
+    fprintf(fp, ".zero %zu\n", bytetab[size] * count);
+}
+
+static void
+gas_align(FILE *fp, size_t bytes, bool nobits)
+{
+    (void)nobits;
+    fprintf(fp, ".balign %zu\n", bytes);
+}
+
+static void
+gas_codealign(FILE *fp, size_t bytes, bool longnop)
+{
+    fprintf(fp, longnop ? ".balign %zu\n" : ".balign %zu, 0x90\n", bytes);
+}
+
+static void
+gas_memref(char *buf, size_t len, msize_t size, const char *label)
+{
+    snprintf(buf, len, "%s ptr [rip + %s]", sztab[size], label);
+}
+
+static void
+gas_stackref(char *buf, size_t len, msize_t size, ssize_t off)
+{
+    if (off < 0) {
+        snprintf(buf, len, "%s ptr [rsp - %zd]", sztab[size], -off);
+        return;
+    }
+
+    snprintf(buf, len, "%s ptr [rsp + %zd]", sztab[size], off);
+}
+
+static void
+gas_idxref(char *buf, size_t len, msize_t size, const char *base,
+    const char *index, size_t scale, ssize_t disp)
+{
+    char sib[64];
+
+    cg_sibfmt(sib, sizeof(sib), base, index, scale, disp);
+    snprintf(buf, len, "%s ptr [%s]", sztab[size], sib);
+}
+
+static bool
+gas_secname(const char *line, char *buf, size_t len)
+{
+    static const char *shorttab[] = { ".text", ".data", ".bss" };
+    static const char *stacktab[] = {
+        ".pushsection", ".popsection", ".previous", ".subsection"
+    };
+    const char *p = line + strspn(line, " \t");
+    size_t n;
+
+    if (strncmp(p, ".section", 8) == 0 && isspace(p[8])) {
+        p += 9 + strspn(p + 9, " \t");
+        n = strcspn(p, ", \t");
+        n = (n < len) ? n : 0;
+        memcpy(buf, p, n);
+        buf[n] = '\0';
+        return true;
+    }
+
+    n = strcspn(p, " \t");
+    for (size_t i = 0; i < sizeof(shorttab) / sizeof(shorttab[0]); ++i) {
+        if (strlen(shorttab[i]) == n && strncmp(p, shorttab[i], n) == 0) {
+            snprintf(buf, len, "%s", shorttab[i]);
+            return true;
+        }
+    }
+
+    /* Switches whose target we do not track */
+    for (size_t i = 0; i < sizeof(stacktab) / sizeof(stacktab[0]); ++i) {
+        if (strlen(stacktab[i]) == n && strncmp(p, stacktab[i], n) == 0) {
+            buf[0] = '\0';
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Supported assembler syntaxes, first is the default */
+static const struct mu_syntax syntaxtab[] = {
+    {
+        .name = "nasm",
+        .prologue = nasm_prologue,
+        .section = nasm_section,
+        .global = nasm_global,
+        .data = nasm_data,
+        .zero = nasm_zero,
+        .reserve = nasm_reserve,
+        .align = nasm_align,
+        .codealign = nasm_codealign,
+        .memref = nasm_memref,
+        .stackref = nasm_stackref,
+        .idxref = nasm_idxref,
+        .secname = nasm_secname
+    },
+    {
+        .name = "gas",
+        .prologue = gas_prologue,
+        .section = gas_section,
+        .global = gas_global,
+        .data = gas_data,
+        .zero = gas_zero,
+        .reserve = gas_reserve,
+        .align = gas_align,
+        .codealign = gas_codealign,
+        .memref = gas_memref,
+        .stackref = gas_stackref,
+        .idxref = gas_idxref,
+        .secname = gas_secname
+    }
+};
+
+/*
+ * Represents a tuning profile, chosen once per run with
+ * -mtune and consulted wherever processors disagree on
+ * the best encoding
+ *
+ * @name:       Name used to select the profile
+ * @proc_align: Bytes procedures are aligned to, zero for none
+ * @loop_align: Bytes loop headers are aligned to, zero for none
+ * @longnop:    If set, pad with multi-byte nops rather than 0x90s
+ * @movzx:      If set, byte and word results are zero extended into
+ *              the full register instead of written in place
+ * @incdec:     If set, adding or subtracting one uses inc and dec
+ */
+struct mu_tune {
+    const char *name;
+    size_t proc_align;
+    size_t loop_align;
+    bool longnop;
+    bool movzx;
+    bool incdec;
 };
 
-/* Bitmap used to allocate registers */
-static uint8_t gpreg_bitmap = 0;
+/*
+ * Supported tuning profiles, first is the default
+ *
+ * Generic code avoids inc and dec, which stall on the
+ * flags they leave alone on older Intel cores. Zen and Ice
+ * Lake fetch and cache decoded loops in 32 byte windows.
+ * Atom decodes in order, where neither partial register
+ * writes nor alignment pay for their size and each long nop
+ * costs more to decode than a run of short ones.
+ */
+static const struct mu_tune tunetab[] = {
+    { "generic", 16, 16, true,  true,  false },
+    { "znver",   32, 32, true,  true,  true },
+    { "icelake", 16, 32, true,  true,  true },
+    { "atom",    16, 0,  false, false, false }
+};
 
 /*
  * Ensure that the current section is of a specific type
@@ -81,57 +508,204 @@ cg_assert_section(struct bup_state *state, bin_section_t section)
     }
 
     if (section != state->cur_section) {
-        fprintf(
-            state->out_fp,
-            "[section %s]\n",
-            sectab[section]
-        );
+        state->syntax->section(state->out_fp, sectab[section], section);
 
         state->cur_section = section;
     }
 }
 
 /*
- * Convert a general purpose register ID to a
- * string name
+ * Keep track of a section switched to by name
  *
- * @id: ID to convert to name
+ * @state: Compiler state
+ * @name:  Section name
  */
-static inline const char *
-cg_gpreg_name(uint8_t id)
+static void
+cg_track_section(struct bup_state *state, const char *name)
 {
-    if (id >= 8) {
-        return "bad";
+    if (state->cur_section == SECTION_DISABLED) {
+        return;
     }
 
-    return gpregtab[id];
+    state->cur_section = SECTION_NONE;
+    for (bin_section_t i = SECTION_TEXT; i < SECTION_MAX; ++i) {
+        if (strcmp(sectab[i], name) == 0)
+            state->cur_section = i;
+    }
 }
 
 /*
- * Free a mask of general purpose registers
+ * Define zero-initialized data at the current location,
+ * as a reservation when in .bss.
+ *
+ * @state: Compiler state
+ * @label: Label of data
+ * @size:  Element size
+ * @count: Number of elements
+ * @align: Required alignment in bytes
  */
-static inline void
-cg_free_gpreg(uint8_t mask)
+static void
+cg_zero_data(struct bup_state *state, const char *label, msize_t size,
+    size_t count, size_t align)
+{
+    bool nobits = state->cur_section == SECTION_BSS;
+
+    if (align > 1) {
+        state->syntax->align(state->out_fp, align, nobits);
+    }
+
+    fprintf(state->out_fp, "%s: ", label);
+    if (nobits) {
+        state->syntax->reserve(state->out_fp, size, count);
+    } else if (count == 1) {
+        state->syntax->data(state->out_fp, size, 0);
+    } else {
+        state->syntax->zero(state->out_fp, bytetab[size] * count);
+    }
+}
+
+/*
+ * Tear down the frame of the current procedure
+ *
+ * @state: Compiler state
+ */
+static void
+cg_leave(struct bup_state *state)
+{
+    if (frame.size > 0 && !frame.redzone) {
+        fprintf(state->out_fp, "\tadd rsp, %zu\n", frame.size);
+    }
+
+    for (int i = REG_MAX - 1; i >= 0; --i) {
+        if ((frame.saved & regmask(i)) != 0)
+            fprintf(state->out_fp, "\tpop %s\n", gpregsztab[MSIZE_QWORD][i]);
+    }
+}
+
+const struct mu_syntax *
+mu_syntax_lookup(const char *name)
+{
+    size_t n = sizeof(syntaxtab) / sizeof(syntaxtab[0]);
+
+    if (name == NULL) {
+        return &syntaxtab[0];
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        if (strcmp(syntaxtab[i].name, name) == 0)
+            return &syntaxtab[i];
+    }
+
+    return NULL;
+}
+
+/*
+ * Get the size arithmetic of a given size is done at, as
+ * byte and word registers are zero extended into their
+ * dword register (avoiding partial register writes).
+ */
+static inline msize_t
+cg_opsize(msize_t size)
 {
-    gpreg_bitmap &= ~mask;
+    return (size < MSIZE_DWORD) ? MSIZE_DWORD : size;
 }
 
 /*
- * Allocate a general purpose register and return
- * the ID on success, otherwise a less than zero
- * value on failure.
+ * Get the size an immediate is moved into a register at,
+ * writing a dword register clears the upper half so
+ * unsigned 32-bit immediates do not need the 10 byte form.
  */
-static reg_id_t
-cg_alloc_gpreg(void)
+static inline msize_t
+cg_immsize(msize_t size, ssize_t imm)
 {
-    for (uint8_t i = 0; i < 8; ++i) {
-        if ((gpreg_bitmap & (1 << i)) == 0) {
-            gpreg_bitmap |= (1 << i);
-            return i;
-        }
+    size = cg_opsize(size);
+    if (size == MSIZE_QWORD && imm >= 0 && imm <= UINT32_MAX) {
+        return MSIZE_DWORD;
+    }
+
+    return size;
+}
+
+/*
+ * Returns true if adding or subtracting an immediate is
+ * done with inc or dec, which leave the carry flag alone.
+ * Nothing tests the flags of arithmetic without comparing
+ * first, so that is never missed.
+ */
+static inline bool
+cg_incdec(struct bup_state *state, mu_binop_t op, ssize_t imm)
+{
+    if (!state->tune->incdec || (op != MU_ADD && op != MU_SUB)) {
+        return false;
+    }
+
+    return imm == 1 || imm == -1;
+}
+
+const struct mu_tune *
+mu_tune_lookup(const char *name)
+{
+    size_t n = sizeof(tunetab) / sizeof(tunetab[0]);
+
+    if (name == NULL) {
+        return &tunetab[0];
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        if (strcmp(tunetab[i].name, name) == 0)
+            return &tunetab[i];
+    }
+
+    return NULL;
+}
+
+uint8_t
+mu_code_bits(const char *line)
+{
+    unsigned long bits;
+    char *end;
+
+    if (line == NULL) {
+        return 0;
+    }
+
+    /* NASM '[bits n]' or 'bits n', GAS '.coden' */
+    while (isspace(*line) || *line == '[')
+        ++line;
+
+    if (strncasecmp(line, "bits", 4) == 0 && isspace(line[4])) {
+        line += 4;
+    } else if (strncmp(line, ".code", 5) == 0) {
+        line += 5;
+    } else {
+        return 0;
+    }
+
+    bits = strtoul(line, &end, 10);
+    if (end == line) {
+        return 0;
+    }
+
+    switch (bits) {
+    case 16:
+    case 32:
+    case 64:
+        return bits;
+    }
+
+    return 0;
+}
+
+int
+mu_cg_begin(struct bup_state *state)
+{
+    if (state == NULL) {
+        errno = -EINVAL;
+        return -1;
     }
 
-    return -1;
+    state->syntax->prologue(state->out_fp, state->code_bits == 64);
+    return 0;
 }
 
 int
@@ -145,19 +719,18 @@ mu_cg_label(struct bup_state *state, const char *name, const char *section,
 
     /* .text is the default */
     if (section != NULL) {
-        fprintf(
-            state->out_fp,
-            "[section %s]\n",
-            section
-        );
+        state->syntax->section(state->out_fp, section, SECTION_TEXT);
+        cg_track_section(state, section);
     }
 
     if (is_global) {
-        fprintf(
-            state->out_fp,
-            "[global %s]\n",
-            name
-        );
+        state->syntax->global(state->out_fp, name);
+    }
+
+    if (state->align_next > 0) {
+        state->syntax->codealign(state->out_fp, state->align_next,
+            state->tune->longnop);
+        state->align_next = 0;
     }
 
     fprintf(
@@ -169,6 +742,40 @@ mu_cg_label(struct bup_state *state, const char *name, const char *section,
     return 0;
 }
 
+int
+mu_cg_align(struct bup_state *state, mu_align_t where)
+{
+    size_t bytes;
+
+    if (state == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    /* The padding and long nops are 64-bit only */
+    if (state->code_bits != 64) {
+        return 0;
+    }
+
+    switch (where) {
+    case MU_ALIGN_PROC:
+        bytes = state->tune->proc_align;
+        break;
+    case MU_ALIGN_LOOP:
+        bytes = state->tune->loop_align;
+        break;
+    default:
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if (bytes > state->align_next) {
+        state->align_next = bytes;
+    }
+
+    return 0;
+}
+
 int
 mu_cg_ret(struct bup_state *state)
 {
@@ -177,6 +784,7 @@ mu_cg_ret(struct bup_state *state)
         return -1;
     }
 
+    cg_leave(state);
     fprintf(
         state->out_fp,
         "\tret\n"
@@ -193,14 +801,24 @@ mu_cg_retimm(struct bup_state *state, msize_t size, ssize_t imm)
         return -1;
     }
 
+    /* Writing all of eax breaks the dependency on its old value */
+    if (size < MSIZE_DWORD && state->tune->movzx) {
+        imm &= (size == MSIZE_BYTE) ? 0xFF : 0xFFFF;
+    }
+
+    if (size >= MSIZE_DWORD || state->tune->movzx) {
+        size = cg_immsize(size, imm);
+    }
+
     fprintf(
         state->out_fp,
-        "\tmov %s, %zd\n"
-        "\tret\n",
+        "\tmov %s, %zd\n",
         rettab[size],
         imm
     );
 
+    cg_leave(state);
+    fprintf(state->out_fp, "\tret\n");
     return 0;
 }
 
@@ -255,20 +873,16 @@ mu_cg_globvar(struct bup_state *state, const char *name, msize_t size,
     /* Put it in the section and global if we can */
     cg_assert_section(state, sect);
     if (is_global) {
-        fprintf(
-            state->out_fp,
-            "[global %s]\n",
-            name
-        );
+        state->syntax->global(state->out_fp, name);
     }
 
-    fprintf(
-        state->out_fp,
-        "%s: %s %zd\n",
-        name,
-        dsztab[size],
-        imm
-    );
+    if (sect == SECTION_BSS) {
+        cg_zero_data(state, name, size, 1, bytetab[size]);
+        return 0;
+    }
+
+    fprintf(state->out_fp, "%s: ", name);
+    state->syntax->data(state->out_fp, size, imm);
 
     return 0;
 }
@@ -277,6 +891,8 @@ int
 mu_cg_istorevar(struct bup_state *state, msize_t size,
     const char *label, ssize_t imm)
 {
+    char memref[128];
+
     if (state == NULL || label == NULL) {
         errno = -EINVAL;
         return -1;
@@ -287,11 +903,17 @@ mu_cg_istorevar(struct bup_state *state, msize_t size,
         return -1;
     }
 
+    /* Only sign extended 32-bit immediates can be stored */
+    if (size == MSIZE_QWORD && (imm < INT32_MIN || imm > INT32_MAX)) {
+        mu_cg_ldimm(state, size, regfile.scratch[1], imm);
+        return mu_cg_storevar(state, size, label, regfile.scratch[1]);
+    }
+
+    state->syntax->memref(memref, sizeof(memref), size, label);
     fprintf(
         state->out_fp,
-        "\tmov %s [rel %s], %zd\n",
-        sztab[size],
-        label,
+        "\tmov %s, %zd\n",
+        memref,
         imm
     );
 
@@ -316,22 +938,34 @@ mu_cg_call(struct bup_state *state, const char *label)
 }
 
 int
-mu_cg_icmpnz(struct bup_state *state, const char *label, ssize_t imm)
+mu_cg_tailcall(struct bup_state *state, const char *label)
 {
-    reg_id_t reg;
-    const char *name;
-
     if (state == NULL || label == NULL) {
         errno = -EINVAL;
         return -1;
     }
 
-    if ((reg = cg_alloc_gpreg()) < 0) {
-        out_of_regs(state);
+    cg_leave(state);
+    fprintf(
+        state->out_fp,
+        "\tjmp %s\n",
+        label
+    );
+
+    return 0;
+}
+
+int
+mu_cg_icmpnz(struct bup_state *state, const char *label, ssize_t imm)
+{
+    const char *name;
+
+    if (state == NULL || label == NULL) {
+        errno = -EINVAL;
         return -1;
     }
 
-    name = cg_gpreg_name(reg);
+    name = gpregsztab[MSIZE_QWORD][regfile.scratch[0]];
     fprintf(
         state->out_fp,
         "\tmov %s, %zd\n"
@@ -342,12 +976,18 @@ mu_cg_icmpnz(struct bup_state *state, const char *label, ssize_t imm)
         label
     );
 
-    cg_free_gpreg(regmask(reg));
     return 0;
 }
 
-int
-mu_cg_struct(struct bup_state *state, const char *name, struct symbol *instance,
+/*
+ * Emit the label and fields of a structure instance
+ *
+ * @state:  Compiler state
+ * @name:   Instance (or nested field) name
+ * @symbol: Structure symbol
+ */
+static void
+cg_struct_fields(struct bup_state *state, const char *name,
     struct symbol *symbol)
 {
     char name_buf[64];
@@ -355,32 +995,19 @@ mu_cg_struct(struct bup_state *state, const char *name, struct symbol *instance,
     struct datum_type *dtype;
     msize_t size;
 
-    if (state == NULL || symbol == NULL) {
-        errno = -EINVAL;
-        return -1;
-    }
-
-    if (instance->section == NULL) {
-        cg_assert_section(state, SECTION_DATA);
-    } else {
-        fprintf(
-            state->out_fp,
-            "[section %s]\n",
-            instance->section
-        );
-    }
     fprintf(state->out_fp, "%s:\n", name);
     FIELD_FOREACH(symbol, field) {
+        snprintf(
+            name_buf,
+            sizeof(name_buf),
+            "%s.%s",
+            name,
+            field->name
+        );
+
         /* Handle struct instances */
         if (field->type == SYMBOL_STRUCT) {
-            snprintf(
-                name_buf,
-                sizeof(name_buf),
-                "%s.%s",
-                name,
-                field->name
-            );
-            mu_cg_struct(state, name_buf, instance, field->parent);
+            cg_struct_fields(state, name_buf, field->parent);
             continue;
         }
 
@@ -390,15 +1017,32 @@ mu_cg_struct(struct bup_state *state, const char *name, struct symbol *instance,
             continue;
         }
 
-        fprintf(
-            state->out_fp,
-            "%s.%s: %s 0\n",
-            name,
-            field->name,
-            dsztab[size]
-        );
+        cg_zero_data(state, name_buf, size, 1, 1);
+    }
+}
+
+int
+mu_cg_struct(struct bup_state *state, const char *name, struct symbol *instance,
+    struct symbol *symbol)
+{
+    if (state == NULL || symbol == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    /* Fields are never initialized, so reserve them unless placed */
+    if (instance->section == NULL) {
+        cg_assert_section(state, SECTION_BSS);
+    } else {
+        state->syntax->section(state->out_fp, instance->section, SECTION_DATA);
+        cg_track_section(state, instance->section);
+    }
+
+    if (state->cur_section == SECTION_BSS) {
+        state->syntax->align(state->out_fp, 8, true);
     }
 
+    cg_struct_fields(state, name, symbol);
     return 0;
 }
 
@@ -409,21 +1053,998 @@ int mu_cg_array(struct bup_state *state, const char *label, bool is_global,
         return -1;
     }
 
-    cg_assert_section(state, SECTION_DATA);
+    cg_assert_section(state, SECTION_BSS);
     if (is_global) {
+        state->syntax->global(state->out_fp, label);
+    }
+
+    cg_zero_data(state, label, MSIZE_BYTE, count, (count >= 16) ? 16 : 1);
+
+    return 0;
+}
+
+const struct mu_regfile *
+mu_regfile(void)
+{
+    return &regfile;
+}
+
+/*
+ * Format a spill slot operand
+ *
+ * @state: Compiler state
+ * @buf:   Operand buffer
+ * @len:   Length of operand buffer
+ * @size:  Access size
+ * @slot:  Spill slot
+ */
+static void
+cg_slotref(struct bup_state *state, char *buf, size_t len, msize_t size,
+    size_t slot)
+{
+    ssize_t off = slot * 8;
+
+    if (frame.redzone) {
+        off -= frame.size;
+    }
+
+    state->syntax->stackref(buf, len, size, off);
+}
+
+int
+mu_cg_enter(struct bup_state *state, uint32_t saved, size_t slots, bool leaf)
+{
+    size_t npush = 0;
+
+    if (state == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    frame.saved = saved & regfile.callee;
+    frame.size = slots * 8;
+    frame.redzone = false;
+    for (int i = 0; i < REG_MAX; ++i) {
+        if ((frame.saved & regmask(i)) == 0)
+            continue;
+
+        fprintf(state->out_fp, "\tpush %s\n", gpregsztab[MSIZE_QWORD][i]);
+        ++npush;
+    }
+
+    /* Nothing below a leaf needs the slots or stack alignment */
+    if (leaf) {
+        frame.redzone = !state->no_red_zone && frame.size <= RED_ZONE_SIZE;
+        if (frame.redzone)
+            return 0;
+    }
+
+    /*
+     * Keep the stack 16 byte aligned at calls, the call that
+     * got us here left it 8 bytes off. This is SysV x86-64, the
+     * stack of 16 and 32-bit code is left alone.
+     */
+    if (!leaf && state->code_bits == 64) {
+        if (((npush * 8) + frame.size) % 16 == 0)
+            frame.size += 8;
+    }
+
+    if (frame.size > 0) {
+        fprintf(state->out_fp, "\tsub rsp, %zu\n", frame.size);
+    }
+
+    return 0;
+}
+
+int
+mu_cg_spill(struct bup_state *state, size_t slot, mu_reg_t reg)
+{
+    char memref[64];
+
+    if (state == NULL || reg < 0 || reg >= REG_MAX) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    cg_slotref(state, memref, sizeof(memref), MSIZE_QWORD, slot);
+    fprintf(
+        state->out_fp,
+        "\tmov %s, %s\n",
+        memref,
+        gpregsztab[MSIZE_QWORD][reg]
+    );
+
+    return 0;
+}
+
+int
+mu_cg_reload(struct bup_state *state, mu_reg_t reg, size_t slot)
+{
+    char memref[64];
+
+    if (state == NULL || reg < 0 || reg >= REG_MAX) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    cg_slotref(state, memref, sizeof(memref), MSIZE_QWORD, slot);
+    fprintf(
+        state->out_fp,
+        "\tmov %s, %s\n",
+        gpregsztab[MSIZE_QWORD][reg],
+        memref
+    );
+
+    return 0;
+}
+
+int
+mu_cg_ldimm(struct bup_state *state, msize_t size, mu_reg_t reg, ssize_t imm)
+{
+    if (state == NULL || reg < 0 || size >= MSIZE_MAX) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    fprintf(
+        state->out_fp,
+        "\tmov %s, %zd\n",
+        gpregsztab[cg_immsize(size, imm)][reg],
+        imm
+    );
+
+    return 0;
+}
+
+int
+mu_cg_movreg(struct bup_state *state, msize_t size, mu_reg_t dst, mu_reg_t src)
+{
+    if (state == NULL || dst < 0 || src < 0 || size >= MSIZE_MAX) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    size = cg_opsize(size);
+    fprintf(
+        state->out_fp,
+        "\tmov %s, %s\n",
+        gpregsztab[size][dst],
+        gpregsztab[size][src]
+    );
+
+    return 0;
+}
+
+int
+mu_cg_loadvar(struct bup_state *state, msize_t size, mu_reg_t reg,
+    const char *label)
+{
+    char memref[128];
+
+    if (state == NULL || label == NULL || reg < 0) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if (size == MSIZE_BAD || size >= MSIZE_MAX) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    state->syntax->memref(memref, sizeof(memref), size, label);
+    fprintf(
+        state->out_fp,
+        "\t%s %s, %s\n",
+        (size < MSIZE_DWORD) ? "movzx" : "mov",
+        gpregsztab[cg_opsize(size)][reg],
+        memref
+    );
+
+    return 0;
+}
+
+int
+mu_cg_storevar(struct bup_state *state, msize_t size, const char *label,
+    mu_reg_t reg)
+{
+    char memref[128];
+
+    if (state == NULL || label == NULL || reg < 0) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if (size == MSIZE_BAD || size >= MSIZE_MAX) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    state->syntax->memref(memref, sizeof(memref), size, label);
+    fprintf(
+        state->out_fp,
+        "\tmov %s, %s\n",
+        memref,
+        gpregsztab[size][reg]
+    );
+
+    return 0;
+}
+
+/*
+ * Format an indexed memory operand. The address of a label
+ * indexed by a register cannot be encoded RIP relative so it
+ * is loaded into the first scratch register.
+ *
+ * @state: Compiler state
+ * @buf:   Operand buffer
+ * @len:   Length of operand buffer
+ * @size:  Access size
+ * @addr:  Address of operand
+ *
+ * Returns zero on success
+ */
+static int
+cg_addrref(struct bup_state *state, char *buf, size_t len, msize_t size,
+    const struct mu_addr *addr)
+{
+    const char *index = NULL;
+    char label[128];
+    mu_reg_t base = addr->base;
+
+    if (addr->index >= REG_MAX || base >= REG_MAX) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    switch (addr->scale) {
+    case 1:
+    case 2:
+    case 4:
+    case 8:
+        break;
+    default:
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if (addr->index >= 0) {
+        index = gpregsztab[MSIZE_QWORD][addr->index];
+    }
+
+    if (addr->label != NULL && index == NULL) {
+        cg_sibfmt(label, sizeof(label), addr->label, NULL, 0, addr->disp);
+        state->syntax->memref(buf, len, size, label);
+        return 0;
+    }
+
+    if (addr->label != NULL) {
+        base = regfile.scratch[0];
+        if (addr->index == base) {
+            errno = -EINVAL;
+            return -1;
+        }
+
+        state->syntax->memref(label, sizeof(label), MSIZE_QWORD, addr->label);
         fprintf(
             state->out_fp,
-            "[global %s]\n",
+            "\tlea %s, %s\n",
+            gpregsztab[MSIZE_QWORD][base],
             label
         );
     }
 
+    if (base < 0) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    state->syntax->idxref(
+        buf, len, size,
+        gpregsztab[MSIZE_QWORD][base],
+        index,
+        addr->scale,
+        addr->disp
+    );
+
+    return 0;
+}
+
+int
+mu_cg_loadidx(struct bup_state *state, msize_t size, mu_reg_t reg,
+    const struct mu_addr *addr)
+{
+    char memref[128];
+
+    if (state == NULL || addr == NULL || reg < 0) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if (size == MSIZE_BAD || size >= MSIZE_MAX) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if (cg_addrref(state, memref, sizeof(memref), size, addr) < 0) {
+        return -1;
+    }
+
     fprintf(
         state->out_fp,
-        "%s: times %zu db 0\n",
-        label,
-        count
+        "\t%s %s, %s\n",
+        (size < MSIZE_DWORD) ? "movzx" : "mov",
+        gpregsztab[cg_opsize(size)][reg],
+        memref
     );
 
     return 0;
 }
+
+int
+mu_cg_storeidx(struct bup_state *state, msize_t size,
+    const struct mu_addr *addr, mu_reg_t reg)
+{
+    char memref[128];
+
+    if (state == NULL || addr == NULL || reg < 0) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if (size == MSIZE_BAD || size >= MSIZE_MAX) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if (cg_addrref(state, memref, sizeof(memref), size, addr) < 0) {
+        return -1;
+    }
+
+    fprintf(
+        state->out_fp,
+        "\tmov %s, %s\n",
+        memref,
+        gpregsztab[size][reg]
+    );
+
+    return 0;
+}
+
+int
+mu_cg_istoreidx(struct bup_state *state, msize_t size,
+    const struct mu_addr *addr, ssize_t imm)
+{
+    struct mu_addr flat;
+    mu_reg_t reg = regfile.scratch[0];
+    char memref[128];
+
+    if (state == NULL || addr == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if (size == MSIZE_BAD || size >= MSIZE_MAX) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    /*
+     * Only sign extended 32-bit immediates can be stored. The
+     * index may be spilled into scratch[1] and an indexed label
+     * is addressed through scratch[0], so in that case the address
+     * is computed first and the index register is free again.
+     */
+    if (size == MSIZE_QWORD && (imm < INT32_MIN || imm > INT32_MAX)) {
+        if (addr->label != NULL && addr->index >= 0) {
+            if (mu_cg_leaidx(state, MSIZE_QWORD, reg, addr) < 0)
+                return -1;
+
+            flat.label = NULL;
+            flat.base = reg;
+            flat.index = -1;
+            flat.scale = 1;
+            flat.disp = 0;
+            addr = &flat;
+            reg = regfile.scratch[1];
+        }
+
+        if (mu_cg_ldimm(state, size, reg, imm) < 0)
+            return -1;
+
+        return mu_cg_storeidx(state, size, addr, reg);
+    }
+
+    if (cg_addrref(state, memref, sizeof(memref), size, addr) < 0) {
+        return -1;
+    }
+
+    fprintf(
+        state->out_fp,
+        "\tmov %s, %zd\n",
+        memref,
+        imm
+    );
+
+    return 0;
+}
+
+int
+mu_cg_leaidx(struct bup_state *state, msize_t size, mu_reg_t reg,
+    const struct mu_addr *addr)
+{
+    char memref[128];
+
+    if (state == NULL || addr == NULL || reg < 0 || reg >= REG_MAX) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if (size >= MSIZE_MAX) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    size = cg_opsize(size);
+    if (cg_addrref(state, memref, sizeof(memref), size, addr) < 0) {
+        return -1;
+    }
+
+    fprintf(
+        state->out_fp,
+        "\tlea %s, %s\n",
+        gpregsztab[size][reg],
+        memref
+    );
+
+    return 0;
+}
+
+int
+mu_cg_binop(struct bup_state *state, mu_binop_t op, msize_t size,
+    mu_reg_t dst, mu_reg_t src)
+{
+    if (state == NULL || dst < 0 || src < 0 || size >= MSIZE_MAX) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    size = cg_opsize(size);
+    fprintf(
+        state->out_fp,
+        "\t%s %s, %s\n",
+        binoptab[op],
+        gpregsztab[size][dst],
+        gpregsztab[size][src]
+    );
+
+    return 0;
+}
+
+/*
+ * Perform 'dst = dst <op> mem' with a formatted memory
+ * operand
+ */
+static void
+cg_binopmem(struct bup_state *state, mu_binop_t op, msize_t size,
+    mu_reg_t dst, const char *memref)
+{
+    fprintf(
+        state->out_fp,
+        "\t%s %s, %s\n",
+        binoptab[op],
+        gpregsztab[size][dst],
+        memref
+    );
+}
+
+int
+mu_cg_binopvar(struct bup_state *state, mu_binop_t op, msize_t size,
+    mu_reg_t dst, const char *label)
+{
+    char memref[128];
+
+    if (state == NULL || label == NULL || dst < 0) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    /* The operand cannot be zero extended in place */
+    if (size < MSIZE_DWORD || size >= MSIZE_MAX) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    state->syntax->memref(memref, sizeof(memref), size, label);
+    cg_binopmem(state, op, size, dst, memref);
+    return 0;
+}
+
+int
+mu_cg_rmwvar(struct bup_state *state, mu_binop_t op, msize_t size,
+    const char *label, mu_reg_t src)
+{
+    char memref[128];
+
+    if (state == NULL || label == NULL || src < 0 || src >= REG_MAX) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if (op != MU_ADD && op != MU_SUB) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if (size == MSIZE_BAD || size >= MSIZE_MAX) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    state->syntax->memref(memref, sizeof(memref), size, label);
+    fprintf(
+        state->out_fp,
+        "\t%s %s, %s\n",
+        binoptab[op],
+        memref,
+        gpregsztab[size][src]
+    );
+
+    return 0;
+}
+
+int
+mu_cg_irmwvar(struct bup_state *state, mu_binop_t op, msize_t size,
+    const char *label, ssize_t imm)
+{
+    mu_reg_t tmp = regfile.scratch[1];
+    char memref[128];
+
+    if (state == NULL || label == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if (op != MU_ADD && op != MU_SUB) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    /* Only the bits that fit the variable matter */
+    switch (size) {
+    case MSIZE_BYTE:
+        imm = (int8_t)imm;
+        break;
+    case MSIZE_WORD:
+        imm = (int16_t)imm;
+        break;
+    case MSIZE_DWORD:
+        imm = (int32_t)imm;
+        break;
+    case MSIZE_QWORD:
+        if (imm >= INT32_MIN && imm <= INT32_MAX)
+            break;
+
+        mu_cg_ldimm(state, size, tmp, imm);
+        return mu_cg_rmwvar(state, op, size, label, tmp);
+    default:
+        errno = -EINVAL;
+        return -1;
+    }
+
+    state->syntax->memref(memref, sizeof(memref), size, label);
+    if (cg_incdec(state, op, imm)) {
+        fprintf(
+            state->out_fp,
+            "\t%s %s\n",
+            ((op == MU_ADD) == (imm == 1)) ? "inc" : "dec",
+            memref
+        );
+
+        return 0;
+    }
+
+    fprintf(
+        state->out_fp,
+        "\t%s %s, %zd\n",
+        binoptab[op],
+        memref,
+        imm
+    );
+
+    return 0;
+}
+
+int
+mu_cg_binopslot(struct bup_state *state, mu_binop_t op, msize_t size,
+    mu_reg_t dst, size_t slot)
+{
+    char memref[64];
+
+    if (state == NULL || dst < 0 || size >= MSIZE_MAX) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    /* Slots are little endian qwords, the low part is the value */
+    size = cg_opsize(size);
+    cg_slotref(state, memref, sizeof(memref), size, slot);
+    cg_binopmem(state, op, size, dst, memref);
+    return 0;
+}
+
+int
+mu_cg_ibinop(struct bup_state *state, mu_binop_t op, msize_t size,
+    mu_reg_t dst, ssize_t imm)
+{
+    mu_reg_t tmp = regfile.scratch[1];
+
+    if (state == NULL || dst < 0 || size >= MSIZE_MAX) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    /* Only sign extended 32-bit immediates can be encoded */
+    size = cg_opsize(size);
+    if (size == MSIZE_QWORD && (imm < INT32_MIN || imm > INT32_MAX)) {
+        mu_cg_ldimm(state, size, tmp, imm);
+        return mu_cg_binop(state, op, size, dst, tmp);
+    }
+
+    if (cg_incdec(state, op, imm)) {
+        fprintf(
+            state->out_fp,
+            "\t%s %s\n",
+            ((op == MU_ADD) == (imm == 1)) ? "inc" : "dec",
+            gpregsztab[size][dst]
+        );
+
+        return 0;
+    }
+
+    if (op == MU_MUL) {
+        fprintf(
+            state->out_fp,
+            "\timul %s, %s, %zd\n",
+            gpregsztab[size][dst],
+            gpregsztab[size][dst],
+            imm
+        );
+
+        return 0;
+    }
+
+    fprintf(
+        state->out_fp,
+        "\t%s %s, %zd\n",
+        binoptab[op],
+        gpregsztab[size][dst],
+        imm
+    );
+
+    return 0;
+}
+
+int
+mu_cg_retreg(struct bup_state *state, msize_t size, mu_reg_t reg)
+{
+    if (state == NULL || reg < 0 || size == MSIZE_BAD || size >= MSIZE_MAX) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if (reg != REG_RAX && size < MSIZE_DWORD && state->tune->movzx) {
+        fprintf(
+            state->out_fp,
+            "\tmovzx eax, %s\n",
+            gpregsztab[size][reg]
+        );
+    } else if (reg != REG_RAX) {
+        fprintf(
+            state->out_fp,
+            "\tmov %s, %s\n",
+            rettab[size],
+            gpregsztab[size][reg]
+        );
+    }
+
+    cg_leave(state);
+    fprintf(state->out_fp, "\tret\n");
+    return 0;
+}
+
+/*
+ * Test a register and emit a conditional jump
+ *
+ * @state: Compiler state
+ * @size:  Machine size
+ * @reg:   Register to test
+ * @jcc:   Jump mnemonic
+ * @label: Label to jump to
+ */
+static int
+cg_testjmp(struct bup_state *state, msize_t size, mu_reg_t reg,
+    const char *jcc, const char *label)
+{
+    const char *name;
+
+    if (state == NULL || label == NULL || reg < 0 || size >= MSIZE_MAX) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    name = gpregsztab[cg_opsize(size)][reg];
+    fprintf(
+        state->out_fp,
+        "\ttest %s, %s\n"
+        "\t%s %s\n",
+        name, name,
+        jcc, label
+    );
+
+    return 0;
+}
+
+int
+mu_cg_jz(struct bup_state *state, msize_t size, mu_reg_t reg,
+    const char *label)
+{
+    return cg_testjmp(state, size, reg, "jz", label);
+}
+
+int
+mu_cg_jnz(struct bup_state *state, msize_t size, mu_reg_t reg,
+    const char *label)
+{
+    return cg_testjmp(state, size, reg, "jnz", label);
+}
+
+int
+mu_cg_jcc(struct bup_state *state, mu_cond_t cond, const char *label)
+{
+    if (state == NULL || label == NULL || cond > MU_GE) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    fprintf(
+        state->out_fp,
+        "\tj%s %s\n",
+        cctab[cond],
+        label
+    );
+
+    return 0;
+}
+
+int
+mu_cg_setcc(struct bup_state *state, mu_cond_t cond, mu_reg_t reg)
+{
+    if (state == NULL || reg < 0 || cond > MU_GE) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    fprintf(
+        state->out_fp,
+        "\tset%s %s\n"
+        "\tmovzx %s, %s\n",
+        cctab[cond],
+        gpregsztab[MSIZE_BYTE][reg],
+        gpregsztab[MSIZE_DWORD][reg],
+        gpregsztab[MSIZE_BYTE][reg]
+    );
+
+    return 0;
+}
+
+int
+mu_cg_cmov(struct bup_state *state, mu_cond_t cond, mu_reg_t dst, mu_reg_t src)
+{
+    if (state == NULL || dst < 0 || src < 0 || cond > MU_GE) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    fprintf(
+        state->out_fp,
+        "\tcmov%s %s, %s\n",
+        cctab[cond],
+        gpregsztab[MSIZE_QWORD][dst],
+        gpregsztab[MSIZE_QWORD][src]
+    );
+
+    return 0;
+}
+
+/*
+ * Look up a general purpose register by name
+ *
+ * @name: Register name
+ * @id:   Register is written here
+ * @size: Size of register name is written here
+ *
+ * Returns true if the name is a register
+ */
+static bool
+cg_reg_lookup(const char *name, reg_id_t *id, msize_t *size)
+{
+    for (msize_t s = MSIZE_BYTE; s < MSIZE_MAX; ++s) {
+        for (int i = 0; i < REG_MAX; ++i) {
+            if (strcmp(gpregsztab[s][i], name) != 0)
+                continue;
+
+            *id = i;
+            *size = s;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Returns true if an instruction writes the arithmetic
+ * flags without reading them first
+ */
+static bool
+cg_sets_flags(const char *op)
+{
+    static const char *optab[] = {
+        "add", "sub", "and", "or", "xor",
+        "cmp", "test", "imul", "call"
+    };
+
+    for (size_t i = 0; i < sizeof(optab) / sizeof(optab[0]); ++i) {
+        if (strcmp(optab[i], op) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * jmp L / jcc L
+ * L:           ->  L:
+ */
+static bool
+peep_jmp_next(struct peep_ctx *ctx, struct peep_line **win)
+{
+    struct peep_line *jmp = win[0];
+
+    (void)ctx;
+    if (jmp->kind != PEEP_INSN || jmp->nargs != 1) {
+        return false;
+    }
+
+    /* Every j* instruction only jumps */
+    if (jmp->op[0] != 'j') {
+        return false;
+    }
+
+    for (size_t i = 1; win[i] != NULL && win[i]->kind == PEEP_LABEL; ++i) {
+        if (strcmp(win[i]->name, jmp->args[0]) == 0) {
+            jmp->dead = true;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * mov reg, 0   ->  xor reg32, reg32
+ *
+ * Unlike mov, xor writes the flags so they must be dead. Byte
+ * and word registers are only widened when they hold the
+ * return value, as nothing past the ret reads the upper bits.
+ */
+static bool
+peep_xor_zero(struct peep_ctx *ctx, struct peep_line **win)
+{
+    struct peep_line *mov = win[0], *line;
+    const char *name;
+    reg_id_t id;
+    msize_t size;
+
+    if (mov->kind != PEEP_INSN || mov->nargs != 2) {
+        return false;
+    }
+
+    if (strcmp(mov->op, "mov") != 0 || strcmp(mov->args[1], "0") != 0) {
+        return false;
+    }
+
+    if (!cg_reg_lookup(mov->args[0], &id, &size)) {
+        return false;
+    }
+
+    for (size_t i = 1; (line = win[i]) != NULL; ++i) {
+        if (line->kind != PEEP_INSN)
+            return false;
+
+        if (strcmp(line->op, "ret") == 0) {
+            if (size < MSIZE_DWORD && id != REG_RAX)
+                return false;
+            break;
+        }
+
+        /* The frame is torn down between us and the ret */
+        if (strcmp(line->op, "pop") == 0)
+            continue;
+        if (strcmp(line->op, "add") == 0 && strcmp(line->args[0], "rsp") == 0)
+            continue;
+        if (size < MSIZE_DWORD)
+            return false;
+
+        if (cg_sets_flags(line->op))
+            break;
+        if (strcmp(line->op, "mov") != 0 && strcmp(line->op, "push") != 0)
+            return false;
+    }
+
+    if (line == NULL) {
+        return false;
+    }
+
+    name = gpregsztab[MSIZE_DWORD][id];
+    return peep_set(ctx, mov, "\txor %s, %s", name, name) == 0;
+}
+
+/*
+ * Switching to the section we are already in
+ */
+static bool
+peep_dup_section(struct peep_ctx *ctx, struct peep_line **win)
+{
+    struct peep_line *line = win[0];
+
+    if (line->kind != PEEP_SECTION || line->name[0] == '\0') {
+        return false;
+    }
+
+    if (strcmp(line->name, ctx->section) != 0) {
+        return false;
+    }
+
+    line->dead = true;
+    return true;
+}
+
+/*
+ * Switching to a section with nothing placed in it, the
+ * stack note is empty on purpose
+ */
+static bool
+peep_empty_section(struct peep_ctx *ctx, struct peep_line **win)
+{
+    (void)ctx;
+    if (win[0]->kind != PEEP_SECTION || win[1] == NULL) {
+        return false;
+    }
+
+    if (strcmp(win[0]->name, ".note.GNU-stack") == 0) {
+        return false;
+    }
+
+    if (win[1]->kind != PEEP_SECTION || win[1]->name[0] == '\0') {
+        return false;
+    }
+
+    win[0]->dead = true;
+    return true;
+}
+
+/* Peephole rules, tried in order at each line */
+static const struct peep_rule peeptab[] = {
+    { "jmp-next",      4, peep_jmp_next },
+    { "xor-zero",      8, peep_xor_zero },
+    { "dup-section",   1, peep_dup_section },
+    { "empty-section", 2, peep_empty_section }
+};
+
+const struct peep_rule *
+mu_peep_rules(size_t *count)
+{
+    *count = sizeof(peeptab) / sizeof(peeptab[0]);
+    return peeptab;
+}
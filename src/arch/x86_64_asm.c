@@ -0,0 +1,2099 @@
+/*
+ * Copyright (C) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+/*
+ * In-process x86-64 assembler for the subset of NASM syntax
+ * emitted by the compiler (and common inline assembly). Every
+ * symbol reference is kept as a relocation so that the result
+ * can be placed anywhere by the JIT or the static linker.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include "bup/asm.h"
+#include "bup/trace.h"
+
+#define ASM_LINE_MAX 512
+#define ASM_OPERAND_MAX 3
+
+/* Register number meaning 'none' */
+#define REG_NONE -1
+
+/*
+ * Represents valid operand kinds
+ */
+typedef enum {
+    OPR_NONE,
+    OPR_REG,
+    OPR_IMM,
+    OPR_MEM,
+    OPR_SYM
+} opr_kind_t;
+
+/*
+ * Represents a parsed operand
+ *
+ * @kind:  Operand kind
+ * @size:  Operand size in bytes, zero if unknown
+ * @reg:   Register number (OPR_REG)
+ * @rex8:  Byte register requiring REX (spl, bpl, sil, dil)
+ * @high8: High byte register (ah, ch, dh, bh)
+ * @base:  Base register (OPR_MEM)
+ * @index: Index register (OPR_MEM)
+ * @scale: Index scale (OPR_MEM)
+ * @rip:   RIP-relative (OPR_MEM)
+ * @disp:  Displacement or immediate value
+ * @sym:   Referenced symbol index, ASM_UNDEF if none
+ */
+struct asm_operand {
+    opr_kind_t kind;
+    uint8_t size;
+    int8_t reg;
+    uint8_t rex8 : 1;
+    uint8_t high8 : 1;
+    int8_t base;
+    int8_t index;
+    uint8_t scale;
+    uint8_t rip : 1;
+    int64_t disp;
+    size_t sym;
+};
+
+/*
+ * Represents an instruction being encoded
+ *
+ * @rex:     REX bits (W, R, X, B)
+ * @need_rex: Force a REX prefix
+ * @no_rex:  REX prefix forbidden
+ * @opsize:  Operand size override prefix
+ * @rep:     REP prefix
+ * @op:      Opcode bytes
+ * @nop:     Number of opcode bytes
+ * @has_modrm: ModRM byte present
+ * @modrm:   ModRM byte
+ * @has_sib: SIB byte present
+ * @sib:     SIB byte
+ * @dispsz:  Displacement size
+ * @disp:    Displacement
+ * @disp_sym: Symbol for RIP-relative displacement
+ * @immsz:   Immediate size
+ * @imm:     Immediate
+ * @imm_sym: Symbol for immediate
+ * @imm_rel: Immediate is a PC-relative branch target
+ */
+struct asm_enc {
+    uint8_t rex;
+    uint8_t need_rex : 1;
+    uint8_t no_rex : 1;
+    uint8_t opsize : 1;
+    uint8_t rep : 1;
+    uint8_t op[3];
+    uint8_t nop;
+    uint8_t has_modrm : 1;
+    uint8_t modrm;
+    uint8_t has_sib : 1;
+    uint8_t sib;
+    uint8_t dispsz;
+    int64_t disp;
+    size_t disp_sym;
+    uint8_t immsz;
+    int64_t imm;
+    size_t imm_sym;
+    uint8_t imm_rel : 1;
+};
+
+/*
+ * Per-section assembler bookkeeping
+ *
+ * @term_end: Offset just past the last unconditional transfer
+ * @chunk:    Symbol owning the end of the section
+ */
+struct asm_sstate {
+    size_t term_end;
+    size_t chunk;
+};
+
+/*
+ * Assembler context
+ *
+ * @obj:    Object being built
+ * @sstate: Per-section state
+ * @cur:    Current section index
+ * @line:   Current line number
+ * @scope:  Last non-local label, used for NASM local labels
+ * @nopmax: Longest nop code is aligned with, see 'alignmode'
+ */
+struct asm_ctx {
+    struct asm_object *obj;
+    struct asm_sstate *sstate;
+    size_t cur;
+    size_t line;
+    char scope[128];
+    size_t nopmax;
+};
+
+/*
+ * Represents valid instruction encoding classes
+ */
+typedef enum {
+    ENC_FIXED,
+    ENC_ALU,
+    ENC_MOV,
+    ENC_TEST,
+    ENC_GRP3,
+    ENC_INCDEC,
+    ENC_SHIFT,
+    ENC_IMUL,
+    ENC_LEA,
+    ENC_MOVX,
+    ENC_JMP,
+    ENC_CALL,
+    ENC_PUSH,
+    ENC_POP,
+    ENC_JCC,
+    ENC_SETCC,
+    ENC_CMOVCC
+} enc_class_t;
+
+/*
+ * Represents an instruction description
+ *
+ * @mnemonic: Instruction mnemonic
+ * @enc:      Encoding class
+ * @arg:      Class specific argument (e.g., ModRM /digit)
+ * @bytes:    Opcode bytes for ENC_FIXED
+ * @nbytes:   Number of opcode bytes for ENC_FIXED
+ */
+struct asm_insn_desc {
+    const char *mnemonic;
+    enc_class_t enc;
+    uint8_t arg;
+    const char *bytes;
+    uint8_t nbytes;
+};
+
+static const struct asm_insn_desc insntab[] = {
+    { "add",     ENC_ALU, 0 },
+    { "or",      ENC_ALU, 1 },
+    { "adc",     ENC_ALU, 2 },
+    { "sbb",     ENC_ALU, 3 },
+    { "and",     ENC_ALU, 4 },
+    { "sub",     ENC_ALU, 5 },
+    { "xor",     ENC_ALU, 6 },
+    { "cmp",     ENC_ALU, 7 },
+    { "mov",     ENC_MOV, 0 },
+    { "test",    ENC_TEST, 0 },
+    { "not",     ENC_GRP3, 2 },
+    { "neg",     ENC_GRP3, 3 },
+    { "mul",     ENC_GRP3, 4 },
+    { "div",     ENC_GRP3, 6 },
+    { "idiv",    ENC_GRP3, 7 },
+    { "inc",     ENC_INCDEC, 0 },
+    { "dec",     ENC_INCDEC, 1 },
+    { "rol",     ENC_SHIFT, 0 },
+    { "ror",     ENC_SHIFT, 1 },
+    { "shl",     ENC_SHIFT, 4 },
+    { "sal",     ENC_SHIFT, 4 },
+    { "shr",     ENC_SHIFT, 5 },
+    { "sar",     ENC_SHIFT, 7 },
+    { "imul",    ENC_IMUL, 0 },
+    { "lea",     ENC_LEA, 0 },
+    { "movzx",   ENC_MOVX, 0xB6 },
+    { "movsx",   ENC_MOVX, 0xBE },
+    { "jmp",     ENC_JMP, 0 },
+    { "call",    ENC_CALL, 0 },
+    { "push",    ENC_PUSH, 0 },
+    { "pop",     ENC_POP, 0 },
+    { "nop",     ENC_FIXED, 0, "\x90", 1 },
+    { "ret",     ENC_FIXED, 0, "\xC3", 1 },
+    { "leave",   ENC_FIXED, 0, "\xC9", 1 },
+    { "cli",     ENC_FIXED, 0, "\xFA", 1 },
+    { "sti",     ENC_FIXED, 0, "\xFB", 1 },
+    { "hlt",     ENC_FIXED, 0, "\xF4", 1 },
+    { "cld",     ENC_FIXED, 0, "\xFC", 1 },
+    { "std",     ENC_FIXED, 0, "\xFD", 1 },
+    { "int3",    ENC_FIXED, 0, "\xCC", 1 },
+    { "pause",   ENC_FIXED, 0, "\xF3\x90", 2 },
+    { "cdq",     ENC_FIXED, 0, "\x99", 1 },
+    { "cqo",     ENC_FIXED, 0, "\x48\x99", 2 },
+    { "ud2",     ENC_FIXED, 0, "\x0F\x0B", 2 },
+    { "syscall", ENC_FIXED, 0, "\x0F\x05", 2 },
+    { "lodsb",   ENC_FIXED, 0, "\xAC", 1 },
+    { "stosb",   ENC_FIXED, 0, "\xAA", 1 },
+    { "movsb",   ENC_FIXED, 0, "\xA4", 1 },
+    { "lfence",  ENC_FIXED, 0, "\x0F\xAE\xE8", 3 },
+    { "mfence",  ENC_FIXED, 0, "\x0F\xAE\xF0", 3 },
+    { "sfence",  ENC_FIXED, 0, "\x0F\xAE\xF8", 3 },
+    { NULL,      ENC_FIXED, 0 }
+};
+
+/* Condition code suffixes */
+static const struct {
+    const char *suffix;
+    uint8_t cc;
+} cctab[] = {
+    { "o", 0x0 },  { "no", 0x1 },
+    { "b", 0x2 },  { "c", 0x2 },   { "nae", 0x2 },
+    { "ae", 0x3 }, { "nb", 0x3 },  { "nc", 0x3 },
+    { "e", 0x4 },  { "z", 0x4 },
+    { "ne", 0x5 }, { "nz", 0x5 },
+    { "be", 0x6 }, { "na", 0x6 },
+    { "a", 0x7 },  { "nbe", 0x7 },
+    { "s", 0x8 },  { "ns", 0x9 },
+    { "p", 0xA },  { "pe", 0xA },
+    { "np", 0xB }, { "po", 0xB },
+    { "l", 0xC },  { "nge", 0xC },
+    { "ge", 0xD }, { "nl", 0xD },
+    { "le", 0xE }, { "ng", 0xE },
+    { "g", 0xF },  { "nle", 0xF },
+    { NULL, 0 }
+};
+
+/* Register lookup table */
+static const struct {
+    const char *name;
+    int8_t num;
+    uint8_t size;
+    uint8_t rex8 : 1;
+    uint8_t high8 : 1;
+} regtab[] = {
+    { "rax", 0, 8 },  { "rcx", 1, 8 },  { "rdx", 2, 8 },  { "rbx", 3, 8 },
+    { "rsp", 4, 8 },  { "rbp", 5, 8 },  { "rsi", 6, 8 },  { "rdi", 7, 8 },
+    { "r8", 8, 8 },   { "r9", 9, 8 },   { "r10", 10, 8 }, { "r11", 11, 8 },
+    { "r12", 12, 8 }, { "r13", 13, 8 }, { "r14", 14, 8 }, { "r15", 15, 8 },
+    { "eax", 0, 4 },  { "ecx", 1, 4 },  { "edx", 2, 4 },  { "ebx", 3, 4 },
+    { "esp", 4, 4 },  { "ebp", 5, 4 },  { "esi", 6, 4 },  { "edi", 7, 4 },
+    { "r8d", 8, 4 },  { "r9d", 9, 4 },  { "r10d", 10, 4 }, { "r11d", 11, 4 },
+    { "r12d", 12, 4 }, { "r13d", 13, 4 }, { "r14d", 14, 4 }, { "r15d", 15, 4 },
+    { "ax", 0, 2 },   { "cx", 1, 2 },   { "dx", 2, 2 },   { "bx", 3, 2 },
+    { "sp", 4, 2 },   { "bp", 5, 2 },   { "si", 6, 2 },   { "di", 7, 2 },
+    { "r8w", 8, 2 },  { "r9w", 9, 2 },  { "r10w", 10, 2 }, { "r11w", 11, 2 },
+    { "r12w", 12, 2 }, { "r13w", 13, 2 }, { "r14w", 14, 2 }, { "r15w", 15, 2 },
+    { "al", 0, 1 },   { "cl", 1, 1 },   { "dl", 2, 1 },   { "bl", 3, 1 },
+    { "spl", 4, 1, 1 }, { "bpl", 5, 1, 1 }, { "sil", 6, 1, 1 }, { "dil", 7, 1, 1 },
+    { "ah", 4, 1, 0, 1 }, { "ch", 5, 1, 0, 1 }, { "dh", 6, 1, 0, 1 }, { "bh", 7, 1, 0, 1 },
+    { "r8b", 8, 1 },  { "r9b", 9, 1 },  { "r10b", 10, 1 }, { "r11b", 11, 1 },
+    { "r12b", 12, 1 }, { "r13b", 13, 1 }, { "r14b", 14, 1 }, { "r15b", 15, 1 },
+    { NULL, 0, 0 }
+};
+
+/* Longest nop in 'noptab' */
+#define ASM_NOP_MAX 9
+
+/* Recommended multi-byte nop sequences */
+static const char *noptab[] = {
+    [1] = "\x90",
+    [2] = "\x66\x90",
+    [3] = "\x0F\x1F\x00",
+    [4] = "\x0F\x1F\x40\x00",
+    [5] = "\x0F\x1F\x44\x00\x00",
+    [6] = "\x66\x0F\x1F\x44\x00\x00",
+    [7] = "\x0F\x1F\x80\x00\x00\x00\x00",
+    [8] = "\x0F\x1F\x84\x00\x00\x00\x00\x00",
+    [9] = "\x66\x0F\x1F\x84\x00\x00\x00\x00\x00"
+};
+
+static int
+asm_error(struct asm_ctx *ctx, const char *fmt, ...)
+{
+    char buf[256];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+
+    trace_emit(TRACE_ERROR, ctx->line, "asm: %s\n", buf);
+    return -1;
+}
+
+static inline bool
+fits_i8(int64_t v)
+{
+    return v >= -128 && v <= 127;
+}
+
+static inline bool
+fits_i32(int64_t v)
+{
+    return v >= INT32_MIN && v <= INT32_MAX;
+}
+
+/*
+ * Returns true if a string is a case-insensitive match
+ */
+static inline bool
+streq(const char *a, const char *b)
+{
+    return strcasecmp(a, b) == 0;
+}
+
+/*
+ * Strip leading and trailing whitespace in place
+ */
+static char *
+strip(char *s)
+{
+    char *end;
+
+    while (isspace((unsigned char)*s)) {
+        ++s;
+    }
+
+    end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1])) {
+        *--end = '\0';
+    }
+
+    return s;
+}
+
+/*
+ * Returns true if the name begins a new chunk
+ */
+static inline bool
+asm_is_chunk(const char *name)
+{
+    return strchr(name, '.') == NULL;
+}
+
+/*
+ * Select a section by name, creating it if needed
+ *
+ * @ctx:  Assembler context
+ * @name: Section name
+ */
+static int
+asm_section_select(struct asm_ctx *ctx, const char *name)
+{
+    struct asm_object *obj = ctx->obj;
+    struct asm_section *sect;
+    size_t n;
+
+    for (size_t i = 0; i < obj->nsections; ++i) {
+        if (strcmp(obj->sections[i].name, name) == 0) {
+            ctx->cur = i;
+            return 0;
+        }
+    }
+
+    n = obj->nsections + 1;
+    obj->sections = realloc(obj->sections, n * sizeof(*obj->sections));
+    ctx->sstate = realloc(ctx->sstate, n * sizeof(*ctx->sstate));
+    if (obj->sections == NULL || ctx->sstate == NULL) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    sect = &obj->sections[obj->nsections];
+    memset(sect, 0, sizeof(*sect));
+    sect->name = strdup(name);
+    sect->align = 16;
+
+    if (strncmp(name, ".bss", 4) == 0) {
+        sect->nobits = 1;
+        sect->write = 1;
+    } else if (strncmp(name, ".text", 5) == 0 || strstr(name, ".text") != NULL) {
+        sect->exec = 1;
+    } else if (strncmp(name, ".rodata", 7) != 0) {
+        sect->write = 1;
+    }
+
+    ctx->sstate[obj->nsections].term_end = 0;
+    ctx->sstate[obj->nsections].chunk = ASM_UNDEF;
+    ctx->cur = obj->nsections++;
+    return 0;
+}
+
+/*
+ * Emit raw bytes into the current section
+ */
+static int
+asm_emit(struct asm_ctx *ctx, const void *buf, size_t n)
+{
+    struct asm_section *sect = &ctx->obj->sections[ctx->cur];
+
+    if (sect->nobits) {
+        return asm_error(ctx, "data in nobits section %s", sect->name);
+    }
+
+    if (sect->size + n > sect->cap) {
+        sect->cap = (sect->cap == 0) ? 256 : sect->cap;
+        while (sect->size + n > sect->cap)
+            sect->cap *= 2;
+
+        sect->data = realloc(sect->data, sect->cap);
+        if (sect->data == NULL) {
+            errno = -ENOMEM;
+            return -1;
+        }
+    }
+
+    if (buf == NULL) {
+        memset(&sect->data[sect->size], 0, n);
+    } else {
+        memcpy(&sect->data[sect->size], buf, n);
+    }
+
+    sect->size += n;
+    return 0;
+}
+
+/*
+ * Emit a little-endian integer of a given size
+ */
+static int
+asm_emit_int(struct asm_ctx *ctx, int64_t v, uint8_t size)
+{
+    uint8_t buf[8];
+
+    for (uint8_t i = 0; i < size; ++i) {
+        buf[i] = (v >> (i * 8)) & 0xFF;
+    }
+
+    return asm_emit(ctx, buf, size);
+}
+
+/*
+ * Reserve zeroed space in the current section
+ */
+static int
+asm_reserve(struct asm_ctx *ctx, size_t n)
+{
+    struct asm_section *sect = &ctx->obj->sections[ctx->cur];
+
+    if (sect->nobits) {
+        sect->size += n;
+        return 0;
+    }
+
+    return asm_emit(ctx, NULL, n);
+}
+
+/*
+ * Pad the current section to an alignment, code is padded
+ * with nops no longer than 'nopmax' bytes
+ */
+static int
+asm_align(struct asm_ctx *ctx, size_t align, size_t nopmax)
+{
+    struct asm_section *sect = &ctx->obj->sections[ctx->cur];
+    size_t pad, n;
+
+    if (align == 0 || (align & (align - 1)) != 0) {
+        return asm_error(ctx, "bad alignment %zu", align);
+    }
+
+    if (align > sect->align) {
+        sect->align = align;
+    }
+
+    pad = (align - (sect->size & (align - 1))) & (align - 1);
+    if (!sect->exec) {
+        return asm_reserve(ctx, pad);
+    }
+
+    while (pad > 0) {
+        n = (pad > nopmax) ? nopmax : pad;
+        if (asm_emit(ctx, noptab[n], n) < 0)
+            return -1;
+
+        pad -= n;
+    }
+
+    return 0;
+}
+
+/*
+ * Get a symbol index by name, creating an undefined
+ * symbol if it does not exist yet.
+ */
+static size_t
+asm_symbol_get(struct asm_ctx *ctx, const char *name)
+{
+    struct asm_object *obj = ctx->obj;
+    struct asm_symbol *sym;
+    size_t idx;
+
+    if ((idx = asm_symbol_lookup(obj, name)) != ASM_UNDEF) {
+        return idx;
+    }
+
+    obj->symbols = realloc(obj->symbols, (obj->nsymbols + 1) * sizeof(*sym));
+    if (obj->symbols == NULL) {
+        errno = -ENOMEM;
+        return ASM_UNDEF;
+    }
+
+    sym = &obj->symbols[obj->nsymbols];
+    memset(sym, 0, sizeof(*sym));
+    sym->name = strdup(name);
+    sym->section = ASM_UNDEF;
+    return obj->nsymbols++;
+}
+
+/*
+ * Expand a NASM local label ('.name') using the
+ * current scope.
+ */
+static void
+asm_expand_name(struct asm_ctx *ctx, const char *name, char *buf, size_t len)
+{
+    if (*name == '.' && ctx->scope[0] != '\0') {
+        snprintf(buf, len, "%s%s", ctx->scope, name);
+        return;
+    }
+
+    snprintf(buf, len, "%s", name);
+}
+
+/*
+ * Define a label at the current position
+ */
+static int
+asm_define(struct asm_ctx *ctx, const char *name)
+{
+    struct asm_sstate *ss = &ctx->sstate[ctx->cur];
+    struct asm_section *sect = &ctx->obj->sections[ctx->cur];
+    struct asm_symbol *sym;
+    char buf[256];
+    size_t idx;
+
+    asm_expand_name(ctx, name, buf, sizeof(buf));
+    if ((idx = asm_symbol_get(ctx, buf)) == ASM_UNDEF) {
+        return -1;
+    }
+
+    sym = &ctx->obj->symbols[idx];
+    if (sym->section != ASM_UNDEF) {
+        return asm_error(ctx, "symbol %s redefined", buf);
+    }
+
+    sym->section = ctx->cur;
+    sym->off = sect->size;
+
+    if (*name != '.') {
+        snprintf(ctx->scope, sizeof(ctx->scope), "%s", name);
+    }
+
+    if (!asm_is_chunk(buf)) {
+        return 0;
+    }
+
+    /* Close the previous chunk in this section */
+    if (ss->chunk != ASM_UNDEF) {
+        ctx->obj->symbols[ss->chunk].fallthrough =
+            !(ss->term_end == sect->size &&
+              ss->term_end > ctx->obj->symbols[ss->chunk].off);
+    }
+
+    ss->chunk = idx;
+    return 0;
+}
+
+/*
+ * Add a relocation at an offset in the current section
+ */
+static int
+asm_reloc_add(struct asm_ctx *ctx, asm_reloc_t type, size_t off,
+    size_t sym, int64_t addend)
+{
+    struct asm_object *obj = ctx->obj;
+    struct asm_reloc *reloc;
+
+    obj->relocs = realloc(obj->relocs, (obj->nrelocs + 1) * sizeof(*reloc));
+    if (obj->relocs == NULL) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    reloc = &obj->relocs[obj->nrelocs++];
+    reloc->type = type;
+    reloc->section = ctx->cur;
+    reloc->off = off;
+    reloc->symbol = sym;
+    reloc->addend = addend;
+    return 0;
+}
+
+/*
+ * Parse a numeric literal
+ *
+ * @s:   String to parse
+ * @res: Result is written here
+ *
+ * Returns zero on success
+ */
+static int
+asm_parse_number(const char *s, int64_t *res)
+{
+    char *end;
+    bool neg = false;
+    size_t len;
+
+    if (*s == '-') {
+        neg = true;
+        ++s;
+    } else if (*s == '+') {
+        ++s;
+    }
+
+    len = strlen(s);
+    if (len == 3 && (s[0] == '\'' || s[0] == '`') && s[2] == s[0]) {
+        *res = neg ? -s[1] : s[1];
+        return 0;
+    }
+
+    if (!isdigit((unsigned char)*s)) {
+        return -1;
+    }
+
+    if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+        *res = strtoull(s + 2, &end, 16);
+    } else if (len > 1 && (s[len - 1] == 'h' || s[len - 1] == 'H')) {
+        *res = strtoull(s, &end, 16);
+        ++end;
+    } else {
+        *res = strtoull(s, &end, 10);
+    }
+
+    if (*end != '\0') {
+        return -1;
+    }
+
+    if (neg) {
+        *res = -*res;
+    }
+
+    return 0;
+}
+
+/*
+ * Returns true if a string is a valid identifier
+ */
+static bool
+asm_is_ident(const char *s)
+{
+    if (!isalpha((unsigned char)*s) && *s != '_' && *s != '.') {
+        return false;
+    }
+
+    while (*++s != '\0') {
+        if (!isalnum((unsigned char)*s) && *s != '_' && *s != '.')
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Look up a register by name
+ */
+static int
+asm_parse_reg(const char *s, struct asm_operand *res)
+{
+    for (size_t i = 0; regtab[i].name != NULL; ++i) {
+        if (!streq(regtab[i].name, s)) {
+            continue;
+        }
+
+        res->kind = OPR_REG;
+        res->reg = regtab[i].num;
+        res->size = regtab[i].size;
+        res->rex8 = regtab[i].rex8;
+        res->high8 = regtab[i].high8;
+        return 0;
+    }
+
+    return -1;
+}
+
+/*
+ * Parse the inside of a memory operand
+ */
+static int
+asm_parse_mem(struct asm_ctx *ctx, char *s, struct asm_operand *res)
+{
+    struct asm_operand reg;
+    char *p, *term, *star;
+    char buf[256];
+    int64_t v;
+    int sign = 1, next;
+
+    res->kind = OPR_MEM;
+    res->base = REG_NONE;
+    res->index = REG_NONE;
+    res->scale = 1;
+    res->disp = 0;
+    res->sym = ASM_UNDEF;
+
+    s = strip(s);
+    if (strncasecmp(s, "rel ", 4) == 0) {
+        res->rip = 1;
+        s = strip(s + 4);
+    } else if (strncasecmp(s, "abs ", 4) == 0) {
+        s = strip(s + 4);
+    }
+
+    p = s;
+    while (*p != '\0') {
+        next = 0;
+        term = p;
+        while (*p != '\0' && *p != '+' && *p != '-') {
+            ++p;
+        }
+
+        if (*p != '\0') {
+            next = (*p == '-') ? -1 : 1;
+            *p++ = '\0';
+        }
+
+        term = strip(term);
+        if (*term == '\0') {
+            sign = (next != 0) ? sign * next : sign;
+            continue;
+        }
+
+        memset(&reg, 0, sizeof(reg));
+        if ((star = strchr(term, '*')) != NULL) {
+            *star++ = '\0';
+            if (asm_parse_reg(strip(term), &reg) == 0 &&
+                asm_parse_number(strip(star), &v) == 0) {
+                res->index = reg.reg;
+                res->scale = v;
+            } else if (asm_parse_reg(strip(star), &reg) == 0 &&
+                asm_parse_number(strip(term), &v) == 0) {
+                res->index = reg.reg;
+                res->scale = v;
+            } else {
+                return asm_error(ctx, "bad memory operand");
+            }
+        } else if (asm_parse_reg(term, &reg) == 0) {
+            if (sign < 0) {
+                return asm_error(ctx, "cannot subtract register");
+            }
+
+            if (res->base == REG_NONE) {
+                res->base = reg.reg;
+            } else if (res->index == REG_NONE) {
+                res->index = reg.reg;
+            } else {
+                return asm_error(ctx, "too many registers");
+            }
+        } else if (asm_parse_number(term, &v) == 0) {
+            res->disp += sign * v;
+        } else if (asm_is_ident(term) && res->sym == ASM_UNDEF) {
+            asm_expand_name(ctx, term, buf, sizeof(buf));
+            res->sym = asm_symbol_get(ctx, buf);
+        } else {
+            return asm_error(ctx, "bad memory operand term '%s'", term);
+        }
+
+        sign = (next != 0) ? next : 1;
+    }
+
+    switch (res->scale) {
+    case 1:
+    case 2:
+    case 4:
+    case 8:
+        break;
+    default:
+        return asm_error(ctx, "bad index scale %u", res->scale);
+    }
+
+    /* Symbols without registers are addressed relative to RIP */
+    if (res->sym != ASM_UNDEF) {
+        if (res->base != REG_NONE || res->index != REG_NONE) {
+            return asm_error(ctx, "symbol with register in memory operand");
+        }
+
+        res->rip = 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Parse a single instruction operand
+ */
+static int
+asm_parse_operand(struct asm_ctx *ctx, char *s, struct asm_operand *res)
+{
+    static const struct {
+        const char *name;
+        uint8_t size;
+    } sizetab[] = {
+        { "byte", 1 }, { "word", 2 },
+        { "dword", 4 }, { "qword", 8 },
+        { NULL, 0 }
+    };
+    char buf[256], *end;
+    uint8_t size = 0;
+    size_t len;
+
+    memset(res, 0, sizeof(*res));
+    res->sym = ASM_UNDEF;
+    s = strip(s);
+
+    for (size_t i = 0; sizetab[i].name != NULL; ++i) {
+        len = strlen(sizetab[i].name);
+        if (strncasecmp(s, sizetab[i].name, len) == 0 &&
+            (isspace((unsigned char)s[len]) || s[len] == '[')) {
+            size = sizetab[i].size;
+            s = strip(s + len);
+            if (strncasecmp(s, "ptr", 3) == 0 && !isalnum((unsigned char)s[3]))
+                s = strip(s + 3);
+            break;
+        }
+    }
+
+    if (*s == '[') {
+        if ((end = strrchr(s, ']')) == NULL) {
+            return asm_error(ctx, "missing ']'");
+        }
+
+        *end = '\0';
+        if (asm_parse_mem(ctx, s + 1, res) < 0) {
+            return -1;
+        }
+
+        res->size = size;
+        return 0;
+    }
+
+    if (asm_parse_reg(s, res) == 0) {
+        return 0;
+    }
+
+    if (asm_parse_number(s, &res->disp) == 0) {
+        res->kind = OPR_IMM;
+        res->size = size;
+        return 0;
+    }
+
+    if (asm_is_ident(s)) {
+        asm_expand_name(ctx, s, buf, sizeof(buf));
+        res->kind = OPR_SYM;
+        res->size = size;
+        res->sym = asm_symbol_get(ctx, buf);
+        return 0;
+    }
+
+    return asm_error(ctx, "bad operand '%s'", s);
+}
+
+/*
+ * Set the operand size of an instruction
+ */
+static int
+enc_size(struct asm_ctx *ctx, struct asm_enc *e, uint8_t size)
+{
+    switch (size) {
+    case 1:
+    case 4:
+        return 0;
+    case 2:
+        e->opsize = 1;
+        return 0;
+    case 8:
+        e->rex |= 0x8;
+        return 0;
+    default:
+        return asm_error(ctx, "operation size not specified");
+    }
+}
+
+/*
+ * Account for REX requirements of a register operand
+ */
+static void
+enc_reg_flags(struct asm_enc *e, struct asm_operand *op)
+{
+    if (op->kind != OPR_REG) {
+        return;
+    }
+
+    if (op->rex8) {
+        e->need_rex = 1;
+    }
+
+    if (op->high8) {
+        e->no_rex = 1;
+    }
+}
+
+/*
+ * Encode a ModRM (and SIB) for a register field and
+ * a register or memory operand.
+ */
+static int
+enc_modrm(struct asm_ctx *ctx, struct asm_enc *e, uint8_t regfield,
+    struct asm_operand *rm)
+{
+    uint8_t mod, base, index;
+
+    e->has_modrm = 1;
+    e->disp_sym = ASM_UNDEF;
+    if (regfield & 8) {
+        e->rex |= 0x4;
+    }
+
+    if (rm->kind == OPR_REG) {
+        enc_reg_flags(e, rm);
+        if (rm->reg & 8)
+            e->rex |= 0x1;
+
+        e->modrm = 0xC0 | ((regfield & 7) << 3) | (rm->reg & 7);
+        return 0;
+    }
+
+    if (rm->kind != OPR_MEM) {
+        return asm_error(ctx, "expected register or memory operand");
+    }
+
+    if (rm->rip) {
+        e->modrm = ((regfield & 7) << 3) | 0x5;
+        e->dispsz = 4;
+        e->disp = rm->disp;
+        e->disp_sym = rm->sym;
+        return 0;
+    }
+
+    if (!fits_i32(rm->disp)) {
+        return asm_error(ctx, "displacement out of range");
+    }
+
+    /* Absolute address */
+    if (rm->base == REG_NONE && rm->index == REG_NONE) {
+        e->modrm = ((regfield & 7) << 3) | 0x4;
+        e->has_sib = 1;
+        e->sib = 0x25;
+        e->dispsz = 4;
+        e->disp = rm->disp;
+        return 0;
+    }
+
+    if (rm->index == 4) {
+        return asm_error(ctx, "rsp cannot be an index");
+    }
+
+    if (rm->base == REG_NONE) {
+        index = rm->index;
+        if (index & 8)
+            e->rex |= 0x2;
+
+        e->modrm = ((regfield & 7) << 3) | 0x4;
+        e->has_sib = 1;
+        e->sib = ((__builtin_ctz(rm->scale)) << 6) | ((index & 7) << 3) | 0x5;
+        e->dispsz = 4;
+        e->disp = rm->disp;
+        return 0;
+    }
+
+    base = rm->base;
+    if (base & 8) {
+        e->rex |= 0x1;
+    }
+
+    if (rm->disp == 0 && (base & 7) != 5) {
+        mod = 0;
+    } else if (fits_i8(rm->disp)) {
+        mod = 1;
+    } else {
+        mod = 2;
+    }
+
+    e->dispsz = (mod == 1) ? 1 : (mod == 2) ? 4 : 0;
+    e->disp = rm->disp;
+
+    if (rm->index == REG_NONE && (base & 7) != 4) {
+        e->modrm = (mod << 6) | ((regfield & 7) << 3) | (base & 7);
+        return 0;
+    }
+
+    index = (rm->index == REG_NONE) ? 4 : rm->index;
+    if (index & 8) {
+        e->rex |= 0x2;
+    }
+
+    e->modrm = (mod << 6) | ((regfield & 7) << 3) | 0x4;
+    e->has_sib = 1;
+    e->sib = (__builtin_ctz(rm->scale) << 6) | ((index & 7) << 3) | (base & 7);
+    return 0;
+}
+
+/*
+ * Write out an encoded instruction
+ */
+static int
+enc_flush(struct asm_ctx *ctx, struct asm_enc *e)
+{
+    struct asm_section *sect = &ctx->obj->sections[ctx->cur];
+    uint8_t rex;
+    size_t off;
+
+    if ((e->rex != 0 || e->need_rex) && e->no_rex) {
+        return asm_error(ctx, "high byte register used with REX prefix");
+    }
+
+    if (e->rep && asm_emit_int(ctx, 0xF3, 1) < 0) {
+        return -1;
+    }
+
+    if (e->opsize && asm_emit_int(ctx, 0x66, 1) < 0) {
+        return -1;
+    }
+
+    if (e->rex != 0 || e->need_rex) {
+        rex = 0x40 | e->rex;
+        if (asm_emit(ctx, &rex, 1) < 0)
+            return -1;
+    }
+
+    if (asm_emit(ctx, e->op, e->nop) < 0) {
+        return -1;
+    }
+
+    if (e->has_modrm && asm_emit(ctx, &e->modrm, 1) < 0) {
+        return -1;
+    }
+
+    if (e->has_sib && asm_emit(ctx, &e->sib, 1) < 0) {
+        return -1;
+    }
+
+    if (e->dispsz > 0) {
+        off = sect->size;
+        if (e->disp_sym != ASM_UNDEF) {
+            if (asm_reloc_add(ctx, ASM_RELOC_REL32, off, e->disp_sym,
+                e->disp - 4 - e->immsz) < 0)
+                return -1;
+
+            e->disp = 0;
+        }
+
+        if (asm_emit_int(ctx, e->disp, e->dispsz) < 0)
+            return -1;
+    }
+
+    if (e->immsz > 0) {
+        off = ctx->obj->sections[ctx->cur].size;
+        if (e->imm_rel) {
+            if (asm_reloc_add(ctx, ASM_RELOC_REL32, off, e->imm_sym, e->imm - 4) < 0)
+                return -1;
+
+            e->imm = 0;
+        } else if (e->imm_sym != ASM_UNDEF) {
+            if (asm_reloc_add(ctx, (e->immsz == 8) ? ASM_RELOC_ABS64 : ASM_RELOC_ABS32,
+                off, e->imm_sym, e->imm) < 0)
+                return -1;
+
+            e->imm = 0;
+        }
+
+        if (asm_emit_int(ctx, e->imm, e->immsz) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Figure out the operation size of a two operand instruction
+ */
+static uint8_t
+enc_opsize(struct asm_operand *a, struct asm_operand *b)
+{
+    if (a->kind == OPR_REG) {
+        return a->size;
+    }
+
+    if (b != NULL && b->kind == OPR_REG) {
+        return b->size;
+    }
+
+    return a->size;
+}
+
+/*
+ * Set an immediate of the given operation size
+ */
+static int
+enc_imm(struct asm_ctx *ctx, struct asm_enc *e, struct asm_operand *op,
+    uint8_t size)
+{
+    e->immsz = (size == 8) ? 4 : size;
+    e->imm = op->disp;
+    e->imm_sym = op->sym;
+
+    if (op->kind == OPR_SYM && size != 4 && size != 8) {
+        return asm_error(ctx, "symbol immediate too small");
+    }
+
+    if (size == 8 && op->kind == OPR_IMM && !fits_i32(op->disp)) {
+        return asm_error(ctx, "immediate out of range");
+    }
+
+    return 0;
+}
+
+static int
+enc_alu(struct asm_ctx *ctx, struct asm_enc *e, uint8_t digit,
+    struct asm_operand *ops, size_t nops)
+{
+    struct asm_operand *dst = &ops[0], *src = &ops[1];
+    uint8_t size;
+
+    if (nops != 2) {
+        return asm_error(ctx, "expected two operands");
+    }
+
+    size = enc_opsize(dst, src);
+    if (enc_size(ctx, e, size) < 0) {
+        return -1;
+    }
+
+    e->nop = 1;
+    if (src->kind == OPR_IMM || src->kind == OPR_SYM) {
+        if (size == 1) {
+            e->op[0] = 0x80;
+            e->immsz = 1;
+            e->imm = src->disp;
+        } else if (src->kind == OPR_IMM && fits_i8(src->disp)) {
+            e->op[0] = 0x83;
+            e->immsz = 1;
+            e->imm = src->disp;
+        } else {
+            e->op[0] = 0x81;
+            if (enc_imm(ctx, e, src, size) < 0)
+                return -1;
+        }
+
+        return enc_modrm(ctx, e, digit, dst);
+    }
+
+    if (src->kind == OPR_REG) {
+        enc_reg_flags(e, src);
+        e->op[0] = (digit << 3) | ((size == 1) ? 0x00 : 0x01);
+        return enc_modrm(ctx, e, src->reg, dst);
+    }
+
+    if (dst->kind == OPR_REG && src->kind == OPR_MEM) {
+        enc_reg_flags(e, dst);
+        e->op[0] = (digit << 3) | ((size == 1) ? 0x02 : 0x03);
+        return enc_modrm(ctx, e, dst->reg, src);
+    }
+
+    return asm_error(ctx, "invalid operand combination");
+}
+
+static int
+enc_mov(struct asm_ctx *ctx, struct asm_enc *e, struct asm_operand *ops,
+    size_t nops)
+{
+    struct asm_operand *dst = &ops[0], *src = &ops[1];
+    uint8_t size;
+
+    if (nops != 2) {
+        return asm_error(ctx, "expected two operands");
+    }
+
+    size = enc_opsize(dst, src);
+    if (enc_size(ctx, e, size) < 0) {
+        return -1;
+    }
+
+    e->nop = 1;
+    if (dst->kind == OPR_REG && (src->kind == OPR_IMM || src->kind == OPR_SYM)) {
+        enc_reg_flags(e, dst);
+        if (dst->reg & 8)
+            e->rex |= 0x1;
+
+        e->imm = src->disp;
+        e->imm_sym = src->sym;
+        switch (size) {
+        case 1:
+            e->op[0] = 0xB0 + (dst->reg & 7);
+            e->immsz = 1;
+            return 0;
+        case 2:
+            e->op[0] = 0xB8 + (dst->reg & 7);
+            e->immsz = 2;
+            return (src->kind == OPR_SYM)
+                ? asm_error(ctx, "symbol immediate too small")
+                : 0;
+        case 4:
+            e->op[0] = 0xB8 + (dst->reg & 7);
+            e->immsz = 4;
+            return 0;
+        }
+
+        /* 64-bit: pick the shortest encoding */
+        if (src->kind == OPR_SYM || !fits_i32(src->disp)) {
+            if (src->kind == OPR_IMM && (uint64_t)src->disp <= UINT32_MAX) {
+                e->rex &= ~0x8;
+                e->op[0] = 0xB8 + (dst->reg & 7);
+                e->immsz = 4;
+                return 0;
+            }
+
+            e->op[0] = 0xB8 + (dst->reg & 7);
+            e->immsz = 8;
+            return 0;
+        }
+
+        e->rex &= ~0x1;
+        e->op[0] = 0xC7;
+        e->immsz = 4;
+        return enc_modrm(ctx, e, 0, dst);
+    }
+
+    if (dst->kind == OPR_MEM && (src->kind == OPR_IMM || src->kind == OPR_SYM)) {
+        e->op[0] = (size == 1) ? 0xC6 : 0xC7;
+        if (enc_imm(ctx, e, src, size) < 0)
+            return -1;
+
+        return enc_modrm(ctx, e, 0, dst);
+    }
+
+    if (src->kind == OPR_REG) {
+        enc_reg_flags(e, src);
+        e->op[0] = (size == 1) ? 0x88 : 0x89;
+        return enc_modrm(ctx, e, src->reg, dst);
+    }
+
+    if (dst->kind == OPR_REG && src->kind == OPR_MEM) {
+        enc_reg_flags(e, dst);
+        e->op[0] = (size == 1) ? 0x8A : 0x8B;
+        return enc_modrm(ctx, e, dst->reg, src);
+    }
+
+    return asm_error(ctx, "invalid operand combination");
+}
+
+static int
+enc_test(struct asm_ctx *ctx, struct asm_enc *e, struct asm_operand *ops,
+    size_t nops)
+{
+    struct asm_operand *dst = &ops[0], *src = &ops[1];
+    uint8_t size;
+
+    if (nops != 2) {
+        return asm_error(ctx, "expected two operands");
+    }
+
+    size = enc_opsize(dst, src);
+    if (enc_size(ctx, e, size) < 0) {
+        return -1;
+    }
+
+    e->nop = 1;
+    if (src->kind == OPR_IMM) {
+        e->op[0] = (size == 1) ? 0xF6 : 0xF7;
+        if (enc_imm(ctx, e, src, size) < 0)
+            return -1;
+
+        return enc_modrm(ctx, e, 0, dst);
+    }
+
+    if (src->kind != OPR_REG) {
+        return asm_error(ctx, "invalid operand combination");
+    }
+
+    enc_reg_flags(e, src);
+    e->op[0] = (size == 1) ? 0x84 : 0x85;
+    return enc_modrm(ctx, e, src->reg, dst);
+}
+
+static int
+enc_unary(struct asm_ctx *ctx, struct asm_enc *e, uint8_t opc, uint8_t digit,
+    struct asm_operand *ops, size_t nops)
+{
+    uint8_t size;
+
+    if (nops != 1) {
+        return asm_error(ctx, "expected one operand");
+    }
+
+    size = ops[0].size;
+    if (enc_size(ctx, e, size) < 0) {
+        return -1;
+    }
+
+    e->nop = 1;
+    e->op[0] = (size == 1) ? opc : opc + 1;
+    return enc_modrm(ctx, e, digit, &ops[0]);
+}
+
+static int
+enc_shift(struct asm_ctx *ctx, struct asm_enc *e, uint8_t digit,
+    struct asm_operand *ops, size_t nops)
+{
+    struct asm_operand *dst = &ops[0], *src = &ops[1];
+    uint8_t size;
+
+    if (nops != 2) {
+        return asm_error(ctx, "expected two operands");
+    }
+
+    size = dst->size;
+    if (enc_size(ctx, e, size) < 0) {
+        return -1;
+    }
+
+    e->nop = 1;
+    if (src->kind == OPR_REG && src->reg == 1 && src->size == 1) {
+        e->op[0] = (size == 1) ? 0xD2 : 0xD3;
+    } else if (src->kind == OPR_IMM && src->disp == 1) {
+        e->op[0] = (size == 1) ? 0xD0 : 0xD1;
+    } else if (src->kind == OPR_IMM) {
+        e->op[0] = (size == 1) ? 0xC0 : 0xC1;
+        e->immsz = 1;
+        e->imm = src->disp;
+    } else {
+        return asm_error(ctx, "invalid shift count");
+    }
+
+    return enc_modrm(ctx, e, digit, dst);
+}
+
+static int
+enc_imul(struct asm_ctx *ctx, struct asm_enc *e, struct asm_operand *ops,
+    size_t nops)
+{
+    struct asm_operand *dst = &ops[0];
+    struct asm_operand *src = &ops[nops > 1 ? 1 : 0];
+
+    if (nops == 1) {
+        return enc_unary(ctx, e, 0xF6, 5, ops, nops);
+    }
+
+    if (dst->kind != OPR_REG || dst->size == 1) {
+        return asm_error(ctx, "invalid operand combination");
+    }
+
+    if (enc_size(ctx, e, dst->size) < 0) {
+        return -1;
+    }
+
+    /* imul r, imm is imul r, r, imm */
+    if (nops == 2 && src->kind == OPR_IMM) {
+        ops[2] = *src;
+        ops[1] = *dst;
+        nops = 3;
+    }
+
+    if (nops == 3) {
+        if (ops[2].kind != OPR_IMM)
+            return asm_error(ctx, "expected immediate");
+
+        e->nop = 1;
+        if (fits_i8(ops[2].disp)) {
+            e->op[0] = 0x6B;
+            e->immsz = 1;
+            e->imm = ops[2].disp;
+        } else {
+            e->op[0] = 0x69;
+            if (enc_imm(ctx, e, &ops[2], dst->size) < 0)
+                return -1;
+        }
+
+        return enc_modrm(ctx, e, dst->reg, &ops[1]);
+    }
+
+    e->nop = 2;
+    e->op[0] = 0x0F;
+    e->op[1] = 0xAF;
+    return enc_modrm(ctx, e, dst->reg, src);
+}
+
+static int
+enc_branch(struct asm_ctx *ctx, struct asm_enc *e, const uint8_t *op,
+    uint8_t nop, uint8_t digit, struct asm_operand *ops, size_t nops)
+{
+    if (nops != 1) {
+        return asm_error(ctx, "expected one operand");
+    }
+
+    if (ops[0].kind == OPR_SYM) {
+        memcpy(e->op, op, nop);
+        e->nop = nop;
+        e->immsz = 4;
+        e->imm = 0;
+        e->imm_sym = ops[0].sym;
+        e->imm_rel = 1;
+        return 0;
+    }
+
+    /* Indirect, only for jmp and call */
+    if (digit == 0 || (ops[0].kind != OPR_REG && ops[0].kind != OPR_MEM)) {
+        return asm_error(ctx, "invalid branch target");
+    }
+
+    if (ops[0].kind == OPR_REG && ops[0].size != 8) {
+        return asm_error(ctx, "invalid branch target");
+    }
+
+    e->nop = 1;
+    e->op[0] = 0xFF;
+    return enc_modrm(ctx, e, digit, &ops[0]);
+}
+
+static int
+enc_pushpop(struct asm_ctx *ctx, struct asm_enc *e, bool push,
+    struct asm_operand *ops, size_t nops)
+{
+    struct asm_operand *op = &ops[0];
+
+    if (nops != 1) {
+        return asm_error(ctx, "expected one operand");
+    }
+
+    e->nop = 1;
+    if (op->kind == OPR_REG) {
+        if (op->size != 8)
+            return asm_error(ctx, "expected 64-bit register");
+
+        if (op->reg & 8)
+            e->rex |= 0x1;
+
+        e->op[0] = (push ? 0x50 : 0x58) + (op->reg & 7);
+        return 0;
+    }
+
+    if (push && op->kind == OPR_IMM) {
+        e->op[0] = fits_i8(op->disp) ? 0x6A : 0x68;
+        e->immsz = fits_i8(op->disp) ? 1 : 4;
+        e->imm = op->disp;
+        return 0;
+    }
+
+    e->op[0] = push ? 0xFF : 0x8F;
+    return enc_modrm(ctx, e, push ? 6 : 0, op);
+}
+
+/*
+ * Look up a condition code suffix
+ */
+static int
+asm_cc(const char *suffix)
+{
+    for (size_t i = 0; cctab[i].suffix != NULL; ++i) {
+        if (streq(cctab[i].suffix, suffix))
+            return cctab[i].cc;
+    }
+
+    return -1;
+}
+
+/*
+ * Encode a single instruction
+ *
+ * @ctx:  Assembler context
+ * @mn:   Mnemonic
+ * @args: Operand string
+ *
+ * Returns zero on success
+ */
+static int
+asm_insn(struct asm_ctx *ctx, char *mn, char *args)
+{
+    const struct asm_insn_desc *desc = NULL;
+    struct asm_operand ops[ASM_OPERAND_MAX];
+    struct asm_enc e;
+    uint8_t op[2];
+    char *p, *start;
+    size_t nops = 0;
+    int depth = 0, cc = -1;
+    bool rep = false, last;
+
+    memset(&e, 0, sizeof(e));
+    e.imm_sym = ASM_UNDEF;
+    e.disp_sym = ASM_UNDEF;
+
+    if (streq(mn, "rep")) {
+        rep = true;
+        mn = strip(args);
+        for (args = mn; *args != '\0' && !isspace((unsigned char)*args); ++args);
+        if (*args != '\0')
+            *args++ = '\0';
+    }
+
+    for (size_t i = 0; insntab[i].mnemonic != NULL; ++i) {
+        if (streq(insntab[i].mnemonic, mn)) {
+            desc = &insntab[i];
+            break;
+        }
+    }
+
+    if (desc == NULL) {
+        if (tolower((unsigned char)mn[0]) == 'j' && (cc = asm_cc(mn + 1)) >= 0) {
+            static const struct asm_insn_desc jcc = { "jcc", ENC_JCC };
+            desc = &jcc;
+        } else if (strncasecmp(mn, "set", 3) == 0 && (cc = asm_cc(mn + 3)) >= 0) {
+            static const struct asm_insn_desc setcc = { "setcc", ENC_SETCC };
+            desc = &setcc;
+        } else if (strncasecmp(mn, "cmov", 4) == 0 && (cc = asm_cc(mn + 4)) >= 0) {
+            static const struct asm_insn_desc cmovcc = { "cmovcc", ENC_CMOVCC };
+            desc = &cmovcc;
+        } else {
+            return asm_error(ctx, "unsupported instruction '%s'", mn);
+        }
+    }
+
+    /* Split the operands on top-level commas */
+    start = p = args;
+    for (;; ++p) {
+        if (*p == '[') {
+            ++depth;
+        } else if (*p == ']') {
+            --depth;
+        }
+
+        if ((*p != ',' || depth != 0) && *p != '\0') {
+            continue;
+        }
+
+        last = (*p == '\0');
+        *p = '\0';
+        if (*strip(start) != '\0') {
+            if (nops >= ASM_OPERAND_MAX)
+                return asm_error(ctx, "too many operands");
+            if (asm_parse_operand(ctx, start, &ops[nops++]) < 0)
+                return -1;
+        }
+
+        if (last) {
+            break;
+        }
+
+        start = p + 1;
+    }
+
+    e.rep = rep;
+    switch (desc->enc) {
+    case ENC_FIXED:
+        if (nops != 0) {
+            return asm_error(ctx, "unexpected operands for %s", mn);
+        }
+
+        memcpy(e.op, desc->bytes, desc->nbytes);
+        e.nop = desc->nbytes;
+        break;
+    case ENC_ALU:
+        if (enc_alu(ctx, &e, desc->arg, ops, nops) < 0)
+            return -1;
+        break;
+    case ENC_MOV:
+        if (enc_mov(ctx, &e, ops, nops) < 0)
+            return -1;
+        break;
+    case ENC_TEST:
+        if (enc_test(ctx, &e, ops, nops) < 0)
+            return -1;
+        break;
+    case ENC_GRP3:
+        if (enc_unary(ctx, &e, 0xF6, desc->arg, ops, nops) < 0)
+            return -1;
+        break;
+    case ENC_INCDEC:
+        if (enc_unary(ctx, &e, 0xFE, desc->arg, ops, nops) < 0)
+            return -1;
+        break;
+    case ENC_SHIFT:
+        if (enc_shift(ctx, &e, desc->arg, ops, nops) < 0)
+            return -1;
+        break;
+    case ENC_IMUL:
+        if (enc_imul(ctx, &e, ops, nops) < 0)
+            return -1;
+        break;
+    case ENC_LEA:
+        if (nops != 2 || ops[0].kind != OPR_REG || ops[1].kind != OPR_MEM)
+            return asm_error(ctx, "invalid operand combination");
+        if (enc_size(ctx, &e, ops[0].size) < 0)
+            return -1;
+
+        e.nop = 1;
+        e.op[0] = 0x8D;
+        if (enc_modrm(ctx, &e, ops[0].reg, &ops[1]) < 0)
+            return -1;
+        break;
+    case ENC_MOVX:
+        if (nops != 2 || ops[0].kind != OPR_REG)
+            return asm_error(ctx, "invalid operand combination");
+        if (ops[1].size != 1 && ops[1].size != 2)
+            return asm_error(ctx, "operation size not specified");
+        if (enc_size(ctx, &e, ops[0].size) < 0)
+            return -1;
+
+        enc_reg_flags(&e, &ops[0]);
+        e.nop = 2;
+        e.op[0] = 0x0F;
+        e.op[1] = desc->arg + (ops[1].size == 2);
+        if (enc_modrm(ctx, &e, ops[0].reg, &ops[1]) < 0)
+            return -1;
+        break;
+    case ENC_JMP:
+        op[0] = 0xE9;
+        if (enc_branch(ctx, &e, op, 1, 4, ops, nops) < 0)
+            return -1;
+        break;
+    case ENC_CALL:
+        op[0] = 0xE8;
+        if (enc_branch(ctx, &e, op, 1, 2, ops, nops) < 0)
+            return -1;
+        break;
+    case ENC_JCC:
+        op[0] = 0x0F;
+        op[1] = 0x80 + cc;
+        if (enc_branch(ctx, &e, op, 2, 0, ops, nops) < 0)
+            return -1;
+        break;
+    case ENC_PUSH:
+    case ENC_POP:
+        if (enc_pushpop(ctx, &e, desc->enc == ENC_PUSH, ops, nops) < 0)
+            return -1;
+        break;
+    case ENC_SETCC:
+        if (nops != 1 || ops[0].size != 1)
+            return asm_error(ctx, "expected byte operand");
+
+        e.nop = 2;
+        e.op[0] = 0x0F;
+        e.op[1] = 0x90 + cc;
+        if (enc_modrm(ctx, &e, 0, &ops[0]) < 0)
+            return -1;
+        break;
+    case ENC_CMOVCC:
+        if (nops != 2 || ops[0].kind != OPR_REG || ops[0].size == 1)
+            return asm_error(ctx, "invalid operand combination");
+        if (enc_size(ctx, &e, ops[0].size) < 0)
+            return -1;
+
+        e.nop = 2;
+        e.op[0] = 0x0F;
+        e.op[1] = 0x40 + cc;
+        if (enc_modrm(ctx, &e, ops[0].reg, &ops[1]) < 0)
+            return -1;
+        break;
+    }
+
+    if (enc_flush(ctx, &e) < 0) {
+        return -1;
+    }
+
+    /* Track where unconditional transfers end */
+    if (desc->enc == ENC_JMP || streq(mn, "ret") || streq(mn, "ud2")) {
+        ctx->sstate[ctx->cur].term_end = ctx->obj->sections[ctx->cur].size;
+    }
+
+    return 0;
+}
+
+/*
+ * Emit data items (db, dw, dd, dq)
+ */
+static int
+asm_data(struct asm_ctx *ctx, uint8_t size, char *args)
+{
+    struct asm_operand op;
+    char *p = args, *start, quote;
+    size_t off;
+
+    for (;;) {
+        while (isspace((unsigned char)*p)) {
+            ++p;
+        }
+
+        if (*p == '\0') {
+            break;
+        }
+
+        /* String literal */
+        if (*p == '"' || *p == '\'' || *p == '`') {
+            quote = *p++;
+            start = p;
+            while (*p != '\0' && *p != quote) {
+                ++p;
+            }
+
+            if (*p != quote) {
+                return asm_error(ctx, "unterminated string");
+            }
+
+            if (p - start == 1 && size > 1) {
+                if (asm_emit_int(ctx, *start, size) < 0)
+                    return -1;
+            } else if (asm_emit(ctx, start, p - start) < 0) {
+                return -1;
+            }
+
+            ++p;
+        } else {
+            start = p;
+            while (*p != '\0' && *p != ',') {
+                ++p;
+            }
+
+            quote = *p;
+            *p = '\0';
+            if (asm_parse_operand(ctx, start, &op) < 0) {
+                return -1;
+            }
+
+            *p = quote;
+            off = ctx->obj->sections[ctx->cur].size;
+            if (op.kind == OPR_SYM) {
+                if (size != 4 && size != 8)
+                    return asm_error(ctx, "symbol data too small");
+                if (asm_reloc_add(ctx, (size == 8) ? ASM_RELOC_ABS64 : ASM_RELOC_ABS32,
+                    off, op.sym, 0) < 0)
+                    return -1;
+
+                op.disp = 0;
+            } else if (op.kind != OPR_IMM) {
+                return asm_error(ctx, "bad data item");
+            }
+
+            if (asm_emit_int(ctx, op.disp, size) < 0)
+                return -1;
+        }
+
+        while (isspace((unsigned char)*p)) {
+            ++p;
+        }
+
+        if (*p == ',') {
+            ++p;
+        } else if (*p != '\0') {
+            return asm_error(ctx, "expected ','");
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Handle a statement (directive, data or instruction)
+ */
+static int
+asm_statement(struct asm_ctx *ctx, char *s)
+{
+    static const char *dtab[] = { "db", "dw", "dd", "dq" };
+    static const char *rtab[] = { "resb", "resw", "resd", "resq" };
+    char *args, *mn, *p;
+    int64_t count;
+
+    s = strip(s);
+    if (*s == '\0') {
+        return 0;
+    }
+
+    mn = s;
+    for (args = s; *args != '\0' && !isspace((unsigned char)*args); ++args);
+    if (*args != '\0') {
+        *args++ = '\0';
+    }
+
+    args = strip(args);
+    for (uint8_t i = 0; i < 4; ++i) {
+        if (streq(mn, dtab[i])) {
+            return asm_data(ctx, 1 << i, args);
+        }
+
+        if (streq(mn, rtab[i])) {
+            if (asm_parse_number(args, &count) < 0 || count < 0)
+                return asm_error(ctx, "bad reserve count");
+
+            return asm_reserve(ctx, count << i);
+        }
+    }
+
+    if (streq(mn, "times")) {
+        mn = args;
+        for (args = mn; *args != '\0' && !isspace((unsigned char)*args); ++args);
+        if (*args != '\0') {
+            *args++ = '\0';
+        }
+
+        if (asm_parse_number(mn, &count) < 0 || count < 0) {
+            return asm_error(ctx, "unsupported times count '%s'", mn);
+        }
+
+        /* Zero fill is the common case, do it in one go */
+        if (strcmp(strip(args), "db 0") == 0) {
+            return asm_reserve(ctx, count);
+        }
+
+        for (int64_t i = 0; i < count; ++i) {
+            char buf[ASM_LINE_MAX];
+
+            snprintf(buf, sizeof(buf), "%s", args);
+            if (asm_statement(ctx, buf) < 0)
+                return -1;
+        }
+
+        return 0;
+    }
+
+    if (streq(mn, "align") || streq(mn, "alignb")) {
+        if ((p = strchr(args, ',')) != NULL)
+            *p++ = '\0';
+        if (asm_parse_number(strip(args), &count) < 0)
+            return asm_error(ctx, "bad alignment");
+        if (p == NULL)
+            return asm_align(ctx, count, ctx->nopmax);
+
+        /* NASM repeats the given one byte instruction */
+        if (!streq(strip(p), "nop"))
+            return asm_error(ctx, "only nop can pad an alignment");
+
+        return asm_align(ctx, count, 1);
+    }
+
+    /* NASM smartalign, 'nop' pads with single byte nops */
+    if (streq(mn, "alignmode")) {
+        if ((p = strchr(args, ',')) != NULL)
+            *p = '\0';
+
+        args = strip(args);
+        if (streq(args, "nop")) {
+            ctx->nopmax = 1;
+        } else if (streq(args, "p6") || streq(args, "generic")) {
+            ctx->nopmax = ASM_NOP_MAX;
+        } else {
+            return asm_error(ctx, "unsupported alignment mode %s", args);
+        }
+
+        return 0;
+    }
+
+    return asm_insn(ctx, mn, args);
+}
+
+/*
+ * Handle a directive ('[section ...]', 'global ...', etc)
+ *
+ * Returns one if the line was not a directive
+ */
+static int
+asm_directive(struct asm_ctx *ctx, char *s)
+{
+    char *name, *args, *end;
+    size_t idx;
+
+    if (*s == '[') {
+        if ((end = strchr(s, ']')) == NULL) {
+            return asm_error(ctx, "missing ']'");
+        }
+
+        *end = '\0';
+        ++s;
+    }
+
+    s = strip(s);
+    name = s;
+    for (args = s; *args != '\0' && !isspace((unsigned char)*args); ++args);
+    if (*args != '\0') {
+        *args++ = '\0';
+    }
+
+    args = strip(args);
+    if (streq(name, "section") || streq(name, "segment")) {
+        for (end = args; *end != '\0' && !isspace((unsigned char)*end); ++end);
+        *end = '\0';
+        return asm_section_select(ctx, args);
+    }
+
+    if (streq(name, "global")) {
+        if ((idx = asm_symbol_get(ctx, args)) == ASM_UNDEF)
+            return -1;
+
+        ctx->obj->symbols[idx].global = 1;
+        return 0;
+    }
+
+    if (streq(name, "extern") || streq(name, "default")) {
+        return 0;
+    }
+
+    if (streq(name, "bits")) {
+        if (strcmp(args, "64") != 0)
+            return asm_error(ctx, "only 64-bit code is supported");
+
+        return 0;
+    }
+
+    if (streq(name, "org")) {
+        return asm_error(ctx, "'org' is not supported");
+    }
+
+    return 1;
+}
+
+/*
+ * Assemble a single source line
+ */
+static int
+asm_line(struct asm_ctx *ctx, char *line)
+{
+    char *s, *p, *colon;
+    int error;
+
+    /* Strip comments, ignoring ';' within strings */
+    for (p = line; *p != '\0'; ++p) {
+        if (*p == '"' || *p == '\'' || *p == '`') {
+            char q = *p;
+
+            while (*++p != '\0' && *p != q);
+            if (*p == '\0')
+                break;
+        } else if (*p == ';') {
+            *p = '\0';
+            break;
+        }
+    }
+
+    s = strip(line);
+    if (*s == '\0') {
+        return 0;
+    }
+
+    /* Only standard macro packages are pulled in, they are built in */
+    if (*s == '%') {
+        if (strncasecmp(s, "%use ", 5) == 0)
+            return 0;
+
+        return asm_error(ctx, "unsupported preprocessor directive");
+    }
+
+    if (*s == '[' || strncasecmp(s, "section ", 8) == 0 ||
+        strncasecmp(s, "global ", 7) == 0 || strncasecmp(s, "extern ", 7) == 0 ||
+        strncasecmp(s, "bits ", 5) == 0 || strncasecmp(s, "default ", 8) == 0) {
+        if ((error = asm_directive(ctx, s)) <= 0)
+            return error;
+    }
+
+    /* Label? */
+    colon = strchr(s, ':');
+    if (colon != NULL) {
+        *colon = '\0';
+        if (asm_is_ident(strip(s))) {
+            if (asm_define(ctx, strip(s)) < 0)
+                return -1;
+
+            s = colon + 1;
+        } else {
+            *colon = ':';
+        }
+    }
+
+    return asm_statement(ctx, s);
+}
+
+size_t
+asm_symbol_lookup(struct asm_object *obj, const char *name)
+{
+    if (obj == NULL || name == NULL) {
+        return ASM_UNDEF;
+    }
+
+    for (size_t i = 0; i < obj->nsymbols; ++i) {
+        if (strcmp(obj->symbols[i].name, name) == 0)
+            return i;
+    }
+
+    return ASM_UNDEF;
+}
+
+int
+asm_assemble(const char *text, size_t len, struct asm_object *res)
+{
+    struct asm_ctx ctx;
+    struct asm_sstate *ss;
+    struct asm_section *sect;
+    char line[ASM_LINE_MAX];
+    size_t off = 0, n;
+
+    if (text == NULL || res == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    memset(res, 0, sizeof(*res));
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.obj = res;
+    ctx.nopmax = ASM_NOP_MAX;
+
+    if (asm_section_select(&ctx, ".text") < 0) {
+        return -1;
+    }
+
+    while (off < len) {
+        ++ctx.line;
+        for (n = 0; off + n < len && text[off + n] != '\n'; ++n);
+        if (n >= sizeof(line)) {
+            asm_error(&ctx, "line too long");
+            goto fail;
+        }
+
+        memcpy(line, &text[off], n);
+        line[n] = '\0';
+        off += n + 1;
+
+        if (asm_line(&ctx, line) < 0) {
+            goto fail;
+        }
+    }
+
+    /* Close the last chunk of each section */
+    for (size_t i = 0; i < res->nsections; ++i) {
+        ss = &ctx.sstate[i];
+        sect = &res->sections[i];
+        if (ss->chunk == ASM_UNDEF) {
+            continue;
+        }
+
+        res->symbols[ss->chunk].fallthrough =
+            !(ss->term_end == sect->size &&
+              ss->term_end > res->symbols[ss->chunk].off);
+    }
+
+    free(ctx.sstate);
+    return 0;
+fail:
+    free(ctx.sstate);
+    asm_object_destroy(res);
+    return -1;
+}
+
+void
+asm_object_destroy(struct asm_object *obj)
+{
+    if (obj == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < obj->nsections; ++i) {
+        free(obj->sections[i].name);
+        free(obj->sections[i].data);
+    }
+
+    for (size_t i = 0; i < obj->nsymbols; ++i) {
+        free(obj->symbols[i].name);
+    }
+
+    free(obj->sections);
+    free(obj->symbols);
+    free(obj->relocs);
+    memset(obj, 0, sizeof(*obj));
+}
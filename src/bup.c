@@ -8,8 +8,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <sys/stat.h>
 #include "bup/state.h"
-#include "bup/parser.h"
+#include "bup/libbup.h"
+#include "bup/asm.h"
+#include "bup/jit.h"
+#include "bup/link.h"
 
 #define BUP_VERSION "0.0.9"
 
@@ -17,6 +22,35 @@
 static bool asm_only = false;
 static bool no_sections = false;
 static const char *binfmt = "elf64";
+static bool run_jit = false;
+static const char *syntax = "nasm";
+static bool link_only = false;
+static const char *outpath = "a.out";
+static bool dump_ir = false;
+static bool peep_stats = false;
+static bool time_passes = false;
+static const char *opt_level = NULL;
+static bool no_red_zone = false;
+static const char *tune = NULL;
+
+/* Passes disabled with -fno-<pass> */
+#define MAX_NO_PASSES 16
+static const char *no_passes[MAX_NO_PASSES + 1];
+static size_t no_pass_count = 0;
+
+/* Long-only options */
+#define OPT_RUN     0x100
+#define OPT_DUMP_IR 0x101
+#define OPT_PEEP_STATS 0x102
+#define OPT_TIME_PASSES 0x103
+
+static const struct option longopts[] = {
+    { "run", no_argument, NULL, OPT_RUN },
+    { "dump-ir", no_argument, NULL, OPT_DUMP_IR },
+    { "peephole-stats", no_argument, NULL, OPT_PEEP_STATS },
+    { "time-passes", no_argument, NULL, OPT_TIME_PASSES },
+    { NULL, 0, NULL, 0 }
+};
 
 static void
 help(void)
@@ -28,6 +62,17 @@ help(void)
         "[-v]   Display the version\n"
         "[-a]   Output ASM file only [do not assemble]\n"
         "[-s]   Disable sections in output\n"
+        "[-S]   Assembler syntax [nasm, gas]\n"
+        "[-x]   Link into an executable [built-in]\n"
+        "[-o]   Output path when linking\n"
+        "[-O]   Optimization level [0, 1, 2, s]\n"
+        "[-fno-<pass>] Disable a single optimization pass\n"
+        "[-fno-red-zone] Never keep data below the stack pointer\n"
+        "[-mtune=<cpu>] Tune for a processor [generic, znver, icelake, atom]\n"
+        "[--run] Compile and call 'main' in-process\n"
+        "[--dump-ir] Print the IR of each file\n"
+        "[--peephole-stats] Print how often each peephole rule fired\n"
+        "[--time-passes] Print the time and memory spent in each pass\n"
         "Usage: bup <flags, ...> <files, ...>\n"
     );
 }
@@ -42,27 +87,114 @@ version(void)
     );
 }
 
+/*
+ * Read an entire source file into memory
+ *
+ * @path: Path of source file
+ * @len:  Length of file is written here
+ *
+ * Returns NULL on failure
+ */
+static char *
+read_source(const char *path, size_t *len)
+{
+    struct stat st;
+    char *buf;
+    ssize_t n;
+    size_t off = 0;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        return NULL;
+    }
+
+    if (fstat(fd, &st) < 0 || (buf = malloc(st.st_size + 1)) == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    while (off < (size_t)st.st_size) {
+        if ((n = read(fd, buf + off, st.st_size - off)) <= 0)
+            break;
+
+        off += n;
+    }
+
+    close(fd);
+    *len = off;
+    return buf;
+}
+
+/*
+ * Compile a source file into assembly held in memory
+ *
+ * @path: Path of source file
+ * @out:  Output buffer is written here
+ * @out_len: Output length is written here
+ *
+ * Returns zero on success
+ */
 static int
-compile(const char *path)
+compile_mem(const char *path, char **out, size_t *out_len)
 {
-    struct bup_state state;
-    char cmd[64];
+    struct bup_opts opts = {
+        .no_sections = no_sections,
+        .syntax = syntax,
+        .dump_ir = dump_ir,
+        .peep_stats = peep_stats,
+        .time_passes = time_passes,
+        .opt_level = opt_level,
+        .no_passes = no_passes,
+        .no_red_zone = no_red_zone,
+        .tune = tune
+    };
+    char *src;
+    size_t src_len;
+    int error;
 
-    if (bup_state_init(path, &state) < 0) {
-        printf("fatal: failed to initialize state\n");
+    if ((src = read_source(path, &src_len)) == NULL) {
+        printf("fatal: failed to read %s\n", path);
         return -1;
     }
 
-    if (no_sections) {
-        state.cur_section = SECTION_DISABLED;
+    error = bup_compile_buffer(src, src_len, &opts, out, out_len);
+    free(src);
+    return error;
+}
+
+static int
+compile(const char *path)
+{
+    char cmd[64];
+    char *out;
+    size_t out_len;
+    FILE *fp;
+
+    if (compile_mem(path, &out, &out_len) < 0) {
+        return -1;
     }
 
-    if (parser_parse(&state) < 0) {
+    if ((fp = fopen(DEFAULT_ASMOUT, "w")) == NULL) {
+        printf("fatal: failed to open %s\n", DEFAULT_ASMOUT);
+        free(out);
         return -1;
     }
 
-    bup_state_destroy(&state);
-    if (!asm_only) {
+    fwrite(out, 1, out_len, fp);
+    fclose(fp);
+    free(out);
+
+    if (!asm_only && strcmp(syntax, "gas") == 0) {
+        snprintf(
+            cmd,
+            sizeof(cmd),
+            "as --64 %s -o bupgen.o",
+            DEFAULT_ASMOUT
+        );
+
+        system(cmd);
+        remove(DEFAULT_ASMOUT);
+    } else if (!asm_only) {
         snprintf(
             cmd,
             sizeof(cmd),
@@ -78,10 +210,117 @@ compile(const char *path)
     return 0;
 }
 
+/*
+ * Compile and assemble each file in-process
+ *
+ * @paths:  Source files
+ * @npaths: Number of source files
+ * @objs:   Objects are written here
+ * @nobjs:  Number of objects assembled is written here
+ *
+ * Returns zero on success
+ */
+static int
+assemble(char **paths, size_t npaths, struct asm_object *objs, size_t *nobjs)
+{
+    char *out;
+    size_t out_len;
+
+    *nobjs = 0;
+    for (size_t i = 0; i < npaths; ++i) {
+        if (compile_mem(paths[i], &out, &out_len) < 0)
+            return -1;
+
+        if (asm_assemble(out, out_len, &objs[*nobjs]) < 0) {
+            free(out);
+            return -1;
+        }
+
+        free(out);
+        ++*nobjs;
+    }
+
+    return 0;
+}
+
+/*
+ * Compile and assemble each file in-process, then
+ * call 'main'.
+ *
+ * @paths:  Source files
+ * @npaths: Number of source files
+ *
+ * Returns the status of 'main' on success, otherwise
+ * a less than zero value.
+ */
+static int
+run(char **paths, size_t npaths)
+{
+    struct asm_object *objs;
+    size_t nobjs;
+    int status = -1;
+
+    if ((objs = calloc(npaths, sizeof(*objs))) == NULL) {
+        return -1;
+    }
+
+    if (assemble(paths, npaths, objs, &nobjs) == 0) {
+        if (jit_run(objs, nobjs, "main", &status) < 0)
+            status = -1;
+    }
+
+    for (size_t i = 0; i < nobjs; ++i) {
+        asm_object_destroy(&objs[i]);
+    }
+
+    free(objs);
+    return status;
+}
+
+/*
+ * Compile and assemble each file in-process, then
+ * statically link them into a single executable.
+ *
+ * @paths:  Source files
+ * @npaths: Number of source files
+ *
+ * Returns zero on success
+ */
+static int
+link_files(char **paths, size_t npaths)
+{
+    struct asm_object *objs;
+    link_fmt_t fmt = LINK_ELF64;
+    size_t nobjs;
+    int error = -1;
+
+    if (strcmp(binfmt, "bin") == 0) {
+        fmt = LINK_FLAT;
+    } else if (strcmp(binfmt, "elf64") != 0) {
+        printf("fatal: cannot link format %s\n", binfmt);
+        return -1;
+    }
+
+    if ((objs = calloc(npaths, sizeof(*objs))) == NULL) {
+        return -1;
+    }
+
+    if (assemble(paths, npaths, objs, &nobjs) == 0) {
+        error = link_write(objs, nobjs, outpath, fmt);
+    }
+
+    for (size_t i = 0; i < nobjs; ++i) {
+        asm_object_destroy(&objs[i]);
+    }
+
+    free(objs);
+    return error;
+}
+
 int
 main(int argc, char **argv)
 {
-    int opt;
+    int opt, status;
 
     if (argc < 2) {
         printf("fatal: expected argument\n");
@@ -89,7 +328,7 @@ main(int argc, char **argv)
         return -1;
     }
 
-    while ((opt = getopt(argc, argv, "hvaf:s")) != -1) {
+    while ((opt = getopt_long(argc, argv, "hvaf:m:sS:xo:O:", longopts, NULL)) != -1) {
         switch (opt) {
         case 'h':
             help();
@@ -101,19 +340,84 @@ main(int argc, char **argv)
             asm_only = true;
             break;
         case 'f':
-            binfmt = strdup(optarg);
+            if (strncmp(optarg, "no-", 3) != 0) {
+                binfmt = strdup(optarg);
+                break;
+            }
+
+            if (strcmp(optarg, "no-red-zone") == 0) {
+                no_red_zone = true;
+                break;
+            }
+
+            if (no_pass_count == MAX_NO_PASSES) {
+                printf("fatal: too many disabled passes\n");
+                return -1;
+            }
+
+            no_passes[no_pass_count++] = strdup(optarg + 3);
+            break;
+        case 'm':
+            if (strncmp(optarg, "tune=", 5) != 0) {
+                printf("fatal: unknown option -m%s\n", optarg);
+                return -1;
+            }
+
+            tune = strdup(optarg + 5);
+            break;
+        case 'O':
+            opt_level = strdup(optarg);
             break;
         case 's':
             no_sections = true;
             break;
+        case 'S':
+            syntax = strdup(optarg);
+            break;
+        case 'x':
+            link_only = true;
+            break;
+        case 'o':
+            outpath = strdup(optarg);
+            break;
+        case OPT_RUN:
+            run_jit = true;
+            break;
+        case OPT_DUMP_IR:
+            dump_ir = true;
+            break;
+        case OPT_PEEP_STATS:
+            peep_stats = true;
+            break;
+        case OPT_TIME_PASSES:
+            time_passes = true;
+            break;
         }
     }
 
+    /* The built-in assembler only takes NASM syntax */
+    if (run_jit || link_only) {
+        syntax = "nasm";
+    }
+
+    if (run_jit) {
+        status = run(&argv[optind], argc - optind);
+        bup_release();
+        return (status < 0) ? 1 : status;
+    }
+
+    if (link_only) {
+        status = link_files(&argv[optind], argc - optind);
+        bup_release();
+        return (status < 0) ? 1 : 0;
+    }
+
     while (optind < argc) {
         if (compile(argv[optind++]) < 0) {
             break;
         }
     }
 
+    bup_release();
     return 0;
 }
@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "bup/callgraph.h"
+#include "bup/opt.h"
+#include "bup/trace.h"
+
+/*
+ * Mark the procedures an assembly line mentions
+ */
+static void
+callgraph_mentions(struct callgraph *graph, const char *text)
+{
+    struct callgraph_node *node;
+
+    for (size_t i = 0; i < graph->count; ++i) {
+        node = &graph->nodes[i];
+        if (opt_mentions(text, node->item->proc->symbol->name))
+            node->mentioned = true;
+    }
+}
+
+int
+callgraph_build(struct ir_unit *unit, struct callgraph *res)
+{
+    struct ir_item *item;
+    size_t count = 0;
+
+    if (unit == NULL || res == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    res->nodes = NULL;
+    res->count = 0;
+    TAILQ_FOREACH(item, &unit->items, link) {
+        if (item->type == IR_ITEM_PROC)
+            ++count;
+    }
+
+    if (count == 0) {
+        return 0;
+    }
+
+    if ((res->nodes = calloc(count, sizeof(*res->nodes))) == NULL) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    TAILQ_FOREACH(item, &unit->items, link) {
+        if (item->type == IR_ITEM_PROC)
+            res->nodes[res->count++].item = item;
+    }
+
+    callgraph_count(unit, res);
+    return 0;
+}
+
+void
+callgraph_count(struct ir_unit *unit, struct callgraph *graph)
+{
+    struct ir_item *item;
+    struct ir_block *blk;
+    struct ir_insn *insn;
+    ssize_t idx;
+
+    if (unit == NULL || graph == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < graph->count; ++i) {
+        graph->nodes[i].calls = 0;
+        graph->nodes[i].mentioned = false;
+    }
+
+    TAILQ_FOREACH(item, &unit->items, link) {
+        if (item->type == IR_ITEM_ASM) {
+            callgraph_mentions(graph, item->text);
+            continue;
+        }
+
+        if (item->type != IR_ITEM_PROC)
+            continue;
+
+        TAILQ_FOREACH(blk, &item->proc->blocks, link) {
+            TAILQ_FOREACH(insn, &blk->insns, link) {
+                if (insn->op == IR_ASM) {
+                    callgraph_mentions(graph, insn->text);
+                    continue;
+                }
+
+                if (insn->op != IR_CALL && insn->op != IR_TAILCALL)
+                    continue;
+                if ((idx = callgraph_find(graph, insn->sym)) >= 0)
+                    ++graph->nodes[idx].calls;
+            }
+        }
+    }
+}
+
+ssize_t
+callgraph_find(const struct callgraph *graph, const char *name)
+{
+    if (graph == NULL || name == NULL) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < graph->count; ++i) {
+        if (strcmp(graph->nodes[i].item->proc->symbol->name, name) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+void
+callgraph_measure(struct ir_proc *proc, struct callgraph_size *res)
+{
+    struct ir_block *blk;
+    struct ir_insn *insn;
+
+    if (proc == NULL || res == NULL) {
+        return;
+    }
+
+    memset(res, 0, sizeof(*res));
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        TAILQ_FOREACH(insn, &blk->insns, link) {
+            switch (insn->op) {
+            case IR_JMP:
+                break;
+            case IR_RET:
+                if (insn->a.type != IR_VAL_NONE)
+                    ++res->nvals;
+                ++res->nrets;
+                break;
+            default:
+                ++res->cost;
+                break;
+            }
+        }
+    }
+}
+
+void
+callgraph_drop(struct ir_unit *unit, struct callgraph *graph, const char *pass)
+{
+    struct callgraph_node *node;
+
+    if (unit == NULL || graph == NULL) {
+        return;
+    }
+
+    callgraph_count(unit, graph);
+    for (size_t i = 0; i < graph->count; ++i) {
+        node = &graph->nodes[i];
+        if (node->moved == 0 || node->calls > 0 || node->mentioned)
+            continue;
+        if (node->item->proc->symbol->is_global)
+            continue;
+
+        trace_debug("%s: dropping %s\n", pass, node->item->proc->symbol->name);
+        TAILQ_REMOVE(&unit->items, node->item, link);
+        node->moved = 0;
+    }
+}
+
+void
+callgraph_release(struct callgraph *graph)
+{
+    if (graph == NULL || graph->nodes == NULL) {
+        return;
+    }
+
+    free(graph->nodes);
+    graph->nodes = NULL;
+    graph->count = 0;
+}
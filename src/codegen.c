@@ -9,26 +9,607 @@
 #include <errno.h>
 #include "bup/codegen.h"
 #include "bup/trace.h"
+#include "bup/ptrbox.h"
+#include "bup/ir.h"
+#include "bup/pass.h"
 #include "bup/mu.h"
 
-static void
+/*
+ * Returns true if an expression is a variable that can be
+ * used directly as the memory operand of an operation of a
+ * given size
+ */
+static inline bool
+cg_expr_is_mem(struct ast_node *node, msize_t size)
+{
+    if (node->type != AST_SYMBOL || size < MSIZE_DWORD) {
+        return false;
+    }
+
+    return datum_msize(&node->symbol->data_type) == size;
+}
+
+/*
+ * Returns true if a binary operator is commutative
+ */
+static inline bool
+cg_expr_commutes(struct ast_node *node)
+{
+    switch (node->v) {
+    case TT_PLUS:
+    case TT_STAR:
+    case TT_EQEQ:
+    case TT_NEQ:
+        return true;
+    default:
+        break;
+    }
+
+    return false;
+}
+
+/*
+ * Get the branch condition of a comparison
+ *
+ * Returns IR_COND_NZ if the node is not a comparison
+ */
+static ir_cond_t
+cg_expr_cond(struct ast_node *node)
+{
+    if (node->type != AST_BINOP) {
+        return IR_COND_NZ;
+    }
+
+    switch (node->v) {
+    case TT_EQEQ:
+        return IR_COND_EQ;
+    case TT_NEQ:
+        return IR_COND_NE;
+    case TT_LT:
+        return IR_COND_LT;
+    case TT_LTE:
+        return IR_COND_LE;
+    case TT_GT:
+        return IR_COND_GT;
+    case TT_GTE:
+        return IR_COND_GE;
+    default:
+        break;
+    }
+
+    return IR_COND_NZ;
+}
+
+/*
+ * Attempt to fold an expression to a constant
+ *
+ * @node: Expression root
+ * @res:  Result is written here
+ *
+ * Returns true if the expression is constant
+ */
+static bool
+cg_const_fold(struct ast_node *node, ssize_t *res)
+{
+    ssize_t lhs, rhs;
+
+    switch (node->type) {
+    case AST_NUMBER:
+        *res = node->v;
+        return true;
+    case AST_BINOP:
+        if (!cg_const_fold(node->left, &lhs))
+            return false;
+        if (!cg_const_fold(node->right, &rhs))
+            return false;
+
+        switch (node->v) {
+        case TT_PLUS:
+            *res = lhs + rhs;
+            return true;
+        case TT_MINUS:
+            *res = lhs - rhs;
+            return true;
+        case TT_STAR:
+            *res = lhs * rhs;
+            return true;
+        default:
+            break;
+        }
+
+        if (cg_expr_cond(node) != IR_COND_NZ) {
+            *res = ir_cond_holds(cg_expr_cond(node), lhs, rhs);
+            return true;
+        }
+        break;
+    default:
+        break;
+    }
+
+    return false;
+}
+
+/*
+ * Combine the register needs of two operands
+ */
+static inline size_t
+cg_expr_su(size_t l, size_t r)
+{
+    if (l == r) {
+        return l + 1;
+    }
+
+    return (l > r) ? l : r;
+}
+
+static size_t cg_expr_order(struct ast_node *node, msize_t size,
+    struct ast_node **left, struct ast_node **right);
+
+/*
+ * Get the number of registers needed to evaluate an
+ * expression without spilling (Sethi-Ullman labelling)
+ *
+ * @node: Expression root
+ * @size: Size to evaluate expression at
+ * @rhs:  True if the expression is the right operand, which
+ *        needs no register if it can be an immediate or
+ *        memory operand
+ */
+static size_t
+cg_expr_need(struct ast_node *node, msize_t size, bool rhs)
+{
+    struct ast_node *left, *right;
+
+    switch (node->type) {
+    case AST_NUMBER:
+        return rhs ? 0 : 1;
+    case AST_SYMBOL:
+        return (rhs && cg_expr_is_mem(node, size)) ? 0 : 1;
+    case AST_BINOP:
+        return cg_expr_order(node, size, &left, &right);
+    case AST_INDEX:
+        /* The element is loaded over its index */
+        return cg_expr_need(node->right, MSIZE_QWORD, false);
+    default:
+        break;
+    }
+
+    return 1;
+}
+
+/*
+ * Order the operands of a binary operation, swapping those
+ * of commutative operations when that needs fewer registers
+ * (e.g. to make the right one an immediate or memory operand).
+ *
+ * @node:  Binary operation
+ * @size:  Size to evaluate expression at
+ * @left:  Left operand is written here
+ * @right: Right operand is written here
+ *
+ * Returns the number of registers needed
+ */
+static size_t
+cg_expr_order(struct ast_node *node, msize_t size, struct ast_node **left,
+    struct ast_node **right)
+{
+    struct ast_node *kids[2] = { node->left, node->right };
+    size_t need[2][2], label, swapped;
+
+    /* [i][0] as the left operand, [i][1] as the right one */
+    for (int i = 0; i < 2; ++i) {
+        need[i][1] = cg_expr_need(kids[i], size, true);
+        need[i][0] = need[i][1];
+        if (kids[i]->type != AST_BINOP)
+            need[i][0] = cg_expr_need(kids[i], size, false);
+    }
+
+    *left = kids[0];
+    *right = kids[1];
+    label = cg_expr_su(need[0][0], need[1][1]);
+    if (!cg_expr_commutes(node)) {
+        return label;
+    }
+
+    swapped = cg_expr_su(need[1][0], need[0][1]);
+    if (swapped < label) {
+        *left = kids[1];
+        *right = kids[0];
+        return swapped;
+    }
+
+    return label;
+}
+
+static int cg_emit_expr(struct bup_state *state, struct ast_node *node,
+    msize_t size, struct ir_value *res);
+
+/*
+ * Emit an access of an array element, its index is lowered
+ * first and constant indices become the displacement. Other
+ * indices go through the address of the array held in a
+ * register, which loops can then compute once.
+ *
+ * @state: Compiler state
+ * @node:  Array element
+ * @op:    IR_LOADX or IR_STOREX
+ * @size:  Operation size
+ *
+ * Returns NULL on failure
+ */
+static struct ir_insn *
+cg_emit_elem(struct bup_state *state, struct ast_node *node, ir_op_t op,
+    msize_t size)
+{
+    struct symbol *symbol = node->symbol;
+    struct datum_type *dtype = &symbol->data_type;
+    struct ir_insn *insn;
+    struct ir_value index, base;
+    msize_t msize;
+
+    if (cg_emit_expr(state, node->right, MSIZE_QWORD, &index) < 0) {
+        return NULL;
+    }
+
+    msize = datum_msize(dtype);
+    if (index.type == IR_VAL_IMM &&
+        (size_t)index.imm >= dtype->array_size / msize_bytes(msize)) {
+        trace_error(state, "index %zd is out of bounds of %s\n", index.imm,
+            symbol->name);
+        return NULL;
+    }
+
+    /* Registers cannot index a RIP relative label, take its address */
+    base.type = IR_VAL_NONE;
+    if (index.type != IR_VAL_IMM) {
+        if ((insn = ir_emit(state, IR_ADDR, MSIZE_QWORD)) == NULL)
+            return NULL;
+
+        insn->sym = symbol->name;
+        insn->var = symbol;
+        insn->dst = ir_vreg_new(state);
+        base.type = IR_VAL_VREG;
+        base.vreg = insn->dst;
+    }
+
+    if ((insn = ir_emit(state, op, size)) == NULL) {
+        return NULL;
+    }
+
+    insn->base = base;
+    insn->msize = msize;
+    insn->scale = msize_bytes(msize);
+    insn->sym = symbol->name;
+    insn->var = symbol;
+    if (index.type == IR_VAL_IMM) {
+        insn->disp = index.imm * insn->scale;
+        index.type = IR_VAL_NONE;
+    }
+
+    if (op == IR_LOADX) {
+        insn->a = index;
+    } else {
+        insn->b = index;
+    }
+
+    return insn;
+}
+
+/*
+ * Lower the right operand of an operation, variables that
+ * can be used in place become memory operands.
+ */
+static int
+cg_emit_rhs(struct bup_state *state, struct ast_node *node, msize_t size,
+    struct ir_value *res)
+{
+    struct symbol *symbol = node->symbol;
+
+    if (!cg_expr_is_mem(node, size)) {
+        return cg_emit_expr(state, node, size, res);
+    }
+
+    res->type = IR_VAL_MEM;
+    res->mem.var = symbol;
+    res->mem.sym = symbol->name;
+    res->mem.msize = size;
+    return 0;
+}
+
+/*
+ * Lower both operands of an operation, the one needing more
+ * registers goes first
+ *
+ * @state: Compiler state
+ * @left:  Left operand
+ * @right: Right operand, may become an immediate or memory operand
+ * @size:  Size to evaluate operands at
+ * @lhs:   Left value is written here
+ * @rhs:   Right value is written here
+ *
+ * Returns zero on success
+ */
+static int
+cg_emit_operands(struct bup_state *state, struct ast_node *left,
+    struct ast_node *right, msize_t size, struct ir_value *lhs,
+    struct ir_value *rhs)
+{
+    if (cg_expr_need(right, size, true) > cg_expr_need(left, size, false)) {
+        if (cg_emit_rhs(state, right, size, rhs) < 0)
+            return -1;
+
+        return cg_emit_expr(state, left, size, lhs);
+    }
+
+    if (cg_emit_expr(state, left, size, lhs) < 0) {
+        return -1;
+    }
+
+    return cg_emit_rhs(state, right, size, rhs);
+}
+
+/*
+ * Lower the operands of a comparison and emit the instruction
+ * testing it. The side that can be an operand on the right
+ * goes there, constants first as they make immediates.
+ *
+ * @state: Compiler state
+ * @expr:  Comparison
+ * @op:    IR_BR or IR_SET
+ *
+ * Returns the instruction with its condition and operands
+ * set, or NULL on failure
+ */
+static struct ir_insn *
+cg_emit_compare(struct bup_state *state, struct ast_node *expr, ir_op_t op)
+{
+    struct ast_node *left = expr->left, *right = expr->right;
+    struct ir_value lhs, rhs;
+    struct ir_insn *insn;
+    bool swap = false;
+    ir_cond_t cond = cg_expr_cond(expr);
+    ssize_t imm;
+
+    if (cg_const_fold(left, &imm) && !cg_const_fold(right, &imm)) {
+        swap = true;
+    } else if (cg_expr_need(left, MSIZE_QWORD, true) < cg_expr_need(right, MSIZE_QWORD, true)) {
+        swap = true;
+    }
+
+    if (swap) {
+        left = expr->right;
+        right = expr->left;
+        cond = ir_cond_swap(cond);
+    }
+
+    if (cg_emit_operands(state, left, right, MSIZE_QWORD, &lhs, &rhs) < 0) {
+        return NULL;
+    }
+
+    if ((insn = ir_emit(state, op, MSIZE_QWORD)) == NULL) {
+        return NULL;
+    }
+
+    insn->cond = cond;
+    insn->a = lhs;
+    insn->b = rhs;
+    return insn;
+}
+
+/*
+ * Lower an expression into the current block
+ *
+ * Subtrees are evaluated in Sethi-Ullman order, the operand
+ * needing more registers goes first so fewer values are live
+ * at once. Operands of commutative operations are swapped
+ * when that lets the right one be an immediate or memory
+ * operand.
+ *
+ * @state: Compiler state
+ * @node:  Expression root
+ * @size:  Size to evaluate expression at
+ * @res:   Resulting value is written here
+ *
+ * Returns zero on success
+ */
+static int
+cg_emit_expr(struct bup_state *state, struct ast_node *node, msize_t size,
+    struct ir_value *res)
+{
+    struct ast_node *left, *right;
+    struct ir_insn *insn;
+    struct ir_value lhs, rhs;
+    struct symbol *symbol;
+    ir_op_t op;
+
+    switch (node->type) {
+    case AST_NUMBER:
+        res->type = IR_VAL_IMM;
+        res->imm = node->v;
+        return 0;
+    case AST_SYMBOL:
+        symbol = node->symbol;
+        if ((insn = ir_emit(state, IR_LOAD, size)) == NULL) {
+            return -1;
+        }
+
+        insn->msize = datum_msize(&symbol->data_type);
+        insn->sym = symbol->name;
+        insn->var = symbol;
+        insn->dst = ir_vreg_new(state);
+        res->type = IR_VAL_VREG;
+        res->vreg = insn->dst;
+        return 0;
+    case AST_INDEX:
+        if ((insn = cg_emit_elem(state, node, IR_LOADX, size)) == NULL) {
+            return -1;
+        }
+
+        insn->dst = ir_vreg_new(state);
+        res->type = IR_VAL_VREG;
+        res->vreg = insn->dst;
+        return 0;
+    case AST_BINOP:
+        /* Comparisons are worth 1 or 0 */
+        if (cg_expr_cond(node) != IR_COND_NZ) {
+            if ((insn = cg_emit_compare(state, node, IR_SET)) == NULL)
+                return -1;
+
+            insn->dst = ir_vreg_new(state);
+            res->type = IR_VAL_VREG;
+            res->vreg = insn->dst;
+            return 0;
+        }
+
+        cg_expr_order(node, size, &left, &right);
+        if (cg_emit_operands(state, left, right, size, &lhs, &rhs) < 0) {
+            return -1;
+        }
+
+        switch (node->v) {
+        case TT_PLUS:
+            op = IR_ADD;
+            break;
+        case TT_MINUS:
+            op = IR_SUB;
+            break;
+        case TT_STAR:
+            op = IR_MUL;
+            break;
+        default:
+            trace_error(state, "bad binary operator %zd\n", node->v);
+            return -1;
+        }
+
+        if ((insn = ir_emit(state, op, size)) == NULL) {
+            return -1;
+        }
+
+        insn->a = lhs;
+        insn->b = rhs;
+        insn->dst = ir_vreg_new(state);
+        res->type = IR_VAL_VREG;
+        res->vreg = insn->dst;
+        return 0;
+    default:
+        trace_error(state, "got bad expression node %d\n", node->type);
+        break;
+    }
+
+    return -1;
+}
+
+/*
+ * Evaluate a constant expression
+ *
+ * @state: Compiler state
+ * @node:  Expression root
+ * @res:   Result is written here
+ *
+ * Returns zero on success
+ */
+static int
+cg_const_eval(struct bup_state *state, struct ast_node *node, ssize_t *res)
+{
+    if (!cg_const_fold(node, res)) {
+        trace_error(state, "expression is not constant\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Emit a store of an expression
+ *
+ * @state: Compiler state
+ * @var:   Variable being stored to
+ * @msize: Size of destination
+ * @name:  Destination symbol name
+ * @expr:  Value expression
+ *
+ * Returns zero on success
+ */
+static int
+cg_emit_store(struct bup_state *state, struct symbol *var, msize_t msize,
+    const char *name, struct ast_node *expr)
+{
+    struct ir_insn *insn;
+    struct ir_value val;
+
+    if (state->ir->proc == NULL) {
+        trace_error(state, "assignment must be in procedure\n");
+        return -1;
+    }
+
+    if (cg_emit_expr(state, expr, msize, &val) < 0) {
+        return -1;
+    }
+
+    if ((insn = ir_emit(state, IR_STORE, msize)) == NULL) {
+        return -1;
+    }
+
+    insn->msize = msize;
+    insn->sym = name;
+    insn->var = var;
+    insn->a = val;
+    return 0;
+}
+
+/*
+ * Emit a store of an expression to an array element
+ *
+ * @state: Compiler state
+ * @node:  Array element
+ * @expr:  Value expression
+ *
+ * Returns zero on success
+ */
+static int
+cg_emit_storeidx(struct bup_state *state, struct ast_node *node,
+    struct ast_node *expr)
+{
+    struct ir_insn *insn;
+    struct ir_value val;
+    msize_t msize;
+
+    if (state->ir->proc == NULL) {
+        trace_error(state, "assignment must be in procedure\n");
+        return -1;
+    }
+
+    msize = datum_msize(&node->symbol->data_type);
+    if (cg_emit_expr(state, expr, msize, &val) < 0) {
+        return -1;
+    }
+
+    if ((insn = cg_emit_elem(state, node, IR_STOREX, msize)) == NULL) {
+        return -1;
+    }
+
+    insn->a = val;
+    return 0;
+}
+
+static int
 cg_field_assign(struct bup_state *state, struct ast_node *symbol_node,
     struct ast_node *root, struct ast_node *value_node)
 {
-    char buf[256];
+    char buf[256], *name;
     struct ast_node *cur;
     struct symbol *symbol, *instance;
 
     if (root == NULL) {
-        return;
+        return 0;
     }
 
     if (root->type != AST_FIELD_ACCESS) {
-        return;
+        return 0;
     }
 
     if ((symbol = symbol_node->symbol) == NULL) {
-        return;
+        return 0;
     }
 
     snprintf(buf, sizeof(buf), "%s.", symbol->name);
@@ -42,16 +623,22 @@ cg_field_assign(struct bup_state *state, struct ast_node *symbol_node,
             strncat(buf, ".", sizeof(buf) - 1);
     }
 
-    mu_cg_istorevar(
+    if ((name = ptrbox_strdup(&state->ptrbox, buf)) == NULL) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    return cg_emit_store(
         state,
+        symbol,
         datum_msize(&instance->data_type),
-        buf,
-        value_node->v
+        name,
+        value_node
     );
 }
 
 /*
- * Emit a procedure to assembly
+ * Emit a procedure to IR
  *
  * @state: Compiler state
  * @root:  Root node of procedure
@@ -63,7 +650,7 @@ cg_emit_proc(struct bup_state *state, struct ast_node *root)
 {
     const char *section;
     struct symbol *symbol;
-    int retval = 0;
+    struct ir_unit *unit;
 
     if (state == NULL || root == NULL) {
         errno = -EINVAL;
@@ -75,23 +662,29 @@ cg_emit_proc(struct bup_state *state, struct ast_node *root)
         return -1;
     }
 
+    unit = state->ir;
+    /* Fall off the end with a return */
     if (root->epilogue) {
-        retval = mu_cg_ret(state);
-    } else {
-        trace_debug("detected procedure %s\n", symbol->name);
-        section = (symbol->section) == NULL
-            ? ".text"
-            : symbol->section;
+        if (ir_block_term(unit->cur) == NULL) {
+            if (ir_emit(state, IR_RET, MSIZE_BAD) == NULL)
+                return -1;
+        }
 
-        retval = mu_cg_label(
-            state,
-            symbol->name,
-            section,
-            symbol->is_global
-        );
+        unit->proc = NULL;
+        unit->cur = NULL;
+        return 0;
     }
 
-    return retval;
+    trace_debug("detected procedure %s\n", symbol->name);
+    section = (symbol->section) == NULL
+        ? ".text"
+        : symbol->section;
+
+    if (ir_proc_new(state, symbol, section) == NULL) {
+        return -1;
+    }
+
+    return 0;
 }
 
 /*
@@ -108,6 +701,9 @@ cg_emit_return(struct bup_state *state, struct ast_node *root)
     struct ast_node *node;
     struct symbol *cur_proc;
     struct datum_type *dtype;
+    struct ir_insn *insn;
+    struct ir_value val;
+    msize_t size;
 
     if (state == NULL || root == NULL) {
         errno = -EINVAL;
@@ -132,7 +728,21 @@ cg_emit_return(struct bup_state *state, struct ast_node *root)
 
     dtype = &cur_proc->data_type;
     node = root->right;
-    return mu_cg_retimm(state, datum_msize(dtype), node->v);
+    size = datum_msize(dtype);
+    if (cg_emit_expr(state, node, size, &val) < 0) {
+        return -1;
+    }
+
+    if ((insn = ir_emit(state, IR_RET, size)) == NULL) {
+        return -1;
+    }
+
+    insn->a = val;
+
+    /* Nothing after us in this scope runs */
+    state->unreachable = 1;
+    state->dead_depth = state->scope_depth;
+    return 0;
 }
 
 /*
@@ -146,6 +756,9 @@ cg_emit_return(struct bup_state *state, struct ast_node *root)
 static int
 cg_emit_asm(struct bup_state *state, struct ast_node *root)
 {
+    struct ir_item *item;
+    struct ir_insn *insn;
+
     if (state == NULL || root == NULL) {
         errno = -EINVAL;
         return -1;
@@ -156,7 +769,21 @@ cg_emit_asm(struct bup_state *state, struct ast_node *root)
         return -1;
     }
 
-    return mu_cg_inject(state, root->s);
+    /* Top-level assembly keeps its place between items */
+    if (state->ir->proc == NULL) {
+        if ((item = ir_item_new(state, IR_ITEM_ASM)) == NULL)
+            return -1;
+
+        item->text = root->s;
+        return 0;
+    }
+
+    if ((insn = ir_emit(state, IR_ASM, MSIZE_BAD)) == NULL) {
+        return -1;
+    }
+
+    insn->text = root->s;
+    return 0;
 }
 
 /*
@@ -171,6 +798,8 @@ static int
 cg_emit_loop(struct bup_state *state, struct ast_node *root)
 {
     char label_buf[32];
+    struct ir_block *head, *exit;
+    struct ir_insn *insn;
 
     if (state == NULL || root == NULL) {
         errno = -EINVAL;
@@ -182,31 +811,39 @@ cg_emit_loop(struct bup_state *state, struct ast_node *root)
         return -1;
     }
 
-    if (!root->epilogue) {
-        snprintf(
-            label_buf,
-            sizeof(label_buf),
-            "L.%zu",
-            state->loop_count++
-        );
-    } else {
-        snprintf(
-            label_buf,
-            sizeof(label_buf),
-            "L.%zu",
-            state->loop_count - 1
-        );
+    /*
+     * The epilogue jumps back to the head unless the body
+     * already left, then continues at the exit block.
+     */
+    if (root->epilogue) {
+        --state->loop_depth;
+        head = state->loop_stack[state->loop_depth][0];
+        exit = state->loop_stack[state->loop_depth][1];
+        if (ir_block_term(state->ir->cur) == NULL) {
+            if ((insn = ir_emit(state, IR_JMP, MSIZE_BAD)) == NULL)
+                return -1;
+
+            insn->target[0] = head;
+        }
 
-        mu_cg_jmp(state, label_buf);
-        snprintf(
-            label_buf,
-            sizeof(label_buf),
-            "L.%zu.1",
-            state->loop_count - 1
-        );
+        return ir_block_place(state, exit);
+    }
+
+    snprintf(label_buf, sizeof(label_buf), "L.%zu", state->loop_count);
+    if ((head = ir_block_new(state, label_buf)) == NULL) {
+        return -1;
+    }
+
+    snprintf(label_buf, sizeof(label_buf), "L.%zu.1", state->loop_count++);
+    if ((exit = ir_block_new(state, label_buf)) == NULL) {
+        return -1;
     }
 
-    return mu_cg_label(state, label_buf, NULL, false);
+    head->unroll = root->v;
+    state->loop_stack[state->loop_depth][0] = head;
+    state->loop_stack[state->loop_depth][1] = exit;
+    ++state->loop_depth;
+    return ir_block_place(state, head);
 }
 
 /*
@@ -221,7 +858,7 @@ static int
 cg_emit_var(struct bup_state *state, struct ast_node *root)
 {
     struct symbol *symbol;
-    struct datum_type *dtype;
+    struct ir_item *item;
 
     if (state == NULL || root == NULL) {
         errno = -EINVAL;
@@ -233,24 +870,12 @@ cg_emit_var(struct bup_state *state, struct ast_node *root)
         return -1;
     }
 
-    dtype = &symbol->data_type;
-    if (dtype->array_size > 0) {
-        return mu_cg_array(
-            state,
-            symbol->name,
-            symbol->is_global,
-            dtype->array_size
-        );
+    if ((item = ir_item_new(state, IR_ITEM_VAR)) == NULL) {
+        return -1;
     }
 
-    return mu_cg_globvar(
-        state,
-        symbol->name,
-        datum_msize(dtype),
-        SECTION_DATA,
-        0,
-        symbol->is_global
-    );
+    item->symbol = symbol;
+    return 0;
 }
 
 /*
@@ -264,7 +889,7 @@ cg_emit_var(struct bup_state *state, struct ast_node *root)
 static int
 cg_emit_break(struct bup_state *state, struct ast_node *root)
 {
-    char label_buf[32];
+    struct ir_insn *insn;
 
     if (state == NULL || root == NULL) {
         errno = -EINVAL;
@@ -276,8 +901,16 @@ cg_emit_break(struct bup_state *state, struct ast_node *root)
         return -1;
     }
 
-    snprintf(label_buf, sizeof(label_buf), "L.%zu.1", state->loop_count - 1);
-    mu_cg_jmp(state, label_buf);
+    if (state->loop_depth == 0) {
+        trace_error(state, "break is not in loop\n");
+        return -1;
+    }
+
+    if ((insn = ir_emit(state, IR_JMP, MSIZE_BAD)) == NULL) {
+        return -1;
+    }
+
+    insn->target[0] = state->loop_stack[state->loop_depth - 1][1];
     return 0;
 }
 
@@ -294,7 +927,8 @@ cg_emit_vardef(struct bup_state *state, struct ast_node *root)
 {
     struct ast_node *expr;
     struct symbol *symbol;
-    struct datum_type *dtype;
+    struct ir_item *item;
+    ssize_t v;
 
     if (state == NULL || root == NULL) {
         errno = -EINVAL;
@@ -306,21 +940,23 @@ cg_emit_vardef(struct bup_state *state, struct ast_node *root)
         return -1;
     }
 
-    /* XXX: Perhaps handle binary expressions */
     if ((expr = root->right) == NULL) {
         errno = -EIO;
         return -1;
     }
 
-    dtype = &symbol->data_type;
-    return mu_cg_globvar(
-        state,
-        symbol->name,
-        type_to_msize(dtype->type),
-        SECTION_DATA,
-        expr->v,
-        symbol->is_global
-    );
+    if (cg_const_eval(state, expr, &v) < 0) {
+        return -1;
+    }
+
+    if ((item = ir_item_new(state, IR_ITEM_VAR)) == NULL) {
+        return -1;
+    }
+
+    item->symbol = symbol;
+    item->init = true;
+    item->imm = v;
+    return 0;
 }
 
 /*
@@ -332,7 +968,7 @@ cg_emit_vardef(struct bup_state *state, struct ast_node *root)
 static int
 cg_emit_cont(struct bup_state *state, struct ast_node *root)
 {
-    char label_buf[32];
+    struct ir_insn *insn;
 
     if (state == NULL || root == NULL) {
         errno = -EINVAL;
@@ -344,8 +980,46 @@ cg_emit_cont(struct bup_state *state, struct ast_node *root)
         return -1;
     }
 
-    snprintf(label_buf, sizeof(label_buf), "L.%zu", state->loop_count - 1);
-    return mu_cg_jmp(state, label_buf);
+    if (state->loop_depth == 0) {
+        trace_error(state, "continue is not in loop\n");
+        return -1;
+    }
+
+    if ((insn = ir_emit(state, IR_JMP, MSIZE_BAD)) == NULL) {
+        return -1;
+    }
+
+    insn->target[0] = state->loop_stack[state->loop_depth - 1][0];
+    return 0;
+}
+
+/*
+ * Emit the branch testing a condition, a comparison is a
+ * single compare and jump with no value in between
+ *
+ * @state: Compiler state
+ * @expr:  Condition
+ *
+ * Returns the branch, its targets are left to the caller,
+ * or NULL on failure.
+ */
+static struct ir_insn *
+cg_emit_cond(struct bup_state *state, struct ast_node *expr)
+{
+    struct ir_value lhs;
+    struct ir_insn *insn;
+
+    if (cg_expr_cond(expr) == IR_COND_NZ) {
+        if (cg_emit_expr(state, expr, MSIZE_QWORD, &lhs) < 0)
+            return NULL;
+        if ((insn = ir_emit(state, IR_BR, MSIZE_QWORD)) == NULL)
+            return NULL;
+
+        insn->a = lhs;
+        return insn;
+    }
+
+    return cg_emit_compare(state, expr, IR_BR);
 }
 
 /*
@@ -358,7 +1032,10 @@ static int
 cg_emit_if(struct bup_state *state, struct ast_node *root)
 {
     struct ast_node *expr;
+    struct ir_block *body, *end;
+    struct ir_insn *insn;
     char label_buf[32];
+    ssize_t imm;
 
     if (state == NULL || root == NULL) {
         errno = -EINVAL;
@@ -376,17 +1053,29 @@ cg_emit_if(struct bup_state *state, struct ast_node *root)
     }
 
     /*
-     * If this is the epilogue, simply create a label
+     * If this is the epilogue, simply place the block
      * to jump to if the condition fails.
      */
     if (root->epilogue) {
-        snprintf(
-            label_buf,
-            sizeof(label_buf),
-            "IF.%zu",
-            state->if_count - 1
-        );
-        mu_cg_label(state, label_buf, NULL, false);
+        end = state->if_stack[--state->if_depth];
+        if (end == NULL)
+            return 0;
+
+        return ir_block_place(state, end);
+    }
+
+    /*
+     * Constant conditions need no test, a true body runs
+     * in line and a false one is parsed as unreachable
+     * code so nothing is emitted for it.
+     */
+    if (cg_const_fold(expr, &imm)) {
+        state->if_stack[state->if_depth++] = NULL;
+        if (imm == 0) {
+            state->unreachable = 1;
+            state->dead_depth = state->scope_depth;
+        }
+
         return 0;
     }
 
@@ -397,8 +1086,23 @@ cg_emit_if(struct bup_state *state, struct ast_node *root)
         state->if_count++
     );
 
-    /* TODO: Handle more complex expressions */
-    return mu_cg_icmpnz(state, label_buf, expr->v);
+    if ((end = ir_block_new(state, label_buf)) == NULL) {
+        return -1;
+    }
+
+    if ((body = ir_block_new(state, NULL)) == NULL) {
+        return -1;
+    }
+
+    if ((insn = cg_emit_cond(state, expr)) == NULL) {
+        return -1;
+    }
+
+    insn->target[0] = body;
+    insn->target[1] = end;
+    insn->hint = root->v;
+    state->if_stack[state->if_depth++] = end;
+    return ir_block_place(state, body);
 }
 
 /*
@@ -431,26 +1135,23 @@ cg_emit_assign(struct bup_state *state, struct ast_node *root)
         return -1;
     }
 
-    /* TODO: Support a non-numeric lhs */
-    if (value_node->type != AST_NUMBER) {
-        trace_error(state, "non-numeric rhs for assign unsupported\n");
-        return -1;
-    }
-
     if ((symbol_node = root->left) == NULL) {
         trace_error(state, "assign has no lhs\n");
         errno = -EIO;
         return -1;
     }
 
+    if (symbol_node->type == AST_INDEX) {
+        return cg_emit_storeidx(state, symbol_node, value_node);
+    }
+
     if ((field_node = root->mid) != NULL) {
-        cg_field_assign(
+        return cg_field_assign(
             state,
             symbol_node,
             field_node->mid,
             field_node->right
         );
-        return 0;
     }
 
     if ((symbol = symbol_node->symbol) == NULL) {
@@ -459,11 +1160,12 @@ cg_emit_assign(struct bup_state *state, struct ast_node *root)
     }
 
     dtype = &symbol->data_type;
-    return mu_cg_istorevar(
+    return cg_emit_store(
         state,
+        symbol,
         datum_msize(dtype),
         symbol->name,
-        value_node->v
+        value_node
     );
 }
 
@@ -478,6 +1180,7 @@ cg_emit_call(struct bup_state *state, struct ast_node *root)
 {
     struct ast_node *symbol_node;
     struct symbol *symbol;
+    struct ir_insn *insn;
 
     if (state == NULL || root == NULL) {
         errno = -EINVAL;
@@ -513,7 +1216,17 @@ cg_emit_call(struct bup_state *state, struct ast_node *root)
         return -1;
     }
 
-    return mu_cg_call(state, symbol->name);
+    if (state->ir->proc == NULL) {
+        trace_error(state, "call must be in procedure\n");
+        return -1;
+    }
+
+    if ((insn = ir_emit(state, IR_CALL, MSIZE_BAD)) == NULL) {
+        return -1;
+    }
+
+    insn->sym = symbol->name;
+    return 0;
 }
 
 /*
@@ -528,6 +1241,7 @@ cg_emit_struct(struct bup_state *state, struct ast_node *root)
     struct symbol *symbol;
     struct symbol *instance;
     struct ast_node *symbol_node, *instance_node;
+    struct ir_item *item;
 
     if (state == NULL || root == NULL) {
         errno = -EINVAL;
@@ -564,7 +1278,37 @@ cg_emit_struct(struct bup_state *state, struct ast_node *root)
         return -1;
     }
 
-    return mu_cg_struct(state, instance->name, instance, symbol);
+    if ((item = ir_item_new(state, IR_ITEM_STRUCT)) == NULL) {
+        return -1;
+    }
+
+    item->symbol = instance;
+    return 0;
+}
+
+/*
+ * Returns true if a node is a statement that can be
+ * dropped when unreachable, declarations are always kept
+ * as code after them may refer to them.
+ */
+static inline bool
+cg_is_stmt(struct ast_node *root)
+{
+    switch (root->type) {
+    case AST_RETURN:
+    case AST_ASM:
+    case AST_LOOP:
+    case AST_BREAK:
+    case AST_CONT:
+    case AST_IF:
+    case AST_ASSIGN:
+    case AST_CALL:
+        return !root->epilogue;
+    default:
+        break;
+    }
+
+    return false;
 }
 
 int
@@ -575,6 +1319,10 @@ cg_compile_node(struct bup_state *state, struct ast_node *root)
         return -1;
     }
 
+    if (state->unreachable && cg_is_stmt(root)) {
+        return 0;
+    }
+
     switch (root->type) {
     case AST_PROC:
         if (cg_emit_proc(state, root) < 0) {
@@ -655,3 +1403,14 @@ cg_compile_node(struct bup_state *state, struct ast_node *root)
 
     return -1;
 }
+
+int
+cg_finish(struct bup_state *state)
+{
+    if (state == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    return pass_run(state, state->ir, state->out_fp);
+}
@@ -0,0 +1,488 @@
+/*
+ * Copyright (C) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include "bup/inline.h"
+#include "bup/callgraph.h"
+#include "bup/opt.h"
+#include "bup/pass.h"
+#include "bup/ptrbox.h"
+#include "bup/trace.h"
+
+/*
+ * What the inliner knows about the body of a procedure
+ *
+ * @size: Size of body, not counting returned values
+ * @safe: Set if the body may be copied
+ */
+struct inline_info {
+    struct callgraph_size size;
+    bool safe;
+};
+
+/*
+ * Represents a call that may be inlined
+ *
+ * @blk:  Block the call is in
+ * @call: Call instruction
+ */
+struct inline_site {
+    struct ir_block *blk;
+    struct ir_insn *call;
+};
+
+/*
+ * Returns true if an inline assembly line may be copied
+ * into another procedure. Labels would be defined twice
+ * while control flow and stack accesses assume the frame
+ * of the procedure they were written in.
+ */
+static bool
+inline_asm_ok(const char *text)
+{
+    static const char *unsafe[] = {
+        "ret", "call", "loop", "push", "pop", "leave", "rsp", NULL
+    };
+
+    if (strchr(text, ':') != NULL) {
+        return false;
+    }
+
+    while (isspace(*text)) {
+        ++text;
+    }
+
+    if (*text == 'j') {
+        return false;
+    }
+
+    for (int i = 0; unsafe[i] != NULL; ++i) {
+        if (opt_mentions(text, unsafe[i]))
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Measure the body of a procedure and find out if it may be
+ * copied. Jumps and returns cost nothing as they become
+ * fallthrough into the rest of the caller.
+ *
+ * @proc: Procedure
+ * @res:  Result is written here
+ */
+static void
+inline_measure(struct ir_proc *proc, struct inline_info *res)
+{
+    struct ir_block *blk;
+    struct ir_insn *insn;
+
+    callgraph_measure(proc, &res->size);
+    res->safe = true;
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        TAILQ_FOREACH(insn, &blk->insns, link) {
+            /* A tail call returns straight to the caller of the body */
+            if (insn->op == IR_TAILCALL)
+                res->safe = false;
+            if (insn->op == IR_ASM && !inline_asm_ok(insn->text))
+                res->safe = false;
+        }
+    }
+}
+
+/*
+ * Find out if the value a call leaves in the return register
+ * may be looked at afterwards, either by inline assembly or
+ * by falling off the end of a procedure that returns a value.
+ *
+ * @proc: Procedure making the call
+ * @call: Call instruction
+ *
+ * Returns zero if it is not, one if it is returned by the
+ * terminator of the block of the call and a less than zero
+ * value if it is looked at in any other way.
+ */
+static int
+inline_result_use(struct ir_proc *proc, struct ir_insn *call)
+{
+    struct ir_insn *insn = TAILQ_NEXT(call, link);
+    bool local = true;
+    size_t hops = 0;
+
+    if (call->dst != IR_NOREG) {
+        return -1;
+    }
+
+    while (insn != NULL) {
+        switch (insn->op) {
+        case IR_CALL:
+        case IR_TAILCALL:
+            return 0;
+        case IR_ASM:
+        case IR_BR:
+            return -1;
+        case IR_RET:
+            if (insn->a.type != IR_VAL_NONE)
+                return 0;
+            if (datum_msize(&proc->symbol->data_type) == MSIZE_BAD)
+                return 0;
+
+            return local ? 1 : -1;
+        case IR_JMP:
+            if (hops++ == proc->nblocks)
+                return -1;
+
+            insn = TAILQ_FIRST(&insn->target[0]->insns);
+            local = false;
+            continue;
+        default:
+            break;
+        }
+
+        insn = TAILQ_NEXT(insn, link);
+    }
+
+    return -1;
+}
+
+/*
+ * Decide if a call should be inlined
+ *
+ * @state:  Compiler state
+ * @caller: Procedure making the call
+ * @call:   Call instruction
+ * @use:    What inline_result_use() says about the call
+ * @node:   Called procedure
+ * @info:   Body of called procedure
+ */
+static bool
+inline_wanted(struct bup_state *state, struct ir_proc *caller,
+    struct ir_insn *call, int use, struct callgraph_node *node,
+    struct inline_info *info)
+{
+    struct symbol *symbol = node->item->proc->symbol;
+    size_t cost = info->size.cost;
+
+    if (node->item->proc == caller || symbol->no_inline || !info->safe) {
+        return false;
+    }
+
+    /*
+     * The result would be assigned once per return, and if
+     * it is only passed on in the return register it has to
+     * be made explicit first.
+     */
+    if (use != 0 && info->size.nvals > 0) {
+        if (info->size.nrets > 1)
+            return false;
+        if (call->dst == IR_NOREG && use < 0)
+            return false;
+
+        cost += info->size.nvals;
+    }
+
+    if (symbol->is_inline) {
+        return true;
+    }
+
+    /* Procedures placed in their own section stay there */
+    if (symbol->section != NULL) {
+        return false;
+    }
+
+    /* The only copy of the body moves into its caller */
+    if (!symbol->is_global && !node->mentioned && node->calls == 1) {
+        return true;
+    }
+
+    if (state->opt_level == PASS_OS) {
+        return cost <= INLINE_CALL_COST;
+    }
+
+    return cost <= INLINE_MAX_COST;
+}
+
+/*
+ * Copy an instruction of an inlined procedure into a
+ * block of its caller
+ *
+ * @state: Compiler state
+ * @insn:  Instruction to copy
+ * @dst:   Block to append to
+ * @map:   Copy of each block of the callee
+ * @base:  First virtual register of the copy
+ * @call:  Call being inlined
+ * @cont:  Block the caller continues in after the call
+ *
+ * Returns zero on success
+ */
+static int
+inline_copy(struct bup_state *state, struct ir_insn *insn, struct ir_block *dst,
+    struct ir_block **map, ir_vreg_t base, struct ir_insn *call,
+    struct ir_block *cont)
+{
+    struct ir_value *vals[IR_MAX_OPERANDS];
+    struct ir_insn *copy;
+    size_t nvals;
+
+    copy = ptrbox_alloc(&state->ptrbox, sizeof(*copy));
+    if (copy == NULL) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    memcpy(copy, insn, sizeof(*copy));
+    if (copy->dst != IR_NOREG)
+        copy->dst += base;
+
+    nvals = ir_operands(copy, vals);
+    for (size_t i = 0; i < nvals; ++i) {
+        if (vals[i]->type == IR_VAL_VREG)
+            vals[i]->vreg += base;
+    }
+
+    for (int i = 0; i < 2; ++i) {
+        if (copy->target[i] != NULL)
+            copy->target[i] = map[copy->target[i]->id];
+    }
+
+    TAILQ_INSERT_TAIL(&dst->insns, copy, link);
+    if (copy->op != IR_RET) {
+        return 0;
+    }
+
+    /* The returned value lands in the result of the call */
+    if (call->dst != IR_NOREG && copy->a.type != IR_VAL_NONE) {
+        copy->op = IR_MOV;
+        copy->dst = call->dst;
+
+        copy = ptrbox_alloc(&state->ptrbox, sizeof(*copy));
+        if (copy == NULL) {
+            errno = -ENOMEM;
+            return -1;
+        }
+
+        memset(copy, 0, sizeof(*copy));
+        copy->dst = IR_NOREG;
+        TAILQ_INSERT_TAIL(&dst->insns, copy, link);
+    }
+
+    copy->op = IR_JMP;
+    copy->size = MSIZE_BAD;
+    copy->a.type = IR_VAL_NONE;
+    copy->target[0] = cont;
+    return 0;
+}
+
+/*
+ * Make a result that is passed on in the return register
+ * explicit, the call gets a destination that the return
+ * after it returns.
+ *
+ * @proc: Procedure making the call
+ * @blk:  Block of the call
+ * @call: Call instruction
+ */
+static void
+inline_pass_result(struct ir_proc *proc, struct ir_block *blk,
+    struct ir_insn *call)
+{
+    struct ir_insn *ret = ir_block_term(blk);
+    msize_t size = datum_msize(&proc->symbol->data_type);
+
+    call->dst = proc->nvregs++;
+    call->size = size;
+    ret->size = size;
+    ret->a.type = IR_VAL_VREG;
+    ret->a.vreg = call->dst;
+}
+
+/*
+ * Inline a single call
+ *
+ * @state:  Compiler state
+ * @caller: Procedure making the call
+ * @site:   Call site
+ * @callee: Called procedure
+ *
+ * Returns the block the caller continues in after the
+ * call, or NULL on failure.
+ */
+static struct ir_block *
+inline_call(struct bup_state *state, struct ir_proc *caller,
+    struct inline_site *site, struct ir_proc *callee)
+{
+    struct ir_block **map, *cont, *src, *at;
+    struct ir_insn *insn;
+    ir_vreg_t base = caller->nvregs;
+
+    if ((map = calloc(callee->nblocks, sizeof(*map))) == NULL) {
+        errno = -ENOMEM;
+        return NULL;
+    }
+
+    /* Whatever follows the call moves to a block of its own */
+    if ((cont = ir_block_new(state, NULL)) == NULL) {
+        goto fail;
+    }
+
+    while ((insn = TAILQ_NEXT(site->call, link)) != NULL) {
+        TAILQ_REMOVE(&site->blk->insns, insn, link);
+        TAILQ_INSERT_TAIL(&cont->insns, insn, link);
+    }
+
+    at = site->blk;
+    TAILQ_FOREACH(src, &callee->blocks, link) {
+        if ((map[src->id] = ir_block_new(state, NULL)) == NULL)
+            goto fail;
+
+        map[src->id]->id = caller->nblocks++;
+        map[src->id]->unroll = src->unroll;
+        TAILQ_INSERT_AFTER(&caller->blocks, at, map[src->id], link);
+        at = map[src->id];
+    }
+
+    cont->id = caller->nblocks++;
+    TAILQ_INSERT_AFTER(&caller->blocks, at, cont, link);
+
+    TAILQ_FOREACH(src, &callee->blocks, link) {
+        TAILQ_FOREACH(insn, &src->insns, link) {
+            if (inline_copy(state, insn, map[src->id], map, base, site->call, cont) < 0)
+                goto fail;
+        }
+    }
+
+    /* The call becomes a jump into the copied entry block */
+    caller->nvregs += callee->nvregs;
+    site->call->op = IR_JMP;
+    site->call->dst = IR_NOREG;
+    site->call->sym = NULL;
+    site->call->target[0] = map[TAILQ_FIRST(&callee->blocks)->id];
+
+    free(map);
+    return cont;
+fail:
+    free(map);
+    return NULL;
+}
+
+/*
+ * Inline the wanted calls of a procedure. Only calls that
+ * were there before are considered so recursion through
+ * inlined bodies cannot go on forever.
+ *
+ * @state: Compiler state
+ * @proc:  Procedure
+ * @graph: Procedures of the unit
+ *
+ * Returns the number of calls inlined, or a less than zero
+ * value on failure.
+ */
+static int
+inline_proc(struct bup_state *state, struct ir_proc *proc,
+    struct callgraph *graph)
+{
+    struct inline_site *sites;
+    struct callgraph_node *node;
+    struct inline_info info;
+    struct ir_block *blk, *cont;
+    struct ir_insn *insn;
+    size_t nsites = 0, cap = 0;
+    ssize_t idx;
+    int use, inlined = 0;
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        TAILQ_FOREACH(insn, &blk->insns, link) {
+            if (insn->op == IR_CALL)
+                ++cap;
+        }
+    }
+
+    if (cap == 0) {
+        return 0;
+    }
+
+    if ((sites = calloc(cap, sizeof(*sites))) == NULL) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        TAILQ_FOREACH(insn, &blk->insns, link) {
+            if (insn->op != IR_CALL)
+                continue;
+
+            sites[nsites].blk = blk;
+            sites[nsites++].call = insn;
+        }
+    }
+
+    for (size_t i = 0; i < nsites; ++i) {
+        if ((idx = callgraph_find(graph, sites[i].call->sym)) < 0)
+            continue;
+
+        /* Its body may have grown since by inlining into it */
+        node = &graph->nodes[idx];
+        inline_measure(node->item->proc, &info);
+        use = inline_result_use(proc, sites[i].call);
+        if (!inline_wanted(state, proc, sites[i].call, use, node, &info))
+            continue;
+        if (use > 0 && info.size.nvals > 0)
+            inline_pass_result(proc, sites[i].blk, sites[i].call);
+
+        trace_debug("inline: %s into %s\n", sites[i].call->sym, proc->symbol->name);
+        if ((cont = inline_call(state, proc, &sites[i], node->item->proc)) == NULL) {
+            free(sites);
+            return -1;
+        }
+
+        /* Later calls of the same block now follow the body */
+        for (size_t j = i + 1; j < nsites; ++j) {
+            if (sites[j].blk == sites[i].blk)
+                sites[j].blk = cont;
+        }
+
+        ++node->moved;
+        ++inlined;
+    }
+
+    free(sites);
+    return inlined;
+}
+
+int
+inline_unit(struct bup_state *state, struct ir_unit *unit)
+{
+    struct callgraph graph;
+    int n, inlined = 0;
+
+    if (state == NULL || unit == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if (callgraph_build(unit, &graph) < 0) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < graph.count; ++i) {
+        if ((n = inline_proc(state, graph.nodes[i].item->proc, &graph)) < 0) {
+            callgraph_release(&graph);
+            return -1;
+        }
+
+        inlined += n;
+    }
+
+    /* Drop internal procedures nothing calls anymore */
+    callgraph_drop(unit, &graph, "inline");
+    callgraph_release(&graph);
+    return inlined;
+}
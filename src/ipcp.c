@@ -0,0 +1,830 @@
+/*
+ * Copyright (C) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "bup/ipcp.h"
+#include "bup/callgraph.h"
+#include "bup/opt.h"
+#include "bup/pass.h"
+#include "bup/mu.h"
+#include "bup/ptrbox.h"
+#include "bup/trace.h"
+
+/*
+ * What is known about what a procedure returns, kept for
+ * each procedure of the call graph
+ *
+ * @known: Set if every path returns 'imm'
+ * @imm:   Constant returned
+ */
+struct ipcp_ret {
+    bool known;
+    ssize_t imm;
+};
+
+/*
+ * Represents a global read by a procedure
+ *
+ * @sym:   Symbol name
+ * @msize: Size every read is made with
+ */
+struct ipcp_param {
+    const char *sym;
+    msize_t msize;
+};
+
+/*
+ * Represents a call and the globals known to hold a
+ * constant when it is made
+ *
+ * @call:  Call instruction
+ * @known: Set for each parameter known at the call
+ * @imm:   Value of each known parameter
+ * @done:  Set once the call has been considered for a clone
+ */
+struct ipcp_site {
+    struct ir_insn *call;
+    bool known[IPCP_MAX_PARAMS];
+    ssize_t imm[IPCP_MAX_PARAMS];
+    bool done;
+};
+
+/*
+ * Measure the body of a procedure, jumps are not counted
+ * as most become fallthrough
+ */
+static size_t
+ipcp_cost(struct ir_proc *proc)
+{
+    struct callgraph_size size;
+
+    callgraph_measure(proc, &size);
+    return size.cost + size.nrets;
+}
+
+/*
+ * Add a global read by a procedure to its parameters. A
+ * global read with more than one size is kept with a size
+ * of MSIZE_BAD so it is never specialized.
+ *
+ * @params:  Parameters found so far
+ * @nparams: Number of parameters, updated in place
+ * @sym:     Symbol name
+ * @msize:   Size of the read
+ */
+static void
+ipcp_add_param(struct ipcp_param *params, size_t *nparams, const char *sym,
+    msize_t msize)
+{
+    for (size_t i = 0; i < *nparams; ++i) {
+        if (strcmp(params[i].sym, sym) != 0)
+            continue;
+        if (params[i].msize != msize)
+            params[i].msize = MSIZE_BAD;
+        return;
+    }
+
+    if (*nparams == IPCP_MAX_PARAMS) {
+        return;
+    }
+
+    params[*nparams].sym = sym;
+    params[(*nparams)++].msize = msize;
+}
+
+/*
+ * Find the globals a procedure reads
+ *
+ * @proc:   Procedure
+ * @params: Parameters are written here
+ *
+ * Returns the number of parameters
+ */
+static size_t
+ipcp_params(struct ir_proc *proc, struct ipcp_param *params)
+{
+    struct ir_block *blk;
+    struct ir_insn *insn;
+    size_t nparams = 0;
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        TAILQ_FOREACH(insn, &blk->insns, link) {
+            if (insn->op == IR_LOAD)
+                ipcp_add_param(params, &nparams, insn->sym, insn->msize);
+            if (insn->b.type == IR_VAL_MEM)
+                ipcp_add_param(params, &nparams, insn->b.mem.sym, insn->b.mem.msize);
+        }
+    }
+
+    return nparams;
+}
+
+/*
+ * Returns true if an instruction may change a global
+ *
+ * @insn:  Instruction
+ * @param: Global
+ */
+static bool
+ipcp_writes(struct ir_insn *insn, struct ipcp_param *param)
+{
+    switch (insn->op) {
+    case IR_STORE:
+        return strcmp(insn->sym, param->sym) == 0;
+    case IR_CALL:
+    case IR_TAILCALL:
+    case IR_ASM:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+ * Find which parameters hold a constant when a call is
+ * made, stored to in the block of the call with nothing
+ * in between that could change them.
+ *
+ * @site:    Call site, its known values are filled in
+ * @params:  Parameters of the called procedure
+ * @nparams: Number of parameters
+ */
+static void
+ipcp_site_values(struct ipcp_site *site, struct ipcp_param *params,
+    size_t nparams)
+{
+    struct ir_insn *insn;
+    struct ipcp_param *param;
+
+    for (size_t i = 0; i < nparams; ++i) {
+        param = &params[i];
+        site->known[i] = false;
+        if (param->msize == MSIZE_BAD)
+            continue;
+
+        insn = TAILQ_PREV(site->call, ir_insn_q, link);
+        while (insn != NULL && !ipcp_writes(insn, param)) {
+            insn = TAILQ_PREV(insn, ir_insn_q, link);
+        }
+
+        if (insn == NULL || insn->op != IR_STORE)
+            continue;
+        if (insn->msize != param->msize || insn->a.type != IR_VAL_IMM)
+            continue;
+
+        site->known[i] = true;
+        site->imm[i] = opt_trunc(param->msize, insn->a.imm);
+    }
+}
+
+/*
+ * Replace the reads of a global that are only reached
+ * from the entry of a procedure with nothing changing
+ * the global on the way. The CFG of the procedure must
+ * be built.
+ *
+ * @proc:  Procedure
+ * @param: Global
+ * @imm:   Value it holds on entry
+ *
+ * Returns the number of reads replaced, or a less than
+ * zero value on failure.
+ */
+static int
+ipcp_subst(struct ir_proc *proc, struct ipcp_param *param, ssize_t imm)
+{
+    struct ir_block *blk;
+    struct ir_insn *insn;
+    bool *in, *dirty, clean, changed = true;
+    int count = 0;
+
+    in = malloc((proc->nblocks + 1) * sizeof(*in));
+    dirty = calloc(proc->nblocks + 1, sizeof(*dirty));
+    if (in == NULL || dirty == NULL) {
+        free(in);
+        free(dirty);
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        in[blk->id] = true;
+        TAILQ_FOREACH(insn, &blk->insns, link) {
+            if (ipcp_writes(insn, param))
+                dirty[blk->id] = true;
+        }
+    }
+
+    /* A block is clean if every path into it is */
+    while (changed) {
+        changed = false;
+        TAILQ_FOREACH(blk, &proc->blocks, link) {
+            clean = blk == TAILQ_FIRST(&proc->blocks) || blk->npreds > 0;
+            for (size_t i = 0; i < blk->npreds && clean; ++i) {
+                if (!in[blk->preds[i]->id] || dirty[blk->preds[i]->id])
+                    clean = false;
+            }
+
+            if (clean != in[blk->id]) {
+                in[blk->id] = clean;
+                changed = true;
+            }
+        }
+    }
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        if (!in[blk->id])
+            continue;
+
+        TAILQ_FOREACH(insn, &blk->insns, link) {
+            if (insn->op == IR_LOAD && strcmp(insn->sym, param->sym) == 0) {
+                insn->op = IR_MOV;
+                insn->a.type = IR_VAL_IMM;
+                insn->a.imm = imm;
+                insn->sym = NULL;
+                insn->var = NULL;
+                ++count;
+            }
+
+            if (insn->b.type == IR_VAL_MEM &&
+                strcmp(insn->b.mem.sym, param->sym) == 0) {
+                insn->b.type = IR_VAL_IMM;
+                insn->b.imm = imm;
+                ++count;
+            }
+
+            if (ipcp_writes(insn, param))
+                break;
+        }
+    }
+
+    free(in);
+    free(dirty);
+    return count;
+}
+
+/*
+ * Specialize a procedure for the parameters known at a
+ * call and clean it up
+ *
+ * @state:   Compiler state
+ * @proc:    Procedure
+ * @params:  Parameters of the procedure
+ * @nparams: Number of parameters
+ * @known:   Set for each parameter to specialize for
+ * @imm:     Value of each parameter
+ *
+ * Returns the number of reads replaced, or a less than
+ * zero value on failure.
+ */
+static int
+ipcp_specialize(struct bup_state *state, struct ir_proc *proc,
+    struct ipcp_param *params, size_t nparams, const bool *known,
+    const ssize_t *imm)
+{
+    int n, count = 0;
+
+    if (ir_cfg_build(state, proc) < 0) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < nparams; ++i) {
+        if (!known[i])
+            continue;
+        if ((n = ipcp_subst(proc, &params[i], imm[i])) < 0)
+            return -1;
+
+        count += n;
+    }
+
+    if (count > 0 && opt_simplify(state, proc) < 0) {
+        return -1;
+    }
+
+    return count;
+}
+
+/*
+ * Returns true if a procedure may be copied. Blocks of a
+ * copy lose their labels, so inline assembly must neither
+ * define labels nor mention those of the blocks.
+ */
+static bool
+ipcp_can_clone(struct ir_proc *proc)
+{
+    struct ir_block *blk, *cur;
+    struct ir_insn *insn;
+
+    TAILQ_FOREACH(cur, &proc->blocks, link) {
+        TAILQ_FOREACH(insn, &cur->insns, link) {
+            if (insn->op != IR_ASM)
+                continue;
+            if (strchr(insn->text, ':') != NULL)
+                return false;
+
+            TAILQ_FOREACH(blk, &proc->blocks, link) {
+                if (blk->label != NULL && opt_mentions(insn->text, blk->label))
+                    return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Returns true if a name is already used by a symbol or
+ * an item of the unit
+ */
+static bool
+ipcp_name_taken(struct bup_state *state, struct ir_unit *unit,
+    const char *name)
+{
+    struct ir_item *item;
+    struct symbol *symbol;
+
+    if (symbol_from_name(&state->symtab, name) != NULL) {
+        return true;
+    }
+
+    TAILQ_FOREACH(item, &unit->items, link) {
+        symbol = (item->type == IR_ITEM_PROC) ? item->proc->symbol : item->symbol;
+        if (symbol != NULL && strcmp(symbol->name, name) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * Copy a procedure into a new internal procedure that is
+ * not yet part of the unit. The clone is named
+ * '<proc>_constprop_<n>' for the first free 'n' from
+ * 'index', a name without dots as those are the local
+ * labels of a procedure.
+ *
+ * @state: Compiler state
+ * @unit:  Translation unit
+ * @proc:  Procedure to copy
+ * @index: Number of the clone
+ *
+ * Returns NULL on failure
+ */
+static struct ir_item *
+ipcp_clone(struct bup_state *state, struct ir_unit *unit,
+    struct ir_proc *proc, size_t index)
+{
+    struct ir_block **map, *src;
+    struct ir_insn *insn, *copy;
+    struct ir_item *item;
+    struct ir_proc *clone;
+    struct symbol *symbol;
+    char name[256];
+
+    item = ptrbox_alloc(&state->ptrbox, sizeof(*item));
+    clone = ptrbox_alloc(&state->ptrbox, sizeof(*clone));
+    symbol = ptrbox_alloc(&state->ptrbox, sizeof(*symbol));
+    if (item == NULL || clone == NULL || symbol == NULL) {
+        errno = -ENOMEM;
+        return NULL;
+    }
+
+    do {
+        snprintf(name, sizeof(name), "%s_constprop_%zu", proc->symbol->name,
+            index++);
+    } while (ipcp_name_taken(state, unit, name));
+
+    memcpy(symbol, proc->symbol, sizeof(*symbol));
+    if ((symbol->name = ptrbox_strdup(&state->ptrbox, name)) == NULL) {
+        errno = -ENOMEM;
+        return NULL;
+    }
+
+    symbol->is_global = 0;
+    memset(clone, 0, sizeof(*clone));
+    clone->symbol = symbol;
+    clone->section = proc->section;
+    clone->nblocks = proc->nblocks;
+    clone->nvregs = proc->nvregs;
+    TAILQ_INIT(&clone->blocks);
+
+    memset(item, 0, sizeof(*item));
+    item->type = IR_ITEM_PROC;
+    item->proc = clone;
+
+    if ((map = calloc(proc->nblocks, sizeof(*map))) == NULL) {
+        errno = -ENOMEM;
+        return NULL;
+    }
+
+    TAILQ_FOREACH(src, &proc->blocks, link) {
+        if ((map[src->id] = ir_block_new(state, NULL)) == NULL)
+            goto fail;
+
+        map[src->id]->id = src->id;
+        map[src->id]->unroll = src->unroll;
+        TAILQ_INSERT_TAIL(&clone->blocks, map[src->id], link);
+    }
+
+    TAILQ_FOREACH(src, &proc->blocks, link) {
+        TAILQ_FOREACH(insn, &src->insns, link) {
+            if ((copy = ptrbox_alloc(&state->ptrbox, sizeof(*copy))) == NULL) {
+                errno = -ENOMEM;
+                goto fail;
+            }
+
+            memcpy(copy, insn, sizeof(*copy));
+            for (int i = 0; i < 2; ++i) {
+                if (copy->target[i] != NULL)
+                    copy->target[i] = map[copy->target[i]->id];
+            }
+
+            TAILQ_INSERT_TAIL(&map[src->id]->insns, copy, link);
+        }
+    }
+
+    free(map);
+    return item;
+fail:
+    free(map);
+    return NULL;
+}
+
+/*
+ * Returns true if two calls know the same parameters,
+ * apart from those already specialized for
+ *
+ * @a:       First call
+ * @b:       Second call
+ * @nparams: Number of parameters
+ * @skip:    Set for each parameter to ignore
+ */
+static bool
+ipcp_site_same(struct ipcp_site *a, struct ipcp_site *b, size_t nparams,
+    const bool *skip)
+{
+    for (size_t i = 0; i < nparams; ++i) {
+        if (skip[i])
+            continue;
+        if (a->known[i] != b->known[i])
+            return false;
+        if (a->known[i] && a->imm[i] != b->imm[i])
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Point groups of calls that agree on constants at clones
+ * specialized for them, where a clone pays off
+ *
+ * @state:   Compiler state
+ * @unit:    Translation unit
+ * @node:    Called procedure
+ * @params:  Parameters of the procedure
+ * @nparams: Number of parameters
+ * @sites:   Calls of the procedure
+ * @nsites:  Number of calls
+ * @skip:    Set for each parameter already specialized for
+ *
+ * Returns the number of clones made, or a less than zero
+ * value on failure.
+ */
+static int
+ipcp_clone_sites(struct bup_state *state, struct ir_unit *unit,
+    struct callgraph_node *node, struct ipcp_param *params, size_t nparams,
+    struct ipcp_site *sites, size_t nsites, const bool *skip)
+{
+    struct ir_proc *proc = node->item->proc;
+    struct ir_item *item, *at = node->item;
+    struct ipcp_site *site;
+    bool known[IPCP_MAX_PARAMS], any;
+    size_t cost, base, ncalls, nclones = 0;
+
+    base = ipcp_cost(proc);
+    for (size_t i = 0; i < nsites && nclones < IPCP_MAX_CLONES; ++i) {
+        site = &sites[i];
+        if (site->done)
+            continue;
+
+        any = false;
+        for (size_t j = 0; j < nparams; ++j) {
+            known[j] = site->known[j] && !skip[j];
+            any |= known[j];
+        }
+
+        if (!any)
+            continue;
+
+        item = ipcp_clone(state, unit, proc, nclones);
+        if (item == NULL)
+            return -1;
+        if (ipcp_specialize(state, item->proc, params, nparams, known, site->imm) < 0)
+            return -1;
+
+        /* The calls alike share the verdict */
+        ncalls = 0;
+        for (size_t j = i; j < nsites; ++j) {
+            if (sites[j].done || !ipcp_site_same(site, &sites[j], nparams, skip))
+                continue;
+
+            sites[j].done = true;
+            ++ncalls;
+        }
+
+        cost = ipcp_cost(item->proc);
+        if (cost > IPCP_CLONE_MAX_COST || cost + IPCP_CLONE_MIN_GAIN > base)
+            continue;
+
+        for (size_t j = i; j < nsites; ++j) {
+            if (sites[j].done && ipcp_site_same(site, &sites[j], nparams, skip))
+                sites[j].call->sym = item->proc->symbol->name;
+        }
+
+        trace_debug("ipcp: %s for %zu calls, %zu instructions instead of %zu\n",
+            item->proc->symbol->name, ncalls, cost, base);
+        TAILQ_INSERT_AFTER(&unit->items, at, item, link);
+        node->moved += ncalls;
+        at = item;
+        ++nclones;
+    }
+
+    return nclones;
+}
+
+/*
+ * Specialize a procedure for the constants its calls
+ * store to the globals it reads
+ *
+ * @state: Compiler state
+ * @unit:  Translation unit
+ * @node:  Procedure
+ *
+ * Returns the number of changes made, or a less than zero
+ * value on failure.
+ */
+static int
+ipcp_proc(struct bup_state *state, struct ir_unit *unit,
+    struct callgraph_node *node)
+{
+    struct ir_proc *proc = node->item->proc;
+    const char *name = proc->symbol->name;
+    struct ipcp_param params[IPCP_MAX_PARAMS];
+    struct ipcp_site *sites;
+    struct ir_item *item;
+    struct ir_block *blk;
+    struct ir_insn *insn;
+    bool same[IPCP_MAX_PARAMS], local, any = false;
+    size_t nparams, nsites = 0;
+    int n, count = 0;
+
+    if ((nparams = ipcp_params(proc, params)) == 0 || node->calls == 0) {
+        return 0;
+    }
+
+    if ((sites = calloc(node->calls, sizeof(*sites))) == NULL) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    TAILQ_FOREACH(item, &unit->items, link) {
+        if (item->type != IR_ITEM_PROC)
+            continue;
+
+        TAILQ_FOREACH(blk, &item->proc->blocks, link) {
+            TAILQ_FOREACH(insn, &blk->insns, link) {
+                if (insn->op != IR_CALL && insn->op != IR_TAILCALL)
+                    continue;
+                if (strcmp(insn->sym, name) != 0 || nsites == node->calls)
+                    continue;
+
+                sites[nsites].call = insn;
+                ipcp_site_values(&sites[nsites++], params, nparams);
+            }
+        }
+    }
+
+    /* Every caller agrees, nothing outside the unit may call */
+    local = !proc->symbol->is_global && !node->mentioned;
+    for (size_t i = 0; i < nparams; ++i) {
+        same[i] = local && nsites > 0;
+        for (size_t j = 0; j < nsites && same[i]; ++j) {
+            if (!sites[j].known[i] || sites[j].imm[i] != sites[0].imm[i])
+                same[i] = false;
+        }
+
+        if (same[i])
+            trace_debug("ipcp: %s = %zd in %s\n", params[i].sym, sites[0].imm[i], name);
+        any |= same[i];
+    }
+
+    if (any) {
+        if ((n = ipcp_specialize(state, proc, params, nparams, same, sites[0].imm)) < 0)
+            goto fail;
+
+        count += n;
+    }
+
+    if (state->opt_level == PASS_O2 && ipcp_can_clone(proc)) {
+        n = ipcp_clone_sites(state, unit, node, params, nparams, sites, nsites, same);
+        if (n < 0)
+            goto fail;
+
+        count += n;
+    }
+
+    free(sites);
+    return count;
+fail:
+    free(sites);
+    return -1;
+}
+
+/*
+ * Find out if a procedure returns the same constant on
+ * every path
+ *
+ * @graph: Procedures of the unit
+ * @rets:  What each procedure of the graph returns
+ * @proc:  Procedure
+ * @res:   Constant returned is written here
+ */
+static bool
+ipcp_returns(struct callgraph *graph, struct ipcp_ret *rets,
+    struct ir_proc *proc, ssize_t *res)
+{
+    msize_t size = datum_msize(&proc->symbol->data_type);
+    struct ir_block *blk;
+    struct ir_insn *insn, *prev;
+    bool seen = false;
+    ssize_t callee;
+    ssize_t imm;
+
+    if (size == MSIZE_BAD) {
+        return false;
+    }
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        TAILQ_FOREACH(insn, &blk->insns, link) {
+            switch (insn->op) {
+            case IR_ASM:
+                if (opt_mentions(insn->text, "ret"))
+                    return false;
+                continue;
+            case IR_RET:
+                if (insn->a.type == IR_VAL_IMM) {
+                    imm = opt_trunc(size, insn->a.imm);
+                    break;
+                }
+
+                /* Passes on what a call just returned */
+                prev = TAILQ_PREV(insn, ir_insn_q, link);
+                if (insn->a.type != IR_VAL_NONE || prev == NULL || prev->op != IR_CALL)
+                    return false;
+
+                callee = callgraph_find(graph, prev->sym);
+                if (callee < 0 || !rets[callee].known)
+                    return false;
+
+                imm = opt_trunc(size, rets[callee].imm);
+                break;
+            case IR_TAILCALL:
+                callee = callgraph_find(graph, insn->sym);
+                if (callee < 0 || !rets[callee].known)
+                    return false;
+
+                imm = opt_trunc(size, rets[callee].imm);
+                break;
+            default:
+                continue;
+            }
+
+            if (seen && imm != *res)
+                return false;
+
+            *res = imm;
+            seen = true;
+        }
+    }
+
+    return seen;
+}
+
+/*
+ * Record what each procedure returns and hand constants
+ * to calls whose result is kept in a register
+ *
+ * @state: Compiler state
+ * @unit:  Translation unit
+ * @graph: Procedures of the unit
+ *
+ * Returns the number of calls changed, or a less than zero
+ * value on failure.
+ */
+static int
+ipcp_propagate_returns(struct bup_state *state, struct ir_unit *unit,
+    struct callgraph *graph)
+{
+    struct ipcp_ret *rets;
+    struct ir_proc *proc;
+    struct ir_item *item;
+    struct ir_block *blk;
+    struct ir_insn *insn, *mov;
+    bool changed = true;
+    ssize_t imm, callee;
+    int calls = 0;
+
+    if ((rets = calloc(graph->count, sizeof(*rets))) == NULL) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    /* Passing on results chains procedures, go until settled */
+    for (size_t round = 0; changed && round <= graph->count; ++round) {
+        changed = false;
+        for (size_t i = 0; i < graph->count; ++i) {
+            proc = graph->nodes[i].item->proc;
+            if (rets[i].known || !ipcp_returns(graph, rets, proc, &imm))
+                continue;
+
+            trace_debug("ipcp: %s returns %zd\n", proc->symbol->name, imm);
+            rets[i].known = true;
+            rets[i].imm = imm;
+            changed = true;
+        }
+    }
+
+    TAILQ_FOREACH(item, &unit->items, link) {
+        if (item->type != IR_ITEM_PROC)
+            continue;
+
+        TAILQ_FOREACH(blk, &item->proc->blocks, link) {
+            TAILQ_FOREACH(insn, &blk->insns, link) {
+                if (insn->op != IR_CALL || insn->dst == IR_NOREG)
+                    continue;
+
+                callee = callgraph_find(graph, insn->sym);
+                if (callee < 0 || !rets[callee].known)
+                    continue;
+                if ((mov = ir_insn_new(state, IR_MOV, insn->size)) == NULL) {
+                    free(rets);
+                    return -1;
+                }
+
+                mov->dst = insn->dst;
+                mov->a.type = IR_VAL_IMM;
+                mov->a.imm = opt_trunc(insn->size, rets[callee].imm);
+                insn->dst = IR_NOREG;
+                TAILQ_INSERT_AFTER(&blk->insns, insn, mov, link);
+                ++calls;
+            }
+        }
+    }
+
+    free(rets);
+    return calls;
+}
+
+int
+ipcp_unit(struct bup_state *state, struct ir_unit *unit)
+{
+    struct callgraph graph;
+    int n, changes = 0;
+
+    if (state == NULL || unit == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if (callgraph_build(unit, &graph) < 0) {
+        return -1;
+    }
+
+    if (graph.count == 0) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < graph.count; ++i) {
+        if ((n = ipcp_proc(state, unit, &graph.nodes[i])) < 0)
+            goto fail;
+
+        changes += n;
+    }
+
+    /* Drop internal procedures whose calls all went to clones */
+    callgraph_drop(unit, &graph, "ipcp");
+    if ((n = ipcp_propagate_returns(state, unit, &graph)) < 0)
+        goto fail;
+
+    callgraph_release(&graph);
+    return changes + n;
+fail:
+    callgraph_release(&graph);
+    return -1;
+}
@@ -0,0 +1,615 @@
+/*
+ * Copyright (C) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "bup/ir.h"
+#include "bup/ptrbox.h"
+#include "bup/trace.h"
+
+/* Operation name lookup table */
+static const char *optab[] = {
+    [IR_MOV]   = "mov",
+    [IR_ADD]   = "add",
+    [IR_SUB]   = "sub",
+    [IR_MUL]   = "mul",
+    [IR_LOAD]  = "load",
+    [IR_STORE] = "store",
+    [IR_LOADX] = "loadx",
+    [IR_STOREX] = "storex",
+    [IR_ADDR]  = "addr",
+    [IR_SET]   = "set",
+    [IR_SEL]   = "sel",
+    [IR_CALL]  = "call",
+    [IR_ASM]   = "asm",
+    [IR_JMP]   = "jmp",
+    [IR_BR]    = "br",
+    [IR_RET]   = "ret",
+    [IR_TAILCALL] = "tailcall"
+};
+
+/* Branch condition lookup table */
+static const char *condtab[] = {
+    [IR_COND_NZ] = "nz",
+    [IR_COND_EQ] = "eq",
+    [IR_COND_NE] = "ne",
+    [IR_COND_LT] = "lt",
+    [IR_COND_LE] = "le",
+    [IR_COND_GT] = "gt",
+    [IR_COND_GE] = "ge"
+};
+
+/* Type name lookup table */
+static const char *typetab[] = {
+    [MSIZE_BAD]   = "void",
+    [MSIZE_BYTE]  = "u8",
+    [MSIZE_WORD]  = "u16",
+    [MSIZE_DWORD] = "u32",
+    [MSIZE_QWORD] = "u64"
+};
+
+struct ir_unit *
+ir_unit_new(struct bup_state *state)
+{
+    struct ir_unit *unit;
+
+    unit = ptrbox_alloc(&state->ptrbox, sizeof(*unit));
+    if (unit == NULL) {
+        errno = -ENOMEM;
+        return NULL;
+    }
+
+    memset(unit, 0, sizeof(*unit));
+    TAILQ_INIT(&unit->items);
+    return unit;
+}
+
+struct ir_item *
+ir_item_new(struct bup_state *state, ir_item_type_t type)
+{
+    struct ir_item *item;
+
+    if (state == NULL || state->ir == NULL) {
+        errno = -EINVAL;
+        return NULL;
+    }
+
+    item = ptrbox_alloc(&state->ptrbox, sizeof(*item));
+    if (item == NULL) {
+        errno = -ENOMEM;
+        return NULL;
+    }
+
+    memset(item, 0, sizeof(*item));
+    item->type = type;
+    TAILQ_INSERT_TAIL(&state->ir->items, item, link);
+    return item;
+}
+
+struct ir_proc *
+ir_proc_new(struct bup_state *state, struct symbol *symbol,
+    const char *section)
+{
+    struct ir_item *item;
+    struct ir_proc *proc;
+    struct ir_block *entry;
+
+    if ((item = ir_item_new(state, IR_ITEM_PROC)) == NULL) {
+        return NULL;
+    }
+
+    proc = ptrbox_alloc(&state->ptrbox, sizeof(*proc));
+    if (proc == NULL) {
+        errno = -ENOMEM;
+        return NULL;
+    }
+
+    memset(proc, 0, sizeof(*proc));
+    proc->symbol = symbol;
+    proc->section = section;
+    TAILQ_INIT(&proc->blocks);
+
+    item->proc = proc;
+    state->ir->proc = proc;
+    state->ir->cur = NULL;
+
+    /* The entry block goes by the procedure name */
+    if ((entry = ir_block_new(state, NULL)) == NULL) {
+        return NULL;
+    }
+
+    if (ir_block_place(state, entry) < 0) {
+        return NULL;
+    }
+
+    return proc;
+}
+
+struct ir_block *
+ir_block_new(struct bup_state *state, const char *label)
+{
+    struct ir_block *blk;
+
+    blk = ptrbox_alloc(&state->ptrbox, sizeof(*blk));
+    if (blk == NULL) {
+        errno = -ENOMEM;
+        return NULL;
+    }
+
+    memset(blk, 0, sizeof(*blk));
+    if (label != NULL) {
+        blk->label = ptrbox_strdup(&state->ptrbox, label);
+    }
+
+    TAILQ_INIT(&blk->insns);
+    return blk;
+}
+
+struct ir_insn *
+ir_block_term(struct ir_block *blk)
+{
+    struct ir_insn *last;
+
+    if (blk == NULL) {
+        return NULL;
+    }
+
+    last = TAILQ_LAST(&blk->insns, ir_insn_q);
+    if (last == NULL || !ir_is_term(last->op)) {
+        return NULL;
+    }
+
+    return last;
+}
+
+int
+ir_block_place(struct bup_state *state, struct ir_block *blk)
+{
+    struct ir_unit *unit = state->ir;
+    struct ir_insn *jmp;
+
+    if (unit->proc == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    /* Make fallthrough explicit */
+    if (unit->cur != NULL && ir_block_term(unit->cur) == NULL) {
+        if ((jmp = ir_emit(state, IR_JMP, MSIZE_BAD)) == NULL)
+            return -1;
+
+        jmp->target[0] = blk;
+    }
+
+    blk->id = unit->proc->nblocks++;
+    TAILQ_INSERT_TAIL(&unit->proc->blocks, blk, link);
+    unit->cur = blk;
+    return 0;
+}
+
+void
+ir_block_name(struct ir_proc *proc, struct ir_block *blk, char *buf,
+    size_t len)
+{
+    if (blk->label != NULL) {
+        snprintf(buf, len, "%s", blk->label);
+    } else if (blk == TAILQ_FIRST(&proc->blocks)) {
+        snprintf(buf, len, "%s", proc->symbol->name);
+    } else {
+        snprintf(buf, len, "%s.B%zu", proc->symbol->name, blk->id);
+    }
+}
+
+struct ir_insn *
+ir_insn_new(struct bup_state *state, ir_op_t op, msize_t size)
+{
+    struct ir_insn *insn;
+
+    insn = ptrbox_alloc(&state->ptrbox, sizeof(*insn));
+    if (insn == NULL) {
+        errno = -ENOMEM;
+        return NULL;
+    }
+
+    memset(insn, 0, sizeof(*insn));
+    insn->op = op;
+    insn->size = size;
+    insn->dst = IR_NOREG;
+    return insn;
+}
+
+struct ir_insn *
+ir_emit(struct bup_state *state, ir_op_t op, msize_t size)
+{
+    struct ir_unit *unit = state->ir;
+    struct ir_block *blk;
+    struct ir_insn *insn;
+
+    if (unit->proc == NULL || unit->cur == NULL) {
+        errno = -EINVAL;
+        return NULL;
+    }
+
+    /* Anything after a terminator starts a new block */
+    if (ir_block_term(unit->cur) != NULL) {
+        if ((blk = ir_block_new(state, NULL)) == NULL)
+            return NULL;
+        if (ir_block_place(state, blk) < 0)
+            return NULL;
+    }
+
+    if ((insn = ir_insn_new(state, op, size)) == NULL) {
+        return NULL;
+    }
+
+    TAILQ_INSERT_TAIL(&unit->cur->insns, insn, link);
+    return insn;
+}
+
+ir_vreg_t
+ir_vreg_new(struct bup_state *state)
+{
+    return state->ir->proc->nvregs++;
+}
+
+ir_cond_t
+ir_cond_negate(ir_cond_t cond)
+{
+    switch (cond) {
+    case IR_COND_EQ:
+        return IR_COND_NE;
+    case IR_COND_NE:
+        return IR_COND_EQ;
+    case IR_COND_LT:
+        return IR_COND_GE;
+    case IR_COND_LE:
+        return IR_COND_GT;
+    case IR_COND_GT:
+        return IR_COND_LE;
+    case IR_COND_GE:
+        return IR_COND_LT;
+    default:
+        break;
+    }
+
+    return cond;
+}
+
+ir_cond_t
+ir_cond_swap(ir_cond_t cond)
+{
+    switch (cond) {
+    case IR_COND_LT:
+        return IR_COND_GT;
+    case IR_COND_LE:
+        return IR_COND_GE;
+    case IR_COND_GT:
+        return IR_COND_LT;
+    case IR_COND_GE:
+        return IR_COND_LE;
+    default:
+        break;
+    }
+
+    return cond;
+}
+
+bool
+ir_cond_holds(ir_cond_t cond, size_t a, size_t b)
+{
+    switch (cond) {
+    case IR_COND_EQ:
+        return a == b;
+    case IR_COND_NE:
+        return a != b;
+    case IR_COND_LT:
+        return a < b;
+    case IR_COND_LE:
+        return a <= b;
+    case IR_COND_GT:
+        return a > b;
+    case IR_COND_GE:
+        return a >= b;
+    default:
+        break;
+    }
+
+    return a != 0;
+}
+
+size_t
+ir_operands(struct ir_insn *insn, struct ir_value *res[IR_MAX_OPERANDS])
+{
+    res[0] = &insn->a;
+    res[1] = &insn->b;
+    res[2] = &insn->base;
+    res[3] = &insn->sel[0];
+    res[4] = &insn->sel[1];
+    return IR_MAX_OPERANDS;
+}
+
+size_t
+ir_succs(struct ir_block *blk, struct ir_block *res[2])
+{
+    struct ir_insn *term;
+
+    if ((term = ir_block_term(blk)) == NULL) {
+        return 0;
+    }
+
+    switch (term->op) {
+    case IR_JMP:
+        res[0] = term->target[0];
+        return 1;
+    case IR_BR:
+        res[0] = term->target[0];
+        res[1] = term->target[1];
+        return (res[0] == res[1]) ? 1 : 2;
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+int
+ir_cfg_build(struct bup_state *state, struct ir_proc *proc)
+{
+    struct ir_block *blk, *succ[2];
+    size_t n;
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        blk->npreds = 0;
+    }
+
+    /* Count first, then fill */
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        n = ir_succs(blk, succ);
+        for (size_t i = 0; i < n; ++i)
+            ++succ[i]->npreds;
+    }
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        blk->preds = ptrbox_alloc(&state->ptrbox, (blk->npreds + 1) * sizeof(*blk->preds));
+        if (blk->preds == NULL) {
+            errno = -ENOMEM;
+            return -1;
+        }
+
+        blk->npreds = 0;
+    }
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        n = ir_succs(blk, succ);
+        for (size_t i = 0; i < n; ++i)
+            succ[i]->preds[succ[i]->npreds++] = blk;
+    }
+
+    return 0;
+}
+
+/*
+ * Print an operand
+ */
+static void
+ir_dump_value(struct ir_value *val, FILE *fp)
+{
+    switch (val->type) {
+    case IR_VAL_IMM:
+        fprintf(fp, "%zd", val->imm);
+        break;
+    case IR_VAL_VREG:
+        fprintf(fp, "%%%zu", val->vreg);
+        break;
+    case IR_VAL_MEM:
+        fprintf(fp, "%s [%s]", typetab[val->mem.msize], val->mem.sym);
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * Print the address of an indexed access
+ *
+ * @insn:  Indexed load or store
+ * @index: Index operand
+ * @fp:    Output file
+ */
+static void
+ir_dump_addr(struct ir_insn *insn, struct ir_value *index, FILE *fp)
+{
+    fprintf(fp, "[%s", insn->sym);
+    if (insn->base.type != IR_VAL_NONE) {
+        fprintf(fp, " @ ");
+        ir_dump_value(&insn->base, fp);
+    }
+
+    if (index->type != IR_VAL_NONE) {
+        fprintf(fp, " + ");
+        ir_dump_value(index, fp);
+        fprintf(fp, "*%zu", insn->scale);
+    }
+
+    if (insn->disp != 0) {
+        fprintf(fp, " %c %zd", (insn->disp < 0) ? '-' : '+',
+            (insn->disp < 0) ? -insn->disp : insn->disp);
+    }
+
+    fprintf(fp, "]");
+}
+
+/*
+ * Print the condition of a branch, set or select
+ */
+static void
+ir_dump_cond(struct ir_insn *insn, FILE *fp)
+{
+    fprintf(fp, " ");
+    ir_dump_value(&insn->a, fp);
+    if (insn->cond != IR_COND_NZ) {
+        fprintf(fp, " %s ", condtab[insn->cond]);
+        ir_dump_value(&insn->b, fp);
+    }
+}
+
+/*
+ * Print a single instruction
+ */
+static void
+ir_dump_insn(struct ir_proc *proc, struct ir_insn *insn, FILE *fp)
+{
+    char name[2][64];
+
+    fprintf(fp, "\t");
+    if (insn->dst != IR_NOREG) {
+        fprintf(fp, "%%%zu = ", insn->dst);
+    }
+
+    fprintf(fp, "%s", optab[insn->op]);
+    if (insn->size != MSIZE_BAD) {
+        fprintf(fp, ".%s", typetab[insn->size]);
+    }
+
+    switch (insn->op) {
+    case IR_LOAD:
+        fprintf(fp, " %s [%s]", typetab[insn->msize], insn->sym);
+        break;
+    case IR_STORE:
+        fprintf(fp, " [%s], ", insn->sym);
+        ir_dump_value(&insn->a, fp);
+        break;
+    case IR_LOADX:
+        fprintf(fp, " %s ", typetab[insn->msize]);
+        ir_dump_addr(insn, &insn->a, fp);
+        break;
+    case IR_STOREX:
+        fprintf(fp, " ");
+        ir_dump_addr(insn, &insn->b, fp);
+        fprintf(fp, ", ");
+        ir_dump_value(&insn->a, fp);
+        break;
+    case IR_ADDR:
+    case IR_CALL:
+    case IR_TAILCALL:
+        fprintf(fp, " %s", insn->sym);
+        break;
+    case IR_ASM:
+        fprintf(fp, " \"%s\"", insn->text);
+        break;
+    case IR_JMP:
+        ir_block_name(proc, insn->target[0], name[0], sizeof(name[0]));
+        fprintf(fp, " %s", name[0]);
+        break;
+    case IR_BR:
+        ir_block_name(proc, insn->target[0], name[0], sizeof(name[0]));
+        ir_block_name(proc, insn->target[1], name[1], sizeof(name[1]));
+        ir_dump_cond(insn, fp);
+        fprintf(fp, ", %s, %s", name[0], name[1]);
+        if (insn->hint != 0)
+            fprintf(fp, " (%s)", (insn->hint > 0) ? "likely" : "unlikely");
+        break;
+    case IR_SET:
+        ir_dump_cond(insn, fp);
+        break;
+    case IR_SEL:
+        ir_dump_cond(insn, fp);
+        fprintf(fp, ", ");
+        ir_dump_value(&insn->sel[0], fp);
+        fprintf(fp, ", ");
+        ir_dump_value(&insn->sel[1], fp);
+        break;
+    default:
+        if (insn->a.type != IR_VAL_NONE) {
+            fprintf(fp, " ");
+            ir_dump_value(&insn->a, fp);
+        }
+
+        if (insn->b.type != IR_VAL_NONE) {
+            fprintf(fp, ", ");
+            ir_dump_value(&insn->b, fp);
+        }
+        break;
+    }
+
+    fprintf(fp, "\n");
+}
+
+/*
+ * Print a procedure
+ */
+static void
+ir_dump_proc(struct ir_proc *proc, FILE *fp)
+{
+    struct symbol *symbol = proc->symbol;
+    struct ir_block *blk;
+    struct ir_insn *insn;
+    char name[64];
+
+    fprintf(
+        fp,
+        "proc %s%s -> %s [%s]\n",
+        symbol->is_global ? "pub " : "",
+        symbol->name,
+        typetab[datum_msize(&symbol->data_type)],
+        proc->section
+    );
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        ir_block_name(proc, blk, name, sizeof(name));
+        fprintf(fp, "%s:", name);
+        if (blk->npreds > 0) {
+            fprintf(fp, "\t\t; preds:");
+            for (size_t i = 0; i < blk->npreds; ++i) {
+                ir_block_name(proc, blk->preds[i], name, sizeof(name));
+                fprintf(fp, " %s", name);
+            }
+        }
+
+        fprintf(fp, "\n");
+        TAILQ_FOREACH(insn, &blk->insns, link) {
+            ir_dump_insn(proc, insn, fp);
+        }
+    }
+}
+
+void
+ir_dump(struct ir_unit *unit, FILE *fp)
+{
+    struct ir_item *item;
+    struct symbol *symbol;
+    struct datum_type *dtype;
+
+    TAILQ_FOREACH(item, &unit->items, link) {
+        symbol = item->symbol;
+        switch (item->type) {
+        case IR_ITEM_PROC:
+            ir_dump_proc(item->proc, fp);
+            break;
+        case IR_ITEM_ASM:
+            fprintf(fp, "asm \"%s\"\n", item->text);
+            break;
+        case IR_ITEM_VAR:
+            dtype = &symbol->data_type;
+            fprintf(fp, "var %s%s", symbol->is_global ? "pub " : "", symbol->name);
+            if (dtype->array_size > 0) {
+                fprintf(fp, "[%zu]\n", dtype->array_size);
+                break;
+            }
+
+            fprintf(fp, ": %s", typetab[datum_msize(dtype)]);
+            if (item->init) {
+                fprintf(fp, " = %zd", item->imm);
+            }
+
+            fprintf(fp, "\n");
+            break;
+        case IR_ITEM_STRUCT:
+            fprintf(fp, "struct %s: %s\n", symbol->name, symbol->parent->name);
+            break;
+        }
+    }
+}
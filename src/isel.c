@@ -0,0 +1,510 @@
+/*
+ * Copyright (C) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "bup/isel.h"
+
+/*
+ * Represents an instruction while selecting a block
+ *
+ * @insn:   Instruction
+ * @pos:    Position within the block
+ * @kids:   Nodes computing operands 'a' and 'b' if used only here
+ * @parent: Node using our result if we are its kid
+ * @cover:  Cheapest cover of the tree rooted here
+ * @cost:   Cost of that cover, kids included
+ */
+struct isel_node {
+    struct ir_insn *insn;
+    size_t pos;
+    struct isel_node *kids[2];
+    struct isel_node *parent;
+    struct isel_cover {
+        isel_rule_t rule;
+        size_t cost;
+        struct isel_node *covered[2];
+        struct isel_node *leaves[2];
+    } cover;
+    size_t cost;
+};
+
+/*
+ * Represents the state of selecting a procedure
+ *
+ * @ra:    Register allocation
+ * @nodes: Nodes of the block being selected
+ * @uses:  Number of uses of each virtual register
+ * @defs:  Node defining each virtual register in the block
+ */
+struct isel_ctx {
+    struct ra_result *ra;
+    struct isel_node *nodes;
+    size_t *uses;
+    struct isel_node **defs;
+};
+
+/*
+ * Represents a rule of the selector
+ *
+ * @rule:  Rule
+ * @cost:  Cost of the machine instruction it emits
+ * @match: Returns true if the rule covers a node, filling in
+ *         what it covers, what is left and any extra cost
+ */
+struct isel_pattern {
+    isel_rule_t rule;
+    size_t cost;
+    bool(*match)(struct isel_ctx *ctx, struct isel_node *node,
+        struct isel_cover *res);
+};
+
+/* Cost of lowering an operation on its own */
+static const size_t costtab[] = {
+    [IR_MOV]      = 1,
+    [IR_ADD]      = 1,
+    [IR_SUB]      = 1,
+    [IR_MUL]      = 3,
+    [IR_LOAD]     = 1,
+    [IR_STORE]    = 1,
+    [IR_LOADX]    = 1,
+    [IR_STOREX]   = 1,
+    [IR_ADDR]     = 1,
+    [IR_SET]      = 3,
+    [IR_SEL]      = 3,
+    [IR_CALL]     = 1,
+    [IR_ASM]      = 1,
+    [IR_JMP]      = 1,
+    [IR_BR]       = 2,
+    [IR_RET]      = 1,
+    [IR_TAILCALL] = 1
+};
+
+/*
+ * Returns true if an arithmetic instruction has to copy
+ * operand 'a' into the register of its result first
+ */
+static bool
+isel_copies(struct isel_ctx *ctx, struct ir_insn *insn)
+{
+    struct ra_loc *dst = &ctx->ra->locs[insn->dst];
+
+    if (insn->a.type != IR_VAL_VREG || dst->reg < 0) {
+        return true;
+    }
+
+    return ctx->ra->locs[insn->a.vreg].reg != dst->reg;
+}
+
+/*
+ * Returns true if anything between two positions of the
+ * block may write a variable
+ */
+static bool
+isel_writes(struct isel_ctx *ctx, size_t from, size_t to, const char *sym)
+{
+    struct ir_insn *insn;
+
+    for (size_t i = from + 1; i < to; ++i) {
+        insn = ctx->nodes[i].insn;
+        switch (insn->op) {
+        case IR_STORE:
+            if (strcmp(insn->sym, sym) == 0)
+                return true;
+            break;
+        case IR_STOREX:
+            /* A store through a pointer may land anywhere */
+            if (insn->base.type == IR_VAL_VREG || insn->sym == NULL)
+                return true;
+            if (strcmp(insn->sym, sym) == 0)
+                return true;
+            break;
+        case IR_CALL:
+        case IR_TAILCALL:
+        case IR_ASM:
+            return true;
+        default:
+            break;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Returns true if an immediate fits a sign extended
+ * 32-bit field
+ */
+static inline bool
+isel_imm32(ssize_t imm)
+{
+    return imm >= INT32_MIN && imm <= INT32_MAX;
+}
+
+/*
+ * store [x], (add|sub (load [x]), b)
+ *
+ * 'b' is read at the store instead of the operation so the
+ * two must be next to each other.
+ */
+static bool
+isel_match_rmw(struct isel_ctx *ctx, struct isel_node *node,
+    struct isel_cover *res)
+{
+    struct ir_insn *insn = node->insn;
+    struct isel_node *op = node->kids[0], *ld;
+
+    if (insn->op != IR_STORE || op == NULL) {
+        return false;
+    }
+
+    if (op->insn->op != IR_ADD && op->insn->op != IR_SUB) {
+        return false;
+    }
+
+    if (op->pos + 1 != node->pos || op->insn->size < insn->msize) {
+        return false;
+    }
+
+    if (op->insn->b.type == IR_VAL_MEM) {
+        return false;
+    }
+
+    if ((ld = op->kids[0]) == NULL || ld->insn->op != IR_LOAD) {
+        return false;
+    }
+
+    if (ld->insn->msize != insn->msize || strcmp(ld->insn->sym, insn->sym) != 0) {
+        return false;
+    }
+
+    if (isel_writes(ctx, ld->pos, node->pos, insn->sym)) {
+        return false;
+    }
+
+    res->covered[0] = op;
+    res->covered[1] = ld;
+    res->leaves[0] = op->kids[1];
+    return true;
+}
+
+/*
+ * add|sub|mul a, (load [x])
+ */
+static bool
+isel_match_memop(struct isel_ctx *ctx, struct isel_node *node,
+    struct isel_cover *res)
+{
+    struct ir_insn *insn = node->insn;
+    struct isel_node *ld = node->kids[1];
+
+    if (insn->op != IR_ADD && insn->op != IR_SUB && insn->op != IR_MUL) {
+        return false;
+    }
+
+    if (ld == NULL || ld->insn->op != IR_LOAD) {
+        return false;
+    }
+
+    /* The operand cannot be zero extended in place */
+    if (insn->size < MSIZE_DWORD || ld->insn->msize != insn->size) {
+        return false;
+    }
+
+    if (isel_writes(ctx, ld->pos, node->pos, ld->insn->sym)) {
+        return false;
+    }
+
+    res->cost = isel_copies(ctx, insn);
+    res->covered[0] = ld;
+    res->leaves[0] = node->kids[0];
+    return true;
+}
+
+/*
+ * add a, imm / sub a, imm / add a, b / mul a, 2|3|5|9
+ */
+static bool
+isel_match_lea(struct isel_ctx *ctx, struct isel_node *node,
+    struct isel_cover *res)
+{
+    struct ir_insn *insn = node->insn;
+    struct ir_value *b = &insn->b;
+
+    (void)ctx;
+    if (insn->a.type != IR_VAL_VREG) {
+        return false;
+    }
+
+    switch (insn->op) {
+    case IR_ADD:
+        if (b->type == IR_VAL_IMM && !isel_imm32(b->imm))
+            return false;
+        if (b->type != IR_VAL_IMM && b->type != IR_VAL_VREG)
+            return false;
+        break;
+    case IR_SUB:
+        if (b->type != IR_VAL_IMM || !isel_imm32(-b->imm))
+            return false;
+        break;
+    case IR_MUL:
+        if (b->type != IR_VAL_IMM)
+            return false;
+        if (b->imm != 2 && b->imm != 3 && b->imm != 5 && b->imm != 9)
+            return false;
+        break;
+    default:
+        return false;
+    }
+
+    res->leaves[0] = node->kids[0];
+    res->leaves[1] = node->kids[1];
+    return true;
+}
+
+/*
+ * add a, (mul b, 2|4|8)
+ *
+ * 'b' is read at the add instead of the multiply so the two
+ * must be next to each other.
+ */
+static bool
+isel_match_leaidx(struct isel_ctx *ctx, struct isel_node *node,
+    struct isel_cover *res)
+{
+    struct ir_insn *insn = node->insn, *mul;
+    struct ir_value *other;
+    struct isel_node *kid;
+
+    (void)ctx;
+    if (insn->op != IR_ADD) {
+        return false;
+    }
+
+    for (int i = 0; i < 2; ++i) {
+        if ((kid = node->kids[i]) == NULL)
+            continue;
+
+        mul = kid->insn;
+        other = (i == 0) ? &insn->b : &insn->a;
+        if (mul->op != IR_MUL || kid->pos + 1 != node->pos)
+            continue;
+        if (mul->size < insn->size || mul->a.type != IR_VAL_VREG)
+            continue;
+        if (mul->b.type != IR_VAL_IMM || other->type != IR_VAL_VREG)
+            continue;
+        if (mul->b.imm != 2 && mul->b.imm != 4 && mul->b.imm != 8)
+            continue;
+
+        res->covered[0] = kid;
+        res->leaves[0] = node->kids[!i];
+        res->leaves[1] = kid->kids[0];
+        return true;
+    }
+
+    return false;
+}
+
+/* Rules tried at each node, the cheapest cover wins */
+static const struct isel_pattern iseltab[] = {
+    { ISEL_RMW,    2, isel_match_rmw },
+    { ISEL_MEMOP,  1, isel_match_memop },
+    { ISEL_LEA,    1, isel_match_lea },
+    { ISEL_LEAIDX, 1, isel_match_leaidx }
+};
+
+/*
+ * Find the cheapest cover of the tree rooted at a node, its
+ * kids already have theirs
+ */
+static void
+isel_label(struct isel_ctx *ctx, struct isel_node *node)
+{
+    struct ir_insn *insn = node->insn;
+    struct isel_cover cover;
+    size_t cost;
+
+    memset(&node->cover, 0, sizeof(node->cover));
+    node->cover.rule = ISEL_SELF;
+    node->cover.cost = costtab[insn->op];
+    node->cover.leaves[0] = node->kids[0];
+    node->cover.leaves[1] = node->kids[1];
+    if (insn->op == IR_ADD || insn->op == IR_SUB || insn->op == IR_MUL) {
+        node->cover.cost += isel_copies(ctx, insn);
+    }
+
+    node->cost = node->cover.cost;
+    for (int i = 0; i < 2; ++i) {
+        if (node->kids[i] != NULL)
+            node->cost += node->kids[i]->cost;
+    }
+
+    for (size_t i = 0; i < sizeof(iseltab) / sizeof(iseltab[0]); ++i) {
+        memset(&cover, 0, sizeof(cover));
+        if (!iseltab[i].match(ctx, node, &cover))
+            continue;
+
+        cover.rule = iseltab[i].rule;
+        cover.cost += iseltab[i].cost;
+        cost = cover.cost;
+        for (int j = 0; j < 2; ++j) {
+            if (cover.leaves[j] != NULL)
+                cost += cover.leaves[j]->cost;
+        }
+
+        if (cost < node->cost) {
+            node->cover = cover;
+            node->cost = cost;
+        }
+    }
+}
+
+/*
+ * Apply the cover chosen for a tree
+ *
+ * @node: Root of tree
+ * @res:  Choices of the block
+ */
+static void
+isel_reduce(struct isel_node *node, struct isel_choice *res)
+{
+    struct isel_cover *cover = &node->cover;
+
+    res[node->pos].rule = cover->rule;
+    res[node->pos].kid = NULL;
+    if (cover->covered[0] != NULL) {
+        res[node->pos].kid = cover->covered[0]->insn;
+    }
+
+    for (int i = 0; i < 2; ++i) {
+        if (cover->covered[i] != NULL)
+            res[cover->covered[i]->pos].rule = ISEL_COVERED;
+        if (cover->leaves[i] != NULL)
+            isel_reduce(cover->leaves[i], res);
+    }
+}
+
+/*
+ * Select the instructions of a block
+ *
+ * @ctx: Selection context
+ * @blk: Block
+ * @res: Choices of the block are written here
+ */
+static int
+isel_block(struct isel_ctx *ctx, struct ir_block *blk, struct isel_choice *res)
+{
+    struct isel_node *node;
+    struct ir_value *vals[2];
+    struct ir_insn *insn;
+    size_t count = 0;
+
+    TAILQ_FOREACH(insn, &blk->insns, link) {
+        ++count;
+    }
+
+    if ((ctx->nodes = calloc(count + 1, sizeof(*ctx->nodes))) == NULL) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    count = 0;
+    TAILQ_FOREACH(insn, &blk->insns, link) {
+        node = &ctx->nodes[count];
+        node->insn = insn;
+        node->pos = count++;
+
+        /* Values used only here join our tree */
+        vals[0] = &insn->a;
+        vals[1] = &insn->b;
+        for (int i = 0; i < 2; ++i) {
+            if (vals[i]->type != IR_VAL_VREG || ctx->uses[vals[i]->vreg] != 1)
+                continue;
+            if (ctx->defs[vals[i]->vreg] == NULL)
+                continue;
+
+            node->kids[i] = ctx->defs[vals[i]->vreg];
+            node->kids[i]->parent = node;
+        }
+
+        isel_label(ctx, node);
+        if (insn->dst != IR_NOREG)
+            ctx->defs[insn->dst] = node;
+    }
+
+    for (size_t i = count; i-- > 0;) {
+        node = &ctx->nodes[i];
+        if (node->parent == NULL)
+            isel_reduce(node, res);
+        if (node->insn->dst != IR_NOREG)
+            ctx->defs[node->insn->dst] = NULL;
+    }
+
+    free(ctx->nodes);
+    ctx->nodes = NULL;
+    return 0;
+}
+
+int
+isel_proc(struct bup_state *state, struct ir_proc *proc,
+    struct ra_result *ra, struct isel_choice **res)
+{
+    struct isel_ctx ctx;
+    struct isel_choice *choices;
+    struct ir_value *vals[IR_MAX_OPERANDS];
+    struct ir_block *blk;
+    struct ir_insn *insn;
+    size_t count = 0, nvals, base = 0;
+    int error = 0;
+
+    if (state == NULL || proc == NULL || ra == NULL || res == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        TAILQ_FOREACH(insn, &blk->insns, link)
+            ++count;
+    }
+
+    ctx.ra = ra;
+    ctx.nodes = NULL;
+    ctx.uses = calloc(proc->nvregs + 1, sizeof(*ctx.uses));
+    ctx.defs = calloc(proc->nvregs + 1, sizeof(*ctx.defs));
+    choices = calloc(count + 1, sizeof(*choices));
+    if (ctx.uses == NULL || ctx.defs == NULL || choices == NULL) {
+        errno = -ENOMEM;
+        error = -1;
+        goto done;
+    }
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        TAILQ_FOREACH(insn, &blk->insns, link) {
+            nvals = ir_operands(insn, vals);
+            for (size_t i = 0; i < nvals; ++i) {
+                if (vals[i]->type == IR_VAL_VREG)
+                    ++ctx.uses[vals[i]->vreg];
+            }
+        }
+    }
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        if ((error = isel_block(&ctx, blk, &choices[base])) < 0)
+            goto done;
+
+        TAILQ_FOREACH(insn, &blk->insns, link)
+            ++base;
+    }
+
+    *res = choices;
+    choices = NULL;
+done:
+    free(ctx.uses);
+    free(ctx.defs);
+    free(choices);
+    return error;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "bup/jit.h"
+#include "bup/link.h"
+#include "bup/trace.h"
+
+typedef uint64_t(*jit_entry_t)(void);
+
+/*
+ * Write a perf map entry for each chunk of code
+ *
+ * @img:  Loaded image
+ * @base: Base address of image
+ */
+static void
+jit_perf_map(struct link_image *img, uint64_t base)
+{
+    struct link_chunk *chunk;
+    struct asm_object *obj;
+    char path[64];
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+    if ((fp = fopen(path, "w")) == NULL) {
+        trace_warn("failed to open %s\n", path);
+        return;
+    }
+
+    for (size_t i = 0; i < img->nchunks; ++i) {
+        chunk = &img->chunks[i];
+        obj = &img->objs[chunk->obj];
+        if (!chunk->live || chunk->sym == ASM_UNDEF)
+            continue;
+        if (!obj->sections[chunk->section].exec)
+            continue;
+
+        fprintf(
+            fp,
+            "%lx %zx %s\n",
+            (unsigned long)(base + chunk->off),
+            chunk->end - chunk->start,
+            obj->symbols[chunk->sym].name
+        );
+    }
+
+    fclose(fp);
+}
+
+int
+jit_run(struct asm_object *objs, size_t nobjs, const char *entry, int *status)
+{
+    struct link_image img;
+    jit_entry_t fn;
+    uint64_t base, addr;
+    uint8_t *mem;
+    size_t page;
+
+    if (objs == NULL || entry == NULL || status == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    page = sysconf(_SC_PAGESIZE);
+    if (link_layout(&img, objs, nobjs, page, NULL) < 0) {
+        return -1;
+    }
+
+    mem = mmap(
+        NULL, img.size,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS,
+        -1, 0
+    );
+
+    if (mem == MAP_FAILED) {
+        trace_emit(TRACE_ERROR, 0, "jit: failed to map %zu bytes\n", img.size);
+        link_destroy(&img);
+        return -1;
+    }
+
+    base = (uint64_t)(uintptr_t)mem;
+    if (link_load(&img, mem, base) < 0) {
+        goto fail;
+    }
+
+    if (link_lookup(&img, entry, base, &addr) < 0) {
+        trace_emit(TRACE_ERROR, 0, "jit: no entry procedure %s\n", entry);
+        goto fail;
+    }
+
+    if (img.text_size > 0 && mprotect(mem, img.text_size, PROT_READ | PROT_EXEC) < 0) {
+        trace_emit(TRACE_ERROR, 0, "jit: failed to protect code\n");
+        goto fail;
+    }
+
+    jit_perf_map(&img, base);
+
+    *(void **)&fn = (void *)(uintptr_t)addr;
+    *status = fn() & 0xFF;
+
+    munmap(mem, img.size);
+    link_destroy(&img);
+    return 0;
+fail:
+    munmap(mem, img.size);
+    link_destroy(&img);
+    return -1;
+}
@@ -7,7 +7,6 @@
 #include <stdint.h>
 #include <ctype.h>
 #include <errno.h>
-#include <unistd.h>
 #include <stdlib.h>
 #include <stddef.h>
 #include <stdbool.h>
@@ -15,6 +14,25 @@
 #include "bup/lexer.h"
 #include "bup/trace.h"
 
+/*
+ * Read a single character from the input buffer
+ *
+ * @state: Compiler state
+ * @res:   Character result
+ *
+ * Returns true if a character was read
+ */
+static inline bool
+lexer_getc(struct bup_state *state, char *res)
+{
+    if (state->in_off >= state->in_len) {
+        return false;
+    }
+
+    *res = state->in_buf[state->in_off++];
+    return true;
+}
+
 static inline void
 lexer_putback_chr(struct bup_state *state, char c)
 {
@@ -39,7 +57,7 @@ lexer_skip_line(struct bup_state *state)
         return;
     }
 
-    while (read(state->in_fd, &c, 1) > 0) {
+    while (lexer_getc(state, &c)) {
         if (c == '\n') {
             break;
         }
@@ -100,7 +118,7 @@ lexer_nom(struct bup_state *state, bool skip_ws)
     }
 
     /* Begin scanning for tokens */
-    while (read(state->in_fd, &c, 1) > 0) {
+    while (lexer_getc(state, &c)) {
         if (c == '\n')
             ++state->line_num;
         if (lexer_is_ws(c) && skip_ws)
@@ -316,6 +334,18 @@ lexer_check_kw(struct bup_state *state, struct token *tok)
             return 0;
         }
 
+        if (strcmp(tok->s, "inline") == 0) {
+            tok->type = TT_INLINE;
+            return 0;
+        }
+
+        break;
+    case 'n':
+        if (strcmp(tok->s, "noinline") == 0) {
+            tok->type = TT_NOINLINE;
+            return 0;
+        }
+
         break;
     case 's':
         if (strcmp(tok->s, "struct") == 0) {
@@ -530,6 +560,21 @@ lexer_scan(struct bup_state *state, struct token *res)
     case '=':
         res->type = TT_EQUALS;
         res->c = c;
+        if ((c = lexer_nom(state, true)) != '=') {
+            lexer_putback_chr(state, c);
+            return 0;
+        }
+
+        res->type = TT_EQEQ;
+        return 0;
+    case '!':
+        res->c = c;
+        if ((c = lexer_nom(state, true)) != '=') {
+            trace_error(state, "expected '=' after '!'\n");
+            return -1;
+        }
+
+        res->type = TT_NEQ;
         return 0;
     case '(':
         res->type = TT_LPAREN;
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "bup/libbup.h"
+#include "bup/state.h"
+#include "bup/parser.h"
+#include "bup/ptrbox.h"
+#include "bup/mu.h"
+#include "bup/pass.h"
+
+/*
+ * Apply the optimization options to the compiler state
+ *
+ * @state: Compiler state
+ * @opts:  Options
+ *
+ * Returns zero on success
+ */
+static int
+bup_set_passes(struct bup_state *state, const struct bup_opts *opts)
+{
+    const char *const *name = opts->no_passes;
+    const struct pass *pass;
+    pass_level_t level;
+
+    if (opts->opt_level != NULL) {
+        if ((level = pass_level(opts->opt_level)) == PASS_OMAX) {
+            trace_emit(TRACE_ERROR, 0, "unknown optimization level -O%s\n", opts->opt_level);
+            return -1;
+        }
+
+        state->opt_level = level;
+    }
+
+    for (; name != NULL && *name != NULL; ++name) {
+        pass = pass_lookup(*name);
+        if (pass == NULL || pass->kind != PASS_TRANSFORM) {
+            trace_emit(TRACE_ERROR, 0, "no optional pass named %s\n", *name);
+            return -1;
+        }
+    }
+
+    state->no_passes = opts->no_passes;
+    state->time_passes = opts->time_passes;
+    return 0;
+}
+
+int
+bup_compile_buffer(const char *src, size_t len, const struct bup_opts *opts,
+    char **out, size_t *outlen)
+{
+    struct bup_state state;
+    FILE *out_fp;
+    char *buf = NULL;
+    size_t buflen = 0;
+    int error;
+
+    if (src == NULL || out == NULL || outlen == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if ((out_fp = open_memstream(&buf, &buflen)) == NULL) {
+        return -1;
+    }
+
+    if (bup_state_init(src, len, out_fp, &state) < 0) {
+        fclose(out_fp);
+        free(buf);
+        return -1;
+    }
+
+    if (opts != NULL) {
+        trace_set_hook(opts->diag, opts->diag_arg);
+        if (opts->no_sections)
+            state.cur_section = SECTION_DISABLED;
+
+        state.dump_ir = opts->dump_ir;
+        state.peep_stats = opts->peep_stats;
+        state.no_red_zone = opts->no_red_zone;
+    }
+
+    if (opts != NULL && opts->syntax != NULL) {
+        state.syntax = mu_syntax_lookup(opts->syntax);
+    }
+
+    if (opts != NULL && opts->tune != NULL) {
+        state.tune = mu_tune_lookup(opts->tune);
+    }
+
+    if (state.syntax == NULL) {
+        trace_emit(TRACE_ERROR, 0, "unknown assembler syntax %s\n", opts->syntax);
+        error = -1;
+    } else if (state.tune == NULL) {
+        trace_emit(TRACE_ERROR, 0, "unknown processor %s\n", opts->tune);
+        error = -1;
+    } else if (opts != NULL && bup_set_passes(&state, opts) < 0) {
+        error = -1;
+    } else {
+        error = parser_parse(&state);
+    }
+
+    /* This also flushes the output buffer */
+    bup_state_destroy(&state);
+    trace_set_hook(NULL, NULL);
+
+    if (error < 0) {
+        free(buf);
+        return -1;
+    }
+
+    *out = buf;
+    *outlen = buflen;
+    return 0;
+}
+
+void
+bup_release(void)
+{
+    ptrbox_cache_drain();
+}
@@ -0,0 +1,707 @@
+/*
+ * Copyright (C) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <elf.h>
+#include <sys/stat.h>
+#include "bup/link.h"
+#include "bup/trace.h"
+
+#define ALIGN_UP(V, A) (((V) + (A) - 1) & ~((A) - 1))
+
+/* Size of the ELF header page */
+#define LINK_ELF_HDRSZ 0x1000
+
+/* Start stub used when no '_start' is provided */
+static const char *start_stub =
+    "[section .text]\n"
+    "[global _start]\n"
+    "_start:\n"
+    "\tcall main\n"
+    "\tmov edi, eax\n"
+    "\tmov eax, 60\n"
+    "\tsyscall\n";
+
+/*
+ * Returns true if a symbol begins a chunk
+ */
+static inline bool
+link_is_chunk_sym(struct asm_symbol *sym)
+{
+    return sym->section != ASM_UNDEF && strchr(sym->name, '.') == NULL;
+}
+
+/*
+ * Append a chunk to the image
+ */
+static struct link_chunk *
+link_chunk_add(struct link_image *img, size_t obj, size_t sect, size_t start)
+{
+    struct link_chunk *chunk, *chunks;
+
+    /* Keep the old chunks if this fails, they are freed with the image */
+    chunks = realloc(img->chunks, (img->nchunks + 1) * sizeof(*chunk));
+    if (chunks == NULL) {
+        errno = -ENOMEM;
+        return NULL;
+    }
+
+    img->chunks = chunks;
+    chunk = &img->chunks[img->nchunks++];
+    memset(chunk, 0, sizeof(*chunk));
+    chunk->obj = obj;
+    chunk->section = sect;
+    chunk->sym = ASM_UNDEF;
+    chunk->start = start;
+    chunk->fallthrough = 1;
+    return chunk;
+}
+
+/*
+ * Split a single section into chunks
+ */
+static int
+link_split(struct link_image *img, size_t obj_idx, size_t sect_idx)
+{
+    struct asm_object *obj = &img->objs[obj_idx];
+    struct asm_section *sect = &obj->sections[sect_idx];
+    struct asm_symbol *sym;
+    struct link_chunk *chunk;
+    size_t first = img->nchunks, next;
+
+    if (link_chunk_add(img, obj_idx, sect_idx, 0) == NULL) {
+        return -1;
+    }
+
+    /*
+     * Repeatedly take the lowest chunk symbol offset above
+     * the current chunk start.
+     */
+    for (;;) {
+        chunk = &img->chunks[img->nchunks - 1];
+        next = sect->size + 1;
+
+        for (size_t i = 0; i < obj->nsymbols; ++i) {
+            sym = &obj->symbols[i];
+            if (sym->section != sect_idx || !link_is_chunk_sym(sym))
+                continue;
+
+            if (sym->off == chunk->start) {
+                /* Empty chunks at the same offset always fall through */
+                if (chunk->sym == ASM_UNDEF || !sym->fallthrough)
+                    chunk->sym = i;
+
+                chunk->fallthrough &= sym->fallthrough;
+            } else if (sym->off > chunk->start && sym->off < next) {
+                next = sym->off;
+            }
+        }
+
+        if (!sect->exec) {
+            chunk->fallthrough = 0;
+        }
+
+        if (next > sect->size) {
+            chunk->end = sect->size;
+            break;
+        }
+
+        chunk->end = next;
+        if (link_chunk_add(img, obj_idx, sect_idx, next) == NULL)
+            return -1;
+    }
+
+    img->sect_chunk[obj_idx][sect_idx] = first;
+    img->sect_chunk[obj_idx][sect_idx + 1] = img->nchunks;
+    return 0;
+}
+
+/*
+ * Find the chunk holding an offset within a section
+ */
+static struct link_chunk *
+link_find_chunk(struct link_image *img, size_t obj, size_t sect, size_t off)
+{
+    struct link_chunk *res = NULL;
+    size_t start, end;
+
+    start = img->sect_chunk[obj][sect];
+    end = img->sect_chunk[obj][sect + 1];
+    for (size_t i = start; i < end; ++i) {
+        if (img->chunks[i].start > off)
+            break;
+
+        res = &img->chunks[i];
+    }
+
+    return res;
+}
+
+/*
+ * Find the object and symbol index of a global symbol
+ * defined in any object.
+ */
+static int
+link_find_global(struct link_image *img, const char *name, size_t *obj_res,
+    size_t *sym_res)
+{
+    struct asm_object *obj;
+    struct asm_symbol *sym;
+    size_t idx;
+
+    for (size_t i = 0; i < img->nobjs; ++i) {
+        obj = &img->objs[i];
+        if ((idx = asm_symbol_lookup(obj, name)) == ASM_UNDEF)
+            continue;
+
+        sym = &obj->symbols[idx];
+        if (!sym->global || sym->section == ASM_UNDEF)
+            continue;
+
+        *obj_res = i;
+        *sym_res = idx;
+        return 0;
+    }
+
+    return -1;
+}
+
+/*
+ * Find the chunk a symbol referenced by an object lives in
+ */
+static struct link_chunk *
+link_target(struct link_image *img, size_t obj, size_t sym)
+{
+    struct asm_symbol *symbol;
+
+    symbol = &img->objs[obj].symbols[sym];
+    if (symbol->section == ASM_UNDEF) {
+        if (link_find_global(img, symbol->name, &obj, &sym) < 0)
+            return NULL;
+
+        symbol = &img->objs[obj].symbols[sym];
+    }
+
+    return link_find_chunk(img, obj, symbol->section, symbol->off);
+}
+
+/*
+ * Find a chunk by symbol name, preferring global symbols
+ */
+static struct link_chunk *
+link_target_name(struct link_image *img, const char *name)
+{
+    size_t obj, sym;
+
+    if (link_find_global(img, name, &obj, &sym) == 0) {
+        return link_target(img, obj, sym);
+    }
+
+    for (size_t i = 0; i < img->nobjs; ++i) {
+        sym = asm_symbol_lookup(&img->objs[i], name);
+        if (sym == ASM_UNDEF || img->objs[i].symbols[sym].section == ASM_UNDEF)
+            continue;
+
+        return link_target(img, i, sym);
+    }
+
+    return NULL;
+}
+
+/*
+ * Mark a chunk and everything reachable from it live
+ */
+static int
+link_mark(struct link_image *img, struct link_chunk *root)
+{
+    struct link_chunk *chunk, *target;
+    struct asm_object *obj;
+    struct asm_reloc *reloc;
+    size_t *stack, depth = 0, idx;
+
+    if (root == NULL || root->live) {
+        return 0;
+    }
+
+    if ((stack = malloc(img->nchunks * sizeof(*stack))) == NULL) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    root->live = 1;
+    stack[depth++] = root - img->chunks;
+    while (depth > 0) {
+        chunk = &img->chunks[stack[--depth]];
+        obj = &img->objs[chunk->obj];
+
+        for (size_t i = 0; i < obj->nrelocs; ++i) {
+            reloc = &obj->relocs[i];
+            if (reloc->section != chunk->section)
+                continue;
+            if (reloc->off < chunk->start || reloc->off >= chunk->end)
+                continue;
+
+            target = link_target(img, chunk->obj, reloc->symbol);
+            if (target == NULL || target->live)
+                continue;
+
+            target->live = 1;
+            stack[depth++] = target - img->chunks;
+        }
+
+        /* Keep whatever control falls into */
+        idx = chunk - img->chunks;
+        if (!chunk->fallthrough || idx + 1 >= img->sect_chunk[chunk->obj][chunk->section + 1])
+            continue;
+
+        target = &img->chunks[idx + 1];
+        if (!target->live) {
+            target->live = 1;
+            stack[depth++] = idx + 1;
+        }
+    }
+
+    free(stack);
+    return 0;
+}
+
+/*
+ * Place every live chunk of a given kind
+ *
+ * @img:    Image being laid out
+ * @off:    Current image offset
+ * @exec:   Place executable chunks
+ * @nobits: Place nobits chunks
+ *
+ * Returns the new image offset
+ */
+static size_t
+link_place(struct link_image *img, size_t off, bool exec, bool nobits)
+{
+    struct link_chunk *chunk;
+    struct asm_section *sect;
+    size_t align;
+
+    for (size_t i = 0; i < img->nchunks; ++i) {
+        chunk = &img->chunks[i];
+        sect = &img->objs[chunk->obj].sections[chunk->section];
+        if (!chunk->live || sect->exec != exec || sect->nobits != nobits)
+            continue;
+
+        /* Keep whatever alignment the chunk had within its section */
+        align = sect->align;
+        while (chunk->start != 0 && (chunk->start & (align - 1)) != 0) {
+            align >>= 1;
+        }
+
+        off = ALIGN_UP(off, align);
+        chunk->off = off;
+        off += chunk->end - chunk->start;
+    }
+
+    return off;
+}
+
+/*
+ * Place all live chunks and compute the image sizes
+ *
+ * @img:  Image being laid out
+ * @page: Page size
+ */
+static void
+link_finish(struct link_image *img, size_t page)
+{
+    size_t off;
+
+    off = link_place(img, 0, true, false);
+    img->text_size = ALIGN_UP(off, page);
+
+    off = link_place(img, img->text_size, false, false);
+    img->file_size = off;
+
+    off = link_place(img, off, false, true);
+    img->size = ALIGN_UP((off == 0) ? 1 : off, page);
+}
+
+int
+link_layout(struct link_image *img, struct asm_object *objs, size_t nobjs,
+    size_t page, const char **roots)
+{
+    if (img == NULL || objs == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    memset(img, 0, sizeof(*img));
+    img->objs = objs;
+    img->nobjs = nobjs;
+    img->sect_chunk = calloc(nobjs, sizeof(*img->sect_chunk));
+    if (img->sect_chunk == NULL) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    for (size_t i = 0; i < nobjs; ++i) {
+        img->sect_chunk[i] = calloc(objs[i].nsections + 1, sizeof(size_t));
+        if (img->sect_chunk[i] == NULL) {
+            link_destroy(img);
+            errno = -ENOMEM;
+            return -1;
+        }
+
+        for (size_t j = 0; j < objs[i].nsections; ++j) {
+            if (link_split(img, i, j) < 0) {
+                link_destroy(img);
+                return -1;
+            }
+        }
+    }
+
+    if (roots == NULL) {
+        for (size_t i = 0; i < img->nchunks; ++i)
+            img->chunks[i].live = 1;
+    }
+
+    for (size_t i = 0; roots != NULL && roots[i] != NULL; ++i) {
+        if (link_mark(img, link_target_name(img, roots[i])) < 0) {
+            link_destroy(img);
+            return -1;
+        }
+    }
+
+    link_finish(img, page);
+    return 0;
+}
+
+int
+link_resolve(struct link_image *img, size_t obj, size_t sym, uint64_t base,
+    uint64_t *res)
+{
+    struct asm_symbol *symbol;
+    struct link_chunk *chunk;
+
+    if (img == NULL || res == NULL || obj >= img->nobjs) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    symbol = &img->objs[obj].symbols[sym];
+    if (symbol->section == ASM_UNDEF) {
+        if (link_find_global(img, symbol->name, &obj, &sym) < 0) {
+            trace_emit(TRACE_ERROR, 0, "undefined reference to %s\n", symbol->name);
+            return -1;
+        }
+
+        symbol = &img->objs[obj].symbols[sym];
+    }
+
+    chunk = link_find_chunk(img, obj, symbol->section, symbol->off);
+    if (chunk == NULL || !chunk->live) {
+        trace_emit(TRACE_ERROR, 0, "reference to dropped symbol %s\n", symbol->name);
+        return -1;
+    }
+
+    *res = base + chunk->off + (symbol->off - chunk->start);
+    return 0;
+}
+
+int
+link_lookup(struct link_image *img, const char *name, uint64_t base,
+    uint64_t *res)
+{
+    struct asm_object *obj;
+    size_t obj_idx, idx;
+
+    if (img == NULL || name == NULL || res == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if (link_find_global(img, name, &obj_idx, &idx) == 0) {
+        return link_resolve(img, obj_idx, idx, base, res);
+    }
+
+    /* Fall back to a symbol with internal linkage */
+    for (size_t i = 0; i < img->nobjs; ++i) {
+        obj = &img->objs[i];
+        idx = asm_symbol_lookup(obj, name);
+        if (idx == ASM_UNDEF || obj->symbols[idx].section == ASM_UNDEF)
+            continue;
+
+        return link_resolve(img, i, idx, base, res);
+    }
+
+    return -1;
+}
+
+int
+link_load(struct link_image *img, uint8_t *mem, uint64_t base)
+{
+    struct link_chunk *chunk;
+    struct asm_object *obj;
+    struct asm_section *sect;
+    struct asm_reloc *reloc;
+    uint64_t s, p;
+    int64_t v;
+    uint8_t *field;
+
+    if (img == NULL || mem == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    for (size_t i = 0; i < img->nchunks; ++i) {
+        chunk = &img->chunks[i];
+        sect = &img->objs[chunk->obj].sections[chunk->section];
+        if (!chunk->live || sect->nobits || chunk->end == chunk->start)
+            continue;
+
+        memcpy(&mem[chunk->off], &sect->data[chunk->start], chunk->end - chunk->start);
+    }
+
+    for (size_t i = 0; i < img->nobjs; ++i) {
+        obj = &img->objs[i];
+        for (size_t j = 0; j < obj->nrelocs; ++j) {
+            reloc = &obj->relocs[j];
+            chunk = link_find_chunk(img, i, reloc->section, reloc->off);
+            if (chunk == NULL || !chunk->live)
+                continue;
+
+            if (link_resolve(img, i, reloc->symbol, base, &s) < 0)
+                return -1;
+
+            field = &mem[chunk->off + (reloc->off - chunk->start)];
+            p = base + (field - mem);
+            switch (reloc->type) {
+            case ASM_RELOC_REL32:
+                v = (int64_t)(s + reloc->addend - p);
+                if (v < INT32_MIN || v > INT32_MAX) {
+                    trace_emit(TRACE_ERROR, 0, "relocation out of range\n");
+                    return -1;
+                }
+
+                memcpy(field, &(int32_t){ v }, 4);
+                break;
+            case ASM_RELOC_ABS32:
+                v = (int64_t)(s + reloc->addend);
+                if (v < 0 || v > UINT32_MAX) {
+                    trace_emit(TRACE_ERROR, 0, "relocation out of range\n");
+                    return -1;
+                }
+
+                memcpy(field, &(uint32_t){ v }, 4);
+                break;
+            case ASM_RELOC_ABS64:
+                memcpy(field, &(uint64_t){ s + reloc->addend }, 8);
+                break;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Write the ELF64 headers for a loaded image
+ *
+ * @img:   Loaded image
+ * @fp:    Output file
+ * @entry: Entry point address
+ */
+static int
+link_write_elf_hdr(struct link_image *img, FILE *fp, uint64_t entry)
+{
+    uint8_t page[LINK_ELF_HDRSZ];
+    Elf64_Ehdr *ehdr = (Elf64_Ehdr *)page;
+    Elf64_Phdr *phdr = (Elf64_Phdr *)(page + sizeof(*ehdr));
+    uint64_t base = LINK_ELF_BASE + LINK_ELF_HDRSZ;
+
+    memset(page, 0, sizeof(page));
+    memcpy(ehdr->e_ident, ELFMAG, SELFMAG);
+    ehdr->e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr->e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr->e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr->e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    ehdr->e_type = ET_EXEC;
+    ehdr->e_machine = EM_X86_64;
+    ehdr->e_version = EV_CURRENT;
+    ehdr->e_entry = entry;
+    ehdr->e_phoff = sizeof(*ehdr);
+    ehdr->e_ehsize = sizeof(*ehdr);
+    ehdr->e_phentsize = sizeof(*phdr);
+    ehdr->e_phnum = 1;
+
+    /* Headers and code */
+    phdr[0].p_type = PT_LOAD;
+    phdr[0].p_flags = PF_R | PF_X;
+    phdr[0].p_offset = 0;
+    phdr[0].p_vaddr = LINK_ELF_BASE;
+    phdr[0].p_paddr = LINK_ELF_BASE;
+    phdr[0].p_filesz = LINK_ELF_HDRSZ + img->text_size;
+    phdr[0].p_memsz = phdr[0].p_filesz;
+    phdr[0].p_align = LINK_ELF_HDRSZ;
+
+    /* Data and zero-initialized data */
+    if (img->size > img->text_size) {
+        ehdr->e_phnum = 2;
+        phdr[1].p_type = PT_LOAD;
+        phdr[1].p_flags = PF_R | PF_W;
+        phdr[1].p_offset = LINK_ELF_HDRSZ + img->text_size;
+        phdr[1].p_vaddr = base + img->text_size;
+        phdr[1].p_paddr = base + img->text_size;
+        phdr[1].p_filesz = img->file_size - img->text_size;
+        phdr[1].p_memsz = img->size - img->text_size;
+        phdr[1].p_align = LINK_ELF_HDRSZ;
+    }
+
+    if (fwrite(page, 1, sizeof(page), fp) != sizeof(page)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+link_write(struct asm_object *objs, size_t nobjs, const char *path,
+    link_fmt_t fmt)
+{
+    static const char *elf_roots[] = { "_start", NULL };
+    static const char *flat_roots[] = { "_start", "main", NULL };
+    struct asm_object *all;
+    struct link_image img;
+    struct link_chunk *chunk;
+    uint64_t base, entry;
+    uint8_t *mem = NULL;
+    size_t nall = nobjs, dropped = 0, tmp, sym;
+    bool has_stub = false;
+    FILE *fp = NULL;
+    int retval = -1;
+
+    if (objs == NULL || path == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if ((all = calloc(nobjs + 1, sizeof(*all))) == NULL) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    memcpy(all, objs, nobjs * sizeof(*objs));
+    img.objs = all;
+    img.nobjs = nobjs;
+
+    /* Provide a start stub if needed */
+    if (fmt == LINK_ELF64 && link_find_global(&img, "_start", &tmp, &sym) < 0) {
+        if (asm_assemble(start_stub, strlen(start_stub), &all[nall]) < 0)
+            goto done;
+
+        has_stub = true;
+        ++nall;
+    }
+
+    if (fmt == LINK_ELF64) {
+        if (link_layout(&img, all, nall, LINK_ELF_HDRSZ, elf_roots) < 0)
+            goto done;
+
+        base = LINK_ELF_BASE + LINK_ELF_HDRSZ;
+    } else {
+        if (link_layout(&img, all, nall, 1, flat_roots) < 0)
+            goto done;
+
+        /* The start of the first code section is the entry */
+        for (size_t i = 0; i < img.nchunks; ++i) {
+            chunk = &img.chunks[i];
+            if (!all[chunk->obj].sections[chunk->section].exec)
+                continue;
+            if (chunk->start != 0 || chunk->end == 0)
+                continue;
+
+            if (link_mark(&img, chunk) < 0)
+                goto done_img;
+
+            link_finish(&img, 1);
+            break;
+        }
+
+        base = 0;
+    }
+
+    for (size_t i = 0; i < img.nchunks; ++i) {
+        chunk = &img.chunks[i];
+        if (!chunk->live && chunk->end > chunk->start)
+            ++dropped;
+    }
+
+    if (dropped > 0) {
+        trace_debug("link: dropped %zu unreferenced chunk(s)\n", dropped);
+    }
+
+    if ((mem = calloc(1, img.size)) == NULL) {
+        errno = -ENOMEM;
+        goto done_img;
+    }
+
+    if (link_load(&img, mem, base) < 0) {
+        goto done_img;
+    }
+
+    if ((fp = fopen(path, "wb")) == NULL) {
+        trace_emit(TRACE_ERROR, 0, "failed to open %s\n", path);
+        goto done_img;
+    }
+
+    if (fmt == LINK_ELF64) {
+        if (link_lookup(&img, "_start", base, &entry) < 0)
+            goto done_img;
+        if (link_write_elf_hdr(&img, fp, entry) < 0)
+            goto done_img;
+    }
+
+    if (fwrite(mem, 1, img.file_size, fp) != img.file_size) {
+        trace_emit(TRACE_ERROR, 0, "failed to write %s\n", path);
+        goto done_img;
+    }
+
+    if (fmt == LINK_ELF64) {
+        chmod(path, 0755);
+    }
+
+    retval = 0;
+done_img:
+    link_destroy(&img);
+done:
+    if (fp != NULL) {
+        fclose(fp);
+    }
+
+    if (has_stub) {
+        asm_object_destroy(&all[nobjs]);
+    }
+
+    free(mem);
+    free(all);
+    return retval;
+}
+
+void
+link_destroy(struct link_image *img)
+{
+    if (img == NULL || img->sect_chunk == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < img->nobjs; ++i) {
+        free(img->sect_chunk[i]);
+    }
+
+    free(img->sect_chunk);
+    free(img->chunks);
+    img->sect_chunk = NULL;
+    img->chunks = NULL;
+}
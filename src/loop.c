@@ -0,0 +1,1567 @@
+/*
+ * Copyright (C) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include "bup/loop.h"
+#include "bup/opt.h"
+#include "bup/pass.h"
+#include "bup/trace.h"
+
+/*
+ * Compute which blocks dominate each block
+ *
+ * @proc: Procedure, with its CFG built
+ * @cap:  Number of block ids
+ *
+ * Returns a cap by cap matrix where [b * cap + d] is set if
+ * block 'd' dominates block 'b', or NULL on failure.
+ */
+static bool *
+loop_dominators(struct ir_proc *proc, size_t cap)
+{
+    struct ir_block *entry = TAILQ_FIRST(&proc->blocks);
+    struct ir_block *blk, *pred;
+    bool *dom, *row, changed;
+    bool in;
+
+    if ((dom = calloc(cap * cap, sizeof(*dom))) == NULL) {
+        errno = -ENOMEM;
+        return NULL;
+    }
+
+    /* Everything dominates everything until shown otherwise */
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        row = &dom[blk->id * cap];
+        if (blk == entry) {
+            row[blk->id] = true;
+            continue;
+        }
+
+        TAILQ_FOREACH(pred, &proc->blocks, link) {
+            row[pred->id] = true;
+        }
+    }
+
+    do {
+        changed = false;
+        TAILQ_FOREACH(blk, &proc->blocks, link) {
+            if (blk == entry || blk->npreds == 0)
+                continue;
+
+            row = &dom[blk->id * cap];
+            TAILQ_FOREACH(pred, &proc->blocks, link) {
+                if (pred == blk || !row[pred->id])
+                    continue;
+
+                in = true;
+                for (size_t i = 0; i < blk->npreds && in; ++i)
+                    in = dom[blk->preds[i]->id * cap + pred->id];
+
+                if (!in) {
+                    row[pred->id] = false;
+                    changed = true;
+                }
+            }
+        }
+    } while (changed);
+
+    return dom;
+}
+
+/*
+ * Get the loop with a header, adding it if there is none
+ *
+ * Returns NULL on failure
+ */
+static struct ir_loop *
+loop_get(struct loop_nest *nest, struct ir_block *head, size_t max)
+{
+    struct ir_loop *loop;
+
+    for (size_t i = 0; i < nest->count; ++i) {
+        if (nest->loops[i].head == head)
+            return &nest->loops[i];
+    }
+
+    if (nest->count == max) {
+        return NULL;
+    }
+
+    loop = &nest->loops[nest->count];
+    if ((loop->body = calloc(nest->cap, sizeof(*loop->body))) == NULL) {
+        errno = -ENOMEM;
+        return NULL;
+    }
+
+    loop->head = head;
+    loop->pre = NULL;
+    loop->body[head->id] = true;
+    loop->nbody = 1;
+    ++nest->count;
+    return loop;
+}
+
+/*
+ * Add the blocks that reach a back edge without going
+ * through the header to a loop
+ *
+ * @loop:  Loop
+ * @tail:  Source of back edge
+ * @stack: Work stack of at least 'cap' entries
+ */
+static void
+loop_fill(struct ir_loop *loop, struct ir_block *tail, struct ir_block **stack)
+{
+    struct ir_block *blk, *pred;
+    size_t sp = 0;
+
+    if (!loop->body[tail->id]) {
+        loop->body[tail->id] = true;
+        ++loop->nbody;
+        stack[sp++] = tail;
+    }
+
+    while (sp > 0) {
+        blk = stack[--sp];
+        for (size_t i = 0; i < blk->npreds; ++i) {
+            pred = blk->preds[i];
+            if (loop->body[pred->id])
+                continue;
+
+            loop->body[pred->id] = true;
+            ++loop->nbody;
+            stack[sp++] = pred;
+        }
+    }
+}
+
+/*
+ * Order loops from the smallest up, inner loops are
+ * always smaller than the loops around them.
+ */
+static int
+loop_cmp(const void *a, const void *b)
+{
+    const struct ir_loop *x = a, *y = b;
+
+    if (x->nbody != y->nbody) {
+        return (x->nbody < y->nbody) ? -1 : 1;
+    }
+
+    return (x->head->id < y->head->id) ? -1 : 1;
+}
+
+int
+loop_find(struct bup_state *state, struct ir_proc *proc, struct loop_nest *res)
+{
+    struct ir_block *blk, *succ[2], **stack;
+    struct ir_loop *loop;
+    size_t nblocks = 0, n;
+    bool *dom;
+
+    if (state == NULL || proc == NULL || res == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    res->loops = NULL;
+    res->count = 0;
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        ++nblocks;
+    }
+
+    /* Room for a preheader per loop */
+    res->cap = proc->nblocks + nblocks;
+    res->loops = calloc(nblocks, sizeof(*res->loops));
+    stack = malloc(res->cap * sizeof(*stack));
+    if (res->loops == NULL || stack == NULL) {
+        free(stack);
+        loop_release(res);
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    if ((dom = loop_dominators(proc, res->cap)) == NULL) {
+        free(stack);
+        loop_release(res);
+        return -1;
+    }
+
+    /* An edge to a block that dominates us closes a loop */
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        n = ir_succs(blk, succ);
+        for (size_t i = 0; i < n; ++i) {
+            if (!dom[blk->id * res->cap + succ[i]->id])
+                continue;
+            if ((loop = loop_get(res, succ[i], nblocks)) == NULL)
+                goto fail;
+
+            loop_fill(loop, blk, stack);
+        }
+    }
+
+    qsort(res->loops, res->count, sizeof(*res->loops), loop_cmp);
+    free(stack);
+    free(dom);
+    return 0;
+fail:
+    free(stack);
+    free(dom);
+    loop_release(res);
+    return -1;
+}
+
+int
+loop_preheader(struct bup_state *state, struct ir_proc *proc,
+    struct loop_nest *nest, struct ir_loop *loop)
+{
+    struct ir_block *head = loop->head, *pred, *pre = NULL;
+    struct ir_block *succ[2];
+    struct ir_insn *term, *jmp;
+    size_t nouter = 0;
+
+    if (loop->pre != NULL) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < head->npreds; ++i) {
+        if (!loop_contains(nest, loop, head->preds[i])) {
+            pre = head->preds[i];
+            ++nouter;
+        }
+    }
+
+    /* A lone block jumping straight to the header will do */
+    if (nouter == 1 && ir_succs(pre, succ) == 1 && ir_block_term(pre) != NULL) {
+        loop->pre = pre;
+        return 0;
+    }
+
+    if (nest->cap <= proc->nblocks) {
+        errno = -ENOSPC;
+        return -1;
+    }
+
+    if ((pre = ir_block_new(state, NULL)) == NULL) {
+        return -1;
+    }
+
+    if ((jmp = ir_insn_new(state, IR_JMP, MSIZE_BAD)) == NULL) {
+        return -1;
+    }
+
+    jmp->target[0] = head;
+    TAILQ_INSERT_TAIL(&pre->insns, jmp, link);
+    pre->id = proc->nblocks++;
+    TAILQ_INSERT_BEFORE(head, pre, link);
+
+    for (size_t i = 0; i < head->npreds; ++i) {
+        pred = head->preds[i];
+        if (loop_contains(nest, loop, pred))
+            continue;
+        if ((term = ir_block_term(pred)) == NULL)
+            continue;
+
+        for (int j = 0; j < 2; ++j) {
+            if (term->target[j] == head)
+                term->target[j] = pre;
+        }
+    }
+
+    /* Loops around this one now hold the preheader too */
+    for (size_t i = 0; i < nest->count; ++i) {
+        if (&nest->loops[i] == loop)
+            continue;
+        if (!loop_contains(nest, &nest->loops[i], head))
+            continue;
+
+        nest->loops[i].body[pre->id] = true;
+        ++nest->loops[i].nbody;
+    }
+
+    loop->pre = pre;
+    if (ir_cfg_build(state, proc) < 0) {
+        return -1;
+    }
+
+    return 1;
+}
+
+void
+loop_release(struct loop_nest *nest)
+{
+    if (nest == NULL || nest->loops == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < nest->count; ++i) {
+        free(nest->loops[i].body);
+    }
+
+    free(nest->loops);
+    nest->loops = NULL;
+    nest->count = 0;
+}
+
+/*
+ * What is known about the memory a loop writes
+ *
+ * @all:    Set if anything may be written (calls, assembly)
+ * @stores: Stores within the loop
+ * @count:  Number of stores
+ */
+struct loop_writes {
+    bool all;
+    struct ir_insn **stores;
+    size_t count;
+};
+
+/*
+ * Collect what a loop may write to memory
+ *
+ * Returns zero on success
+ */
+static int
+loop_scan_writes(struct ir_proc *proc, struct loop_nest *nest,
+    struct ir_loop *loop, struct loop_writes *res)
+{
+    struct ir_block *blk;
+    struct ir_insn *insn;
+    size_t cap = 0;
+
+    res->all = false;
+    res->count = 0;
+    res->stores = NULL;
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        if (!loop_contains(nest, loop, blk))
+            continue;
+
+        TAILQ_FOREACH(insn, &blk->insns, link) {
+            if (insn->op == IR_STORE || insn->op == IR_STOREX)
+                ++cap;
+        }
+    }
+
+    if (cap > 0 && (res->stores = calloc(cap, sizeof(*res->stores))) == NULL) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        if (!loop_contains(nest, loop, blk))
+            continue;
+
+        TAILQ_FOREACH(insn, &blk->insns, link) {
+            switch (insn->op) {
+            case IR_STORE:
+            case IR_STOREX:
+                res->stores[res->count++] = insn;
+                break;
+            case IR_CALL:
+            case IR_TAILCALL:
+            case IR_ASM:
+                res->all = true;
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Returns true if a loop may write a variable
+ */
+static bool
+loop_writes_sym(struct loop_writes *writes, const char *sym)
+{
+    if (writes->all) {
+        return true;
+    }
+
+    for (size_t i = 0; i < writes->count; ++i) {
+        if (strcmp(writes->stores[i]->sym, sym) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * Returns true if an operand has the same value on every
+ * iteration of a loop
+ *
+ * @nest:   Loops of procedure
+ * @loop:   Loop
+ * @val:    Operand
+ * @defs:   Block defining each virtual register
+ * @writes: What the loop writes to memory
+ */
+static bool
+loop_invariant_value(struct loop_nest *nest, struct ir_loop *loop,
+    struct ir_value *val, struct ir_block **defs, struct loop_writes *writes)
+{
+    switch (val->type) {
+    case IR_VAL_NONE:
+    case IR_VAL_IMM:
+        return true;
+    case IR_VAL_VREG:
+        return defs[val->vreg] == NULL || !loop_contains(nest, loop, defs[val->vreg]);
+    case IR_VAL_MEM:
+        return !loop_writes_sym(writes, val->mem.sym);
+    }
+
+    return false;
+}
+
+/*
+ * Returns true if a block runs on every iteration of a loop
+ * that ends, it dominates each block leaving the loop or
+ * jumping back to the header and there is a way out.
+ *
+ * @proc: Procedure
+ * @nest: Loops of procedure
+ * @loop: Loop
+ * @blk:  Block within the loop
+ * @dom:  Dominators, see loop_dominators()
+ */
+static bool
+loop_runs_always(struct ir_proc *proc, struct loop_nest *nest,
+    struct ir_loop *loop, struct ir_block *blk, bool *dom)
+{
+    struct ir_block *cur, *succ[2];
+    bool leaves = false, tail;
+    size_t n;
+
+    TAILQ_FOREACH(cur, &proc->blocks, link) {
+        if (!loop_contains(nest, loop, cur))
+            continue;
+
+        tail = false;
+        n = ir_succs(cur, succ);
+        for (size_t i = 0; i < n; ++i) {
+            if (!loop_contains(nest, loop, succ[i]))
+                leaves = tail = true;
+            if (succ[i] == loop->head)
+                tail = true;
+        }
+
+        if (tail && !dom[cur->id * nest->cap + blk->id])
+            return false;
+    }
+
+    return leaves;
+}
+
+/*
+ * Returns true if an indexed load reads within its array
+ * whatever the loop does, its index being constant
+ */
+static bool
+loop_in_bounds(struct ir_insn *insn)
+{
+    ssize_t off = insn->disp;
+
+    if (insn->var == NULL || insn->var->data_type.array_size == 0) {
+        return false;
+    }
+
+    switch (insn->a.type) {
+    case IR_VAL_NONE:
+        break;
+    case IR_VAL_IMM:
+        off += insn->a.imm * (ssize_t)insn->scale;
+        break;
+    default:
+        return false;
+    }
+
+    return off >= 0 &&
+        (size_t)off + msize_bytes(insn->msize) <= insn->var->data_type.array_size;
+}
+
+/*
+ * Returns true if an instruction computes the same value on
+ * every iteration of a loop and nothing else. Indexed loads
+ * may fault, so they only move out of blocks that run on
+ * every iteration unless their index is known to be good.
+ *
+ * @nest:   Loops of procedure
+ * @loop:   Loop
+ * @insn:   Instruction
+ * @defs:   Block defining each virtual register
+ * @writes: What the loop writes to memory
+ * @always: Set if the block of the instruction runs on
+ *          every iteration
+ */
+static bool
+loop_invariant(struct loop_nest *nest, struct ir_loop *loop,
+    struct ir_insn *insn, struct ir_block **defs, struct loop_writes *writes,
+    bool always)
+{
+    struct ir_value *vals[IR_MAX_OPERANDS];
+    size_t nvals;
+
+    switch (insn->op) {
+    case IR_MOV:
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_ADDR:
+    case IR_SET:
+    case IR_SEL:
+        break;
+    case IR_LOAD:
+        if (loop_writes_sym(writes, insn->sym))
+            return false;
+        break;
+    case IR_LOADX:
+        if (loop_writes_sym(writes, insn->sym))
+            return false;
+        if (!always && !loop_in_bounds(insn))
+            return false;
+        break;
+    default:
+        return false;
+    }
+
+    if (insn->dst == IR_NOREG) {
+        return false;
+    }
+
+    nvals = ir_operands(insn, vals);
+    for (size_t i = 0; i < nvals; ++i) {
+        if (!loop_invariant_value(nest, loop, vals[i], defs, writes))
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Hoist the invariant instructions of a single loop
+ *
+ * Returns the number of instructions hoisted, or a less
+ * than zero value on failure.
+ */
+static int
+loop_hoist(struct bup_state *state, struct ir_proc *proc,
+    struct loop_nest *nest, struct ir_loop *loop, struct ir_block **defs,
+    bool *dom)
+{
+    struct loop_writes writes;
+    struct ir_block *blk;
+    struct ir_insn *insn, *next, *term;
+    bool changed, always;
+    int count = 0;
+
+    if (loop_scan_writes(proc, nest, loop, &writes) < 0) {
+        return -1;
+    }
+
+    /* Hoisting one may make those using it invariant */
+    do {
+        changed = false;
+        TAILQ_FOREACH(blk, &proc->blocks, link) {
+            if (!loop_contains(nest, loop, blk))
+                continue;
+
+            always = loop_runs_always(proc, nest, loop, blk, dom);
+            for (insn = TAILQ_FIRST(&blk->insns); insn != NULL; insn = next) {
+                next = TAILQ_NEXT(insn, link);
+                if (!loop_invariant(nest, loop, insn, defs, &writes, always))
+                    continue;
+
+                if (loop->pre == NULL && loop_preheader(state, proc, nest, loop) < 0) {
+                    free(writes.stores);
+                    return -1;
+                }
+
+                term = ir_block_term(loop->pre);
+                TAILQ_REMOVE(&blk->insns, insn, link);
+                TAILQ_INSERT_BEFORE(term, insn, link);
+                defs[insn->dst] = loop->pre;
+                changed = true;
+                ++count;
+            }
+        }
+    } while (changed);
+
+    free(writes.stores);
+    return count;
+}
+
+int
+loop_licm(struct bup_state *state, struct ir_proc *proc)
+{
+    struct loop_nest nest;
+    struct ir_block **defs, *blk;
+    struct ir_insn *insn;
+    bool *dom;
+    int n, count = 0;
+
+    if (state == NULL || proc == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if (loop_find(state, proc, &nest) < 0) {
+        return -1;
+    }
+
+    if (nest.count == 0) {
+        loop_release(&nest);
+        return 0;
+    }
+
+    if ((dom = loop_dominators(proc, nest.cap)) == NULL) {
+        loop_release(&nest);
+        return -1;
+    }
+
+    if ((defs = calloc(proc->nvregs + 1, sizeof(*defs))) == NULL) {
+        free(dom);
+        loop_release(&nest);
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        TAILQ_FOREACH(insn, &blk->insns, link) {
+            if (insn->dst != IR_NOREG)
+                defs[insn->dst] = blk;
+        }
+    }
+
+    for (size_t i = 0; i < nest.count; ++i) {
+        if ((n = loop_hoist(state, proc, &nest, &nest.loops[i], defs, dom)) < 0) {
+            count = -1;
+            break;
+        }
+
+        count += n;
+    }
+
+    if (count > 0) {
+        trace_debug("licm: hoisted %d from %s\n", count, proc->symbol->name);
+    }
+
+    free(defs);
+    free(dom);
+    loop_release(&nest);
+    return count;
+}
+
+/*
+ * What is known about how often a loop runs
+ *
+ * @test:  Counter test closing each iteration, NULL if none
+ * @exit:  Target of the test that leaves the loop
+ * @count: Number of iterations, zero if unknown
+ */
+struct loop_trip {
+    struct ir_insn *test;
+    int exit;
+    size_t count;
+};
+
+/*
+ * Find the block a loop is closed from. Every edge back to
+ * the header must come from it or from a block that does
+ * nothing but jump there from it.
+ *
+ * Returns NULL if there is no such block
+ */
+static struct ir_block *
+loop_latch(struct loop_nest *nest, struct ir_loop *loop)
+{
+    struct ir_block *head = loop->head, *pred, *latch = NULL;
+
+    for (size_t i = 0; i < head->npreds; ++i) {
+        pred = head->preds[i];
+        if (!loop_contains(nest, loop, pred))
+            continue;
+
+        if (TAILQ_FIRST(&pred->insns) == ir_block_term(pred) &&
+            ir_block_term(pred)->op == IR_JMP && pred->npreds == 1) {
+            pred = pred->preds[0];
+        }
+
+        if (latch != NULL && latch != pred)
+            return NULL;
+
+        latch = pred;
+    }
+
+    return latch;
+}
+
+/*
+ * Returns true if an instruction is within a block
+ */
+static bool
+loop_in_block(struct ir_block *blk, struct ir_insn *insn)
+{
+    struct ir_insn *cur;
+
+    TAILQ_FOREACH(cur, &blk->insns, link) {
+        if (cur == insn)
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * Find the constant a variable holds on the way into a loop
+ * by looking back from the preheader through blocks with a
+ * single predecessor.
+ *
+ * @proc:  Procedure
+ * @loop:  Loop, with a preheader
+ * @load:  Load of the variable within the loop
+ * @res:   Value is written here
+ *
+ * Returns true if the value is known
+ */
+static bool
+loop_entry_value(struct ir_proc *proc, struct ir_loop *loop,
+    struct ir_insn *load, ssize_t *res)
+{
+    struct ir_block *blk = loop->pre;
+    struct ir_insn *insn;
+
+    for (size_t n = 0; n < proc->nblocks; ++n) {
+        insn = TAILQ_LAST(&blk->insns, ir_insn_q);
+        for (; insn != NULL; insn = TAILQ_PREV(insn, ir_insn_q, link)) {
+            switch (insn->op) {
+            case IR_STORE:
+                if (strcmp(insn->sym, load->sym) != 0)
+                    break;
+                if (insn->msize != load->msize || insn->a.type != IR_VAL_IMM)
+                    return false;
+
+                *res = insn->a.imm;
+                return true;
+            case IR_CALL:
+            case IR_TAILCALL:
+            case IR_ASM:
+                return false;
+            default:
+                break;
+            }
+        }
+
+        if (blk->npreds != 1)
+            return false;
+
+        blk = blk->preds[0];
+    }
+
+    return false;
+}
+
+/*
+ * Match a counter being stepped by a constant
+ *
+ * @defs: Instruction defining each virtual register
+ * @insn: Instruction computing the new counter
+ * @step: Step is written here
+ *
+ * Returns the instruction reading the old counter, or
+ * NULL if there is none.
+ */
+static struct ir_insn *
+loop_step(struct ir_insn **defs, struct ir_insn *insn, ssize_t *step)
+{
+    struct ir_insn *load;
+
+    switch (insn->op) {
+    case IR_ADD:
+        if (insn->a.type == IR_VAL_VREG && insn->b.type == IR_VAL_IMM) {
+            load = defs[insn->a.vreg];
+            *step = insn->b.imm;
+        } else if (insn->a.type == IR_VAL_IMM && insn->b.type == IR_VAL_VREG) {
+            load = defs[insn->b.vreg];
+            *step = insn->a.imm;
+        } else {
+            return NULL;
+        }
+        break;
+    case IR_SUB:
+        if (insn->a.type != IR_VAL_VREG || insn->b.type != IR_VAL_IMM)
+            return NULL;
+
+        load = defs[insn->a.vreg];
+        *step = -insn->b.imm;
+        break;
+    default:
+        return NULL;
+    }
+
+    if (load == NULL || load->op != IR_LOAD) {
+        return NULL;
+    }
+
+    return load;
+}
+
+/*
+ * See through a load of a variable stored to earlier in
+ * the same block, the value stored is returned in its place
+ *
+ * @latch:  Block of load
+ * @writes: What the loop writes to memory
+ * @defs:   Instruction defining each virtual register
+ * @insn:   Instruction to see through
+ */
+static struct ir_insn *
+loop_reload(struct ir_block *latch, struct loop_writes *writes,
+    struct ir_insn **defs, struct ir_insn *insn)
+{
+    struct ir_insn *store = NULL, *cur;
+
+    if (insn->op != IR_LOAD) {
+        return insn;
+    }
+
+    for (size_t i = 0; i < writes->count; ++i) {
+        cur = writes->stores[i];
+        if (strcmp(cur->sym, insn->sym) != 0)
+            continue;
+        if (store != NULL)
+            return insn;
+
+        store = cur;
+    }
+
+    if (store == NULL || store->op != IR_STORE || store->msize != insn->msize) {
+        return insn;
+    }
+
+    if (store->a.type != IR_VAL_VREG || defs[store->a.vreg] == NULL) {
+        return insn;
+    }
+
+    TAILQ_FOREACH(cur, &latch->insns, link) {
+        if (cur == store)
+            return defs[store->a.vreg];
+        if (cur == insn)
+            break;
+    }
+
+    return insn;
+}
+
+/*
+ * Work out how many times a loop runs from a counter that
+ * steps by a constant until it reaches a constant:
+ *
+ *      %x = load i             (header)
+ *      %n = add %x, step       (or sub)
+ *      store i, %n             (the only store to i)
+ *      %c = sub %n, limit      (or %n itself, limit zero)
+ *      br %c, <loop>, <exit>   (latch)
+ *
+ * @proc:   Procedure
+ * @nest:   Loops of procedure
+ * @loop:   Loop, with a preheader
+ * @defs:   Instruction defining each virtual register
+ * @writes: What the loop writes to memory
+ * @res:    Result is written here
+ */
+static void
+loop_trip_count(struct ir_proc *proc, struct loop_nest *nest,
+    struct ir_loop *loop, struct ir_insn **defs, struct loop_writes *writes,
+    struct loop_trip *res)
+{
+    struct ir_block *latch, *blk;
+    struct ir_insn *test, *cnt, *next, *load, *store = NULL, *insn;
+    ssize_t init, limit = 0, step, span, last;
+    ir_cond_t cond;
+    bool seen, stay;
+
+    res->test = NULL;
+    res->count = 0;
+    if ((latch = loop_latch(nest, loop)) == NULL || writes->all) {
+        return;
+    }
+
+    test = ir_block_term(latch);
+    if (test->op != IR_BR || test->a.type != IR_VAL_VREG) {
+        return;
+    }
+
+    stay = loop_contains(nest, loop, test->target[0]);
+    if (stay == loop_contains(nest, loop, test->target[1])) {
+        return;
+    }
+
+    /* Make the condition the one that stays in the loop */
+    cond = test->cond;
+    if (!stay) {
+        if (cond == IR_COND_NZ)
+            return;
+
+        cond = ir_cond_negate(cond);
+    }
+
+    res->test = test;
+    res->exit = stay ? 1 : 0;
+    if ((cnt = defs[test->a.vreg]) == NULL) {
+        return;
+    }
+
+    next = loop_reload(latch, writes, defs, cnt);
+    if (cond != IR_COND_NZ) {
+        /* cmp %n, limit */
+        if (test->b.type != IR_VAL_IMM)
+            return;
+
+        limit = test->b.imm;
+    } else if (cnt->op == IR_SUB && cnt->a.type == IR_VAL_VREG && cnt->b.type == IR_VAL_IMM) {
+        /* %c = sub %n, limit, or %n itself with a limit of zero */
+        if ((insn = defs[cnt->a.vreg]) != NULL)
+            insn = loop_reload(latch, writes, defs, insn);
+        if (insn != NULL && loop_step(defs, insn, &step) != NULL) {
+            next = insn;
+            limit = cnt->b.imm;
+        }
+    }
+
+    load = loop_step(defs, next, &step);
+    if (load == NULL) {
+        return;
+    }
+
+    if (load->msize != MSIZE_DWORD && load->msize != MSIZE_QWORD) {
+        return;
+    }
+
+    for (size_t i = 0; i < writes->count; ++i) {
+        insn = writes->stores[i];
+        if (strcmp(insn->sym, load->sym) != 0)
+            continue;
+        if (store != NULL || insn->op != IR_STORE)
+            return;
+
+        store = insn;
+    }
+
+    if (store == NULL || store->msize != load->msize) {
+        return;
+    }
+
+    if (store->a.type != IR_VAL_VREG || defs[store->a.vreg] != next) {
+        return;
+    }
+
+    /*
+     * The counter is stepped on every way to the test, the
+     * load it is stepped from comes first as it defines the
+     * value stored.
+     */
+    for (blk = latch; !loop_in_block(blk, store); blk = blk->preds[0]) {
+        if (blk == loop->head || blk->npreds != 1)
+            return;
+    }
+
+    seen = false;
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        if (loop_contains(nest, loop, blk))
+            seen |= loop_in_block(blk, load);
+    }
+
+    if (!seen) {
+        return;
+    }
+
+    if (!loop_entry_value(proc, loop, load, &init)) {
+        return;
+    }
+
+    if (init < 0 || init > INT32_MAX || limit < 0 || limit > INT32_MAX) {
+        return;
+    }
+
+    if (step == 0 || step < -INT32_MAX || step > INT32_MAX) {
+        return;
+    }
+
+    /*
+     * The test sees the counter after it was stepped, so
+     * the loop runs at least once. Counting down must not
+     * wrap around zero on the way out.
+     */
+    span = limit - init;
+    switch (cond) {
+    case IR_COND_NZ:
+    case IR_COND_NE:
+        if (span % step != 0 || span / step < 1)
+            return;
+
+        res->count = span / step;
+        return;
+    case IR_COND_LT:
+        if (step < 0)
+            return;
+
+        res->count = (span <= 0) ? 1 : (span + step - 1) / step;
+        return;
+    case IR_COND_LE:
+        if (step < 0)
+            return;
+
+        res->count = (span < 0) ? 1 : span / step + 1;
+        return;
+    case IR_COND_GT:
+        if (step > 0)
+            return;
+
+        last = (span >= 0) ? 1 : (-span - step - 1) / -step;
+        break;
+    case IR_COND_GE:
+        if (step > 0)
+            return;
+
+        last = (span > 0) ? 1 : -span / -step + 1;
+        break;
+    default:
+        return;
+    }
+
+    if (init + last * step >= 0) {
+        res->count = last;
+    }
+}
+
+/*
+ * Turn a counter test whose outcome is known into a jump
+ */
+static void
+loop_drop_test(struct ir_insn *test, struct ir_block *to)
+{
+    test->op = IR_JMP;
+    test->size = MSIZE_BAD;
+    test->cond = IR_COND_NZ;
+    test->a.type = IR_VAL_NONE;
+    test->b.type = IR_VAL_NONE;
+    test->target[0] = to;
+    test->target[1] = NULL;
+    test->hint = 0;
+}
+
+/*
+ * Make copies of a loop before its header, each a single
+ * iteration that falls into the next one. The loop itself
+ * stays as the last copy so values used after it keep
+ * their definitions.
+ *
+ * @state:   Compiler state
+ * @proc:    Procedure
+ * @nest:    Loops of procedure
+ * @loop:    Loop, with a preheader
+ * @trip:    What is known about the trip count
+ * @ncopies: Number of copies
+ * @back:    Copy the loop jumps back to, less than zero to
+ *           leave through the counter test instead
+ *
+ * The counter test is dropped from the copies if the trip
+ * count is known. Returns zero on success.
+ */
+static int
+loop_replicate(struct bup_state *state, struct ir_proc *proc,
+    struct loop_nest *nest, struct ir_loop *loop, struct loop_trip *trip,
+    size_t ncopies, ssize_t back)
+{
+    struct ir_block **copies, *blk, *copy, *to, *head = loop->head;
+    struct ir_insn *insn, *dup, *term;
+    ir_vreg_t *vmap, nvregs = proc->nvregs;
+    struct ir_value *vals[IR_MAX_OPERANDS];
+    size_t nvals;
+    size_t nb = proc->nblocks;
+    bool *local;
+
+    copies = calloc(ncopies * nb, sizeof(*copies));
+    vmap = calloc(nvregs + 1, sizeof(*vmap));
+    local = calloc(nvregs + 1, sizeof(*local));
+    if (copies == NULL || vmap == NULL || local == NULL) {
+        errno = -ENOMEM;
+        goto fail;
+    }
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        if (!loop_contains(nest, loop, blk))
+            continue;
+
+        TAILQ_FOREACH(insn, &blk->insns, link) {
+            if (insn->dst != IR_NOREG)
+                local[insn->dst] = true;
+        }
+    }
+
+    for (size_t c = 0; c < ncopies; ++c) {
+        TAILQ_FOREACH(blk, &proc->blocks, link) {
+            if (blk->id >= nb || !loop_contains(nest, loop, blk))
+                continue;
+            if ((copy = ir_block_new(state, NULL)) == NULL)
+                goto fail;
+
+            copy->id = proc->nblocks++;
+            copy->unroll = 1;
+            copies[c * nb + blk->id] = copy;
+            TAILQ_INSERT_BEFORE(head, copy, link);
+        }
+    }
+
+    for (size_t c = 0; c < ncopies; ++c) {
+        for (ir_vreg_t v = 0; v < nvregs; ++v) {
+            if (local[v])
+                vmap[v] = proc->nvregs++;
+        }
+
+        TAILQ_FOREACH(blk, &proc->blocks, link) {
+            if (blk->id >= nb || !loop_contains(nest, loop, blk))
+                continue;
+
+            copy = copies[c * nb + blk->id];
+            TAILQ_FOREACH(insn, &blk->insns, link) {
+                if ((dup = ir_insn_new(state, insn->op, insn->size)) == NULL)
+                    goto fail;
+
+                memcpy(dup, insn, sizeof(*dup));
+                nvals = ir_operands(dup, vals);
+                for (size_t i = 0; i < nvals; ++i) {
+                    if (vals[i]->type == IR_VAL_VREG && local[vals[i]->vreg])
+                        vals[i]->vreg = vmap[vals[i]->vreg];
+                }
+
+                if (dup->dst != IR_NOREG)
+                    dup->dst = vmap[dup->dst];
+
+                /* Edges back to the header run into the next copy */
+                for (int i = 0; i < 2; ++i) {
+                    to = dup->target[i];
+                    if (to == NULL || !loop_contains(nest, loop, to))
+                        continue;
+                    if (to != head)
+                        dup->target[i] = copies[c * nb + to->id];
+                    else if (c + 1 < ncopies)
+                        dup->target[i] = copies[(c + 1) * nb + to->id];
+                }
+
+                if (insn == trip->test && trip->count > 0)
+                    loop_drop_test(dup, dup->target[!trip->exit]);
+
+                TAILQ_INSERT_TAIL(&copy->insns, dup, link);
+            }
+        }
+    }
+
+    /* Close the loop over the copies or leave after the last */
+    if (back < 0) {
+        loop_drop_test(trip->test, trip->test->target[trip->exit]);
+    } else {
+        TAILQ_FOREACH(blk, &proc->blocks, link) {
+            if (blk->id >= nb || !loop_contains(nest, loop, blk))
+                continue;
+            if ((term = ir_block_term(blk)) == NULL)
+                continue;
+
+            for (int i = 0; i < 2; ++i) {
+                if (term->target[i] == head)
+                    term->target[i] = copies[back * nb + head->id];
+            }
+        }
+    }
+
+    if (ncopies > 0) {
+        term = ir_block_term(loop->pre);
+        for (int i = 0; i < 2; ++i) {
+            if (term->target[i] == head)
+                term->target[i] = copies[head->id];
+        }
+    }
+
+    free(copies);
+    free(vmap);
+    free(local);
+    return ir_cfg_build(state, proc);
+fail:
+    free(copies);
+    free(vmap);
+    free(local);
+    return -1;
+}
+
+/*
+ * Unroll a single innermost loop if it asks for it or, at
+ * -O2, if its trip count is known and it is small enough.
+ *
+ * Returns one if the loop was unrolled, zero if it was left
+ * alone and a less than zero value on failure.
+ */
+static int
+loop_unroll_one(struct bup_state *state, struct ir_proc *proc,
+    struct loop_nest *nest, struct ir_loop *loop)
+{
+    struct loop_writes writes;
+    struct loop_trip trip;
+    struct ir_block *blk, **where;
+    struct ir_insn *insn, **defs;
+    struct ir_value *vals[IR_MAX_OPERANDS];
+    size_t nvals;
+    size_t factor = loop->head->unroll, cost = 0, nexits = 0;
+    size_t ncopies, rest;
+    ssize_t back;
+    bool live_out = false, automatic;
+    int error = 0;
+
+    automatic = state->opt_level == PASS_O2;
+    if (factor == 0 && !automatic) {
+        return 0;
+    }
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        if (!loop_contains(nest, loop, blk))
+            continue;
+
+        TAILQ_FOREACH(insn, &blk->insns, link) {
+            /* Labels would be defined once per copy */
+            if (insn->op == IR_ASM && strchr(insn->text, ':') != NULL)
+                return 0;
+            if (insn->op != IR_JMP)
+                ++cost;
+
+            for (int i = 0; i < 2; ++i) {
+                if (insn->target[i] != NULL && !loop_contains(nest, loop, insn->target[i]))
+                    ++nexits;
+            }
+        }
+    }
+
+    defs = calloc(proc->nvregs + 1, sizeof(*defs));
+    where = calloc(proc->nvregs + 1, sizeof(*where));
+    if (defs == NULL || where == NULL) {
+        free(defs);
+        free(where);
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        TAILQ_FOREACH(insn, &blk->insns, link) {
+            if (insn->dst == IR_NOREG)
+                continue;
+
+            defs[insn->dst] = insn;
+            where[insn->dst] = blk;
+        }
+    }
+
+    /* Values used after the loop must come from its last copy */
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        if (loop_contains(nest, loop, blk))
+            continue;
+
+        TAILQ_FOREACH(insn, &blk->insns, link) {
+            nvals = ir_operands(insn, vals);
+            for (size_t i = 0; i < nvals; ++i) {
+                if (vals[i]->type != IR_VAL_VREG || where[vals[i]->vreg] == NULL)
+                    continue;
+
+                live_out |= loop_contains(nest, loop, where[vals[i]->vreg]);
+            }
+        }
+    }
+
+    if ((error = loop_preheader(state, proc, nest, loop)) < 0) {
+        goto done;
+    }
+
+    if ((error = loop_scan_writes(proc, nest, loop, &writes)) < 0) {
+        goto done;
+    }
+
+    loop_trip_count(proc, nest, loop, defs, &writes, &trip);
+    free(writes.stores);
+
+    if (factor == 0) {
+        if (trip.count == 0) {
+            goto done;
+        }
+
+        factor = UNROLL_FACTOR;
+        if (trip.count <= UNROLL_FULL_MAX && trip.count * cost <= UNROLL_MAX_COST) {
+            factor = trip.count;
+        } else if ((factor + trip.count % factor) * cost > UNROLL_MAX_COST) {
+            goto done;
+        }
+    }
+
+    if (trip.count > 0 && trip.count <= factor) {
+        /* Every iteration gets a copy of its own */
+        ncopies = trip.count - 1;
+        back = -1;
+    } else if (trip.count > 0) {
+        /* Iterations left over run before the unrolled loop */
+        rest = trip.count % factor;
+        ncopies = rest + factor - 1;
+        back = rest;
+    } else {
+        /* Not knowing when to stop, every copy tests the counter */
+        ncopies = factor - 1;
+        back = 0;
+    }
+
+    if (live_out && (trip.count == 0 || nexits != 1)) {
+        goto done;
+    }
+
+    if (back < 0 || ncopies > 0) {
+        if ((error = loop_replicate(state, proc, nest, loop, &trip, ncopies, back)) < 0)
+            goto done;
+
+        trace_debug("unroll: %s loop %zu by %zu (%zu trips)\n", proc->symbol->name,
+            loop->head->id, factor, trip.count);
+        error = 1;
+    }
+
+done:
+    free(defs);
+    free(where);
+    return error;
+}
+
+int
+loop_unroll(struct bup_state *state, struct ir_proc *proc)
+{
+    struct loop_nest nest;
+    struct ir_loop *loop;
+    bool inner;
+    int n, count = 0;
+
+    if (state == NULL || proc == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    /* Inner loops first, their enclosing loops are next in line */
+    do {
+        if (loop_find(state, proc, &nest) < 0) {
+            return -1;
+        }
+
+        n = 0;
+        for (size_t i = 0; i < nest.count && n == 0; ++i) {
+            loop = &nest.loops[i];
+            if (loop->head->unroll == 1)
+                continue;
+
+            inner = true;
+            for (size_t j = 0; j < nest.count && inner; ++j) {
+                if (nest.loops[j].head != loop->head)
+                    inner = !loop_contains(&nest, loop, nest.loops[j].head);
+            }
+
+            if (!inner)
+                continue;
+
+            n = loop_unroll_one(state, proc, &nest, loop);
+            loop->head->unroll = 1;
+        }
+
+        loop_release(&nest);
+        if (n < 0 || (n > 0 && opt_prune(state, proc) < 0)) {
+            return -1;
+        }
+
+        count += n;
+    } while (n > 0);
+
+    if (count > 0 && opt_simplify(state, proc) < 0) {
+        return -1;
+    }
+
+    return count;
+}
+
+/*
+ * Returns true if a virtual register is defined in a block
+ */
+static bool
+loop_in_def(struct ir_block *blk, ir_vreg_t vreg)
+{
+    struct ir_insn *insn;
+
+    TAILQ_FOREACH(insn, &blk->insns, link) {
+        if (insn->dst == vreg)
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * Rotate a loop whose header only tests for the way out,
+ * every jump back to the header runs a copy of it instead
+ * and the header is left as a guard on the way in.
+ *
+ * Returns one if the loop was rotated, zero if it was left
+ * alone and a less than zero value on failure.
+ */
+static int
+loop_rotate_one(struct bup_state *state, struct ir_proc *proc,
+    struct loop_nest *nest, struct ir_loop *loop)
+{
+    struct ir_block *head = loop->head, *blk, *body, *pred;
+    struct ir_insn *insn, *term, *dup;
+    struct ir_value *vals[IR_MAX_OPERANDS];
+    size_t nvals;
+    ir_vreg_t *vmap, nvregs = proc->nvregs;
+    size_t cost = 0, nlatch = 0;
+
+    term = ir_block_term(head);
+    if (term == NULL || term->op != IR_BR) {
+        return 0;
+    }
+
+    if (loop_contains(nest, loop, term->target[0]) ==
+        loop_contains(nest, loop, term->target[1])) {
+        return 0;
+    }
+
+    body = term->target[0];
+    if (!loop_contains(nest, loop, body)) {
+        body = term->target[1];
+    }
+
+    if (body == head) {
+        return 0;
+    }
+
+    TAILQ_FOREACH(insn, &head->insns, link) {
+        if (insn->op == IR_ASM && strchr(insn->text, ':') != NULL)
+            return 0;
+
+        ++cost;
+    }
+
+    for (size_t i = 0; i < head->npreds; ++i) {
+        pred = head->preds[i];
+        if (!loop_contains(nest, loop, pred))
+            continue;
+        if (ir_block_term(pred)->op != IR_JMP)
+            return 0;
+
+        ++nlatch;
+    }
+
+    if (cost * nlatch > ROTATE_MAX_COST) {
+        return 0;
+    }
+
+    /* Values of the header have nothing to merge with elsewhere */
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        if (blk == head)
+            continue;
+
+        TAILQ_FOREACH(insn, &blk->insns, link) {
+            nvals = ir_operands(insn, vals);
+            for (size_t i = 0; i < nvals; ++i) {
+                if (vals[i]->type == IR_VAL_VREG && loop_in_def(head, vals[i]->vreg))
+                    return 0;
+            }
+        }
+    }
+
+    if ((vmap = calloc(nvregs + 1, sizeof(*vmap))) == NULL) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    for (size_t i = 0; i < head->npreds; ++i) {
+        pred = head->preds[i];
+        if (!loop_contains(nest, loop, pred))
+            continue;
+
+        TAILQ_FOREACH(insn, &head->insns, link) {
+            if (insn->dst != IR_NOREG)
+                vmap[insn->dst] = proc->nvregs++;
+        }
+
+        /* The jump back becomes a copy of the header */
+        term = ir_block_term(pred);
+        TAILQ_REMOVE(&pred->insns, term, link);
+        TAILQ_FOREACH(insn, &head->insns, link) {
+            if ((dup = ir_insn_new(state, insn->op, insn->size)) == NULL) {
+                free(vmap);
+                return -1;
+            }
+
+            memcpy(dup, insn, sizeof(*dup));
+            nvals = ir_operands(dup, vals);
+            for (size_t j = 0; j < nvals; ++j) {
+                if (vals[j]->type == IR_VAL_VREG && vals[j]->vreg < nvregs &&
+                    loop_in_def(head, vals[j]->vreg)) {
+                    vals[j]->vreg = vmap[vals[j]->vreg];
+                }
+            }
+
+            if (dup->dst != IR_NOREG)
+                dup->dst = vmap[dup->dst];
+
+            TAILQ_INSERT_TAIL(&pred->insns, dup, link);
+        }
+    }
+
+    /* The loop is now entered past its old header */
+    if (head->unroll != 0) {
+        body->unroll = head->unroll;
+        head->unroll = 0;
+    }
+
+    free(vmap);
+    return ir_cfg_build(state, proc) < 0 ? -1 : 1;
+}
+
+int
+loop_rotate(struct bup_state *state, struct ir_proc *proc)
+{
+    struct loop_nest nest;
+    int n, count = 0;
+
+    if (state == NULL || proc == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if (loop_find(state, proc, &nest) < 0) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < nest.count; ++i) {
+        if ((n = loop_rotate_one(state, proc, &nest, &nest.loops[i])) < 0) {
+            count = -1;
+            break;
+        }
+
+        count += n;
+    }
+
+    if (count > 0) {
+        trace_debug("rotate: rotated %d loops in %s\n", count, proc->symbol->name);
+    }
+
+    loop_release(&nest);
+    return count;
+}
@@ -0,0 +1,930 @@
+/*
+ * Copyright (C) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "bup/ir.h"
+#include "bup/regalloc.h"
+#include "bup/isel.h"
+#include "bup/opt.h"
+#include "bup/pass.h"
+#include "bup/mu.h"
+#include "bup/trace.h"
+
+/* Binary operation lookup table */
+static const mu_binop_t binoptab[] = {
+    [IR_ADD] = MU_ADD,
+    [IR_SUB] = MU_SUB,
+    [IR_MUL] = MU_MUL
+};
+
+/* Branch condition lookup table */
+static const mu_cond_t condtab[] = {
+    [IR_COND_EQ] = MU_EQ,
+    [IR_COND_NE] = MU_NE,
+    [IR_COND_LT] = MU_LT,
+    [IR_COND_LE] = MU_LE,
+    [IR_COND_GT] = MU_GT,
+    [IR_COND_GE] = MU_GE
+};
+
+/*
+ * Represents the state of lowering a procedure
+ *
+ * @state: Compiler state
+ * @proc:  Procedure being lowered
+ * @ra:    Register assignment
+ * @isel:  Instruction selected for each instruction
+ */
+struct lower_ctx {
+    struct bup_state *state;
+    struct ir_proc *proc;
+    struct ra_result ra;
+    struct isel_choice *isel;
+};
+
+/*
+ * Get an operand into a register
+ *
+ * @ctx:  Lowering context
+ * @size: Operation size
+ * @val:  Operand
+ * @n:    Scratch register to use if not already in one
+ *
+ * Returns the register holding the operand
+ */
+static mu_reg_t
+lower_use(struct lower_ctx *ctx, msize_t size, struct ir_value *val, int n)
+{
+    const struct mu_regfile *rf = mu_regfile();
+    struct ra_loc *loc;
+
+    if (val->type == IR_VAL_IMM) {
+        mu_cg_ldimm(ctx->state, size, rf->scratch[n], val->imm);
+        return rf->scratch[n];
+    }
+
+    loc = &ctx->ra.locs[val->vreg];
+    if (loc->reg >= 0) {
+        return loc->reg;
+    }
+
+    mu_cg_reload(ctx->state, rf->scratch[n], loc->slot);
+    return rf->scratch[n];
+}
+
+/*
+ * Get the register the result of an instruction is
+ * computed in
+ */
+static inline mu_reg_t
+lower_dst(struct lower_ctx *ctx, struct ir_insn *insn)
+{
+    struct ra_loc *loc = &ctx->ra.locs[insn->dst];
+
+    return (loc->reg >= 0) ? loc->reg : mu_regfile()->scratch[0];
+}
+
+/*
+ * Write the result of an instruction back to its spill
+ * slot if it has one
+ */
+static inline int
+lower_writeback(struct lower_ctx *ctx, struct ir_insn *insn, mu_reg_t reg)
+{
+    struct ra_loc *loc = &ctx->ra.locs[insn->dst];
+
+    if (loc->reg >= 0) {
+        return 0;
+    }
+
+    return mu_cg_spill(ctx->state, loc->slot, reg);
+}
+
+/*
+ * Move an operand into the register a result is computed in
+ *
+ * @ctx:  Lowering context
+ * @size: Operation size
+ * @val:  Operand
+ * @dst:  Register to move it to
+ */
+static int
+lower_copy(struct lower_ctx *ctx, msize_t size, struct ir_value *val,
+    mu_reg_t dst)
+{
+    struct ra_loc *loc;
+
+    switch (val->type) {
+    case IR_VAL_IMM:
+        return mu_cg_ldimm(ctx->state, size, dst, val->imm);
+    case IR_VAL_VREG:
+        loc = &ctx->ra.locs[val->vreg];
+        if (loc->reg == dst)
+            return 0;
+        if (loc->reg < 0)
+            return mu_cg_reload(ctx->state, dst, loc->slot);
+
+        return mu_cg_movreg(ctx->state, size, dst, loc->reg);
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+/*
+ * Apply an operation to the register holding operand 'a',
+ * folding operand 'b' into a memory operand when it lives
+ * in memory anyway.
+ *
+ * @ctx:  Lowering context
+ * @insn: Arithmetic instruction or compare and branch
+ * @op:   Operation
+ * @dst:  Register holding operand 'a'
+ */
+static int
+lower_binop(struct lower_ctx *ctx, struct ir_insn *insn, mu_binop_t op,
+    mu_reg_t dst)
+{
+    struct bup_state *state = ctx->state;
+    struct ir_value *b = &insn->b;
+    struct ra_loc *loc;
+
+    switch (b->type) {
+    case IR_VAL_IMM:
+        return mu_cg_ibinop(state, op, insn->size, dst, b->imm);
+    case IR_VAL_MEM:
+        return mu_cg_binopvar(state, op, insn->size, dst, b->mem.sym);
+    case IR_VAL_VREG:
+        loc = &ctx->ra.locs[b->vreg];
+        if (loc->reg < 0)
+            return mu_cg_binopslot(state, op, insn->size, dst, loc->slot);
+
+        return mu_cg_binop(state, op, insn->size, dst, loc->reg);
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+/*
+ * Get the address of an indexed load or store, a spilled
+ * base is taken from the label again and a spilled index is
+ * reloaded into the second scratch register.
+ *
+ * @ctx:   Lowering context
+ * @insn:  Indexed load or store
+ * @index: Index operand
+ * @res:   Address is written here
+ */
+static void
+lower_addr(struct lower_ctx *ctx, struct ir_insn *insn, struct ir_value *index,
+    struct mu_addr *res)
+{
+    res->label = insn->sym;
+    res->base = -1;
+    if (insn->base.type == IR_VAL_VREG && ctx->ra.locs[insn->base.vreg].reg >= 0) {
+        res->label = NULL;
+        res->base = ctx->ra.locs[insn->base.vreg].reg;
+    }
+
+    res->index = -1;
+    res->scale = insn->scale;
+    res->disp = insn->disp;
+
+    switch (index->type) {
+    case IR_VAL_IMM:
+        res->disp += index->imm * insn->scale;
+        break;
+    case IR_VAL_VREG:
+        res->index = lower_use(ctx, MSIZE_QWORD, index, 1);
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * Lower an indexed store
+ *
+ * @ctx:  Lowering context
+ * @insn: Indexed store
+ */
+static int
+lower_storex(struct lower_ctx *ctx, struct ir_insn *insn)
+{
+    const struct mu_regfile *rf = mu_regfile();
+    struct bup_state *state = ctx->state;
+    struct mu_addr addr;
+    mu_reg_t reg;
+
+    lower_addr(ctx, insn, &insn->b, &addr);
+    if (insn->a.type == IR_VAL_IMM) {
+        return mu_cg_istoreidx(state, insn->msize, &addr, insn->a.imm);
+    }
+
+    /* Free the scratch register holding the index for the value */
+    if (addr.index == rf->scratch[1] && ctx->ra.locs[insn->a.vreg].reg < 0) {
+        if (mu_cg_leaidx(state, MSIZE_QWORD, rf->scratch[0], &addr) < 0)
+            return -1;
+
+        addr.label = NULL;
+        addr.base = rf->scratch[0];
+        addr.index = -1;
+        addr.disp = 0;
+    }
+
+    reg = lower_use(ctx, insn->size, &insn->a, 1);
+    return mu_cg_storeidx(state, insn->msize, &addr, reg);
+}
+
+/*
+ * Compare the operands of a branch, set or select, a lone
+ * operand is compared against zero
+ *
+ * @ctx:  Lowering context
+ * @insn: Instruction with a condition
+ *
+ * Returns the condition to test the flags for, or a less
+ * than zero value on failure
+ */
+static int
+lower_cmp(struct lower_ctx *ctx, struct ir_insn *insn)
+{
+    mu_reg_t reg;
+
+    reg = lower_use(ctx, insn->size, &insn->a, 0);
+    if (insn->cond == IR_COND_NZ) {
+        if (mu_cg_ibinop(ctx->state, MU_CMP, insn->size, reg, 0) < 0)
+            return -1;
+
+        return MU_NE;
+    }
+
+    if (lower_binop(ctx, insn, MU_CMP, reg) < 0) {
+        return -1;
+    }
+
+    return condtab[insn->cond];
+}
+
+/*
+ * Lower a select, the value picked if the condition fails
+ * goes into the result first and the other is moved over
+ * it if the condition holds.
+ *
+ * @ctx:  Lowering context
+ * @insn: Select instruction
+ */
+static int
+lower_sel(struct lower_ctx *ctx, struct ir_insn *insn)
+{
+    mu_reg_t dst, src;
+    int cond;
+
+    if ((cond = lower_cmp(ctx, insn)) < 0) {
+        return -1;
+    }
+
+    /*
+     * Only moves from here on, they leave the flags alone.
+     * There is no conditional move of an immediate.
+     */
+    src = lower_use(ctx, MSIZE_QWORD, &insn->sel[0], 1);
+    dst = lower_dst(ctx, insn);
+    if (lower_copy(ctx, MSIZE_QWORD, &insn->sel[1], dst) < 0) {
+        return -1;
+    }
+
+    if (mu_cg_cmov(ctx->state, cond, dst, src) < 0) {
+        return -1;
+    }
+
+    return lower_writeback(ctx, insn, dst);
+}
+
+/*
+ * Lower a store of an addition or subtraction on the
+ * variable stored to, the variable is updated in place
+ *
+ * @ctx:  Lowering context
+ * @insn: Store instruction
+ * @op:   Operation covered by the store
+ */
+static int
+lower_rmw(struct lower_ctx *ctx, struct ir_insn *insn, struct ir_insn *op)
+{
+    struct bup_state *state = ctx->state;
+    mu_reg_t reg;
+
+    if (op->b.type == IR_VAL_IMM) {
+        return mu_cg_irmwvar(state, binoptab[op->op], insn->msize, insn->sym,
+            op->b.imm);
+    }
+
+    reg = lower_use(ctx, insn->msize, &op->b, 0);
+    return mu_cg_rmwvar(state, binoptab[op->op], insn->msize, insn->sym, reg);
+}
+
+/*
+ * Lower an operation whose operand 'b' is a load covered by
+ * it, the variable becomes a memory operand
+ *
+ * @ctx:  Lowering context
+ * @insn: Arithmetic instruction
+ * @load: Load covered by it
+ */
+static int
+lower_memop(struct lower_ctx *ctx, struct ir_insn *insn, struct ir_insn *load)
+{
+    mu_reg_t reg;
+
+    reg = lower_dst(ctx, insn);
+    if (lower_copy(ctx, insn->size, &insn->a, reg) < 0) {
+        return -1;
+    }
+
+    if (mu_cg_binopvar(ctx->state, binoptab[insn->op], insn->size, reg, load->sym) < 0) {
+        return -1;
+    }
+
+    return lower_writeback(ctx, insn, reg);
+}
+
+/*
+ * Lower an addition, subtraction or multiply as the address
+ * computation of an 'lea', which leaves the operands alone
+ * and needs no copy into the result.
+ *
+ * @ctx:  Lowering context
+ * @insn: Arithmetic instruction
+ * @mul:  Multiply by the scale covered by an addition, if any
+ */
+static int
+lower_lea(struct lower_ctx *ctx, struct ir_insn *insn, struct ir_insn *mul)
+{
+    struct ir_value *base = &insn->a, *index = &insn->b;
+    struct mu_addr addr;
+    mu_reg_t reg;
+
+    addr.label = NULL;
+    addr.index = -1;
+    addr.scale = 1;
+    addr.disp = 0;
+    if (mul != NULL) {
+        if (base->type == IR_VAL_VREG && base->vreg == mul->dst)
+            base = &insn->b;
+
+        index = &mul->a;
+        addr.scale = mul->b.imm;
+    }
+
+    addr.base = lower_use(ctx, MSIZE_QWORD, base, 0);
+    switch (insn->op) {
+    case IR_ADD:
+        if (index->type == IR_VAL_IMM)
+            addr.disp = index->imm;
+        else
+            addr.index = lower_use(ctx, MSIZE_QWORD, index, 1);
+        break;
+    case IR_SUB:
+        addr.disp = -index->imm;
+        break;
+    case IR_MUL:
+        /* a*3 is a + a*2 */
+        addr.index = addr.base;
+        addr.scale = index->imm - 1;
+        break;
+    default:
+        break;
+    }
+
+    reg = lower_dst(ctx, insn);
+    if (mu_cg_leaidx(ctx->state, insn->size, reg, &addr) < 0) {
+        return -1;
+    }
+
+    return lower_writeback(ctx, insn, reg);
+}
+
+/*
+ * Lower a conditional branch
+ *
+ * @ctx:  Lowering context
+ * @insn: Branch instruction
+ * @next: Block placed after this one
+ */
+static int
+lower_br(struct lower_ctx *ctx, struct ir_insn *insn, struct ir_block *next)
+{
+    struct bup_state *state = ctx->state;
+    char name[2][64];
+    mu_reg_t reg;
+    int error;
+
+    ir_block_name(ctx->proc, insn->target[0], name[0], sizeof(name[0]));
+    ir_block_name(ctx->proc, insn->target[1], name[1], sizeof(name[1]));
+
+    /* A single compare sets the flags for the jump */
+    if (insn->cond != IR_COND_NZ) {
+        if ((error = lower_cmp(ctx, insn)) < 0)
+            return error;
+        if (insn->target[0] == next)
+            return mu_cg_jcc(state, condtab[ir_cond_negate(insn->cond)], name[1]);
+
+        error = mu_cg_jcc(state, condtab[insn->cond], name[0]);
+        if (error < 0 || insn->target[1] == next)
+            return error;
+
+        return mu_cg_jmp(state, name[1]);
+    }
+
+    /* Fall into the taken path */
+    if (insn->target[0] == next) {
+        if (insn->a.type == IR_VAL_IMM)
+            return mu_cg_icmpnz(state, name[1], insn->a.imm);
+
+        reg = lower_use(ctx, insn->size, &insn->a, 0);
+        return mu_cg_jz(state, insn->size, reg, name[1]);
+    }
+
+    reg = lower_use(ctx, insn->size, &insn->a, 0);
+    error = mu_cg_jnz(state, insn->size, reg, name[0]);
+    if (error < 0 || insn->target[1] == next) {
+        return error;
+    }
+
+    return mu_cg_jmp(state, name[1]);
+}
+
+/*
+ * Lower a single instruction
+ *
+ * @ctx:  Lowering context
+ * @insn: Instruction to lower
+ * @isel: Rule selected for the instruction
+ * @next: Block placed after the current one
+ */
+static int
+lower_insn(struct lower_ctx *ctx, struct ir_insn *insn, struct isel_choice *isel,
+    struct ir_block *next)
+{
+    struct bup_state *state = ctx->state;
+    struct mu_addr addr;
+    char name[64];
+    mu_reg_t reg;
+    int error = 0;
+
+    switch (isel->rule) {
+    case ISEL_COVERED:
+        return 0;
+    case ISEL_RMW:
+        return lower_rmw(ctx, insn, isel->kid);
+    case ISEL_MEMOP:
+        return lower_memop(ctx, insn, isel->kid);
+    case ISEL_LEA:
+    case ISEL_LEAIDX:
+        return lower_lea(ctx, insn, isel->kid);
+    default:
+        break;
+    }
+
+    switch (insn->op) {
+    case IR_MOV:
+        reg = lower_dst(ctx, insn);
+        if ((error = lower_copy(ctx, insn->size, &insn->a, reg)) < 0)
+            break;
+
+        error = lower_writeback(ctx, insn, reg);
+        break;
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+        reg = lower_dst(ctx, insn);
+        if ((error = lower_copy(ctx, insn->size, &insn->a, reg)) < 0)
+            break;
+
+        error = lower_binop(ctx, insn, binoptab[insn->op], reg);
+
+        if (error == 0)
+            error = lower_writeback(ctx, insn, reg);
+        break;
+    case IR_LOAD:
+        reg = lower_dst(ctx, insn);
+        if ((error = mu_cg_loadvar(state, insn->msize, reg, insn->sym)) < 0)
+            break;
+
+        error = lower_writeback(ctx, insn, reg);
+        break;
+    case IR_LOADX:
+        reg = lower_dst(ctx, insn);
+        lower_addr(ctx, insn, &insn->a, &addr);
+        if ((error = mu_cg_loadidx(state, insn->msize, reg, &addr)) < 0)
+            break;
+
+        error = lower_writeback(ctx, insn, reg);
+        break;
+    case IR_STOREX:
+        error = lower_storex(ctx, insn);
+        break;
+    case IR_SET:
+        if ((error = lower_cmp(ctx, insn)) < 0)
+            break;
+
+        reg = lower_dst(ctx, insn);
+        if ((error = mu_cg_setcc(state, error, reg)) < 0)
+            break;
+
+        error = lower_writeback(ctx, insn, reg);
+        break;
+    case IR_SEL:
+        error = lower_sel(ctx, insn);
+        break;
+    case IR_ADDR:
+        reg = lower_dst(ctx, insn);
+        addr.label = insn->sym;
+        addr.base = -1;
+        addr.index = -1;
+        addr.scale = 1;
+        addr.disp = 0;
+        if ((error = mu_cg_leaidx(state, MSIZE_QWORD, reg, &addr)) < 0)
+            break;
+
+        error = lower_writeback(ctx, insn, reg);
+        break;
+    case IR_STORE:
+        if (insn->a.type == IR_VAL_IMM) {
+            error = mu_cg_istorevar(state, insn->msize, insn->sym, insn->a.imm);
+            break;
+        }
+
+        reg = lower_use(ctx, insn->size, &insn->a, 0);
+        error = mu_cg_storevar(state, insn->msize, insn->sym, reg);
+        break;
+    case IR_CALL:
+        if (insn->dst != IR_NOREG) {
+            trace_emit(TRACE_ERROR, 0, "call results cannot be lowered\n");
+            return -1;
+        }
+
+        error = mu_cg_call(state, insn->sym);
+        break;
+    case IR_TAILCALL:
+        error = mu_cg_tailcall(state, insn->sym);
+        break;
+    case IR_ASM:
+        error = mu_cg_inject(state, (char *)insn->text);
+        break;
+    case IR_JMP:
+        if (insn->target[0] == next)
+            break;
+
+        ir_block_name(ctx->proc, insn->target[0], name, sizeof(name));
+        error = mu_cg_jmp(state, name);
+        break;
+    case IR_BR:
+        error = lower_br(ctx, insn, next);
+        break;
+    case IR_RET:
+        switch (insn->a.type) {
+        case IR_VAL_NONE:
+            error = mu_cg_ret(state);
+            break;
+        case IR_VAL_IMM:
+            error = mu_cg_retimm(state, insn->size, insn->a.imm);
+            break;
+        case IR_VAL_VREG:
+            reg = lower_use(ctx, insn->size, &insn->a, 0);
+            error = mu_cg_retreg(state, insn->size, reg);
+            break;
+        default:
+            break;
+        }
+        break;
+    }
+
+    return error;
+}
+
+/*
+ * Returns true if a procedure is a leaf, it makes no calls
+ * and its inline assembly writes nothing to the stack.
+ * Tail calls leave the frame before jumping so they are
+ * fine.
+ */
+static bool
+lower_is_leaf(struct ir_proc *proc)
+{
+    static const char *stackops[] = {
+        "call", "push", "pushf", "pushfq", "enter", "rsp", NULL
+    };
+    struct ir_block *blk;
+    struct ir_insn *insn;
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        TAILQ_FOREACH(insn, &blk->insns, link) {
+            if (insn->op == IR_CALL)
+                return false;
+            if (insn->op != IR_ASM)
+                continue;
+
+            for (int i = 0; stackops[i] != NULL; ++i) {
+                if (opt_mentions(insn->text, stackops[i]))
+                    return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Returns true if the label of a block must be kept even
+ * if nothing jumps to it, inline assembly may mention it
+ * or rely on it to scope local labels.
+ *
+ * @proc: Procedure
+ * @blk:  Block to check
+ */
+static bool
+lower_keep_label(struct ir_proc *proc, struct ir_block *blk)
+{
+    struct ir_block *cur;
+    struct ir_insn *insn;
+
+    if (blk->label == NULL) {
+        return false;
+    }
+
+    TAILQ_FOREACH(cur, &proc->blocks, link) {
+        TAILQ_FOREACH(insn, &cur->insns, link) {
+            if (insn->op != IR_ASM)
+                continue;
+            if (opt_mentions(insn->text, blk->label))
+                return true;
+            if (cur == blk && strchr(insn->text, ':') != NULL)
+                return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Find which blocks need a label, only those something
+ * jumps to get one.
+ *
+ * @proc: Procedure
+ * @res:  Set for each block that needs a label
+ */
+static void
+lower_mark_labels(struct ir_proc *proc, bool *res)
+{
+    struct ir_block *blk, *next;
+    struct ir_insn *term;
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        res[blk->id] |= lower_keep_label(proc, blk);
+        if ((term = ir_block_term(blk)) == NULL)
+            continue;
+
+        next = TAILQ_NEXT(blk, link);
+        switch (term->op) {
+        case IR_JMP:
+            if (term->target[0] != next)
+                res[term->target[0]->id] = true;
+            break;
+        case IR_BR:
+            if (term->target[0] != next)
+                res[term->target[0]->id] = true;
+            if (term->target[0] == next || term->target[1] != next)
+                res[term->target[1]->id] = true;
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+/*
+ * Find the loop headers of a procedure, the blocks jumped
+ * back to from themselves or a block placed after them.
+ *
+ * @proc: Procedure
+ * @res:  Set for each loop header
+ *
+ * Returns zero on success
+ */
+static int
+lower_mark_loops(struct ir_proc *proc, bool *res)
+{
+    struct ir_block *blk, *succs[2];
+    size_t *order, pos = 0, n;
+
+    if ((order = calloc(proc->nblocks + 1, sizeof(*order))) == NULL) {
+        return -1;
+    }
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        order[blk->id] = pos++;
+    }
+
+    /*
+     * The entry is aligned as the start of the procedure and
+     * cold blocks jumping back are not what makes a loop
+     */
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        if (blk->cold)
+            continue;
+
+        n = ir_succs(blk, succs);
+        for (size_t i = 0; i < n; ++i) {
+            if (order[succs[i]->id] > 0 && order[succs[i]->id] <= order[blk->id])
+                res[succs[i]->id] = true;
+        }
+    }
+
+    free(order);
+    return 0;
+}
+
+/*
+ * Lower a procedure
+ *
+ * @state: Compiler state
+ * @proc:  Procedure to lower
+ */
+static int
+lower_proc(struct bup_state *state, struct ir_proc *proc)
+{
+    struct lower_ctx ctx;
+    struct symbol *symbol = proc->symbol;
+    struct ir_block *blk;
+    struct ir_insn *insn;
+    char name[64];
+    bool *labels, *loops, speed;
+    size_t pos = 0;
+    int error = 0;
+
+    /* Padding only pays off when optimizing for speed */
+    speed = state->opt_level == PASS_O2;
+    ctx.state = state;
+    ctx.proc = proc;
+    if (ra_alloc(state, proc, &ctx.ra) < 0) {
+        return -1;
+    }
+
+    if (isel_proc(state, proc, &ctx.ra, &ctx.isel) < 0) {
+        ra_release(&ctx.ra);
+        return -1;
+    }
+
+    labels = calloc(proc->nblocks + 1, sizeof(*labels));
+    loops = calloc(proc->nblocks + 1, sizeof(*loops));
+    if (labels == NULL || loops == NULL || lower_mark_loops(proc, loops) < 0) {
+        error = -1;
+        goto done;
+    }
+
+    lower_mark_labels(proc, labels);
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        if (blk == TAILQ_FIRST(&proc->blocks)) {
+            if (speed)
+                mu_cg_align(state, MU_ALIGN_PROC);
+
+            mu_cg_label(state, symbol->name, proc->section, symbol->is_global);
+            mu_cg_enter(state, ctx.ra.used, ctx.ra.nslots, lower_is_leaf(proc));
+        } else if (labels[blk->id]) {
+            if (speed && loops[blk->id])
+                mu_cg_align(state, MU_ALIGN_LOOP);
+
+            ir_block_name(proc, blk, name, sizeof(name));
+            mu_cg_label(state, name, NULL, false);
+        }
+
+        TAILQ_FOREACH(insn, &blk->insns, link) {
+            error = lower_insn(&ctx, insn, &ctx.isel[pos++], TAILQ_NEXT(blk, link));
+            if (error < 0)
+                goto done;
+        }
+    }
+
+done:
+    ra_release(&ctx.ra);
+    free(ctx.isel);
+    free(labels);
+    free(loops);
+    return error;
+}
+
+/*
+ * Lower a global variable
+ *
+ * @state: Compiler state
+ * @item:  Variable item
+ */
+static int
+lower_var(struct bup_state *state, struct ir_item *item)
+{
+    struct symbol *symbol = item->symbol;
+    struct datum_type *dtype = &symbol->data_type;
+
+    if (dtype->array_size > 0) {
+        return mu_cg_array(
+            state,
+            symbol->name,
+            symbol->is_global,
+            dtype->array_size
+        );
+    }
+
+    if (item->init) {
+        return mu_cg_globvar(
+            state,
+            symbol->name,
+            type_to_msize(dtype->type),
+            SECTION_DATA,
+            item->imm,
+            symbol->is_global
+        );
+    }
+
+    return mu_cg_globvar(
+        state,
+        symbol->name,
+        datum_msize(dtype),
+        SECTION_BSS,
+        0,
+        symbol->is_global
+    );
+}
+
+/*
+ * Find the narrowest code width the top-level assembly of
+ * a unit selects, 64 if it selects none.
+ */
+static uint8_t
+lower_code_bits(struct ir_unit *unit)
+{
+    struct ir_item *item;
+    uint8_t bits, res = 64;
+
+    TAILQ_FOREACH(item, &unit->items, link) {
+        if (item->type != IR_ITEM_ASM)
+            continue;
+
+        bits = mu_code_bits(item->text);
+        if (bits != 0 && bits < res)
+            res = bits;
+    }
+
+    return res;
+}
+
+int
+ir_lower(struct bup_state *state, struct ir_unit *unit)
+{
+    struct ir_item *item;
+    struct symbol *symbol;
+    int error = 0;
+
+    if (state == NULL || unit == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    state->code_bits = lower_code_bits(unit);
+    if (mu_cg_begin(state) < 0) {
+        return -1;
+    }
+
+    TAILQ_FOREACH(item, &unit->items, link) {
+        symbol = item->symbol;
+        switch (item->type) {
+        case IR_ITEM_PROC:
+            error = lower_proc(state, item->proc);
+            break;
+        case IR_ITEM_ASM:
+            error = mu_cg_inject(state, (char *)item->text);
+            break;
+        case IR_ITEM_VAR:
+            error = lower_var(state, item);
+            break;
+        case IR_ITEM_STRUCT:
+            error = mu_cg_struct(state, symbol->name, symbol, symbol->parent);
+            break;
+        }
+
+        if (error < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
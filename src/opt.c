@@ -0,0 +1,1456 @@
+/*
+ * Copyright (C) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include "bup/opt.h"
+#include "bup/trace.h"
+
+/* Maximum number of propagate/prune rounds per procedure */
+#define OPT_MAX_ROUNDS 8
+
+/* Largest displacement an address can encode */
+#define OPT_MAX_DISP 0x7FFFFFFF
+
+/*
+ * Represents the known contents of a global variable
+ *
+ * @sym:   Symbol name
+ * @msize: Size of access the value is valid for
+ * @val:   Value the variable holds
+ */
+struct opt_mem {
+    const char *sym;
+    msize_t msize;
+    struct ir_value val;
+};
+
+/*
+ * Represents the known contents of memory at a point
+ *
+ * @ents:  Known variables
+ * @count: Number of known variables
+ */
+struct opt_memset {
+    struct opt_mem *ents;
+    size_t count;
+};
+
+ssize_t
+opt_trunc(msize_t size, ssize_t imm)
+{
+    switch (size) {
+    case MSIZE_BYTE:
+        return imm & 0xFF;
+    case MSIZE_WORD:
+        return imm & 0xFFFF;
+    case MSIZE_DWORD:
+        return imm & 0xFFFFFFFF;
+    default:
+        break;
+    }
+
+    return imm;
+}
+
+/*
+ * Returns true if an operation only produces a value
+ */
+static inline bool
+opt_is_pure(ir_op_t op)
+{
+    switch (op) {
+    case IR_MOV:
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_LOAD:
+    case IR_LOADX:
+    case IR_ADDR:
+    case IR_SET:
+    case IR_SEL:
+        return true;
+    default:
+        break;
+    }
+
+    return false;
+}
+
+/*
+ * Returns true if a value is the immediate 'imm'
+ */
+static inline bool
+opt_is_imm(struct ir_value *val, ssize_t imm)
+{
+    return val->type == IR_VAL_IMM && val->imm == imm;
+}
+
+/*
+ * Returns true if two values are the same register or
+ * immediate
+ */
+static inline bool
+opt_same(struct ir_value *a, struct ir_value *b)
+{
+    if (a->type != b->type) {
+        return false;
+    }
+
+    switch (a->type) {
+    case IR_VAL_VREG:
+        return a->vreg == b->vreg;
+    case IR_VAL_IMM:
+        return a->imm == b->imm;
+    default:
+        return false;
+    }
+}
+
+/*
+ * Replace an operand with what its virtual register
+ * is known to hold
+ */
+static inline void
+opt_subst(struct ir_value *subst, struct ir_value *val)
+{
+    if (val->type != IR_VAL_VREG) {
+        return;
+    }
+
+    if (subst[val->vreg].type != IR_VAL_NONE) {
+        *val = subst[val->vreg];
+    }
+}
+
+/*
+ * Attempt to fold an arithmetic instruction
+ *
+ * @insn: Instruction to fold
+ * @res:  Value of the result is written here
+ *
+ * Returns true if the result is known
+ */
+static bool
+opt_fold(struct ir_insn *insn, struct ir_value *res)
+{
+    struct ir_value *a = &insn->a, *b = &insn->b;
+    size_t x, y;
+
+    if (a->type == IR_VAL_IMM && b->type == IR_VAL_IMM) {
+        x = a->imm;
+        y = b->imm;
+        switch (insn->op) {
+        case IR_ADD:
+            x += y;
+            break;
+        case IR_SUB:
+            x -= y;
+            break;
+        case IR_MUL:
+            x *= y;
+            break;
+        default:
+            return false;
+        }
+
+        res->type = IR_VAL_IMM;
+        res->imm = opt_trunc(insn->size, x);
+        return true;
+    }
+
+    /* Identities */
+    switch (insn->op) {
+    case IR_ADD:
+        if (opt_is_imm(b, 0)) {
+            *res = *a;
+            return true;
+        }
+
+        if (opt_is_imm(a, 0) && b->type != IR_VAL_MEM) {
+            *res = *b;
+            return true;
+        }
+        break;
+    case IR_SUB:
+        if (opt_is_imm(b, 0)) {
+            *res = *a;
+            return true;
+        }
+        break;
+    case IR_MUL:
+        if (opt_is_imm(a, 0) || opt_is_imm(b, 0)) {
+            res->type = IR_VAL_IMM;
+            res->imm = 0;
+            return true;
+        }
+
+        if (opt_is_imm(b, 1)) {
+            *res = *a;
+            return true;
+        }
+
+        if (opt_is_imm(a, 1) && b->type != IR_VAL_MEM) {
+            *res = *b;
+            return true;
+        }
+        break;
+    default:
+        break;
+    }
+
+    return false;
+}
+
+/*
+ * Look up what a variable is known to hold
+ *
+ * Returns NULL if unknown
+ */
+static struct opt_mem *
+opt_mem_find(struct opt_memset *mem, const char *sym)
+{
+    for (size_t i = 0; i < mem->count; ++i) {
+        if (strcmp(mem->ents[i].sym, sym) == 0)
+            return &mem->ents[i];
+    }
+
+    return NULL;
+}
+
+/*
+ * Record what a variable holds, a value of type IR_VAL_NONE
+ * forgets the variable.
+ */
+static void
+opt_mem_set(struct opt_memset *mem, const char *sym, msize_t msize,
+    struct ir_value *val)
+{
+    struct opt_mem *ent;
+
+    if ((ent = opt_mem_find(mem, sym)) == NULL) {
+        if (val->type == IR_VAL_NONE)
+            return;
+
+        ent = &mem->ents[mem->count++];
+        ent->sym = sym;
+    }
+
+    if (val->type == IR_VAL_NONE) {
+        *ent = mem->ents[--mem->count];
+        return;
+    }
+
+    ent->msize = msize;
+    ent->val = *val;
+}
+
+/*
+ * Remove an instruction from its block
+ */
+static inline void
+opt_remove(struct ir_block *blk, struct ir_insn *insn)
+{
+    TAILQ_REMOVE(&blk->insns, insn, link);
+}
+
+/*
+ * Tidy the operands of a condition, a variable compared
+ * against is replaced with its known contents and constants
+ * are moved to the right
+ *
+ * @insn: Branch, set or select
+ * @mem:  Known contents of memory
+ *
+ * Returns the number of changes made
+ */
+static int
+opt_cond_operands(struct ir_insn *insn, struct opt_memset *mem)
+{
+    struct opt_mem *ent;
+    struct ir_value val;
+    int changes = 0;
+
+    if (insn->b.type == IR_VAL_MEM) {
+        ent = opt_mem_find(mem, insn->b.mem.sym);
+        if (ent != NULL && ent->msize == insn->b.mem.msize) {
+            insn->b = ent->val;
+            ++changes;
+        }
+    }
+
+    /* Constants are compared against, not with */
+    if (insn->cond != IR_COND_NZ && insn->a.type == IR_VAL_IMM &&
+        insn->b.type == IR_VAL_VREG) {
+        val = insn->a;
+        insn->a = insn->b;
+        insn->b = val;
+        insn->cond = ir_cond_swap(insn->cond);
+    }
+
+    return changes;
+}
+
+/*
+ * Returns true if the condition of a branch, set or select
+ * is known, whether it holds is written to 'res'
+ */
+static bool
+opt_cond_known(struct ir_insn *insn, bool *res)
+{
+    if (insn->a.type != IR_VAL_IMM) {
+        return false;
+    }
+
+    if (insn->cond != IR_COND_NZ && insn->b.type != IR_VAL_IMM) {
+        return false;
+    }
+
+    *res = ir_cond_holds(insn->cond, insn->a.imm, insn->b.imm);
+    return true;
+}
+
+/*
+ * Propagate values through a single block
+ *
+ * @blk:   Block
+ * @subst: Known value of each virtual register
+ * @mem:   Known contents of memory, updated in place
+ *
+ * Returns the number of changes made
+ */
+static int
+opt_propagate_block(struct ir_block *blk, struct ir_value *subst,
+    struct opt_memset *mem)
+{
+    struct ir_insn *insn, *next;
+    struct ir_value val, *vals[IR_MAX_OPERANDS];
+    struct opt_mem *ent;
+    size_t nvals;
+    bool holds;
+    int changes = 0;
+
+    for (insn = TAILQ_FIRST(&blk->insns); insn != NULL; insn = next) {
+        next = TAILQ_NEXT(insn, link);
+        nvals = ir_operands(insn, vals);
+        for (size_t i = 0; i < nvals; ++i)
+            opt_subst(subst, vals[i]);
+
+        switch (insn->op) {
+        case IR_MOV:
+            subst[insn->dst] = insn->a;
+            opt_remove(blk, insn);
+            ++changes;
+            break;
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+            if (insn->b.type == IR_VAL_MEM) {
+                ent = opt_mem_find(mem, insn->b.mem.sym);
+                if (ent != NULL && ent->msize == insn->b.mem.msize) {
+                    insn->b = ent->val;
+                    ++changes;
+                }
+            }
+
+            if (!opt_fold(insn, &val))
+                break;
+
+            subst[insn->dst] = val;
+            opt_remove(blk, insn);
+            ++changes;
+            break;
+        case IR_LOAD:
+            ent = opt_mem_find(mem, insn->sym);
+            if (ent == NULL || ent->msize != insn->msize) {
+                val.type = IR_VAL_VREG;
+                val.vreg = insn->dst;
+                opt_mem_set(mem, insn->sym, insn->msize, &val);
+                break;
+            }
+
+            subst[insn->dst] = ent->val;
+            opt_remove(blk, insn);
+            ++changes;
+            break;
+        case IR_STORE:
+            val = insn->a;
+            if (val.type == IR_VAL_IMM) {
+                val.imm = opt_trunc(insn->msize, val.imm);
+                insn->a = val;
+            }
+
+            /* Writes back what the variable holds (x = x) */
+            ent = opt_mem_find(mem, insn->sym);
+            if (ent != NULL && ent->msize == insn->msize &&
+                opt_same(&ent->val, &val)) {
+                opt_remove(blk, insn);
+                ++changes;
+                break;
+            }
+
+            if (val.type != IR_VAL_IMM && insn->msize != MSIZE_QWORD) {
+                /* Upper bits of the register are not known to be clear */
+                val.type = IR_VAL_NONE;
+            }
+
+            opt_mem_set(mem, insn->sym, insn->msize, &val);
+            break;
+        case IR_CALL:
+        case IR_TAILCALL:
+        case IR_ASM:
+            /* Anything may be written */
+            mem->count = 0;
+            break;
+        case IR_SET:
+            changes += opt_cond_operands(insn, mem);
+            if (!opt_cond_known(insn, &holds))
+                break;
+
+            subst[insn->dst].type = IR_VAL_IMM;
+            subst[insn->dst].imm = holds;
+            opt_remove(blk, insn);
+            ++changes;
+            break;
+        case IR_SEL:
+            changes += opt_cond_operands(insn, mem);
+            if (!opt_cond_known(insn, &holds))
+                break;
+
+            subst[insn->dst] = insn->sel[holds ? 0 : 1];
+            opt_remove(blk, insn);
+            ++changes;
+            break;
+        case IR_BR:
+            changes += opt_cond_operands(insn, mem);
+            if (!opt_cond_known(insn, &holds))
+                break;
+
+            if (!holds)
+                insn->target[0] = insn->target[1];
+
+            insn->op = IR_JMP;
+            insn->size = MSIZE_BAD;
+            insn->cond = IR_COND_NZ;
+            insn->a.type = IR_VAL_NONE;
+            insn->b.type = IR_VAL_NONE;
+            insn->target[1] = NULL;
+            insn->hint = 0;
+            ++changes;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return changes;
+}
+
+int
+opt_propagate(struct bup_state *state, struct ir_proc *proc)
+{
+    struct ir_value *subst;
+    struct opt_memset *out, *mem, *in;
+    struct ir_block *blk;
+    struct ir_insn *insn;
+    size_t cap = 1;
+    bool *done;
+    int changes = 0;
+
+    if (state == NULL || proc == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        TAILQ_FOREACH(insn, &blk->insns, link) {
+            if (insn->op == IR_LOAD || insn->op == IR_STORE)
+                ++cap;
+        }
+    }
+
+    subst = calloc(proc->nvregs + 1, sizeof(*subst));
+    out = calloc(proc->nblocks + 1, sizeof(*out));
+    done = calloc(proc->nblocks + 1, sizeof(*done));
+    if (subst == NULL || out == NULL || done == NULL) {
+        changes = -1;
+        goto done;
+    }
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        mem = &out[blk->id];
+        if ((mem->ents = malloc(cap * sizeof(*mem->ents))) == NULL) {
+            changes = -1;
+            goto done;
+        }
+
+        /* Values flow in from a lone predecessor, which dominates us */
+        mem->count = 0;
+        if (blk->npreds == 1 && done[blk->preds[0]->id]) {
+            in = &out[blk->preds[0]->id];
+            memcpy(mem->ents, in->ents, in->count * sizeof(*in->ents));
+            mem->count = in->count;
+        }
+
+        changes += opt_propagate_block(blk, subst, mem);
+        done[blk->id] = true;
+    }
+
+done:
+    if (out != NULL) {
+        for (size_t i = 0; i < proc->nblocks; ++i)
+            free(out[i].ents);
+    }
+
+    free(subst);
+    free(out);
+    free(done);
+    return changes;
+}
+
+int
+opt_prune(struct bup_state *state, struct ir_proc *proc)
+{
+    struct ir_block **stack, *blk, *next, *succ[2];
+    size_t sp = 0, n;
+    bool *live;
+    int count = 0;
+
+    if (state == NULL || proc == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    stack = malloc((proc->nblocks + 1) * sizeof(*stack));
+    live = calloc(proc->nblocks + 1, sizeof(*live));
+    if (stack == NULL || live == NULL) {
+        free(stack);
+        free(live);
+        return -1;
+    }
+
+    blk = TAILQ_FIRST(&proc->blocks);
+    live[blk->id] = true;
+    stack[sp++] = blk;
+    while (sp > 0) {
+        blk = stack[--sp];
+        n = ir_succs(blk, succ);
+        for (size_t i = 0; i < n; ++i) {
+            if (live[succ[i]->id])
+                continue;
+
+            live[succ[i]->id] = true;
+            stack[sp++] = succ[i];
+        }
+    }
+
+    for (blk = TAILQ_FIRST(&proc->blocks); blk != NULL; blk = next) {
+        next = TAILQ_NEXT(blk, link);
+        if (live[blk->id])
+            continue;
+
+        TAILQ_REMOVE(&proc->blocks, blk, link);
+        ++count;
+    }
+
+    free(stack);
+    free(live);
+    if (ir_cfg_build(state, proc) < 0) {
+        return -1;
+    }
+
+    return count;
+}
+
+int
+opt_dce(struct bup_state *state, struct ir_proc *proc)
+{
+    struct ir_block *blk;
+    struct ir_insn *insn, *prev;
+    struct ir_value *vals[IR_MAX_OPERANDS];
+    size_t nvals;
+    size_t *uses;
+    int count = 0, round;
+
+    if (state == NULL || proc == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    if ((uses = calloc(proc->nvregs + 1, sizeof(*uses))) == NULL) {
+        return -1;
+    }
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        TAILQ_FOREACH(insn, &blk->insns, link) {
+            nvals = ir_operands(insn, vals);
+            for (size_t i = 0; i < nvals; ++i) {
+                if (vals[i]->type == IR_VAL_VREG)
+                    ++uses[vals[i]->vreg];
+            }
+        }
+    }
+
+    /* Walk backwards so chains die in one round */
+    do {
+        round = 0;
+        TAILQ_FOREACH_REVERSE(blk, &proc->blocks, ir_block_q, link) {
+            insn = TAILQ_LAST(&blk->insns, ir_insn_q);
+            for (; insn != NULL; insn = prev) {
+                prev = TAILQ_PREV(insn, ir_insn_q, link);
+                if (insn->dst == IR_NOREG || uses[insn->dst] > 0)
+                    continue;
+                if (!opt_is_pure(insn->op))
+                    continue;
+
+                nvals = ir_operands(insn, vals);
+                for (size_t i = 0; i < nvals; ++i) {
+                    if (vals[i]->type == IR_VAL_VREG)
+                        --uses[vals[i]->vreg];
+                }
+
+                opt_remove(blk, insn);
+                ++round;
+            }
+        }
+
+        count += round;
+    } while (round > 0);
+
+    free(uses);
+    return count;
+}
+
+bool
+opt_mentions(const char *text, const char *name)
+{
+    const char *p = text;
+    size_t len = strlen(name);
+
+    while ((p = strstr(p, name)) != NULL) {
+        if ((p == text || !(isalnum(p[-1]) || p[-1] == '_')) &&
+            !(isalnum(p[len]) || p[len] == '_')) {
+            return true;
+        }
+
+        ++p;
+    }
+
+    return false;
+}
+
+/*
+ * Returns true if a variable may be read anywhere in a
+ * translation unit
+ *
+ * @unit:  Translation unit
+ * @store: Store to the variable
+ */
+static bool
+opt_is_read(struct ir_unit *unit, struct ir_insn *store)
+{
+    struct ir_item *item;
+    struct ir_block *blk;
+    struct ir_insn *insn;
+    const char *name = store->var->name;
+
+    TAILQ_FOREACH(item, &unit->items, link) {
+        if (item->type == IR_ITEM_ASM && opt_mentions(item->text, name))
+            return true;
+        if (item->type != IR_ITEM_PROC)
+            continue;
+
+        TAILQ_FOREACH(blk, &item->proc->blocks, link) {
+            TAILQ_FOREACH(insn, &blk->insns, link) {
+                if (insn->op == IR_LOAD && strcmp(insn->sym, store->sym) == 0)
+                    return true;
+                if (insn->op == IR_LOADX && strcmp(insn->sym, store->sym) == 0)
+                    return true;
+                if (insn->b.type == IR_VAL_MEM &&
+                    strcmp(insn->b.mem.sym, store->sym) == 0)
+                    return true;
+                if (insn->op == IR_ASM && opt_mentions(insn->text, name))
+                    return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Returns true if a variable may be written anywhere in a
+ * translation unit
+ *
+ * @unit: Translation unit
+ * @var:  Variable symbol
+ */
+static bool
+opt_is_written(struct ir_unit *unit, struct symbol *var)
+{
+    struct ir_item *item;
+    struct ir_block *blk;
+    struct ir_insn *insn;
+
+    TAILQ_FOREACH(item, &unit->items, link) {
+        if (item->type == IR_ITEM_ASM && opt_mentions(item->text, var->name))
+            return true;
+        if (item->type != IR_ITEM_PROC)
+            continue;
+
+        TAILQ_FOREACH(blk, &item->proc->blocks, link) {
+            TAILQ_FOREACH(insn, &blk->insns, link) {
+                if (insn->op == IR_STORE && insn->var == var)
+                    return true;
+                if (insn->op == IR_STOREX && insn->var == var)
+                    return true;
+                if (insn->op == IR_ASM && opt_mentions(insn->text, var->name))
+                    return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+int
+opt_const_globals(struct bup_state *state, struct ir_unit *unit)
+{
+    struct ir_item *item, *var;
+    struct ir_block *blk;
+    struct ir_insn *insn;
+    ssize_t imm;
+    int count = 0;
+
+    if (state == NULL || unit == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    TAILQ_FOREACH(var, &unit->items, link) {
+        if (var->type != IR_ITEM_VAR || var->symbol->is_global)
+            continue;
+        if (var->symbol->data_type.array_size > 0)
+            continue;
+        if (opt_is_written(unit, var->symbol))
+            continue;
+
+        TAILQ_FOREACH(item, &unit->items, link) {
+            if (item->type != IR_ITEM_PROC)
+                continue;
+
+            TAILQ_FOREACH(blk, &item->proc->blocks, link) {
+                TAILQ_FOREACH(insn, &blk->insns, link) {
+                    if (insn->b.type == IR_VAL_MEM && insn->b.mem.var == var->symbol) {
+                        imm = var->init ? opt_trunc(insn->b.mem.msize, var->imm) : 0;
+                        insn->b.type = IR_VAL_IMM;
+                        insn->b.imm = imm;
+                        ++count;
+                        continue;
+                    }
+
+                    if (insn->op != IR_LOAD || insn->var != var->symbol)
+                        continue;
+
+                    insn->op = IR_MOV;
+                    insn->a.type = IR_VAL_IMM;
+                    insn->a.imm = var->init ? opt_trunc(insn->msize, var->imm) : 0;
+                    ++count;
+                }
+            }
+        }
+    }
+
+    return count;
+}
+
+int
+opt_dead_stores(struct bup_state *state, struct ir_unit *unit)
+{
+    struct ir_item *item;
+    struct ir_block *blk;
+    struct ir_insn *insn, *next;
+    int count = 0;
+
+    if (state == NULL || unit == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    TAILQ_FOREACH(item, &unit->items, link) {
+        if (item->type != IR_ITEM_PROC)
+            continue;
+
+        TAILQ_FOREACH(blk, &item->proc->blocks, link) {
+            insn = TAILQ_FIRST(&blk->insns);
+            for (; insn != NULL; insn = next) {
+                next = TAILQ_NEXT(insn, link);
+                if (insn->op != IR_STORE || insn->var == NULL)
+                    continue;
+                if (insn->var->is_global || opt_is_read(unit, insn))
+                    continue;
+
+                trace_debug("removed dead store to %s\n", insn->sym);
+                opt_remove(blk, insn);
+                ++count;
+            }
+        }
+    }
+
+    return count;
+}
+
+/*
+ * Returns true if a terminator following a call returns
+ * whatever the call returned, possibly through a chain of
+ * jumps.
+ *
+ * @proc: Procedure
+ * @term: Terminator following the call
+ * @call: Call instruction
+ */
+static bool
+opt_is_tail(struct ir_proc *proc, struct ir_insn *term, struct ir_insn *call)
+{
+    size_t hops = 0;
+
+    while (term != NULL && term->op == IR_JMP && hops++ < proc->nblocks) {
+        term = TAILQ_FIRST(&term->target[0]->insns);
+    }
+
+    if (term == NULL || term->op != IR_RET) {
+        return false;
+    }
+
+    switch (term->a.type) {
+    case IR_VAL_NONE:
+        return true;
+    case IR_VAL_VREG:
+        return call->dst != IR_NOREG && term->a.vreg == call->dst;
+    default:
+        return false;
+    }
+}
+
+int
+opt_tail_calls(struct bup_state *state, struct ir_proc *proc)
+{
+    struct ir_block *blk;
+    struct ir_insn *term, *call;
+    int count = 0;
+
+    if (state == NULL || proc == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        if ((term = ir_block_term(blk)) == NULL)
+            continue;
+
+        call = TAILQ_PREV(term, ir_insn_q, link);
+        if (call == NULL || call->op != IR_CALL)
+            continue;
+        if (!opt_is_tail(proc, term, call))
+            continue;
+
+        trace_debug("tail call to %s\n", call->sym);
+        opt_remove(blk, term);
+        call->op = IR_TAILCALL;
+        call->dst = IR_NOREG;
+        ++count;
+    }
+
+    return count;
+}
+
+/*
+ * Returns true if an address scale can be encoded
+ */
+static inline bool
+opt_is_scale(ssize_t scale)
+{
+    return scale == 1 || scale == 2 || scale == 4 || scale == 8;
+}
+
+/*
+ * Attempt to fold the computation of the index of an indexed
+ * access into the access, 'index + imm' and 'index - imm'
+ * move the displacement and 'index * imm' the scale.
+ *
+ * @insn:  Indexed load or store
+ * @index: Index operand of 'insn'
+ * @def:   Instruction computing the index
+ *
+ * Returns true if folded
+ */
+static bool
+opt_fold_index(struct ir_insn *insn, struct ir_value *index,
+    struct ir_insn *def)
+{
+    struct ir_value *x, *imm;
+    ssize_t disp;
+
+    if (def->size != MSIZE_QWORD) {
+        return false;
+    }
+
+    x = &def->a;
+    imm = &def->b;
+    if (def->op != IR_SUB && x->type == IR_VAL_IMM) {
+        x = &def->b;
+        imm = &def->a;
+    }
+
+    if (x->type != IR_VAL_VREG || imm->type != IR_VAL_IMM) {
+        return false;
+    }
+
+    /* Keep clear of overflowing what is multiplied */
+    if (imm->imm > OPT_MAX_DISP || imm->imm < -OPT_MAX_DISP) {
+        return false;
+    }
+
+    switch (def->op) {
+    case IR_ADD:
+        disp = insn->disp + imm->imm * (ssize_t)insn->scale;
+        break;
+    case IR_SUB:
+        disp = insn->disp - imm->imm * (ssize_t)insn->scale;
+        break;
+    case IR_MUL:
+        if (!opt_is_scale(imm->imm * (ssize_t)insn->scale))
+            return false;
+
+        insn->scale *= imm->imm;
+        *index = *x;
+        return true;
+    default:
+        return false;
+    }
+
+    if (disp > OPT_MAX_DISP || disp < -OPT_MAX_DISP) {
+        return false;
+    }
+
+    insn->disp = disp;
+    *index = *x;
+    return true;
+}
+
+/*
+ * Attempt to fold a constant index of an indexed access into
+ * its displacement. An index that lands outside of the array
+ * is left alone so the access stays as it was written.
+ *
+ * @insn:  Indexed load or store
+ * @index: Constant index operand of 'insn'
+ *
+ * Returns true if folded
+ */
+static bool
+opt_fold_const(struct ir_insn *insn, const struct ir_value *index)
+{
+    ssize_t disp;
+
+    if (index->imm > OPT_MAX_DISP || index->imm < -OPT_MAX_DISP) {
+        return false;
+    }
+
+    disp = insn->disp + index->imm * (ssize_t)insn->scale;
+    if (disp > OPT_MAX_DISP || disp < 0) {
+        return false;
+    }
+
+    if (insn->var != NULL && insn->var->data_type.array_size != 0 &&
+        (size_t)disp + msize_bytes(insn->msize) > insn->var->data_type.array_size) {
+        return false;
+    }
+
+    insn->disp = disp;
+    return true;
+}
+
+int
+opt_fold_addr(struct bup_state *state, struct ir_proc *proc)
+{
+    struct ir_insn **defs, *insn, *prev;
+    struct ir_value *subst, *index;
+    struct ir_block *blk;
+    int count = 0;
+
+    if (state == NULL || proc == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    defs = calloc(proc->nvregs + 1, sizeof(*defs));
+    subst = calloc(proc->nvregs + 1, sizeof(*subst));
+    if (defs == NULL || subst == NULL) {
+        free(defs);
+        free(subst);
+        return -1;
+    }
+
+    /* Reuse the address of an array taken earlier in the block */
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        TAILQ_FOREACH(insn, &blk->insns, link) {
+            if (insn->dst != IR_NOREG)
+                defs[insn->dst] = insn;
+            if (insn->op != IR_ADDR)
+                continue;
+
+            prev = TAILQ_PREV(insn, ir_insn_q, link);
+            for (; prev != NULL; prev = TAILQ_PREV(prev, ir_insn_q, link)) {
+                if (prev->op != IR_ADDR || strcmp(prev->sym, insn->sym) != 0)
+                    continue;
+
+                subst[insn->dst].type = IR_VAL_VREG;
+                subst[insn->dst].vreg = prev->dst;
+                opt_subst(subst, &subst[insn->dst]);
+                break;
+            }
+        }
+    }
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        TAILQ_FOREACH(insn, &blk->insns, link) {
+            if (insn->op != IR_LOADX && insn->op != IR_STOREX)
+                continue;
+
+            if (insn->base.type == IR_VAL_VREG &&
+                subst[insn->base.vreg].type != IR_VAL_NONE) {
+                opt_subst(subst, &insn->base);
+                ++count;
+            }
+
+            index = (insn->op == IR_LOADX) ? &insn->a : &insn->b;
+            while (index->type == IR_VAL_VREG && defs[index->vreg] != NULL) {
+                if (!opt_fold_index(insn, index, defs[index->vreg]))
+                    break;
+
+                ++count;
+            }
+
+            if (index->type == IR_VAL_IMM && opt_fold_const(insn, index)) {
+                index->type = IR_VAL_NONE;
+                ++count;
+            }
+
+            /* Constant addresses are reached RIP relative */
+            if (index->type == IR_VAL_NONE && insn->base.type != IR_VAL_NONE) {
+                insn->base.type = IR_VAL_NONE;
+                ++count;
+            }
+        }
+    }
+
+    free(defs);
+    free(subst);
+    return count;
+}
+
+/*
+ * Returns true if the body of an if may run no matter the
+ * condition, it only computes values and stores to internal
+ * variables, and is cheap enough that running it every time
+ * beats a branch that may be mispredicted
+ */
+static bool
+opt_can_select(struct ir_block *body)
+{
+    struct ir_insn *insn;
+    size_t cost = 0;
+
+    TAILQ_FOREACH(insn, &body->insns, link) {
+        switch (insn->op) {
+        case IR_MOV:
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+        case IR_LOAD:
+        case IR_ADDR:
+        case IR_SET:
+        case IR_SEL:
+            ++cost;
+            break;
+        case IR_STORE:
+            /* Other code may not expect the extra store */
+            if (insn->var == NULL || insn->var->is_global)
+                return false;
+
+            /* Becomes a load, a select and the store */
+            cost += 3;
+            break;
+        case IR_JMP:
+            break;
+        default:
+            return false;
+        }
+    }
+
+    return cost <= SELECT_MAX_COST;
+}
+
+/*
+ * Hoist the body of an if into the block testing it, each
+ * store then writes either the new value or what the
+ * variable held before.
+ *
+ * @state: Compiler state
+ * @proc:  Procedure
+ * @test:  Branch around the body
+ * @side:  Target of the branch that is the body
+ */
+static int
+opt_select_body(struct bup_state *state, struct ir_proc *proc,
+    struct ir_insn *test, int side)
+{
+    struct ir_block *blk = test->target[side];
+    struct ir_insn *insn, *next, *load, *sel;
+
+    /* Stores in the body may change a variable compared with */
+    if (test->b.type == IR_VAL_MEM) {
+        if ((load = ir_insn_new(state, IR_LOAD, MSIZE_QWORD)) == NULL)
+            return -1;
+
+        load->msize = test->b.mem.msize;
+        load->sym = test->b.mem.sym;
+        load->var = test->b.mem.var;
+        load->dst = proc->nvregs++;
+        TAILQ_INSERT_BEFORE(test, load, link);
+        test->b.type = IR_VAL_VREG;
+        test->b.vreg = load->dst;
+    }
+
+    for (insn = TAILQ_FIRST(&blk->insns); insn != NULL; insn = next) {
+        next = TAILQ_NEXT(insn, link);
+        if (ir_is_term(insn->op))
+            break;
+
+        opt_remove(blk, insn);
+        TAILQ_INSERT_BEFORE(test, insn, link);
+        if (insn->op != IR_STORE)
+            continue;
+
+        load = ir_insn_new(state, IR_LOAD, MSIZE_QWORD);
+        sel = ir_insn_new(state, IR_SEL, MSIZE_QWORD);
+        if (load == NULL || sel == NULL)
+            return -1;
+
+        load->msize = insn->msize;
+        load->sym = insn->sym;
+        load->var = insn->var;
+        load->dst = proc->nvregs++;
+
+        sel->cond = test->cond;
+        sel->a = test->a;
+        sel->b = test->b;
+        sel->sel[side] = insn->a;
+        sel->sel[!side].type = IR_VAL_VREG;
+        sel->sel[!side].vreg = load->dst;
+        sel->dst = proc->nvregs++;
+
+        insn->a.type = IR_VAL_VREG;
+        insn->a.vreg = sel->dst;
+        TAILQ_INSERT_BEFORE(insn, load, link);
+        TAILQ_INSERT_BEFORE(insn, sel, link);
+    }
+
+    test->op = IR_JMP;
+    test->size = MSIZE_BAD;
+    test->cond = IR_COND_NZ;
+    test->a.type = IR_VAL_NONE;
+    test->b.type = IR_VAL_NONE;
+    test->target[0] = test->target[!side];
+    test->target[1] = NULL;
+    return 0;
+}
+
+int
+opt_select(struct bup_state *state, struct ir_proc *proc)
+{
+    struct ir_block *blk, *body, *join;
+    struct ir_insn *test, *term;
+    int count = 0;
+
+    if (state == NULL || proc == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        test = ir_block_term(blk);
+        if (test == NULL || test->op != IR_BR || test->hint != 0)
+            continue;
+
+        /* Either target may be the body, the other joins it */
+        for (int side = 0; side < 2; ++side) {
+            body = test->target[side];
+            join = test->target[!side];
+            if (body == join || body == blk || join == blk)
+                continue;
+            if (body->npreds != 1)
+                continue;
+
+            term = ir_block_term(body);
+            if (term == NULL || term->op != IR_JMP || term->target[0] != join)
+                continue;
+            if (!opt_can_select(body))
+                continue;
+
+            if (opt_select_body(state, proc, test, side) < 0)
+                return -1;
+
+            ++count;
+            break;
+        }
+    }
+
+    if (count > 0) {
+        trace_debug("select: %d branches removed from %s\n", count,
+            proc->symbol->name);
+        if (ir_cfg_build(state, proc) < 0)
+            return -1;
+        if (opt_simplify(state, proc) < 0)
+            return -1;
+    }
+
+    return count;
+}
+
+/*
+ * Returns true if inline assembly in a procedure mentions
+ * the label of a block
+ *
+ * @proc: Procedure
+ * @blk:  Block to check
+ */
+static bool
+opt_label_used(struct ir_proc *proc, struct ir_block *blk)
+{
+    struct ir_block *cur;
+    struct ir_insn *insn;
+
+    if (blk->label == NULL) {
+        return false;
+    }
+
+    TAILQ_FOREACH(cur, &proc->blocks, link) {
+        TAILQ_FOREACH(insn, &cur->insns, link) {
+            if (insn->op == IR_ASM && opt_mentions(insn->text, blk->label))
+                return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Follow a chain of blocks that do nothing but jump and
+ * return where it ends
+ *
+ * @proc:   Procedure
+ * @target: Block jumped to
+ */
+static struct ir_block *
+opt_thread(struct ir_proc *proc, struct ir_block *target)
+{
+    struct ir_insn *insn;
+    size_t hops = 0;
+
+    while (hops++ < proc->nblocks) {
+        insn = TAILQ_FIRST(&target->insns);
+        if (insn == NULL || insn->op != IR_JMP)
+            break;
+        if (insn->target[0] == target || opt_label_used(proc, target))
+            break;
+
+        target = insn->target[0];
+    }
+
+    return target;
+}
+
+/*
+ * Thread the jumps and branches of a procedure through
+ * empty blocks, a branch left with one target becomes
+ * a jump.
+ *
+ * @proc: Procedure
+ *
+ * Returns the number of targets changed
+ */
+static int
+opt_thread_jumps(struct ir_proc *proc)
+{
+    struct ir_block *blk, *target;
+    struct ir_insn *term;
+    int count = 0;
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        if ((term = ir_block_term(blk)) == NULL)
+            continue;
+        if (term->op != IR_JMP && term->op != IR_BR)
+            continue;
+
+        for (int i = 0; i < (term->op == IR_BR ? 2 : 1); ++i) {
+            target = opt_thread(proc, term->target[i]);
+            if (target == term->target[i])
+                continue;
+
+            term->target[i] = target;
+            ++count;
+        }
+
+        if (term->op != IR_BR || term->target[0] != term->target[1])
+            continue;
+
+        term->op = IR_JMP;
+        term->size = MSIZE_BAD;
+        term->cond = IR_COND_NZ;
+        term->a.type = IR_VAL_NONE;
+        term->b.type = IR_VAL_NONE;
+        term->target[1] = NULL;
+        term->hint = 0;
+        ++count;
+    }
+
+    return count;
+}
+
+/*
+ * Merge each block that ends in a jump with the block it
+ * jumps to, where nothing else jumps there. The CFG of the
+ * procedure must be built, predecessor counts stay valid
+ * across merges.
+ *
+ * @proc: Procedure
+ *
+ * Returns the number of blocks merged
+ */
+static int
+opt_merge_blocks(struct ir_proc *proc)
+{
+    struct ir_block *blk, *succ;
+    struct ir_insn *term;
+    int count = 0;
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        while ((term = ir_block_term(blk)) != NULL && term->op == IR_JMP) {
+            succ = term->target[0];
+            if (succ == blk || succ == TAILQ_FIRST(&proc->blocks))
+                break;
+            if (succ->npreds != 1 || opt_label_used(proc, succ))
+                break;
+
+            opt_remove(blk, term);
+            TAILQ_CONCAT(&blk->insns, &succ->insns, link);
+            TAILQ_REMOVE(&proc->blocks, succ, link);
+            ++count;
+        }
+    }
+
+    return count;
+}
+
+int
+opt_cleanup_cfg(struct bup_state *state, struct ir_proc *proc)
+{
+    int threaded, merged, pruned, count = 0;
+
+    if (state == NULL || proc == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    for (int i = 0; i < OPT_MAX_ROUNDS; ++i) {
+        threaded = opt_thread_jumps(proc);
+        if ((pruned = opt_prune(state, proc)) < 0)
+            return -1;
+
+        merged = opt_merge_blocks(proc);
+        if (merged > 0 && ir_cfg_build(state, proc) < 0)
+            return -1;
+        if (threaded == 0 && merged == 0 && pruned == 0)
+            break;
+
+        count += threaded + merged + pruned;
+    }
+
+    if (count > 0) {
+        trace_debug("cleanup-cfg: %d changes to %s\n", count,
+            proc->symbol->name);
+    }
+
+    return count;
+}
+
+int
+opt_layout(struct bup_state *state, struct ir_proc *proc)
+{
+    struct ir_block *blk, *cold;
+    struct ir_insn *term;
+    int count = 0;
+
+    if (state == NULL || proc == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    /* Moved blocks are visited again at the end, but not moved twice */
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        term = ir_block_term(blk);
+        if (term == NULL || term->op != IR_BR || term->hint == 0)
+            continue;
+
+        cold = term->target[(term->hint > 0) ? 1 : 0];
+        if (cold == blk || cold == TAILQ_FIRST(&proc->blocks) || cold->cold)
+            continue;
+        if (cold->npreds != 1 || opt_label_used(proc, cold))
+            continue;
+        if (TAILQ_NEXT(cold, link) == NULL)
+            continue;
+
+        TAILQ_REMOVE(&proc->blocks, cold, link);
+        TAILQ_INSERT_TAIL(&proc->blocks, cold, link);
+        cold->cold = true;
+        ++count;
+    }
+
+    if (count > 0) {
+        trace_debug("layout: %d cold blocks moved to the end of %s\n", count,
+            proc->symbol->name);
+    }
+
+    return count;
+}
+
+int
+opt_simplify(struct bup_state *state, struct ir_proc *proc)
+{
+    int n, pruned, count = 0;
+
+    if (state == NULL || proc == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    for (int i = 0; i < OPT_MAX_ROUNDS; ++i) {
+        if ((n = opt_propagate(state, proc)) < 0)
+            return -1;
+        if ((pruned = opt_prune(state, proc)) < 0)
+            return -1;
+        if (n == 0 && pruned == 0)
+            break;
+
+        count += n + pruned;
+    }
+
+    return count;
+}
@@ -4,7 +4,9 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include "bup/lexer.h"
 #include "bup/parser.h"
 #include "bup/token.h"
@@ -60,6 +62,8 @@ static const char *toktab[] = {
     [TT_LT]         = "LESS-THAN",
     [TT_GTE]        = "GREATER-THAN-OR-EQUAL",
     [TT_LTE]        = "LESS-THAN-OR-EQUAL",
+    [TT_EQEQ]       = "EQUALS-EQUALS",
+    [TT_NEQ]        = "NOT-EQUALS",
     [TT_SEMI]       = "SEMICOLON",
     [TT_LBRACE]     = "LBRACE",
     [TT_RBRACE]     = "RBRACE",
@@ -85,6 +89,8 @@ static const char *toktab[] = {
     [TT_IF]         = "IF",
     [TT_STRUCT]     = "STRUCT",
     [TT_TYPE]       = "TYPE",
+    [TT_INLINE]     = "INLINE",
+    [TT_NOINLINE]   = "NOINLINE",
     [TT_IDENT]      = "IDENT",
     [TT_NUMBER]     = "NUMBER",
     [TT_COMMENT]    = "COMMENT",
@@ -377,16 +383,23 @@ parse_rbrace(struct bup_state *state, struct token *tok)
         return TT_NONE;
     }
 
-    /* Handle scope epilogues */
+    /*
+     * Scopes opened within unreachable code were never
+     * started, so they are closed without an epilogue.
+     */
+    if (state->unreachable && state->scope_depth > state->dead_depth) {
+        return scope_pop(state);
+    }
+
+    /*
+     * Handle scope epilogues, these run even when the end
+     * of the scope is unreachable as they close blocks
+     * that are still jumped to.
+     */
     scope = scope_pop(state);
     switch (scope) {
     case TT_PROC:
         state->this_proc = NULL;
-        if (state->unreachable) {
-            state->unreachable = 0;
-            break;
-        }
-
         if (ast_alloc_node(state, AST_PROC, &root) < 0) {
             trace_error(state, "failed to allocate AST_PROC\n");
             return -1;
@@ -399,11 +412,6 @@ parse_rbrace(struct bup_state *state, struct token *tok)
 
         break;
     case TT_LOOP:
-        if (state->unreachable) {
-            state->unreachable = 0;
-            break;
-        }
-
         if (ast_alloc_node(state, AST_LOOP, &root) < 0) {
             trace_error(state, "failed to allocate AST_PROC\n");
             return -1;
@@ -416,11 +424,6 @@ parse_rbrace(struct bup_state *state, struct token *tok)
 
         break;
     case TT_IF:
-        if (state->unreachable) {
-            state->unreachable = 0;
-            break;
-        }
-
         if (ast_alloc_node(state, AST_IF, &root) < 0) {
             trace_error(state, "failed to allocate AST_PROC\n");
             return -1;
@@ -435,29 +438,101 @@ parse_rbrace(struct bup_state *state, struct token *tok)
         break;
     }
 
+    state->unreachable = 0;
     return scope;
 }
 
 /*
- * Parse a binary expression
+ * Get the precedence of a binary operator
  *
- * @state: Compiler state
- * @tok:   Token result
- * @res:   AST node result
+ * @type: Token type
+ *
+ * Returns zero if the token is not a binary operator
+ */
+static inline int
+parse_binprec(tt_t type)
+{
+    switch (type) {
+    case TT_GT:
+    case TT_LT:
+    case TT_GTE:
+    case TT_LTE:
+    case TT_EQEQ:
+    case TT_NEQ:
+        return 1;
+    case TT_PLUS:
+    case TT_MINUS:
+        return 2;
+    case TT_STAR:
+        return 3;
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+static int parse_binclimb(struct bup_state *state, struct token *tok,
+    int min_prec, struct ast_node **res);
+
+/*
+ * Parse the index of an array element, the closing bracket
+ * is left in 'tok'.
+ *
+ * @state:  Compiler state
+ * @tok:    Last token, must be '['
+ * @symbol: Array symbol
+ * @res:    AST node result
  */
 static int
-parse_binexpr(struct bup_state *state, struct token *tok, struct ast_node **res)
+parse_index(struct bup_state *state, struct token *tok, struct symbol *symbol,
+    struct ast_node **res)
 {
-    struct ast_node *root;
+    struct ast_node *root, *expr;
 
-    if (state == NULL || tok == NULL) {
+    if (tok->type != TT_LBRACK) {
+        utok(state, "LBRACK", tokstr(tok));
         return -1;
     }
 
-    if (res == NULL) {
+    if (parse_scan(state, tok) < 0) {
+        ueof(state);
         return -1;
     }
 
+    if (parse_binclimb(state, tok, 1, &expr) < 0) {
+        return -1;
+    }
+
+    if (tok->type != TT_RBRACK) {
+        utok(state, "RBRACK", tokstr(tok));
+        return -1;
+    }
+
+    if (ast_alloc_node(state, AST_INDEX, &root) < 0) {
+        trace_error(state, "failed to allocate AST_INDEX\n");
+        return -1;
+    }
+
+    root->symbol = symbol;
+    root->right = expr;
+    *res = root;
+    return 0;
+}
+
+/*
+ * Parse a primary expression
+ *
+ * @state: Compiler state
+ * @tok:   Token result
+ * @res:   AST node result
+ */
+static int
+parse_primary(struct bup_state *state, struct token *tok, struct ast_node **res)
+{
+    struct ast_node *root;
+    struct symbol *symbol;
+
     switch (tok->type) {
     case TT_NUMBER:
         if (ast_alloc_node(state, AST_NUMBER, &root) < 0) {
@@ -467,6 +542,51 @@ parse_binexpr(struct bup_state *state, struct token *tok, struct ast_node **res)
 
         root->v = tok->v;
         *res = root;
+        return 0;
+    case TT_IDENT:
+        symbol = symbol_from_name(&state->symtab, tok->s);
+        if (symbol == NULL) {
+            trace_error(state, "undefined reference to %s\n", tok->s);
+            return -1;
+        }
+
+        if (symbol->type != SYMBOL_VAR || symbol->parent != NULL) {
+            trace_error(state, "%s is not a scalar variable\n", tok->s);
+            return -1;
+        }
+
+        /* EXPECT '[' <EXPR> ']' for arrays */
+        if (symbol->data_type.array_size > 0) {
+            if (parse_expect(state, tok, TT_LBRACK) < 0)
+                return -1;
+
+            return parse_index(state, tok, symbol, res);
+        }
+
+        if (ast_alloc_node(state, AST_SYMBOL, &root) < 0) {
+            trace_error(state, "failed to allocate AST_SYMBOL\n");
+            return -1;
+        }
+
+        root->symbol = symbol;
+        *res = root;
+        return 0;
+    case TT_LPAREN:
+        if (parse_scan(state, tok) < 0) {
+            ueof(state);
+            return -1;
+        }
+
+        if (parse_binclimb(state, tok, 1, res) < 0) {
+            return -1;
+        }
+
+        /* The lookahead must close the group */
+        if (tok->type != TT_RPAREN) {
+            utok(state, "RPAREN", tokstr(tok));
+            return -1;
+        }
+
         return 0;
     default:
         utok1(state, tok);
@@ -476,6 +596,85 @@ parse_binexpr(struct bup_state *state, struct token *tok, struct ast_node **res)
     return -1;
 }
 
+/*
+ * Parse operators binding at least as tight as 'min_prec',
+ * the token following the expression is left in 'tok'.
+ *
+ * @state:    Compiler state
+ * @tok:      Token result
+ * @min_prec: Minimum operator precedence
+ * @res:      AST node result
+ */
+static int
+parse_binclimb(struct bup_state *state, struct token *tok, int min_prec,
+    struct ast_node **res)
+{
+    struct ast_node *lhs, *rhs, *root;
+    tt_t op;
+    int prec;
+
+    if (parse_primary(state, tok, &lhs) < 0) {
+        return -1;
+    }
+
+    if (parse_scan(state, tok) < 0) {
+        ueof(state);
+        return -1;
+    }
+
+    while ((prec = parse_binprec(tok->type)) >= min_prec && prec > 0) {
+        op = tok->type;
+        if (parse_scan(state, tok) < 0) {
+            ueof(state);
+            return -1;
+        }
+
+        if (parse_binclimb(state, tok, prec + 1, &rhs) < 0) {
+            return -1;
+        }
+
+        if (ast_alloc_node(state, AST_BINOP, &root) < 0) {
+            trace_error(state, "failed to allocate AST_BINOP\n");
+            return -1;
+        }
+
+        root->v = op;
+        root->left = lhs;
+        root->right = rhs;
+        lhs = root;
+    }
+
+    *res = lhs;
+    return 0;
+}
+
+/*
+ * Parse a binary expression
+ *
+ * @state: Compiler state
+ * @tok:   Token result
+ * @res:   AST node result
+ */
+static int
+parse_binexpr(struct bup_state *state, struct token *tok, struct ast_node **res)
+{
+    if (state == NULL || tok == NULL) {
+        return -1;
+    }
+
+    if (res == NULL) {
+        return -1;
+    }
+
+    if (parse_binclimb(state, tok, 1, res) < 0) {
+        return -1;
+    }
+
+    /* Give back the token after the expression */
+    parse_putback(state, tok);
+    return 0;
+}
+
 /*
  * Parse the 'return' keyword
  *
@@ -510,7 +709,6 @@ parse_return(struct bup_state *state, struct token *tok, struct ast_node **res)
         return -1;
     }
 
-    state->unreachable = 1;
     switch (tok->type) {
     case TT_SEMI:
         *res = root;
@@ -586,6 +784,8 @@ parse_proc(struct bup_state *state, struct token *tok, struct ast_node **res)
     struct ast_node *root, *args;
     struct datum_type type;
     char *section = NULL;
+    tt_t attr = TT_NONE;
+    size_t depth = 1;
     int error;
     bool is_global = false;
 
@@ -609,8 +809,16 @@ parse_proc(struct bup_state *state, struct token *tok, struct ast_node **res)
         return -1;
     }
 
-    /* Is the previous token a 'pub' keyword? */
+    /* Is the previous token an inlining attribute? */
     if (parse_backstep(state, 1, tok) == 0) {
+        if (tok->type == TT_INLINE || tok->type == TT_NOINLINE) {
+            attr = tok->type;
+            ++depth;
+        }
+    }
+
+    /* Is the token before that a 'pub' keyword? */
+    if (parse_backstep(state, depth, tok) == 0) {
         if (tok->type == TT_PUB)
             is_global = true;
     }
@@ -618,12 +826,12 @@ parse_proc(struct bup_state *state, struct token *tok, struct ast_node **res)
     /*
      * If there is a pub keyword in place, there might be a section
      * specifier before it. Otherwise check if there is a section
-     * specifier before the 'proc' keyword.
+     * specifier before the 'proc' keyword (or its attribute).
      */
-    if (is_global && parse_backstep(state, 2, tok) == 0) {
+    if (is_global && parse_backstep(state, depth + 1, tok) == 0) {
         if (tok->type == TT_SECTION)
             section = tok->s;
-    } else if (!is_global && parse_backstep(state, 1, tok) == 0) {
+    } else if (!is_global && parse_backstep(state, depth, tok) == 0) {
         if (tok->type == TT_SECTION)
             section = tok->s;
     }
@@ -682,6 +890,8 @@ parse_proc(struct bup_state *state, struct token *tok, struct ast_node **res)
     symbol->is_global = is_global;
     symbol->data_type = type;
     symbol->section = section;
+    symbol->is_inline = attr == TT_INLINE;
+    symbol->no_inline = attr == TT_NOINLINE;
 
     /* EXPECT <SEMICOLON> OR <LBRACE> */
     switch (tok->type) {
@@ -757,6 +967,7 @@ static int
 parse_loop(struct bup_state *state, struct token *tok, struct ast_node **res)
 {
     struct ast_node *root;
+    ssize_t unroll = 0;
 
     if (state == NULL || tok == NULL) {
         return -1;
@@ -776,6 +987,32 @@ parse_loop(struct bup_state *state, struct token *tok, struct ast_node **res)
         return -1;
     }
 
+    /* MAYBE: 'unroll' '(' <NUMBER> ')' */
+    if (tok->type == TT_IDENT && strcmp(tok->s, "unroll") == 0) {
+        if (parse_expect(state, tok, TT_LPAREN) < 0) {
+            return -1;
+        }
+
+        if (parse_expect(state, tok, TT_NUMBER) < 0) {
+            return -1;
+        }
+
+        if (tok->v < 1 || tok->v > AST_UNROLL_MAX) {
+            trace_error(state, "unroll factor must be 1 to %d\n", AST_UNROLL_MAX);
+            return -1;
+        }
+
+        unroll = tok->v;
+        if (parse_expect(state, tok, TT_RPAREN) < 0) {
+            return -1;
+        }
+
+        if (parse_scan(state, tok) < 0) {
+            ueof(state);
+            return -1;
+        }
+    }
+
     if (tok->type != TT_LBRACE) {
         utok(state, "LBRACE", tokstr(tok));
         return -1;
@@ -790,6 +1027,7 @@ parse_loop(struct bup_state *state, struct token *tok, struct ast_node **res)
         return -1;
     }
 
+    root->v = unroll;
     *res = root;
     return 0;
 }
@@ -994,6 +1232,7 @@ static int
 parse_if(struct bup_state *state, struct token *tok, struct ast_node **res)
 {
     struct ast_node *root, *expr;
+    ssize_t hint = 0;
 
     if (state == NULL || tok == NULL) {
         return -1;
@@ -1012,8 +1251,26 @@ parse_if(struct bup_state *state, struct token *tok, struct ast_node **res)
         return -1;
     }
 
+    if (parse_scan(state, tok) < 0) {
+        ueof(state);
+        return -1;
+    }
+
+    /* MAYBE: 'likely' | 'unlikely' */
+    if (tok->type == TT_IDENT && strcmp(tok->s, "likely") == 0) {
+        hint = 1;
+    } else if (tok->type == TT_IDENT && strcmp(tok->s, "unlikely") == 0) {
+        hint = -1;
+    }
+
+    if (hint != 0 && parse_scan(state, tok) < 0) {
+        ueof(state);
+        return -1;
+    }
+
     /* EXPECT '(' */
-    if (parse_expect(state, tok, TT_LPAREN) < 0) {
+    if (tok->type != TT_LPAREN) {
+        utok(state, "LPAREN", tokstr(tok));
         return -1;
     }
 
@@ -1047,6 +1304,7 @@ parse_if(struct bup_state *state, struct token *tok, struct ast_node **res)
     }
 
     root->right = expr;
+    root->v = hint;
     *res = root;
     return 0;
 }
@@ -1214,6 +1472,7 @@ parse_ident(struct bup_state *state, struct token *tok, struct ast_node **res)
 {
     struct ast_node *root, *field_node;
     struct ast_node *symbol_node, *value_node;
+    struct ast_node *index_node;
     struct symbol *symbol;
 
     if (state == NULL || tok == NULL) {
@@ -1267,10 +1526,36 @@ parse_ident(struct bup_state *state, struct token *tok, struct ast_node **res)
         *res = root;
         return 0;
     case TT_EQUALS:
+        if (symbol->data_type.array_size > 0) {
+            trace_error(state, "cannot assign to array %s\n", symbol->name);
+            return -1;
+        }
+
+        if (parse_assign(state, tok, symbol, &root) < 0) {
+            return -1;
+        }
+
+        *res = root;
+        return 0;
+    case TT_LBRACK:
+        if (symbol->type != SYMBOL_VAR || symbol->data_type.array_size == 0) {
+            trace_error(state, "cannot index non-array %s\n", symbol->name);
+            return -1;
+        }
+
+        if (parse_index(state, tok, symbol, &index_node) < 0) {
+            return -1;
+        }
+
+        if (parse_expect(state, tok, TT_EQUALS) < 0) {
+            return -1;
+        }
+
         if (parse_assign(state, tok, symbol, &root) < 0) {
             return -1;
         }
 
+        root->left = index_node;
         *res = root;
         return 0;
     case TT_LPAREN:
@@ -1722,6 +2007,8 @@ parse_program(struct bup_state *state, struct token *tok)
     case TT_SECTION:
         break;
     case TT_PUB:
+    case TT_INLINE:
+    case TT_NOINLINE:
         /* Modifier */
         break;
     case TT_COMMENT:
@@ -1752,7 +2039,7 @@ parse_program(struct bup_state *state, struct token *tok)
 int
 parser_parse(struct bup_state *state)
 {
-    int error;
+    int error = 0;
 
     if (state == NULL) {
         return -1;
@@ -1768,5 +2055,5 @@ parser_parse(struct bup_state *state)
         return -1;
     }
 
-    return 0;
+    return cg_finish(state);
 }
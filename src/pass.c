@@ -0,0 +1,517 @@
+/*
+ * Copyright (C) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include "bup/pass.h"
+#include "bup/opt.h"
+#include "bup/inline.h"
+#include "bup/ipcp.h"
+#include "bup/loop.h"
+#include "bup/peep.h"
+#include "bup/trace.h"
+
+/*
+ * What the pass manager keeps for each pass
+ *
+ * @done:  Set once an analysis ran, cleared when a transform
+ *         that does not keep it changes something
+ * @runs:  Number of times run
+ * @nsec:  Nanoseconds spent running
+ * @bytes: Bytes of IR memory allocated while running
+ */
+struct pass_stat {
+    bool done;
+    size_t runs;
+    uint64_t nsec;
+    size_t bytes;
+};
+
+/*
+ * Run a procedure pass over every procedure of a unit
+ *
+ * @state: Compiler state
+ * @ctx:   Pass context
+ * @fn:    Pass to run on each procedure
+ *
+ * Returns the number of changes made, or a less than
+ * zero value on failure.
+ */
+static int
+pass_run_per_proc(struct bup_state *state, struct pass_ctx *ctx,
+    int(*fn)(struct bup_state *state, struct ir_proc *proc))
+{
+    struct ir_item *item;
+    int n, count = 0;
+
+    TAILQ_FOREACH(item, &ctx->unit->items, link) {
+        if (item->type != IR_ITEM_PROC)
+            continue;
+        if ((n = fn(state, item->proc)) < 0)
+            return -1;
+
+        count += n;
+    }
+
+    return count;
+}
+
+static int
+pass_inline(struct bup_state *state, struct pass_ctx *ctx)
+{
+    return inline_unit(state, ctx->unit);
+}
+
+static int
+pass_ipcp(struct bup_state *state, struct pass_ctx *ctx)
+{
+    return ipcp_unit(state, ctx->unit);
+}
+
+static int
+pass_const_globals(struct bup_state *state, struct pass_ctx *ctx)
+{
+    return opt_const_globals(state, ctx->unit);
+}
+
+static int
+pass_dead_stores(struct bup_state *state, struct pass_ctx *ctx)
+{
+    return opt_dead_stores(state, ctx->unit);
+}
+
+static int
+pass_lower(struct bup_state *state, struct pass_ctx *ctx)
+{
+    FILE *out_fp = state->out_fp;
+    int error;
+
+    if (state->dump_ir) {
+        ir_dump(ctx->unit, stdout);
+    }
+
+    state->out_fp = open_memstream(&ctx->asm_buf, &ctx->asm_len);
+    if (state->out_fp == NULL) {
+        state->out_fp = out_fp;
+        return -1;
+    }
+
+    error = ir_lower(state, ctx->unit);
+    fclose(state->out_fp);
+    state->out_fp = out_fp;
+    return error;
+}
+
+static int
+pass_peephole(struct bup_state *state, struct pass_ctx *ctx)
+{
+    FILE *fp;
+    char *buf = NULL;
+    size_t len = 0;
+    int error;
+
+    if ((fp = open_memstream(&buf, &len)) == NULL) {
+        return -1;
+    }
+
+    error = peep_run(state, ctx->asm_buf, ctx->asm_len, fp);
+    fclose(fp);
+    if (error < 0) {
+        free(buf);
+        return -1;
+    }
+
+    free(ctx->asm_buf);
+    ctx->asm_buf = buf;
+    ctx->asm_len = len;
+    return 0;
+}
+
+/*
+ * Every pass, transforms and code generation run in this
+ * order while analyses only run when depended on.
+ */
+static const struct pass passtab[] = {
+    {
+        .name = "cfg",
+        .kind = PASS_ANALYSIS,
+        .levels = PASS_ALWAYS,
+        .run_proc = ir_cfg_build
+    },
+    {
+        .name = "inline",
+        .kind = PASS_TRANSFORM,
+        .levels = PASS_AT(PASS_O2) | PASS_AT(PASS_OS),
+        .run = pass_inline
+    },
+    {
+        .name = "rotate",
+        .kind = PASS_TRANSFORM,
+        .levels = PASS_AT(PASS_O2),
+        .deps = { "cfg" },
+        .keeps = { "cfg" },
+        .run_proc = loop_rotate
+    },
+    {
+        .name = "const-globals",
+        .kind = PASS_TRANSFORM,
+        .levels = PASS_OPT,
+        .keeps = { "cfg" },
+        .run = pass_const_globals
+    },
+    {
+        .name = "propagate",
+        .kind = PASS_TRANSFORM,
+        .levels = PASS_OPT,
+        .deps = { "cfg" },
+        .keeps = { "cfg" },
+        .run_proc = opt_simplify
+    },
+    {
+        .name = "ipcp",
+        .kind = PASS_TRANSFORM,
+        .levels = PASS_AT(PASS_O2) | PASS_AT(PASS_OS),
+        .keeps = { "cfg" },
+        .run = pass_ipcp
+    },
+    {
+        .name = "licm",
+        .kind = PASS_TRANSFORM,
+        .levels = PASS_AT(PASS_O2) | PASS_AT(PASS_OS),
+        .deps = { "cfg" },
+        .keeps = { "cfg" },
+        .run_proc = loop_licm
+    },
+    {
+        .name = "unroll",
+        .kind = PASS_TRANSFORM,
+        .levels = PASS_OPT,
+        .deps = { "cfg" },
+        .keeps = { "cfg" },
+        .run_proc = loop_unroll
+    },
+    {
+        .name = "select",
+        .kind = PASS_TRANSFORM,
+        .levels = PASS_AT(PASS_O1) | PASS_AT(PASS_O2),
+        .deps = { "cfg" },
+        .keeps = { "cfg" },
+        .run_proc = opt_select
+    },
+    {
+        .name = "cleanup-cfg",
+        .kind = PASS_TRANSFORM,
+        .levels = PASS_OPT,
+        .deps = { "cfg" },
+        .keeps = { "cfg" },
+        .run_proc = opt_cleanup_cfg
+    },
+    {
+        .name = "addr-fold",
+        .kind = PASS_TRANSFORM,
+        .levels = PASS_OPT,
+        .keeps = { "cfg" },
+        .run_proc = opt_fold_addr
+    },
+    {
+        .name = "dead-stores",
+        .kind = PASS_TRANSFORM,
+        .levels = PASS_AT(PASS_O2) | PASS_AT(PASS_OS),
+        .keeps = { "cfg" },
+        .run = pass_dead_stores
+    },
+    {
+        .name = "dce",
+        .kind = PASS_TRANSFORM,
+        .levels = PASS_OPT,
+        .keeps = { "cfg" },
+        .run_proc = opt_dce
+    },
+    {
+        .name = "tail-calls",
+        .kind = PASS_TRANSFORM,
+        .levels = PASS_OPT,
+        .run_proc = opt_tail_calls
+    },
+    {
+        .name = "layout",
+        .kind = PASS_TRANSFORM,
+        .levels = PASS_AT(PASS_O1) | PASS_AT(PASS_O2),
+        .deps = { "cfg" },
+        .keeps = { "cfg" },
+        .run_proc = opt_layout
+    },
+    {
+        .name = "lower",
+        .kind = PASS_CODEGEN,
+        .levels = PASS_ALWAYS,
+        .run = pass_lower
+    },
+    {
+        .name = "peephole",
+        .kind = PASS_TRANSFORM,
+        .levels = PASS_OPT,
+        .run = pass_peephole
+    }
+};
+
+#define NPASS (sizeof(passtab) / sizeof(passtab[0]))
+
+pass_level_t
+pass_level(const char *str)
+{
+    static const char *leveltab[] = {
+        [PASS_O0] = "0",
+        [PASS_O1] = "1",
+        [PASS_O2] = "2",
+        [PASS_OS] = "s"
+    };
+
+    if (str == NULL) {
+        return PASS_OMAX;
+    }
+
+    for (pass_level_t i = 0; i < PASS_OMAX; ++i) {
+        if (strcmp(leveltab[i], str) == 0)
+            return i;
+    }
+
+    return PASS_OMAX;
+}
+
+const struct pass *
+pass_lookup(const char *name)
+{
+    if (name == NULL) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < NPASS; ++i) {
+        if (strcmp(passtab[i].name, name) == 0)
+            return &passtab[i];
+    }
+
+    return NULL;
+}
+
+bool
+pass_enabled(struct bup_state *state, const struct pass *pass)
+{
+    const char *const *name;
+
+    if (state == NULL || pass == NULL) {
+        return false;
+    }
+
+    if (pass->kind != PASS_TRANSFORM) {
+        return true;
+    }
+
+    if ((pass->levels & PASS_AT(state->opt_level)) == 0) {
+        return false;
+    }
+
+    name = state->no_passes;
+    for (; name != NULL && *name != NULL; ++name) {
+        if (strcmp(*name, pass->name) == 0)
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Get the current time in nanoseconds
+ */
+static uint64_t
+pass_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int pass_exec(struct bup_state *state, struct pass_ctx *ctx,
+    size_t idx, struct pass_stat *stats);
+
+/*
+ * Make sure the analyses a pass depends on are current
+ *
+ * @state: Compiler state
+ * @ctx:   Pass context
+ * @pass:  Pass about to run
+ * @stats: Per pass state
+ *
+ * Returns zero on success
+ */
+static int
+pass_require(struct bup_state *state, struct pass_ctx *ctx,
+    const struct pass *pass, struct pass_stat *stats)
+{
+    const struct pass *dep;
+    size_t idx;
+
+    for (int i = 0; i < PASS_MAX_DEPS && pass->deps[i] != NULL; ++i) {
+        dep = pass_lookup(pass->deps[i]);
+        if (dep == NULL || dep->kind != PASS_ANALYSIS) {
+            trace_emit(TRACE_ERROR, 0, "pass %s: unknown analysis %s\n",
+                pass->name, pass->deps[i]);
+            return -1;
+        }
+
+        idx = dep - passtab;
+        if (stats[idx].done)
+            continue;
+        if (pass_exec(state, ctx, idx, stats) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Returns true if a pass keeps an analysis current
+ */
+static bool
+pass_keeps(const struct pass *pass, const char *name)
+{
+    for (int i = 0; i < PASS_MAX_DEPS && pass->keeps[i] != NULL; ++i) {
+        if (strcmp(pass->keeps[i], name) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * Run a single pass, keeping its statistics
+ *
+ * @state: Compiler state
+ * @ctx:   Pass context
+ * @idx:   Index of pass
+ * @stats: Per pass state
+ *
+ * Returns the number of changes made, or a less than
+ * zero value on failure.
+ */
+static int
+pass_exec(struct bup_state *state, struct pass_ctx *ctx, size_t idx,
+    struct pass_stat *stats)
+{
+    const struct pass *pass = &passtab[idx];
+    struct pass_stat *stat = &stats[idx];
+    size_t bytes = state->ptrbox.bytes;
+    uint64_t start;
+    int n;
+
+    if (pass_require(state, ctx, pass, stats) < 0) {
+        return -1;
+    }
+
+    start = pass_clock();
+    if (pass->run_proc != NULL) {
+        n = pass_run_per_proc(state, ctx, pass->run_proc);
+    } else {
+        n = pass->run(state, ctx);
+    }
+    stat->nsec += pass_clock() - start;
+    stat->bytes += state->ptrbox.bytes - bytes;
+    ++stat->runs;
+    if (n < 0) {
+        trace_debug("pass %s failed\n", pass->name);
+        return -1;
+    }
+
+    if (pass->kind == PASS_ANALYSIS) {
+        stat->done = true;
+        return n;
+    }
+
+    if (n == 0) {
+        return n;
+    }
+
+    for (size_t i = 0; i < NPASS; ++i) {
+        if (passtab[i].kind == PASS_ANALYSIS && !pass_keeps(pass, passtab[i].name))
+            stats[i].done = false;
+    }
+
+    return n;
+}
+
+/*
+ * Report the time and memory spent in each pass through
+ * the diagnostic hook
+ *
+ * @stats: Per pass state
+ */
+static void
+pass_report(struct pass_stat *stats)
+{
+    uint64_t nsec = 0;
+    size_t bytes = 0;
+
+    trace_info("%-16s %5s %12s %12s\n", "pass", "runs", "time (ms)", "memory (KiB)");
+    for (size_t i = 0; i < NPASS; ++i) {
+        if (stats[i].runs == 0)
+            continue;
+
+        trace_info(
+            "%-16s %5zu %12.3f %12.1f\n",
+            passtab[i].name,
+            stats[i].runs,
+            stats[i].nsec / 1e6,
+            stats[i].bytes / 1024.0
+        );
+
+        nsec += stats[i].nsec;
+        bytes += stats[i].bytes;
+    }
+
+    trace_info("%-16s %5s %12.3f %12.1f\n", "total", "", nsec / 1e6, bytes / 1024.0);
+}
+
+int
+pass_run(struct bup_state *state, struct ir_unit *unit, FILE *out)
+{
+    struct pass_stat stats[NPASS];
+    struct pass_ctx ctx;
+    int error = 0;
+
+    if (state == NULL || unit == NULL || out == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    memset(stats, 0, sizeof(stats));
+    ctx.unit = unit;
+    ctx.asm_buf = NULL;
+    ctx.asm_len = 0;
+
+    for (size_t i = 0; i < NPASS; ++i) {
+        if (passtab[i].kind == PASS_ANALYSIS)
+            continue;
+        if (!pass_enabled(state, &passtab[i]))
+            continue;
+
+        if ((error = pass_exec(state, &ctx, i, stats)) < 0)
+            break;
+    }
+
+    if (error >= 0 && ctx.asm_buf != NULL) {
+        fwrite(ctx.asm_buf, 1, ctx.asm_len, out);
+    }
+
+    if (state->time_passes) {
+        pass_report(stats);
+    }
+
+    free(ctx.asm_buf);
+    return (error < 0) ? -1 : 0;
+}
@@ -0,0 +1,344 @@
+/*
+ * Copyright (C) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include "bup/peep.h"
+#include "bup/mu.h"
+#include "bup/trace.h"
+
+/* Maximum number of times rules may fire at a single line */
+#define PEEP_MAX_FIRES 16
+
+/* Maximum number of passes over the lines */
+#define PEEP_MAX_ROUNDS 4
+
+/*
+ * Represents the emitted assembly as lines
+ *
+ * @lines: Lines in order
+ * @count: Number of lines
+ */
+struct peep_buf {
+    struct peep_line *lines;
+    size_t count;
+};
+
+/*
+ * Copy a field of a line with surrounding whitespace
+ * trimmed
+ *
+ * @dst: Destination buffer of PEEP_NAME_LEN bytes
+ * @src: Start of field
+ * @len: Length of field
+ *
+ * Returns false if the field does not fit
+ */
+static bool
+peep_copy(char *dst, const char *src, size_t len)
+{
+    while (len > 0 && isspace(*src)) {
+        ++src;
+        --len;
+    }
+
+    while (len > 0 && isspace(src[len - 1])) {
+        --len;
+    }
+
+    if (len >= PEEP_NAME_LEN) {
+        return false;
+    }
+
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+    return true;
+}
+
+/*
+ * Split an instruction line into its mnemonic and operands
+ *
+ * Returns false if the line does not look like a plain
+ * instruction.
+ */
+static bool
+peep_parse_insn(struct peep_line *line)
+{
+    const char *p = line->text + 1;
+    const char *end;
+
+    end = p + strcspn(p, " \t");
+    if (end == p || !peep_copy(line->op, p, end - p)) {
+        return false;
+    }
+
+    for (p = end; *p != '\0'; p = (*end == ',') ? end + 1 : end) {
+        if (line->nargs == PEEP_MAX_ARGS)
+            return false;
+
+        end = p + strcspn(p, ",");
+        if (!peep_copy(line->args[line->nargs++], p, end - p))
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * Classify a line and break it into fields
+ *
+ * @ctx:  Peephole context
+ * @line: Line to parse
+ */
+static void
+peep_parse(struct peep_ctx *ctx, struct peep_line *line)
+{
+    const char *text = line->text;
+    size_t len = strlen(text);
+
+    line->op[0] = '\0';
+    line->name[0] = '\0';
+    line->nargs = 0;
+
+    if (ctx->state->syntax->secname(text, line->name, sizeof(line->name))) {
+        line->kind = PEEP_SECTION;
+        return;
+    }
+
+    if (text[0] == '\t') {
+        line->kind = peep_parse_insn(line) ? PEEP_INSN : PEEP_OTHER;
+        return;
+    }
+
+    line->kind = PEEP_OTHER;
+    if (len < 2 || text[len - 1] != ':' || strpbrk(text, " \t") != NULL) {
+        return;
+    }
+
+    if (peep_copy(line->name, text, len - 1)) {
+        line->kind = PEEP_LABEL;
+    }
+}
+
+int
+peep_set(struct peep_ctx *ctx, struct peep_line *line, const char *fmt, ...)
+{
+    char buf[256];
+    char *text;
+    va_list ap;
+
+    if (ctx == NULL || line == NULL || fmt == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+
+    if ((text = strdup(buf)) == NULL) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    free(line->text);
+    line->text = text;
+    peep_parse(ctx, line);
+    return 0;
+}
+
+/*
+ * Break emitted assembly into lines
+ *
+ * @ctx:  Peephole context
+ * @text: Emitted assembly
+ * @len:  Length of assembly
+ * @res:  Lines are written here
+ *
+ * Returns zero on success
+ */
+static int
+peep_split(struct peep_ctx *ctx, const char *text, size_t len,
+    struct peep_buf *res)
+{
+    struct peep_line *line;
+    const char *p, *end = text + len;
+    const char *nl;
+    size_t cap = 1;
+
+    for (p = text; p < end; ++p) {
+        if (*p == '\n')
+            ++cap;
+    }
+
+    res->count = 0;
+    if ((res->lines = calloc(cap, sizeof(*res->lines))) == NULL) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    for (p = text; p < end; p = nl + 1) {
+        if ((nl = memchr(p, '\n', end - p)) == NULL)
+            nl = end;
+
+        line = &res->lines[res->count++];
+        if ((line->text = strndup(p, nl - p)) == NULL) {
+            errno = -ENOMEM;
+            return -1;
+        }
+
+        peep_parse(ctx, line);
+    }
+
+    return 0;
+}
+
+/*
+ * Gather the live lines starting at a line into a window
+ *
+ * @buf:  Lines
+ * @i:    Index of first line
+ * @win:  Window is written here, NULL terminated
+ * @size: Size of window
+ */
+static void
+peep_window(struct peep_buf *buf, size_t i, struct peep_line **win, size_t size)
+{
+    size_t n = 0;
+
+    for (; i < buf->count && n < size; ++i) {
+        if (!buf->lines[i].dead)
+            win[n++] = &buf->lines[i];
+    }
+
+    win[n] = NULL;
+}
+
+/*
+ * Apply every rule at a single line until none fire
+ *
+ * @ctx:    Peephole context
+ * @buf:    Lines
+ * @i:      Index of line
+ * @rules:  Rule table
+ * @nrules: Number of rules
+ * @hits:   Number of times each rule fired
+ *
+ * Returns the number of times rules fired
+ */
+static size_t
+peep_line_apply(struct peep_ctx *ctx, struct peep_buf *buf, size_t i,
+    const struct peep_rule *rules, size_t nrules, size_t *hits)
+{
+    struct peep_line *win[PEEP_WINDOW_MAX + 1];
+    const struct peep_rule *rule;
+    size_t fires = 0, r = 0;
+
+    while (r < nrules && fires < PEEP_MAX_FIRES) {
+        if (buf->lines[i].dead)
+            break;
+
+        rule = &rules[r];
+        peep_window(buf, i, win, rule->window);
+        if (!rule->apply(ctx, win)) {
+            ++r;
+            continue;
+        }
+
+        trace_debug("peephole: %s\n", rule->name);
+        ++hits[r];
+        ++fires;
+        r = 0;
+    }
+
+    return fires;
+}
+
+/*
+ * Make a single pass of every rule over the lines
+ *
+ * Returns the number of times rules fired
+ */
+static size_t
+peep_pass(struct peep_ctx *ctx, struct peep_buf *buf,
+    const struct peep_rule *rules, size_t nrules, size_t *hits)
+{
+    struct peep_line *line;
+    size_t fires = 0;
+
+    ctx->section[0] = '\0';
+    for (size_t i = 0; i < buf->count; ++i) {
+        line = &buf->lines[i];
+        if (line->dead)
+            continue;
+
+        fires += peep_line_apply(ctx, buf, i, rules, nrules, hits);
+        if (line->dead || line->kind != PEEP_SECTION)
+            continue;
+
+        /* An unnamed switch leaves the section unknown */
+        memcpy(ctx->section, line->name, sizeof(ctx->section));
+    }
+
+    return fires;
+}
+
+int
+peep_run(struct bup_state *state, const char *text, size_t len, FILE *out)
+{
+    const struct peep_rule *rules;
+    struct peep_ctx ctx;
+    struct peep_buf buf;
+    size_t nrules, *hits;
+    int error = 0;
+
+    if (state == NULL || text == NULL || out == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    rules = mu_peep_rules(&nrules);
+    if ((hits = calloc(nrules + 1, sizeof(*hits))) == NULL) {
+        errno = -ENOMEM;
+        return -1;
+    }
+
+    ctx.state = state;
+    ctx.section[0] = '\0';
+    buf.lines = NULL;
+    buf.count = 0;
+    if ((error = peep_split(&ctx, text, len, &buf)) < 0) {
+        goto done;
+    }
+
+    /* Rewrites may expose more behind the window */
+    for (int i = 0; i < PEEP_MAX_ROUNDS; ++i) {
+        if (peep_pass(&ctx, &buf, rules, nrules, hits) == 0)
+            break;
+    }
+
+    for (size_t i = 0; i < buf.count; ++i) {
+        if (!buf.lines[i].dead)
+            fprintf(out, "%s\n", buf.lines[i].text);
+    }
+
+    if (state->peep_stats) {
+        for (size_t r = 0; r < nrules; ++r)
+            trace_info("peephole: %-14s %zu\n", rules[r].name, hits[r]);
+    }
+
+done:
+    for (size_t i = 0; i < buf.count; ++i) {
+        free(buf.lines[i].text);
+    }
+
+    free(buf.lines);
+    free(hits);
+    return error;
+}
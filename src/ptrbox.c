@@ -5,6 +5,67 @@
 #include <string.h>
 #include "bup/ptrbox.h"
 
+/*
+ * Allocations up to PTRBOX_CLASS_MAX bytes are rounded up to a
+ * power-of-two size class. When a pointer box is destroyed, these
+ * are kept on a per-class free list (up to PTRBOX_CACHE_MAX each)
+ * so that later compilations in the same process can reuse them
+ * rather than going back to malloc().
+ */
+#define PTRBOX_CLASS_SHIFT 4
+#define PTRBOX_NCLASS      8
+#define PTRBOX_CLASS_MAX   (1 << (PTRBOX_CLASS_SHIFT + PTRBOX_NCLASS - 1))
+#define PTRBOX_CACHE_MAX   4096
+#define PTRBOX_NOCLASS     0xFF
+
+static struct {
+    TAILQ_HEAD(, ptrbox_entry) entries;
+    size_t count;
+} cachetab[PTRBOX_NCLASS];
+
+/*
+ * Convert an allocation size to a size class
+ *
+ * @sz: Allocation size
+ */
+static inline uint8_t
+ptrbox_size_class(size_t sz)
+{
+    uint8_t sclass = 0;
+
+    if (sz > PTRBOX_CLASS_MAX) {
+        return PTRBOX_NOCLASS;
+    }
+
+    while (((size_t)1 << (sclass + PTRBOX_CLASS_SHIFT)) < sz) {
+        ++sclass;
+    }
+
+    return sclass;
+}
+
+/*
+ * Grab a cached entry of a specific size class
+ *
+ * @sclass: Size class to grab from
+ *
+ * Returns NULL if the cache is empty
+ */
+static struct ptrbox_entry *
+ptrbox_cache_pop(uint8_t sclass)
+{
+    struct ptrbox_entry *entry;
+
+    if (sclass == PTRBOX_NOCLASS || cachetab[sclass].count == 0) {
+        return NULL;
+    }
+
+    entry = TAILQ_FIRST(&cachetab[sclass].entries);
+    TAILQ_REMOVE(&cachetab[sclass].entries, entry, link);
+    --cachetab[sclass].count;
+    return entry;
+}
+
 int
 ptrbox_init(struct ptrbox *res)
 {
@@ -15,6 +76,7 @@ ptrbox_init(struct ptrbox *res)
 
     TAILQ_INIT(&res->entries);
     res->entry_count = 0;
+    res->bytes = 0;
     return 0;
 }
 
@@ -22,11 +84,24 @@ void *
 ptrbox_alloc(struct ptrbox *ptrbox, size_t sz)
 {
     struct ptrbox_entry *entry;
+    uint8_t sclass;
 
     if (ptrbox == NULL || sz == 0) {
         return NULL;
     }
 
+    sclass = ptrbox_size_class(sz);
+    if (sclass != PTRBOX_NOCLASS) {
+        sz = (size_t)1 << (sclass + PTRBOX_CLASS_SHIFT);
+    }
+
+    ptrbox->bytes += sz;
+    if ((entry = ptrbox_cache_pop(sclass)) != NULL) {
+        TAILQ_INSERT_TAIL(&ptrbox->entries, entry, link);
+        ++ptrbox->entry_count;
+        return entry->data;
+    }
+
     if ((entry = malloc(sizeof(*entry))) == NULL) {
         return NULL;
     }
@@ -36,6 +111,7 @@ ptrbox_alloc(struct ptrbox *ptrbox, size_t sz)
         return NULL;
     }
 
+    entry->sclass = sclass;
     TAILQ_INSERT_TAIL(&ptrbox->entries, entry, link);
     ++ptrbox->entry_count;
     return entry->data;
@@ -44,30 +120,27 @@ ptrbox_alloc(struct ptrbox *ptrbox, size_t sz)
 void *
 ptrbox_strdup(struct ptrbox *ptrbox, const char *s)
 {
-    struct ptrbox_entry *entry;
+    char *data;
+    size_t len;
 
     if (ptrbox == NULL || s == 0) {
         return NULL;
     }
 
-    if ((entry = malloc(sizeof(*entry))) == NULL) {
-        return NULL;
-    }
-
-    if ((entry->data = strdup(s)) == NULL) {
-        free(entry);
+    len = strlen(s) + 1;
+    if ((data = ptrbox_alloc(ptrbox, len)) == NULL) {
         return NULL;
     }
 
-    TAILQ_INSERT_TAIL(&ptrbox->entries, entry, link);
-    ++ptrbox->entry_count;
-    return entry->data;
+    memcpy(data, s, len);
+    return data;
 }
 
 void
 ptrbox_destroy(struct ptrbox *ptrbox)
 {
     struct ptrbox_entry *entry;
+    uint8_t sclass;
 
     if (ptrbox == NULL) {
         return;
@@ -79,8 +152,35 @@ ptrbox_destroy(struct ptrbox *ptrbox)
 
     do {
         TAILQ_REMOVE(&ptrbox->entries, entry, link);
-        free(entry->data);
-        free(entry);
+        sclass = entry->sclass;
+
+        if (sclass != PTRBOX_NOCLASS && cachetab[sclass].count < PTRBOX_CACHE_MAX) {
+            if (cachetab[sclass].count == 0)
+                TAILQ_INIT(&cachetab[sclass].entries);
+
+            TAILQ_INSERT_HEAD(&cachetab[sclass].entries, entry, link);
+            ++cachetab[sclass].count;
+        } else {
+            free(entry->data);
+            free(entry);
+        }
+
         entry = TAILQ_FIRST(&ptrbox->entries);
     } while (entry != NULL);
+
+    ptrbox->entry_count = 0;
+}
+
+void
+ptrbox_cache_drain(void)
+{
+    struct ptrbox_entry *entry;
+
+    for (uint8_t i = 0; i < PTRBOX_NCLASS; ++i) {
+        while (cachetab[i].count > 0) {
+            entry = ptrbox_cache_pop(i);
+            free(entry->data);
+            free(entry);
+        }
+    }
 }
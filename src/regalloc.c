@@ -0,0 +1,469 @@
+/*
+ * Copyright (C) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "bup/regalloc.h"
+#include "bup/trace.h"
+
+#define regmask(id)     \
+    (1U << (id))
+
+/* Bits per bitset word */
+#define RA_WORDBITS 64
+
+/*
+ * Represents the live interval of a virtual register
+ *
+ * Instruction 'i' reads its operands at position 2i and
+ * writes its result at 2i + 1.
+ *
+ * @start: First position the value is live
+ * @end:   Last position the value is live
+ * @hint:  Virtual register whose machine register is preferred
+ * @fixed: Machine register preferred if no hint applies
+ */
+struct ra_interval {
+    size_t start;
+    size_t end;
+    ir_vreg_t hint;
+    mu_reg_t fixed;
+};
+
+/*
+ * Represents a position that clobbers registers
+ *
+ * @pos: Position of the instruction
+ * @all: If set, every register is clobbered (inline assembly)
+ */
+struct ra_clobber {
+    size_t pos;
+    bool all;
+};
+
+/*
+ * Represents the liveness state of the allocator
+ *
+ * @proc:    Procedure
+ * @nwords:  Words per bitset
+ * @live_in: Values live on entry of each block
+ * @gen:     Values read in each block before being written
+ * @kill:    Values written in each block
+ */
+struct ra_live {
+    struct ir_proc *proc;
+    size_t nwords;
+    uint64_t *live_in;
+    uint64_t *gen;
+    uint64_t *kill;
+};
+
+static inline uint64_t *
+ra_set(struct ra_live *live, uint64_t *base, struct ir_block *blk)
+{
+    return &base[blk->id * live->nwords];
+}
+
+static inline void
+ra_set_add(uint64_t *set, ir_vreg_t v)
+{
+    set[v / RA_WORDBITS] |= (uint64_t)1 << (v % RA_WORDBITS);
+}
+
+static inline bool
+ra_set_has(uint64_t *set, ir_vreg_t v)
+{
+    return (set[v / RA_WORDBITS] >> (v % RA_WORDBITS)) & 1;
+}
+
+/*
+ * Returns true if an instruction reads an operand after its
+ * result is written, so the two may not share a register.
+ * Arithmetic works on a copy of 'a' and a select moves the
+ * value it picks over the other.
+ */
+static inline bool
+ra_late(struct ir_insn *insn, struct ir_value *val)
+{
+    switch (insn->op) {
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+        return val == &insn->b;
+    case IR_SEL:
+        return val == &insn->sel[0];
+    default:
+        break;
+    }
+
+    return false;
+}
+
+/*
+ * Compute the values live on entry of each block
+ *
+ * @live: Liveness state
+ *
+ * Returns zero on success
+ */
+static int
+ra_liveness(struct ra_live *live)
+{
+    struct ir_proc *proc = live->proc;
+    struct ir_block *blk, *succ[2];
+    struct ir_insn *insn;
+    struct ir_value *vals[IR_MAX_OPERANDS];
+    size_t nvals;
+    uint64_t *in, *gen, *kill, *out, word;
+    size_t n, setlen;
+    bool changed;
+
+    live->nwords = (proc->nvregs + RA_WORDBITS) / RA_WORDBITS;
+    setlen = (proc->nblocks + 1) * live->nwords;
+    live->live_in = calloc(setlen, sizeof(uint64_t));
+    live->gen = calloc(setlen, sizeof(uint64_t));
+    live->kill = calloc(setlen, sizeof(uint64_t));
+    out = calloc(live->nwords, sizeof(uint64_t));
+    if (live->live_in == NULL || live->gen == NULL || live->kill == NULL || out == NULL) {
+        free(out);
+        return -1;
+    }
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        gen = ra_set(live, live->gen, blk);
+        kill = ra_set(live, live->kill, blk);
+        TAILQ_FOREACH(insn, &blk->insns, link) {
+            nvals = ir_operands(insn, vals);
+            for (size_t i = 0; i < nvals; ++i) {
+                if (vals[i]->type != IR_VAL_VREG)
+                    continue;
+                if (!ra_set_has(kill, vals[i]->vreg))
+                    ra_set_add(gen, vals[i]->vreg);
+            }
+
+            if (insn->dst != IR_NOREG)
+                ra_set_add(kill, insn->dst);
+        }
+    }
+
+    /* in = gen | (out & ~kill), iterated backwards to a fixed point */
+    do {
+        changed = false;
+        TAILQ_FOREACH_REVERSE(blk, &proc->blocks, ir_block_q, link) {
+            memset(out, 0, live->nwords * sizeof(uint64_t));
+            n = ir_succs(blk, succ);
+            for (size_t i = 0; i < n; ++i) {
+                in = ra_set(live, live->live_in, succ[i]);
+                for (size_t w = 0; w < live->nwords; ++w)
+                    out[w] |= in[w];
+            }
+
+            in = ra_set(live, live->live_in, blk);
+            gen = ra_set(live, live->gen, blk);
+            kill = ra_set(live, live->kill, blk);
+            for (size_t w = 0; w < live->nwords; ++w) {
+                word = gen[w] | (out[w] & ~kill[w]);
+                if (word != in[w]) {
+                    in[w] = word;
+                    changed = true;
+                }
+            }
+        }
+    } while (changed);
+
+    free(out);
+    return 0;
+}
+
+/*
+ * Extend an interval to cover a position
+ */
+static inline void
+ra_extend(struct ra_interval *iv, size_t pos)
+{
+    if (pos < iv->start)
+        iv->start = pos;
+    if (pos > iv->end || iv->end == (size_t)-1)
+        iv->end = pos;
+}
+
+/*
+ * Build the live interval of every virtual register
+ *
+ * @live:     Liveness state
+ * @ivs:      Intervals are written here
+ * @clobbers: Clobbering positions are written here
+ * @nclob:    Number of clobbering positions is written here
+ */
+static void
+ra_intervals(struct ra_live *live, struct ra_interval *ivs,
+    struct ra_clobber *clobbers, size_t *nclob)
+{
+    struct ir_proc *proc = live->proc;
+    struct ir_block *blk, *succ[2];
+    struct ir_insn *insn;
+    struct ir_value *vals[IR_MAX_OPERANDS];
+    uint64_t *in;
+    size_t pos = 0, first, n, nvals;
+
+    for (size_t v = 0; v < proc->nvregs; ++v) {
+        ivs[v].start = (size_t)-1;
+        ivs[v].end = (size_t)-1;
+        ivs[v].hint = IR_NOREG;
+        ivs[v].fixed = -1;
+    }
+
+    *nclob = 0;
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        first = pos;
+        in = ra_set(live, live->live_in, blk);
+        for (size_t v = 0; v < proc->nvregs; ++v) {
+            if (ra_set_has(in, v))
+                ra_extend(&ivs[v], first);
+        }
+
+        TAILQ_FOREACH(insn, &blk->insns, link) {
+            nvals = ir_operands(insn, vals);
+            for (size_t i = 0; i < nvals; ++i) {
+                if (vals[i]->type == IR_VAL_VREG)
+                    ra_extend(&ivs[vals[i]->vreg], ra_late(insn, vals[i]) ? pos + 1 : pos);
+            }
+
+            if (insn->dst != IR_NOREG) {
+                ra_extend(&ivs[insn->dst], pos + 1);
+                if (insn->op == IR_SEL && insn->sel[1].type == IR_VAL_VREG)
+                    ivs[insn->dst].hint = insn->sel[1].vreg;
+                else if (insn->op != IR_LOAD && insn->a.type == IR_VAL_VREG)
+                    ivs[insn->dst].hint = insn->a.vreg;
+            }
+
+            switch (insn->op) {
+            case IR_CALL:
+            case IR_ASM:
+                clobbers[*nclob].pos = pos;
+                clobbers[*nclob].all = insn->op == IR_ASM;
+                ++*nclob;
+                break;
+            case IR_RET:
+                if (insn->a.type == IR_VAL_VREG)
+                    ivs[insn->a.vreg].fixed = mu_regfile()->retval;
+                break;
+            default:
+                break;
+            }
+
+            pos += 2;
+        }
+
+        /* Values needed by a successor live to the end */
+        n = ir_succs(blk, succ);
+        for (size_t i = 0; i < n; ++i) {
+            in = ra_set(live, live->live_in, succ[i]);
+            for (size_t v = 0; v < proc->nvregs; ++v) {
+                if (ra_set_has(in, v))
+                    ra_extend(&ivs[v], pos - 1);
+            }
+        }
+    }
+
+    /* Compute returned values in the return register */
+    for (size_t v = proc->nvregs; v-- > 0;) {
+        if (ivs[v].fixed < 0 || ivs[v].hint == IR_NOREG)
+            continue;
+        if (ivs[ivs[v].hint].fixed < 0)
+            ivs[ivs[v].hint].fixed = ivs[v].fixed;
+    }
+}
+
+/*
+ * Get the registers an interval may be assigned
+ *
+ * @iv:       Interval
+ * @clobbers: Clobbering positions
+ * @nclob:    Number of clobbering positions
+ */
+static uint32_t
+ra_allowed(struct ra_interval *iv, struct ra_clobber *clobbers, size_t nclob)
+{
+    const struct mu_regfile *rf = mu_regfile();
+    uint32_t allowed = 0;
+
+    for (size_t i = 0; i < rf->count; ++i) {
+        allowed |= regmask(rf->order[i]);
+    }
+
+    for (size_t i = 0; i < nclob; ++i) {
+        if (iv->start >= clobbers[i].pos || iv->end <= clobbers[i].pos + 1)
+            continue;
+
+        if (clobbers[i].all)
+            return 0;
+
+        allowed &= rf->callee;
+    }
+
+    return allowed;
+}
+
+/*
+ * Order virtual registers by interval start
+ */
+static struct ra_interval *sort_ivs;
+
+static int
+ra_cmp(const void *a, const void *b)
+{
+    size_t x = sort_ivs[*(const ir_vreg_t *)a].start;
+    size_t y = sort_ivs[*(const ir_vreg_t *)b].start;
+
+    return (x > y) - (x < y);
+}
+
+int
+ra_alloc(struct bup_state *state, struct ir_proc *proc, struct ra_result *res)
+{
+    const struct mu_regfile *rf = mu_regfile();
+    struct ra_live live;
+    struct ra_interval *ivs = NULL, *iv;
+    struct ra_clobber *clobbers = NULL;
+    ir_vreg_t *order = NULL, *active = NULL, victim;
+    struct ir_block *blk;
+    struct ir_insn *insn;
+    size_t nclob, ninsns = 0, nactive = 0, norder = 0;
+    uint32_t allowed, busy;
+    mu_reg_t reg;
+    int error = -1;
+
+    if (state == NULL || proc == NULL || res == NULL) {
+        errno = -EINVAL;
+        return -1;
+    }
+
+    memset(&live, 0, sizeof(live));
+    memset(res, 0, sizeof(*res));
+    live.proc = proc;
+
+    TAILQ_FOREACH(blk, &proc->blocks, link) {
+        TAILQ_FOREACH(insn, &blk->insns, link) {
+            ++ninsns;
+        }
+    }
+
+    res->locs = malloc((proc->nvregs + 1) * sizeof(*res->locs));
+    ivs = malloc((proc->nvregs + 1) * sizeof(*ivs));
+    order = malloc((proc->nvregs + 1) * sizeof(*order));
+    active = malloc((proc->nvregs + 1) * sizeof(*active));
+    clobbers = malloc((ninsns + 1) * sizeof(*clobbers));
+    if (res->locs == NULL || ivs == NULL || order == NULL || active == NULL || clobbers == NULL) {
+        goto done;
+    }
+
+    if (ra_liveness(&live) < 0) {
+        goto done;
+    }
+
+    ra_intervals(&live, ivs, clobbers, &nclob);
+    for (size_t v = 0; v < proc->nvregs; ++v) {
+        res->locs[v].reg = -1;
+        res->locs[v].slot = RA_NOSLOT;
+        if (ivs[v].start != (size_t)-1)
+            order[norder++] = v;
+    }
+
+    sort_ivs = ivs;
+    qsort(order, norder, sizeof(*order), ra_cmp);
+
+    busy = 0;
+    for (size_t i = 0; i < norder; ++i) {
+        iv = &ivs[order[i]];
+
+        /* Expire intervals that ended */
+        for (size_t j = 0; j < nactive; ++j) {
+            if (ivs[active[j]].end >= iv->start)
+                continue;
+
+            busy &= ~regmask(res->locs[active[j]].reg);
+            active[j--] = active[--nactive];
+        }
+
+        allowed = ra_allowed(iv, clobbers, nclob);
+        reg = -1;
+
+        /* Coalesce with the operand we are computed from */
+        if (iv->hint != IR_NOREG && res->locs[iv->hint].reg >= 0) {
+            reg = res->locs[iv->hint].reg;
+            if ((allowed & ~busy & regmask(reg)) == 0)
+                reg = -1;
+        }
+
+        if (reg < 0 && iv->fixed >= 0 && (allowed & ~busy & regmask(iv->fixed)) != 0) {
+            reg = iv->fixed;
+        }
+
+        for (size_t j = 0; j < rf->count && reg < 0; ++j) {
+            if ((allowed & ~busy & regmask(rf->order[j])) != 0)
+                reg = rf->order[j];
+        }
+
+        /* Out of registers, spill whatever lives longest */
+        if (reg < 0 && allowed != 0) {
+            victim = IR_NOREG;
+            for (size_t j = 0; j < nactive; ++j) {
+                if ((allowed & regmask(res->locs[active[j]].reg)) == 0)
+                    continue;
+                if (victim == IR_NOREG || ivs[active[j]].end > ivs[victim].end)
+                    victim = active[j];
+            }
+
+            if (victim != IR_NOREG && ivs[victim].end > iv->end) {
+                reg = res->locs[victim].reg;
+                res->locs[victim].reg = -1;
+                res->locs[victim].slot = res->nslots++;
+                busy &= ~regmask(reg);
+                for (size_t j = 0; j < nactive; ++j) {
+                    if (active[j] == victim)
+                        active[j] = active[--nactive];
+                }
+            }
+        }
+
+        if (reg < 0) {
+            res->locs[order[i]].slot = res->nslots++;
+            continue;
+        }
+
+        res->locs[order[i]].reg = reg;
+        res->used |= regmask(reg);
+        busy |= regmask(reg);
+        active[nactive++] = order[i];
+    }
+
+    error = 0;
+done:
+    free(live.live_in);
+    free(live.gen);
+    free(live.kill);
+    free(ivs);
+    free(order);
+    free(active);
+    free(clobbers);
+    if (error < 0) {
+        ra_release(res);
+    }
+
+    return error;
+}
+
+void
+ra_release(struct ra_result *res)
+{
+    if (res == NULL) {
+        return;
+    }
+
+    free(res->locs);
+    res->locs = NULL;
+}
@@ -4,46 +4,47 @@
  */
 
 #include <stdint.h>
-#include <fcntl.h>
-#include <unistd.h>
 #include <errno.h>
 #include <string.h>
 #include "bup/state.h"
+#include "bup/mu.h"
+#include "bup/ir.h"
+#include "bup/pass.h"
 
 int
-bup_state_init(const char *input_path, struct bup_state *res)
+bup_state_init(const char *src, size_t len, FILE *out_fp,
+    struct bup_state *res)
 {
-    if (input_path == NULL || res == NULL) {
+    if (src == NULL || out_fp == NULL || res == NULL) {
         errno = -EINVAL;
         return -1;
     }
 
     memset(res, 0, sizeof(*res));
-    res->in_fd = open(input_path, O_RDONLY);
-    if (res->in_fd < 0) {
-        return -1;
-    }
+    res->in_buf = src;
+    res->in_len = len;
+    res->in_off = 0;
+    res->out_fp = out_fp;
+    res->syntax = mu_syntax_lookup(NULL);
+    res->tune = mu_tune_lookup(NULL);
 
     if (symbol_table_init(&res->symtab) < 0) {
-        close(res->in_fd);
+        return -1;
     }
 
     if (ptrbox_init(&res->ptrbox) < 0) {
-        close(res->in_fd);
         symbol_table_destroy(&res->symtab);
         return -1;
     }
 
-    res->out_fp = fopen(DEFAULT_ASMOUT, "w");
-    if (res->out_fp == NULL) {
-        close(res->in_fd);
+    if (token_buf_init(&res->tbuf) < 0) {
+        ptrbox_destroy(&res->ptrbox);
         symbol_table_destroy(&res->symtab);
         return -1;
     }
 
-    if (token_buf_init(&res->tbuf) < 0) {
-        fclose(res->out_fp);
-        close(res->in_fd);
+    if ((res->ir = ir_unit_new(res)) == NULL) {
+        ptrbox_destroy(&res->ptrbox);
         symbol_table_destroy(&res->symtab);
         return -1;
     }
@@ -51,6 +52,8 @@ bup_state_init(const char *input_path, struct bup_state *res)
     memset(res->scope_stack, 0, sizeof(res->scope_stack));
     res->line_num = 1;
     res->cur_section = SECTION_NONE;
+    res->opt_level = PASS_O0;
+    res->code_bits = 64;
     return 0;
 }
 
@@ -61,7 +64,6 @@ bup_state_destroy(struct bup_state *state)
         return;
     }
 
-    close(state->in_fd);
     fclose(state->out_fp);
     ptrbox_destroy(&state->ptrbox);
     symbol_table_destroy(&state->symtab);
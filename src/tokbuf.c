@@ -16,11 +16,7 @@ token_buf_head(struct token_buf *buf)
         return 0;
     }
 
-    if (buf->head == 0) {
-        return 0;
-    }
-
-    return buf->head - 1;
+    return (buf->head - 1) & (MAX_TOKENBUF_SZ - 1);
 }
 
 int
@@ -65,12 +61,7 @@ token_buf_lookbehind(struct token_buf *buf, size_t n, struct token *res)
     }
 
     /* Wrap around if needed */
-    if ((off = buf->head - n - 1) < 0) {
-        off = (MAX_TOKENBUF_SZ - 1) - (n - 1);
-        if (off < 0)
-            off = ~(off) + 1;
-    }
-
+    off = (buf->head - n - 1) & (MAX_TOKENBUF_SZ - 1);
     *res = buf->buf[off];
     return 0;
 }
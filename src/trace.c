@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2026, Ian Moffett.
+ * Provided under the BSD-3 clause.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include "bup/trace.h"
+
+static trace_hook_t trace_hook = NULL;
+static void *trace_hook_arg = NULL;
+
+/* Level prefix lookup table */
+static const char *lvltab[] = {
+    [TRACE_ERROR] = "[\033[90;91merror\033[0m]: ",
+    [TRACE_WARN]  = "[\033[90;95mwarn\033[0m]: ",
+    [TRACE_DEBUG] = "[\033[90;94mdebug\033[0m]: ",
+    [TRACE_INFO]  = ""
+};
+
+void
+trace_set_hook(trace_hook_t hook, void *arg)
+{
+    trace_hook = hook;
+    trace_hook_arg = arg;
+}
+
+void
+trace_emit(trace_level_t level, size_t line, const char *fmt, ...)
+{
+    char buf[512];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+
+    if (trace_hook != NULL) {
+        trace_hook(trace_hook_arg, level, line, buf);
+        return;
+    }
+
+    printf("%s%s", lvltab[level], buf);
+    if (level == TRACE_ERROR) {
+        printf("[near line %zu]\n", line);
+    }
+}